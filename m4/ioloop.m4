@@ -2,6 +2,31 @@ dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
   
+  AS_IF([test "$ioloop" = "uring"], [
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_io_uring_works,[
+      AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[
+        #include <sys/syscall.h>
+        #include <sys/epoll.h>
+        #include <linux/io_uring.h>
+      ]], [[
+        struct io_uring_getevents_arg arg = { .ts = 0 };
+        return epoll_create(5) < 1 || arg.ts != 0 ||
+          syscall(__NR_io_uring_setup, 0, 0) != 0 ||
+          (IORING_FEAT_EXT_ARG & IORING_ENTER_EXT_ARG) != 0;
+      ]])],[
+        i_cv_io_uring_works=yes
+      ], [
+        i_cv_io_uring_works=no
+      ])
+    ])
+    AS_IF([test $i_cv_io_uring_works = yes], [
+      AC_DEFINE(IOLOOP_URING,, [Implement I/O loop with Linux io_uring, falling back to epoll()])
+      have_ioloop=yes
+    ], [
+      AC_MSG_ERROR([io_uring ioloop requested but <linux/io_uring.h> is missing or too old])
+    ])
+  ])
+
   AS_IF([test "$ioloop" = "best" || test "$ioloop" = "epoll"], [
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
       AC_RUN_IFELSE([AC_LANG_PROGRAM([[
@@ -103,6 +103,7 @@ AC_DEFUN([DOVECOT_SSL], [
   DOVECOT_CHECK_SSL_FUNC([SSL_CTX_set_tmp_dh_callback])
   DOVECOT_CHECK_SSL_FUNC([SSL_CTX_set_current_cert])
   DOVECOT_CHECK_SSL_FUNC([SSL_CTX_set0_tmp_dh_pkey])
+  DOVECOT_CHECK_SSL_FUNC([SSL_sendfile])
 
   dnl LibreSSL
   DOVECOT_CHECK_SSL_FUNC([EVP_PKEY_check])
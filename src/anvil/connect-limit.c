@@ -101,7 +101,8 @@ connect_limit_process_free(struct connect_limit *limit, struct process *process)
 
 static unsigned int userip_hash(const struct userip *userip)
 {
-	return str_hash(userip->username) ^ str_hash(userip->protocol) ^
+	return str_hash_fast(userip->username) ^
+		str_hash_fast(userip->protocol) ^
 		net_ip_hash(&userip->ip);
 }
 
@@ -124,12 +125,12 @@ struct connect_limit *connect_limit_init(void)
 	limit = i_new(struct connect_limit, 1);
 	limit->strings = str_table_init();
 	i_array_init(&limit->alt_username_fields, 8);
-	hash_table_create(&limit->user_hash, default_pool, 0,
-			  str_hash, strcmp);
-	hash_table_create(&limit->userip_hash, default_pool, 0,
-			  userip_hash, userip_cmp);
-	hash_table_create(&limit->session_hash, default_pool, 0,
-			  guid_128_hash, guid_128_cmp);
+	hash_table_create_open(&limit->user_hash, default_pool, 0,
+			       str_hash_fast, strcmp);
+	hash_table_create_open(&limit->userip_hash, default_pool, 0,
+			       userip_hash, userip_cmp);
+	hash_table_create_open(&limit->session_hash, default_pool, 0,
+			       guid_128_hash, guid_128_cmp);
 	hash_table_create_direct(&limit->process_hash, default_pool, 0);
 	return limit;
 }
@@ -279,7 +280,8 @@ alt_username_field_ref(struct connect_limit *limit, const char *name)
 				  I_MAX((idx+1), old_count));
 		if (!hash_table_is_created(limit->alt_username_hashes[idx])) {
 			hash_table_create(&limit->alt_username_hashes[idx],
-					  default_pool, 0, str_hash, strcmp);
+					  default_pool, 0, str_hash_fast,
+					  strcmp);
 		} else {
 			i_assert(hash_table_count(limit->alt_username_hashes[idx]) == 0);
 		}
@@ -0,0 +1,569 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* The shared auth cache is a second level cache behind the per-process
+   auth_cache. It's a mmap()ed file, so its entries are seen by all the auth
+   processes using the same base_dir and they survive auth process restarts.
+
+   The file begins with a header, followed by fixed size slots that are
+   split into shards. The key's hash selects the shard and the first slot
+   to try within it, and the entry is stored to one of the following
+   AUTH_CACHE_SHARED_MAX_PROBES slots. When they're all used, the oldest
+   entry is replaced. Entries too large for a slot aren't shared.
+
+   Writers lock the shard with a fcntl() lock on the shard's byte offset,
+   so a crashed process can't leave it locked. Readers don't lock anything:
+   each slot has a sequence number, which is odd while the slot is being
+   written. The reader copies the slot and retries if the sequence changed
+   meanwhile. A slot that can't be read consistently is treated as a cache
+   miss. */
+
+#include "auth-common.h"
+#include "hash.h"
+#include "file-set-size.h"
+#include "auth-cache.h"
+#include "auth-cache-shared.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define AUTH_CACHE_SHARED_MAGIC 0x41554348
+#define AUTH_CACHE_SHARED_VERSION 1
+#define AUTH_CACHE_SHARED_SLOT_SIZE 512
+#define AUTH_CACHE_SHARED_SHARD_SLOTS 256
+#define AUTH_CACHE_SHARED_MAX_PROBES 8
+#define AUTH_CACHE_SHARED_READ_RETRIES 10
+#define AUTH_CACHE_SHARED_OPEN_RETRIES 3
+
+/* fcntl() lock offsets. The file is being initialized while the first byte
+   is locked, and shard n is modified while byte 1+n is locked. */
+#define AUTH_CACHE_SHARED_INIT_LOCK_OFFSET 0
+#define AUTH_CACHE_SHARED_SHARD_LOCK_OFFSET 1
+
+struct auth_cache_shared_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t shard_count;
+	unsigned char config_md5[MD5_RESULTLEN];
+};
+
+struct auth_cache_shared_slot {
+	/* odd while the slot is being written */
+	uint32_t seq;
+	uint32_t hash;
+	int64_t created;
+	/* 0 if the slot is unused */
+	uint16_t key_len;
+	uint16_t value_len;
+	uint8_t last_success;
+	uint8_t unused[3];
+
+	char data[]; /* key \0 value \0 */
+};
+#define AUTH_CACHE_SHARED_DATA_SIZE \
+	(AUTH_CACHE_SHARED_SLOT_SIZE - sizeof(struct auth_cache_shared_slot))
+
+struct auth_cache_shared {
+	char *path;
+	int fd;
+	struct event *event;
+	unsigned char config_md5[MD5_RESULTLEN];
+	unsigned int shard_count;
+
+	void *mmap_base;
+	size_t mmap_size;
+
+	/* copy of the slot returned by the last lookup */
+	uint64_t read_buf[AUTH_CACHE_SHARED_SLOT_SIZE / sizeof(uint64_t)];
+};
+
+static size_t auth_cache_shared_file_size(unsigned int shard_count)
+{
+	/* the header uses the first slot */
+	return (1 + (size_t)shard_count * AUTH_CACHE_SHARED_SHARD_SLOTS) *
+		AUTH_CACHE_SHARED_SLOT_SIZE;
+}
+
+static struct auth_cache_shared_header *
+auth_cache_shared_get_header(struct auth_cache_shared *shared)
+{
+	return shared->mmap_base;
+}
+
+static struct auth_cache_shared_slot *
+auth_cache_shared_get_slot(struct auth_cache_shared *shared,
+			   unsigned int shard, unsigned int idx)
+{
+	size_t slot_idx = 1 + (size_t)shard * AUTH_CACHE_SHARED_SHARD_SLOTS +
+		idx % AUTH_CACHE_SHARED_SHARD_SLOTS;
+
+	return PTR_OFFSET(shared->mmap_base,
+			  slot_idx * AUTH_CACHE_SHARED_SLOT_SIZE);
+}
+
+static void
+auth_cache_shared_get_pos(struct auth_cache_shared *shared, unsigned int hash,
+			  unsigned int *shard_r, unsigned int *first_idx_r)
+{
+	*shard_r = hash % shared->shard_count;
+	*first_idx_r = (hash / shared->shard_count) %
+		AUTH_CACHE_SHARED_SHARD_SLOTS;
+}
+
+static bool auth_cache_shared_is_usable(struct auth_cache_shared *shared)
+{
+	const struct auth_cache_shared_header *hdr =
+		auth_cache_shared_get_header(shared);
+
+	/* Another process with a different configuration has reset the file.
+	   The cache keys contain passdb/userdb IDs, so they can't be mixed.
+	   This process is most likely just about to be stopped. */
+	return hdr->magic == AUTH_CACHE_SHARED_MAGIC &&
+		memcmp(hdr->config_md5, shared->config_md5,
+		       sizeof(shared->config_md5)) == 0;
+}
+
+static int
+auth_cache_shared_lock(struct auth_cache_shared *shared, short type,
+		       off_t offset, off_t len)
+{
+	struct flock fl;
+
+	i_zero(&fl);
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = offset;
+	fl.l_len = len;
+	while (fcntl(shared->fd, type == F_UNLCK ? F_SETLK : F_SETLKW,
+		     &fl) < 0) {
+		if (errno != EINTR) {
+			e_error(shared->event, "fcntl(%s, %s) failed: %m",
+				shared->path,
+				type == F_UNLCK ? "F_UNLCK" : "F_WRLCK");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+auth_cache_shared_lock_shard(struct auth_cache_shared *shared,
+			     unsigned int shard)
+{
+	return auth_cache_shared_lock(shared, F_WRLCK,
+		AUTH_CACHE_SHARED_SHARD_LOCK_OFFSET + shard, 1);
+}
+
+static void
+auth_cache_shared_unlock_shard(struct auth_cache_shared *shared,
+			       unsigned int shard)
+{
+	(void)auth_cache_shared_lock(shared, F_UNLCK,
+		AUTH_CACHE_SHARED_SHARD_LOCK_OFFSET + shard, 1);
+}
+
+static bool
+auth_cache_shared_slot_is_valid(const struct auth_cache_shared_slot *slot)
+{
+	if (slot->key_len == 0 ||
+	    (size_t)slot->key_len + 1 + slot->value_len + 1 >
+	    AUTH_CACHE_SHARED_DATA_SIZE)
+		return FALSE;
+	return slot->data[slot->key_len] == '\0' &&
+		slot->data[slot->key_len + 1 + slot->value_len] == '\0';
+}
+
+static const struct auth_cache_shared_slot *
+auth_cache_shared_slot_read(struct auth_cache_shared *shared,
+			    const struct auth_cache_shared_slot *slot)
+{
+	struct auth_cache_shared_slot *copy = (void *)shared->read_buf;
+	unsigned int i;
+	uint32_t seq;
+
+	for (i = 0; i < AUTH_CACHE_SHARED_READ_RETRIES; i++) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) != 0)
+			continue;
+		memcpy(copy, slot, AUTH_CACHE_SHARED_SLOT_SIZE);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		return auth_cache_shared_slot_is_valid(copy) ? copy : NULL;
+	}
+	return NULL;
+}
+
+static void
+auth_cache_shared_slot_write_begin(struct auth_cache_shared_slot *slot)
+{
+	/* the sequence is already odd if a writer crashed in the middle of
+	   writing the slot */
+	__atomic_store_n(&slot->seq, slot->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+auth_cache_shared_slot_write_end(struct auth_cache_shared_slot *slot)
+{
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void auth_cache_shared_slot_clear(struct auth_cache_shared_slot *slot)
+{
+	auth_cache_shared_slot_write_begin(slot);
+	slot->hash = 0;
+	slot->key_len = 0;
+	slot->value_len = 0;
+	auth_cache_shared_slot_write_end(slot);
+}
+
+static struct auth_cache_shared_slot *
+auth_cache_shared_find_locked(struct auth_cache_shared *shared,
+			      unsigned int shard, unsigned int first_idx,
+			      unsigned int hash, const char *key,
+			      size_t key_len, bool for_insert)
+{
+	struct auth_cache_shared_slot *slot, *free_slot = NULL;
+	unsigned int i;
+
+	/* the shard is locked, so the slots can't change under us */
+	for (i = 0; i < AUTH_CACHE_SHARED_MAX_PROBES; i++) {
+		slot = auth_cache_shared_get_slot(shared, shard, first_idx + i);
+		if (!auth_cache_shared_slot_is_valid(slot)) {
+			if (free_slot == NULL || free_slot->key_len != 0)
+				free_slot = slot;
+			continue;
+		}
+		if (slot->hash == hash && slot->key_len == key_len &&
+		    memcmp(slot->data, key, key_len) == 0)
+			return slot;
+		if (free_slot == NULL ||
+		    (free_slot->key_len != 0 &&
+		     slot->created < free_slot->created))
+			free_slot = slot;
+	}
+	return for_insert ? free_slot : NULL;
+}
+
+bool auth_cache_shared_lookup(struct auth_cache_shared *shared,
+			      const char *key, const char **value_r,
+			      time_t *created_r, bool *last_success_r)
+{
+	const struct auth_cache_shared_slot *slot, *copy;
+	unsigned int i, hash, shard, first_idx;
+	size_t key_len = strlen(key);
+
+	if (key_len + 2 > AUTH_CACHE_SHARED_DATA_SIZE ||
+	    !auth_cache_shared_is_usable(shared))
+		return FALSE;
+
+	hash = str_hash(key);
+	auth_cache_shared_get_pos(shared, hash, &shard, &first_idx);
+	for (i = 0; i < AUTH_CACHE_SHARED_MAX_PROBES; i++) {
+		slot = auth_cache_shared_get_slot(shared, shard, first_idx + i);
+		if (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) != hash)
+			continue;
+		copy = auth_cache_shared_slot_read(shared, slot);
+		if (copy != NULL && copy->hash == hash &&
+		    copy->key_len == key_len &&
+		    memcmp(copy->data, key, key_len) == 0) {
+			*value_r = copy->data + key_len + 1;
+			*created_r = copy->created;
+			*last_success_r = copy->last_success != 0;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+void auth_cache_shared_insert(struct auth_cache_shared *shared,
+			      const char *key, const char *value,
+			      time_t created, bool last_success)
+{
+	struct auth_cache_shared_slot *slot;
+	unsigned int hash, shard, first_idx;
+	size_t key_len = strlen(key), value_len = strlen(value);
+
+	if (key_len + 1 + value_len + 1 > AUTH_CACHE_SHARED_DATA_SIZE ||
+	    !auth_cache_shared_is_usable(shared))
+		return;
+
+	hash = str_hash(key);
+	auth_cache_shared_get_pos(shared, hash, &shard, &first_idx);
+	if (auth_cache_shared_lock_shard(shared, shard) < 0)
+		return;
+	slot = auth_cache_shared_find_locked(shared, shard, first_idx, hash,
+					     key, key_len, TRUE);
+	auth_cache_shared_slot_write_begin(slot);
+	slot->hash = hash;
+	slot->created = created;
+	slot->key_len = key_len;
+	slot->value_len = value_len;
+	slot->last_success = last_success ? 1 : 0;
+	/* @UNSAFE */
+	memcpy(slot->data, key, key_len + 1);
+	memcpy(slot->data + key_len + 1, value, value_len + 1);
+	auth_cache_shared_slot_write_end(slot);
+	auth_cache_shared_unlock_shard(shared, shard);
+}
+
+void auth_cache_shared_remove(struct auth_cache_shared *shared,
+			      const char *key)
+{
+	struct auth_cache_shared_slot *slot;
+	unsigned int hash, shard, first_idx;
+	size_t key_len = strlen(key);
+
+	if (key_len + 2 > AUTH_CACHE_SHARED_DATA_SIZE ||
+	    !auth_cache_shared_is_usable(shared))
+		return;
+
+	hash = str_hash(key);
+	auth_cache_shared_get_pos(shared, hash, &shard, &first_idx);
+	if (auth_cache_shared_lock_shard(shared, shard) < 0)
+		return;
+	slot = auth_cache_shared_find_locked(shared, shard, first_idx, hash,
+					     key, key_len, FALSE);
+	if (slot != NULL)
+		auth_cache_shared_slot_clear(slot);
+	auth_cache_shared_unlock_shard(shared, shard);
+}
+
+static unsigned int
+auth_cache_shared_clear_shard(struct auth_cache_shared *shared,
+			      unsigned int shard,
+			      const char *const *usernames)
+{
+	struct auth_cache_shared_slot *slot;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < AUTH_CACHE_SHARED_SHARD_SLOTS; i++) {
+		slot = auth_cache_shared_get_slot(shared, shard, i);
+		if (auth_cache_shared_slot_is_valid(slot)) {
+			if (usernames != NULL &&
+			    !auth_cache_key_is_one_of_users(slot->data,
+							    usernames))
+				continue;
+			count++;
+		} else if (slot->key_len == 0 && (slot->seq & 1) == 0) {
+			continue;
+		}
+		auth_cache_shared_slot_clear(slot);
+	}
+	return count;
+}
+
+static unsigned int
+auth_cache_shared_clear_full(struct auth_cache_shared *shared,
+			     const char *const *usernames)
+{
+	unsigned int shard, count = 0;
+
+	for (shard = 0; shard < shared->shard_count; shard++) {
+		if (auth_cache_shared_lock_shard(shared, shard) < 0)
+			break;
+		count += auth_cache_shared_clear_shard(shared, shard,
+						       usernames);
+		auth_cache_shared_unlock_shard(shared, shard);
+	}
+	return count;
+}
+
+unsigned int auth_cache_shared_clear(struct auth_cache_shared *shared)
+{
+	if (!auth_cache_shared_is_usable(shared))
+		return 0;
+	return auth_cache_shared_clear_full(shared, NULL);
+}
+
+unsigned int auth_cache_shared_clear_users(struct auth_cache_shared *shared,
+					   const char *const *usernames)
+{
+	if (!auth_cache_shared_is_usable(shared))
+		return 0;
+	return auth_cache_shared_clear_full(shared, usernames);
+}
+
+static int auth_cache_shared_recreate(struct auth_cache_shared *shared)
+{
+	const char *temp_path = t_strconcat(shared->path, ".tmp", NULL);
+	int fd;
+
+	/* Other processes may still have the old file mmap()ed, so it can't
+	   be resized without them crashing. Replace it with a new file
+	   instead. */
+	fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		e_error(shared->event, "open(%s) failed: %m", temp_path);
+		return -1;
+	}
+	if (file_set_size(fd, auth_cache_shared_file_size(shared->shard_count)) < 0) {
+		e_error(shared->event, "file_set_size(%s) failed: %m",
+			temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return -1;
+	}
+	i_close_fd(&fd);
+	if (rename(temp_path, shared->path) < 0) {
+		e_error(shared->event, "rename(%s, %s) failed: %m",
+			temp_path, shared->path);
+		i_unlink(temp_path);
+		return -1;
+	}
+	return 0;
+}
+
+static void auth_cache_shared_reset(struct auth_cache_shared *shared)
+{
+	struct auth_cache_shared_header *hdr =
+		auth_cache_shared_get_header(shared);
+
+	/* invalidate the file for processes using the old configuration
+	   before clearing it */
+	hdr->magic = 0;
+	(void)auth_cache_shared_clear_full(shared, NULL);
+
+	hdr->version = AUTH_CACHE_SHARED_VERSION;
+	hdr->slot_size = AUTH_CACHE_SHARED_SLOT_SIZE;
+	hdr->shard_count = shared->shard_count;
+	memcpy(hdr->config_md5, shared->config_md5, sizeof(hdr->config_md5));
+	__atomic_store_n(&hdr->magic, AUTH_CACHE_SHARED_MAGIC,
+			 __ATOMIC_RELEASE);
+}
+
+static int auth_cache_shared_mmap(struct auth_cache_shared *shared)
+{
+	const struct auth_cache_shared_header *hdr;
+
+	shared->mmap_size = auth_cache_shared_file_size(shared->shard_count);
+	shared->mmap_base = mmap(NULL, shared->mmap_size,
+				 PROT_READ | PROT_WRITE, MAP_SHARED,
+				 shared->fd, 0);
+	if (shared->mmap_base == MAP_FAILED) {
+		shared->mmap_base = NULL;
+		e_error(shared->event, "mmap(%s) failed: %m", shared->path);
+		return -1;
+	}
+
+	hdr = auth_cache_shared_get_header(shared);
+	if (hdr->version != AUTH_CACHE_SHARED_VERSION ||
+	    hdr->slot_size != AUTH_CACHE_SHARED_SLOT_SIZE ||
+	    hdr->shard_count != shared->shard_count ||
+	    !auth_cache_shared_is_usable(shared)) {
+		e_debug(shared->event, "Initializing shared cache file %s",
+			shared->path);
+		auth_cache_shared_reset(shared);
+	}
+	return 0;
+}
+
+static int auth_cache_shared_open(struct auth_cache_shared *shared)
+{
+	size_t file_size = auth_cache_shared_file_size(shared->shard_count);
+	struct stat st, st2;
+	int ret;
+
+	shared->fd = open(shared->path, O_RDWR | O_CREAT, 0600);
+	if (shared->fd == -1) {
+		e_error(shared->event, "open(%s) failed: %m", shared->path);
+		return -1;
+	}
+	if (auth_cache_shared_lock(shared, F_WRLCK,
+				   AUTH_CACHE_SHARED_INIT_LOCK_OFFSET, 1) < 0)
+		return -1;
+
+	if (fstat(shared->fd, &st) < 0) {
+		e_error(shared->event, "fstat(%s) failed: %m", shared->path);
+		ret = -1;
+	} else if (stat(shared->path, &st2) < 0) {
+		if (errno != ENOENT) {
+			e_error(shared->event, "stat(%s) failed: %m",
+				shared->path);
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	} else if (st.st_ino != st2.st_ino || !CMP_DEV_T(st.st_dev, st2.st_dev)) {
+		/* another process replaced the file while we were waiting
+		   for the lock */
+		ret = 0;
+	} else if (st.st_size != 0 && (uoff_t)st.st_size != file_size) {
+		ret = auth_cache_shared_recreate(shared) < 0 ? -1 : 0;
+	} else if (st.st_size == 0 &&
+		   file_set_size(shared->fd, file_size) < 0) {
+		e_error(shared->event, "file_set_size(%s) failed: %m",
+			shared->path);
+		ret = -1;
+	} else {
+		ret = auth_cache_shared_mmap(shared) < 0 ? -1 : 1;
+	}
+
+	if (ret == 0) {
+		/* closing releases the lock */
+		i_close_fd(&shared->fd);
+	} else {
+		(void)auth_cache_shared_lock(shared, F_UNLCK,
+			AUTH_CACHE_SHARED_INIT_LOCK_OFFSET, 1);
+	}
+	return ret;
+}
+
+struct auth_cache_shared *
+auth_cache_shared_init(const char *path, size_t max_size,
+		       const unsigned char config_md5[STATIC_ARRAY MD5_RESULTLEN],
+		       struct event *event)
+{
+	struct auth_cache_shared *shared;
+	unsigned int i;
+	int ret;
+
+	shared = i_new(struct auth_cache_shared, 1);
+	shared->path = i_strdup(path);
+	shared->fd = -1;
+	shared->event = event_create(event);
+	memcpy(shared->config_md5, config_md5, sizeof(shared->config_md5));
+	shared->shard_count = max_size / AUTH_CACHE_SHARED_SLOT_SIZE /
+		AUTH_CACHE_SHARED_SHARD_SLOTS;
+	if (shared->shard_count == 0)
+		shared->shard_count = 1;
+
+	for (i = 0;; i++) {
+		T_BEGIN {
+			ret = auth_cache_shared_open(shared);
+		} T_END;
+		if (ret != 0)
+			break;
+		if (i == AUTH_CACHE_SHARED_OPEN_RETRIES) {
+			e_error(shared->event,
+				"%s: File keeps getting replaced", path);
+			ret = -1;
+			break;
+		}
+	}
+	if (ret < 0) {
+		auth_cache_shared_deinit(&shared);
+		return NULL;
+	}
+	return shared;
+}
+
+void auth_cache_shared_deinit(struct auth_cache_shared **_shared)
+{
+	struct auth_cache_shared *shared = *_shared;
+
+	*_shared = NULL;
+	if (shared->mmap_base != NULL) {
+		if (munmap(shared->mmap_base, shared->mmap_size) < 0)
+			e_error(shared->event, "munmap(%s) failed: %m",
+				shared->path);
+	}
+	i_close_fd_path(&shared->fd, shared->path);
+	event_unref(&shared->event);
+	i_free(shared->path);
+	i_free(shared);
+}
@@ -0,0 +1,38 @@
+#ifndef AUTH_CACHE_SHARED_H
+#define AUTH_CACHE_SHARED_H
+
+#include "md5.h"
+
+struct auth_cache_shared;
+
+/* Open (or create) the shared cache file in path, sized for about max_size
+   bytes of entries. config_md5 identifies the passdb/userdb configuration,
+   since the cache keys contain their IDs. If it doesn't match the existing
+   file's, the file is cleared. Returns NULL if the file couldn't be opened,
+   which has already been logged. */
+struct auth_cache_shared *
+auth_cache_shared_init(const char *path, size_t max_size,
+		       const unsigned char config_md5[STATIC_ARRAY MD5_RESULTLEN],
+		       struct event *event);
+void auth_cache_shared_deinit(struct auth_cache_shared **shared);
+
+/* Look up the key. The returned value is valid until the next
+   auth_cache_shared_*() call. */
+bool auth_cache_shared_lookup(struct auth_cache_shared *shared,
+			      const char *key, const char **value_r,
+			      time_t *created_r, bool *last_success_r);
+/* Insert key => value, replacing any existing entry. Entries that don't fit
+   into a single slot are silently not shared. */
+void auth_cache_shared_insert(struct auth_cache_shared *shared,
+			      const char *key, const char *value,
+			      time_t created, bool last_success);
+void auth_cache_shared_remove(struct auth_cache_shared *shared,
+			      const char *key);
+
+/* Remove all entries / entries of the given users. Returns how many
+   entries were removed. */
+unsigned int auth_cache_shared_clear(struct auth_cache_shared *shared);
+unsigned int auth_cache_shared_clear_users(struct auth_cache_shared *shared,
+					   const char *const *usernames);
+
+#endif
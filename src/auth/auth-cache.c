@@ -9,6 +9,7 @@
 #include "var-expand.h"
 #include "auth-request.h"
 #include "auth-cache.h"
+#include "auth-cache-shared.h"
 
 #include <time.h>
 
@@ -16,6 +17,7 @@ struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
 	struct auth_cache_node *head, *tail;
 	struct event *event;
+	struct auth_cache_shared *shared;
 
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
@@ -233,7 +235,7 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	struct auth_cache *cache;
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create_open(&cache->hash, default_pool, 0, str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
@@ -247,6 +249,23 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	return cache;
 }
 
+void auth_cache_set_shared(struct auth_cache *cache,
+			   struct auth_cache_shared *shared)
+{
+	i_assert(cache->shared == NULL);
+	cache->shared = shared;
+}
+
+static unsigned int auth_cache_clear_local(struct auth_cache *cache)
+{
+	unsigned int ret = hash_table_count(cache->hash);
+
+	while (cache->tail != NULL)
+		auth_cache_node_destroy(cache, cache->tail);
+	hash_table_clear(cache->hash, FALSE);
+	return ret;
+}
+
 void auth_cache_free(struct auth_cache **_cache)
 {
 	struct auth_cache *cache = *_cache;
@@ -255,7 +274,10 @@ void auth_cache_free(struct auth_cache **_cache)
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
-	auth_cache_clear(cache);
+	/* the shared cache is kept over restarts */
+	auth_cache_clear_local(cache);
+	if (cache->shared != NULL)
+		auth_cache_shared_deinit(&cache->shared);
 	hash_table_destroy(&cache->hash);
 	event_unref(&cache->event);
 	i_free(cache);
@@ -263,20 +285,21 @@ void auth_cache_free(struct auth_cache **_cache)
 
 unsigned int auth_cache_clear(struct auth_cache *cache)
 {
-	unsigned int ret = hash_table_count(cache->hash);
+	unsigned int ret = auth_cache_clear_local(cache);
 
-	while (cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-	hash_table_clear(cache->hash, FALSE);
+	if (cache->shared != NULL) {
+		/* most of the shared entries are likely in the local cache
+		   as well, so don't count them twice */
+		ret = I_MAX(ret, auth_cache_shared_clear(cache->shared));
+	}
 	return ret;
 }
 
-static bool auth_cache_node_is_user(struct auth_cache_node *node,
-				    const char *username)
+static bool auth_cache_key_is_user(const char *data, const char *username)
 {
-	const char *data = node->data, *suffix;
+	const char *suffix;
 
-	/* The cache nodes begin with "P"/"U", passdb/userdb ID, optional
+	/* The cache keys begin with "P"/"U", passdb/userdb ID, optional
 	   "+" master user, "\t" and then usually followed by the username.
 	   It's too much trouble to keep track of all the cache keys, so we'll
 	   just match it as if it was the username. If e.g. '%n' is used in the
@@ -301,13 +324,13 @@ static bool auth_cache_node_is_user(struct auth_cache_node *node,
 		(suffix[0] == '\t' || suffix[0] == '\0');
 }
 
-static bool auth_cache_node_is_one_of_users(struct auth_cache_node *node,
-					    const char *const *usernames)
+bool auth_cache_key_is_one_of_users(const char *key,
+				    const char *const *usernames)
 {
 	unsigned int i;
 
 	for (i = 0; usernames[i] != NULL; i++) {
-		if (auth_cache_node_is_user(node, usernames[i]))
+		if (auth_cache_key_is_user(key, usernames[i]))
 			return TRUE;
 	}
 	return FALSE;
@@ -321,11 +344,15 @@ unsigned int auth_cache_clear_users(struct auth_cache *cache,
 
 	for (node = cache->tail; node != NULL; node = next) {
 		next = node->next;
-		if (auth_cache_node_is_one_of_users(node, usernames)) {
+		if (auth_cache_key_is_one_of_users(node->data, usernames)) {
 			auth_cache_node_destroy(cache, node);
 			ret++;
 		}
 	}
+	if (cache->shared != NULL) {
+		ret = I_MAX(ret, auth_cache_shared_clear_users(cache->shared,
+							       usernames));
+	}
 	return ret;
 }
 
@@ -373,6 +400,60 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	return str_c(value);
 }
 
+static struct auth_cache_node *
+auth_cache_node_add(struct auth_cache *cache, const char *key,
+		    const char *value, time_t created, bool last_success)
+{
+	struct auth_cache_node *node;
+	size_t data_size, alloc_size, key_len, value_len = strlen(value);
+	char *hash_key;
+
+	key_len = strlen(key);
+
+	data_size = key_len + 1 + value_len + 1;
+	alloc_size = sizeof(struct auth_cache_node) + data_size;
+
+	/* make sure we have enough space */
+	while (cache->size_left < alloc_size && cache->tail != NULL)
+		auth_cache_node_destroy(cache, cache->tail);
+
+	node = hash_table_lookup(cache->hash, key);
+	if (node != NULL) {
+		/* key is already in cache (probably expired), remove it */
+		auth_cache_node_destroy(cache, node);
+	}
+
+	/* @UNSAFE */
+	node = i_malloc(alloc_size);
+	node->created = created;
+	node->alloc_size = alloc_size;
+	node->last_success = last_success;
+	memcpy(node->data, key, key_len);
+	memcpy(node->data + key_len + 1, value, value_len);
+
+	auth_cache_node_link_head(cache, node);
+
+	cache->size_left -= alloc_size;
+	hash_key = node->data;
+	hash_table_insert(cache->hash, hash_key, node);
+	return node;
+}
+
+static struct auth_cache_node *
+auth_cache_lookup_shared(struct auth_cache *cache, const char *key)
+{
+	const char *value;
+	time_t created;
+	bool last_success;
+
+	if (!auth_cache_shared_lookup(cache->shared, key, &value, &created,
+				      &last_success))
+		return NULL;
+	/* keep the original creation time, so the TTL works the same way
+	   as in the process that added it */
+	return auth_cache_node_add(cache, key, value, created, last_success);
+}
+
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -388,6 +469,8 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
 	node = hash_table_lookup(cache->hash, key);
+	if (node == NULL && cache->shared != NULL)
+		node = auth_cache_lookup_shared(cache, key);
 	if (node == NULL) {
 		cache->miss_count++;
 		return NULL;
@@ -421,9 +504,8 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success)
 {
-        struct auth_cache_node *node;
-	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	char *hash_key;
+	struct auth_cache_node *node;
+	time_t now = time(NULL);
 
 	if (*value == '\0' && cache->neg_ttl_secs == 0) {
 		/* we're not caching negative entries */
@@ -431,41 +513,17 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	}
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	key_len = strlen(key);
-
-	data_size = key_len + 1 + value_len + 1;
-	alloc_size = sizeof(struct auth_cache_node) + data_size;
-
-	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-
-	node = hash_table_lookup(cache->hash, key);
-	if (node != NULL) {
-		/* key is already in cache (probably expired), remove it */
-		auth_cache_node_destroy(cache, node);
-	}
-
-	/* @UNSAFE */
-	node = i_malloc(alloc_size);
-	node->created = time(NULL);
-	node->alloc_size = alloc_size;
-	node->last_success = last_success;
-	memcpy(node->data, key, key_len);
-	memcpy(node->data + key_len + 1, value, value_len);
-
-	auth_cache_node_link_head(cache, node);
-
-	cache->size_left -= alloc_size;
-	hash_key = node->data;
-	hash_table_insert(cache->hash, hash_key, node);
+	node = auth_cache_node_add(cache, key, value, now, last_success);
+	if (cache->shared != NULL)
+		auth_cache_shared_insert(cache->shared, key, value, now,
+					 last_success);
 
 	if (*value != '\0') {
 		cache->pos_entries++;
-		cache->pos_size += alloc_size;
+		cache->pos_size += node->alloc_size;
 	} else {
 		cache->neg_entries++;
-		cache->neg_size += alloc_size;
+		cache->neg_size += node->alloc_size;
 	}
 }
 
@@ -475,6 +533,8 @@ void auth_cache_remove(struct auth_cache *cache,
 	struct auth_cache_node *node;
 
 	key = auth_request_expand_cache_key(request, key, request->fields.user);
+	if (cache->shared != NULL)
+		auth_cache_shared_remove(cache->shared, key);
 	node = hash_table_lookup(cache->hash, key);
 	if (node == NULL)
 		return;
@@ -14,6 +14,7 @@ struct auth_cache_node {
 };
 
 struct auth_cache;
+struct auth_cache_shared;
 struct auth_request;
 
 /* Parses all %x variables from query and compresses them into tab-separated
@@ -32,12 +33,19 @@ char *auth_cache_parse_key_and_fields(pool_t pool, const char *query,
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs);
 void auth_cache_free(struct auth_cache **cache);
+/* Use the shared cache as a second level cache. The cache takes over the
+   ownership of it. */
+void auth_cache_set_shared(struct auth_cache *cache,
+			   struct auth_cache_shared *shared);
 
 /* Clear the cache. Returns how many entries were removed. */
 unsigned int ATTR_NOWARN_UNUSED_RESULT
 auth_cache_clear(struct auth_cache *cache);
 unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *usernames);
+/* Returns TRUE if the (expanded) cache key belongs to one of the users. */
+bool auth_cache_key_is_one_of_users(const char *key,
+				    const char *const *usernames);
 
 /* Look key from cache. key should be the same string as returned by
    auth_cache_parse_key(). Returned node can't be used after any other
@@ -294,6 +294,8 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
 	DEF(BOOL, cache_verify_password_with_worker),
+	DEF(BOOL, cache_shared),
+	DEF(UINT, worker_max_pipelined_requests),
 	DEF(STR, username_chars),
 	DEF(STR_HIDDEN, username_translation),
 	DEF(STR_NOVARS, username_format),
@@ -361,6 +363,8 @@ static const struct auth_settings auth_default_settings = {
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
 	.cache_verify_password_with_worker = FALSE,
+	.cache_shared = FALSE,
+	.worker_max_pipelined_requests = 4,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%{user | lower}",
@@ -601,6 +605,11 @@ static bool auth_settings_ext_check(struct event *event, void *_set,
 	if (!auth_verify_verbose_password(set, error_r))
 		return FALSE;
 
+	if (set->worker_max_pipelined_requests == 0) {
+		*error_r = "auth_worker_max_pipelined_requests must be at least 1";
+		return FALSE;
+	}
+
 	if (*set->username_chars == '\0') {
 		/* all chars are allowed */
 		memset(set->username_chars_map, 1,
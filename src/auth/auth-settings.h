@@ -58,6 +58,8 @@ struct auth_settings {
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
 	bool cache_verify_password_with_worker;
+	bool cache_shared;
+	unsigned int worker_max_pipelined_requests;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
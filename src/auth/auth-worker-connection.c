@@ -38,12 +38,17 @@ struct auth_worker_request {
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	/* LIST request, which has a multi-line reply */
+	bool iterate:1;
 };
 
 struct auth_worker_connection {
 	struct connection conn;
 	struct timeout *to_lookup;
-	struct auth_worker_request *request;
+	/* Requests sent to the worker and still waiting for a reply. There
+	   can be up to auth_worker_max_pipelined_requests of them. */
+	ARRAY(struct auth_worker_request *) requests;
 	unsigned int id_counter;
 
 	bool received_error:1;
@@ -51,6 +56,10 @@ struct auth_worker_connection {
 	bool shutdown:1;
 	bool timeout_pending_resume:1;
 	bool resuming:1;
+	/* LIST request is pending. Worker doesn't read further requests
+	   until it's finished, so don't send any more. */
+	bool iterating:1;
+	bool deinitializing:1;
 };
 
 static struct connection_list *connections = NULL;
@@ -68,7 +77,7 @@ static void auth_worker_deinit(struct auth_worker_connection **worker,
 
 static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request == NULL);
+	i_assert(array_count(&worker->requests) == 0);
 
 	if (idle_count > 1)
 		auth_worker_deinit(&worker, NULL, FALSE);
@@ -78,7 +87,7 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *worker)
 {
-	i_assert(worker->request != NULL);
+	i_assert(array_count(&worker->requests) > 0);
 
 	auth_worker_deinit(&worker, "Lookup timed out", TRUE);
 }
@@ -125,30 +134,48 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 
 	o_stream_nsendv(worker->conn.output, iov, 3);
 
-	i_assert(worker->request == NULL);
-	worker->request = request;
-
-	timeout_remove(&worker->to_lookup);
-	worker->to_lookup = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-					auth_worker_call_timeout, worker);
+	if (str_begins_with(request->data, "LIST\t")) {
+		request->iterate = TRUE;
+		worker->iterating = TRUE;
+	}
+	array_push_back(&worker->requests, &request);
+	if (array_count(&worker->requests) == 1) {
+		/* with pipelined requests the lookup timeout is reset
+		   whenever a reply is received */
+		timeout_remove(&worker->to_lookup);
+		worker->to_lookup =
+			timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+				    auth_worker_call_timeout, worker);
 
-	i_assert(idle_count > 0);
-	idle_count--;
+		i_assert(idle_count > 0);
+		idle_count--;
+	}
 	return TRUE;
 }
 
+static bool auth_worker_can_send(struct auth_worker_connection *worker)
+{
+	unsigned int count = array_count(&worker->requests);
+
+	if (count == 0)
+		return TRUE;
+	if (worker->restart || worker->shutdown || worker->iterating ||
+	    worker->deinitializing)
+		return FALSE;
+	return count < global_auth_settings->worker_max_pipelined_requests;
+}
+
 static void auth_worker_request_send_next(struct auth_worker_connection *worker)
 {
 	struct auth_worker_request *request;
 
-	do {
-		if (aqueue_count(worker_request_queue) == 0)
-			return;
-
+	while (aqueue_count(worker_request_queue) > 0 &&
+	       auth_worker_can_send(worker)) {
 		request = array_idx_elem(&worker_request_array,
 					 aqueue_idx(worker_request_queue, 0));
 		aqueue_delete_tail(worker_request_queue);
-	} while (!auth_worker_request_send(worker, request));
+		(void)auth_worker_request_send(worker, request);
+	}
 }
 
 static int auth_worker_handshake_args(struct connection *conn,
@@ -246,6 +273,8 @@ static struct auth_worker_connection *auth_worker_create(void)
 	}
 
 	event_set_append_log_prefix(worker->conn.event, "auth-worker: ");
+	i_array_init(&worker->requests,
+		     global_auth_settings->worker_max_pipelined_requests);
 
 	worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
 					auth_worker_idle_timeout, worker);
@@ -258,6 +287,7 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 			       const char *reason, bool restart)
 {
 	struct auth_worker_connection *worker = *_worker;
+	struct auth_worker_request *request;
 
 	*_worker = NULL;
 
@@ -267,23 +297,30 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 		auth_workers_with_errors--;
 	}
 
-	if (worker->request == NULL)
+	if (array_count(&worker->requests) == 0)
 		idle_count--;
 	else {
-		e_error(worker->conn.event, "Aborted %s request for %s: %s",
-			t_strcut(worker->request->data, '\t'),
-			worker->request->username, reason);
 		const char *const args[] = {
 			"FAIL",
 			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
 			NULL,
 		};
-		worker->request->callback(worker, args, worker->request->context);
+		/* the callbacks may add new requests - don't send them to
+		   this worker */
+		worker->deinitializing = TRUE;
+		array_foreach_elem(&worker->requests, request) {
+			e_error(worker->conn.event,
+				"Aborted %s request for %s: %s",
+				t_strcut(request->data, '\t'),
+				request->username, reason);
+			request->callback(worker, args, request->context);
+		}
 	}
 
 	timeout_remove(&worker->to_lookup);
 	connection_deinit(&worker->conn);
 
+	array_free(&worker->requests);
 	i_free(worker);
 
 	if (idle_count == 0 && restart) {
@@ -295,27 +332,55 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 
 static struct auth_worker_connection *auth_worker_find_free(void)
 {
-	if (idle_count == 0)
+	struct auth_worker_connection *best = NULL;
+	unsigned int count, best_count = UINT_MAX;
+
+	if (idle_count == 0 &&
+	    global_auth_settings->worker_max_pipelined_requests == 1)
 		return NULL;
 
+	/* Prefer idle workers. Otherwise pipeline the request to the least
+	   busy worker, and create a new worker process only once all the
+	   existing ones have auth_worker_max_pipelined_requests in flight. */
 	struct connection *conn = connections->connections;
 	while (conn != NULL) {
 		struct auth_worker_connection *worker =
 			container_of(conn, struct auth_worker_connection, conn);
-		if (worker->request == NULL)
+		count = array_count(&worker->requests);
+		if (count == 0)
 			return worker;
-
+		if (count < best_count && auth_worker_can_send(worker)) {
+			best = worker;
+			best_count = count;
+		}
 		conn = conn->next;
 	}
+	i_assert(idle_count == 0);
+	return best;
+}
 
-	i_unreached();
+static struct auth_worker_request *
+auth_worker_request_find(struct auth_worker_connection *worker,
+			 unsigned int id, unsigned int *idx_r)
+{
+	struct auth_worker_request *const *requests;
+	unsigned int i, count;
+
+	requests = array_get(&worker->requests, &count);
+	for (i = 0; i < count; i++) {
+		if (requests[i]->id == id) {
+			*idx_r = i;
+			return requests[i];
+		}
+	}
+	return NULL;
 }
 
 static int auth_worker_request_handle(struct auth_worker_connection *worker,
+				      struct auth_worker_request *_request,
+				      unsigned int idx,
 				      const char *const *args)
 {
-	struct auth_worker_request *_request = worker->request;
-
 	/* lines starting with '*' denote a multi-line request
 	   if they do, reset timeouts
 	   if they do not, mark this request as handled */
@@ -329,13 +394,27 @@ static int auth_worker_request_handle(struct auth_worker_connection *worker,
 							auth_worker_call_timeout, worker);
 		}
 	} else {
-		worker->resuming = FALSE;
-		worker->request = NULL;
-		worker->timeout_pending_resume = FALSE;
+		if (_request->iterate) {
+			worker->resuming = FALSE;
+			worker->iterating = FALSE;
+			worker->timeout_pending_resume = FALSE;
+		}
+		array_delete(&worker->requests, idx, 1);
 		timeout_remove(&worker->to_lookup);
-		worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-						auth_worker_idle_timeout, worker);
-		idle_count++;
+		if (array_count(&worker->requests) == 0) {
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					    auth_worker_idle_timeout, worker);
+			idle_count++;
+		} else if (worker->resuming) {
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_RESUME_TIMEOUT_SECS * 1000,
+					    auth_worker_call_timeout, worker);
+		} else {
+			worker->to_lookup =
+				timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+					    auth_worker_call_timeout, worker);
+		}
 	}
 
 	if (!_request->callback(worker, args, _request->context)) {
@@ -416,14 +495,18 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 		return 1;
 	}
 
-	int ret = 0;
-	if (worker->request != NULL && id == worker->request->id)
-		 ret = auth_worker_request_handle(worker, args + 1);
+	struct auth_worker_request *request;
+	unsigned int idx;
+	int ret;
+
+	request = auth_worker_request_find(worker, id, &idx);
+	if (request != NULL)
+		 ret = auth_worker_request_handle(worker, request, idx, args + 1);
 	else {
-		if (worker->request != NULL) {
+		if (array_count(&worker->requests) > 0) {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
-				"expected %u", id, worker->request->id);
+				"which isn't pending", id);
 		} else {
 			e_error(conn->event,
 				"BUG: Worker sent reply with id %u, "
@@ -433,8 +516,9 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 		return -1;
 	}
 
-	if (worker->request != NULL) {
-		/* there's still a pending request */
+	if (array_count(&worker->requests) > 0 &&
+	    (ret < 0 || worker->restart || worker->shutdown)) {
+		/* wait for the pending requests to finish */
 	} else if (worker->restart) {
 		auth_worker_deinit(&worker, "Max requests limit", TRUE);
 		ret = 0;
@@ -513,7 +597,7 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 
 void auth_worker_connection_resume_input(struct auth_worker_connection *worker)
 {
-	if (worker->request == NULL) {
+	if (!worker->iterating) {
 		/* request was just finished, don't try to resume it */
 		return;
 	}
@@ -9,6 +9,7 @@
 #include "passdb.h"
 #include "passdb-cache.h"
 #include "passdb-blocking.h"
+#include "auth-cache-shared.h"
 
 struct auth_cache *passdb_cache = NULL;
 
@@ -186,6 +187,29 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 	return TRUE;
 }
 
+static void passdb_cache_init_shared(const struct auth_settings *set)
+{
+	struct auth_cache_shared *shared;
+	unsigned char passdb_md5[MD5_RESULTLEN], userdb_md5[MD5_RESULTLEN];
+	unsigned char config_md5[MD5_RESULTLEN];
+	struct md5_context ctx;
+	const char *path;
+
+	/* the cache keys contain the passdb/userdb IDs */
+	auth_passdbs_generate_md5(passdb_md5);
+	auth_userdbs_generate_md5(userdb_md5);
+	md5_init(&ctx);
+	md5_update(&ctx, passdb_md5, sizeof(passdb_md5));
+	md5_update(&ctx, userdb_md5, sizeof(userdb_md5));
+	md5_final(&ctx, config_md5);
+
+	path = t_strconcat(set->base_dir, "/auth-cache", NULL);
+	shared = auth_cache_shared_init(path, set->cache_size, config_md5,
+					auth_event);
+	if (shared != NULL)
+		auth_cache_set_shared(passdb_cache, shared);
+}
+
 void passdb_cache_init(const struct auth_settings *set)
 {
 	rlim_t limit;
@@ -202,6 +226,8 @@ void passdb_cache_init(const struct auth_settings *set)
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
 				      set->cache_negative_ttl);
+	if (set->cache_shared)
+		passdb_cache_init_shared(set);
 }
 
 void passdb_cache_deinit(void)
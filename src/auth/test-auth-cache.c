@@ -4,8 +4,13 @@
 #include "str.h"
 #include "auth-request.h"
 #include "auth-cache.h"
+#include "auth-cache-shared.h"
 #include "test-common.h"
 
+#include <unistd.h>
+
+#define TEST_SHARED_CACHE_PATH ".test-auth-cache-shared"
+
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 	{ .key = "user", .value = NULL },
@@ -100,12 +105,109 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static void test_auth_cache_shared(void)
+{
+	static const unsigned char md5[MD5_RESULTLEN] = { 1 };
+	static const unsigned char md5_2[MD5_RESULTLEN] = { 2 };
+	const char *const users[] = { "user1", NULL };
+	struct auth_cache_shared *shared, *shared2;
+	char large_value[1024];
+	const char *value;
+	time_t created;
+	bool last_success;
+
+	test_begin("auth cache shared");
+	memset(large_value, 'x', sizeof(large_value) - 1);
+	large_value[sizeof(large_value) - 1] = '\0';
+	i_unlink_if_exists(TEST_SHARED_CACHE_PATH);
+	shared = auth_cache_shared_init(TEST_SHARED_CACHE_PATH, 1024*1024,
+					md5, auth_event);
+	shared2 = auth_cache_shared_init(TEST_SHARED_CACHE_PATH, 1024*1024,
+					 md5, auth_event);
+	test_assert(shared != NULL && shared2 != NULL);
+
+	auth_cache_shared_insert(shared, "P1\tuser1", "pass1", 100, TRUE);
+	auth_cache_shared_insert(shared, "P1+master\tuser1\tfoo", "", 101,
+				 FALSE);
+	auth_cache_shared_insert(shared, "P1\tuser2", "pass2", 102, FALSE);
+	auth_cache_shared_insert(shared, "P1\tuser10", "pass10", 103, FALSE);
+	/* too large to be shared */
+	auth_cache_shared_insert(shared, "P1\tuser3", large_value, 104,
+				 FALSE);
+
+	/* the entries are seen by the other process */
+	test_assert(auth_cache_shared_lookup(shared2, "P1\tuser1", &value,
+					     &created, &last_success));
+	test_assert_strcmp(value, "pass1");
+	test_assert(created == 100 && last_success);
+	test_assert(auth_cache_shared_lookup(shared2, "P1+master\tuser1\tfoo",
+					     &value, &created, &last_success));
+	test_assert_strcmp(value, "");
+	test_assert(created == 101 && !last_success);
+	test_assert(!auth_cache_shared_lookup(shared2, "P1\tuser3", &value,
+					      &created, &last_success));
+	test_assert(!auth_cache_shared_lookup(shared2, "P1\tuser", &value,
+					      &created, &last_success));
+
+	/* replace */
+	auth_cache_shared_insert(shared2, "P1\tuser2", "pass2b", 105, TRUE);
+	test_assert(auth_cache_shared_lookup(shared, "P1\tuser2", &value,
+					     &created, &last_success));
+	test_assert_strcmp(value, "pass2b");
+	test_assert(created == 105 && last_success);
+
+	/* remove */
+	auth_cache_shared_remove(shared2, "P1\tuser2");
+	test_assert(!auth_cache_shared_lookup(shared, "P1\tuser2", &value,
+					      &created, &last_success));
+
+	/* flush user1 */
+	test_assert(auth_cache_shared_clear_users(shared2, users) == 2);
+	test_assert(!auth_cache_shared_lookup(shared, "P1\tuser1", &value,
+					      &created, &last_success));
+	test_assert(auth_cache_shared_lookup(shared, "P1\tuser10", &value,
+					     &created, &last_success));
+
+	/* the entries survive reopening */
+	auth_cache_shared_deinit(&shared2);
+	shared2 = auth_cache_shared_init(TEST_SHARED_CACHE_PATH, 1024*1024,
+					 md5, auth_event);
+	test_assert(auth_cache_shared_lookup(shared2, "P1\tuser10", &value,
+					     &created, &last_success));
+	auth_cache_shared_deinit(&shared2);
+
+	/* changed configuration resets the file and disables the old one */
+	shared2 = auth_cache_shared_init(TEST_SHARED_CACHE_PATH, 1024*1024,
+					 md5_2, auth_event);
+	test_assert(!auth_cache_shared_lookup(shared2, "P1\tuser10", &value,
+					      &created, &last_success));
+	auth_cache_shared_insert(shared, "P1\tuser1", "pass1", 100, TRUE);
+	test_assert(!auth_cache_shared_lookup(shared2, "P1\tuser1", &value,
+					      &created, &last_success));
+	auth_cache_shared_insert(shared2, "P1\tuser1", "pass1", 100, TRUE);
+	test_assert(auth_cache_shared_clear(shared2) == 1);
+	auth_cache_shared_deinit(&shared2);
+
+	/* changed size replaces the file */
+	shared2 = auth_cache_shared_init(TEST_SHARED_CACHE_PATH, 4*1024*1024,
+					 md5, auth_event);
+	auth_cache_shared_insert(shared2, "P1\tuser1", "pass1", 100, TRUE);
+	test_assert(auth_cache_shared_lookup(shared2, "P1\tuser1", &value,
+					     &created, &last_success));
+	auth_cache_shared_deinit(&shared2);
+
+	auth_cache_shared_deinit(&shared);
+	i_unlink(TEST_SHARED_CACHE_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	lib_init();
 	auth_event = event_create(NULL);
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_shared,
 		NULL
 	};
 	int ret = test_run(test_functions);
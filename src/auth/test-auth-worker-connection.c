@@ -0,0 +1,335 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+#include "array.h"
+#include "ioloop.h"
+#include "net.h"
+#include "istream.h"
+#include "ostream.h"
+#include "str.h"
+#include "strescape.h"
+#include "master-service.h"
+#include "auth-common.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "auth-worker-server.h"
+#include "auth-worker-connection.h"
+
+/* auth-worker-connection.c connects to this path */
+#define TEST_AUTH_WORKER_SOCKET "auth-worker"
+#define TEST_MAX_PIPELINED 3
+
+struct test_worker_request {
+	unsigned int id;
+	const char *data;
+	bool replied;
+};
+
+struct test_worker {
+	int fd;
+	struct io *io;
+	struct istream *input;
+	struct ostream *output;
+	ARRAY(struct test_worker_request) requests;
+};
+
+struct test_call {
+	const char *data;
+	unsigned int reply_count;
+};
+
+static pool_t test_pool;
+static int listen_fd;
+static struct io *io_listen;
+static unsigned int test_process_limit;
+static ARRAY(struct test_worker *) test_workers;
+static unsigned int test_pending_calls;
+
+static void test_worker_input(struct test_worker *worker)
+{
+	const char *line, *const *args;
+	struct test_worker_request *request;
+
+	while ((line = i_stream_read_next_line(worker->input)) != NULL) {
+		args = t_strsplit_tabescaped(line);
+		if (strcmp(args[0], "VERSION") == 0 ||
+		    strcmp(args[0], "DBHASH") == 0)
+			continue;
+		request = array_append_space(&worker->requests);
+		test_assert(str_to_uint(args[0], &request->id) == 0);
+		request->data = p_strdup(test_pool, strchr(line, '\t') + 1);
+	}
+	if (worker->input->stream_errno != 0 || worker->input->eof)
+		io_remove(&worker->io);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_worker_accept(void *context ATTR_UNUSED)
+{
+	struct test_worker *worker;
+	int fd;
+
+	if ((fd = net_accept(listen_fd, NULL, NULL)) < 0)
+		return;
+
+	worker = p_new(test_pool, struct test_worker, 1);
+	worker->fd = fd;
+	p_array_init(&worker->requests, test_pool, 8);
+	worker->input = i_stream_create_fd(fd, SIZE_MAX);
+	worker->output = o_stream_create_fd(fd, SIZE_MAX);
+	o_stream_nsend_str(worker->output, t_strdup_printf(
+		"VERSION\t"AUTH_WORKER_NAME"\t%u\t%u\nPROCESS-LIMIT\t%u\n",
+		AUTH_WORKER_PROTOCOL_MAJOR_VERSION,
+		AUTH_WORKER_PROTOCOL_MINOR_VERSION, test_process_limit));
+	worker->io = io_add(fd, IO_READ, test_worker_input, worker);
+	array_push_back(&test_workers, &worker);
+}
+
+static void test_worker_reply(struct test_worker *worker, unsigned int id)
+{
+	struct test_worker_request *request;
+
+	array_foreach_modifiable(&worker->requests, request) {
+		if (request->id == id) {
+			i_assert(!request->replied);
+			request->replied = TRUE;
+			o_stream_nsend_str(worker->output, t_strdup_printf(
+				"%u\tOK\t%s\n", id, str_tabescape(request->data)));
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void test_worker_reply_all(struct test_worker *worker)
+{
+	const struct test_worker_request *request;
+
+	array_foreach(&worker->requests, request) {
+		if (!request->replied)
+			test_worker_reply(worker, request->id);
+	}
+}
+
+static void test_worker_free(struct test_worker *worker)
+{
+	io_remove(&worker->io);
+	i_stream_destroy(&worker->input);
+	o_stream_destroy(&worker->output);
+	i_close_fd(&worker->fd);
+}
+
+static bool
+test_call_callback(struct auth_worker_connection *conn ATTR_UNUSED,
+		   const char *const *args, void *context)
+{
+	struct test_call *call = context;
+
+	test_assert_strcmp(args[0], "OK");
+	test_assert_strcmp(args[1], call->data);
+	call->reply_count++;
+	i_assert(test_pending_calls > 0);
+	if (--test_pending_calls == 0)
+		io_loop_stop(current_ioloop);
+	return TRUE;
+}
+
+static void test_call(struct test_call *call, const char *data)
+{
+	call->data = data;
+	test_pending_calls++;
+	auth_worker_call(test_pool, "testuser", data,
+			 test_call_callback, call);
+}
+
+static unsigned int test_worker_request_count(struct test_worker *worker)
+{
+	return array_count(&worker->requests);
+}
+
+static void test_run_until_requests(unsigned int count)
+{
+	struct test_worker *worker;
+	unsigned int total;
+
+	for (;;) {
+		total = 0;
+		array_foreach_elem(&test_workers, worker)
+			total += test_worker_request_count(worker);
+		if (total >= count)
+			break;
+		io_loop_run(current_ioloop);
+	}
+}
+
+static void test_run_until_replies(void)
+{
+	while (test_pending_calls > 0)
+		io_loop_run(current_ioloop);
+}
+
+static void test_setup(unsigned int process_limit,
+		       struct auth_settings *set_copy,
+		       const struct auth_settings **orig_set_r)
+{
+	test_auth_init();
+	test_pool = pool_alloconly_create("test auth worker", 1024);
+	p_array_init(&test_workers, test_pool, 4);
+	test_process_limit = process_limit;
+
+	/* enable pipelining */
+	*orig_set_r = global_auth_settings;
+	*set_copy = *global_auth_settings;
+	set_copy->worker_max_pipelined_requests = TEST_MAX_PIPELINED;
+	global_auth_settings = set_copy;
+
+	i_unlink_if_exists(TEST_AUTH_WORKER_SOCKET);
+	listen_fd = net_listen_unix(TEST_AUTH_WORKER_SOCKET, 10);
+	if (listen_fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", TEST_AUTH_WORKER_SOCKET);
+	io_listen = io_add(listen_fd, IO_READ, test_worker_accept, NULL);
+	auth_worker_connection_init();
+}
+
+static void test_teardown(const struct auth_settings *orig_set)
+{
+	struct test_worker *worker;
+
+	auth_worker_connection_deinit();
+	array_foreach_elem(&test_workers, worker)
+		test_worker_free(worker);
+	io_remove(&io_listen);
+	i_close_fd(&listen_fd);
+	i_unlink_if_exists(TEST_AUTH_WORKER_SOCKET);
+	pool_unref(&test_pool);
+
+	global_auth_settings = orig_set;
+	test_auth_deinit();
+}
+
+static void test_auth_worker_pipeline_replies(void)
+{
+	const struct auth_settings *orig_set;
+	struct auth_settings set;
+	struct test_call calls[5];
+	struct test_worker *worker;
+	const struct test_worker_request *requests;
+	unsigned int i, count;
+
+	test_begin("auth worker pipelined replies");
+	struct ioloop *ioloop = io_loop_create();
+	test_setup(1, &set, &orig_set);
+	i_zero(&calls);
+
+	/* first request finishes the handshake */
+	test_call(&calls[0], "PASSV\t1\tfirst");
+	test_run_until_requests(1);
+	worker = array_idx_elem(&test_workers, 0);
+	test_worker_reply(worker, 1);
+	test_run_until_replies();
+	test_assert(calls[0].reply_count == 1);
+
+	/* worker limit is reached, so these are pipelined to the same
+	   worker. The last one is queued until a reply is received. */
+	test_call(&calls[1], "PASSV\t1\tsecond");
+	test_call(&calls[2], "PASSV\t1\tthird");
+	test_call(&calls[3], "PASSV\t1\tfourth");
+	test_call(&calls[4], "PASSV\t1\tfifth");
+	test_run_until_requests(1 + TEST_MAX_PIPELINED);
+	test_assert(array_count(&test_workers) == 1);
+	requests = array_get(&worker->requests, &count);
+	test_assert(count == 1 + TEST_MAX_PIPELINED);
+	for (i = 1; i < count; i++) {
+		test_assert_idx(requests[i].id == i + 1, i);
+		test_assert_strcmp_idx(requests[i].data, calls[i].data, i);
+	}
+
+	/* reply out of order - each reply must go to its own callback */
+	test_worker_reply(worker, 4);
+	test_run_until_requests(2 + TEST_MAX_PIPELINED);
+	test_assert(calls[3].reply_count == 1);
+	requests = array_get(&worker->requests, &count);
+	test_assert(count == 2 + TEST_MAX_PIPELINED);
+	test_assert_strcmp(requests[count-1].data, calls[4].data);
+
+	test_worker_reply(worker, 3);
+	test_worker_reply(worker, 5);
+	test_worker_reply(worker, 2);
+	test_run_until_replies();
+	for (i = 0; i < N_ELEMENTS(calls); i++)
+		test_assert_idx(calls[i].reply_count == 1, i);
+	test_assert(test_pending_calls == 0);
+
+	test_teardown(orig_set);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_pipeline_before_new_worker(void)
+{
+	const struct auth_settings *orig_set;
+	struct auth_settings set;
+	struct test_call calls[1 + TEST_MAX_PIPELINED + 2];
+	struct test_worker *worker, *worker2;
+	unsigned int i;
+
+	test_begin("auth worker pipelining before starting new workers");
+	struct ioloop *ioloop = io_loop_create();
+	test_setup(N_ELEMENTS(calls), &set, &orig_set);
+	i_zero(&calls);
+
+	test_call(&calls[0], "PASSV\t1\tfirst");
+	test_run_until_requests(1);
+	worker = array_idx_elem(&test_workers, 0);
+	test_worker_reply(worker, 1);
+	test_run_until_replies();
+
+	/* The concurrent requests are pipelined to the existing worker until
+	   it's full. Only then a second worker is started, which gets the
+	   rest of them. Starting a new worker for each busy request would
+	   have used five workers. */
+	for (i = 1; i < N_ELEMENTS(calls); i++) {
+		test_call(&calls[i],
+			  p_strdup_printf(test_pool, "PASSV\t1\t%u", i));
+	}
+	test_run_until_requests(N_ELEMENTS(calls));
+	test_assert(array_count(&test_workers) == 2);
+	worker2 = array_idx_elem(&test_workers, 1);
+	test_assert(test_worker_request_count(worker) ==
+		    1 + TEST_MAX_PIPELINED);
+	test_assert(test_worker_request_count(worker2) == 2);
+
+	test_worker_reply_all(worker);
+	test_worker_reply_all(worker2);
+	test_run_until_replies();
+	for (i = 0; i < N_ELEMENTS(calls); i++)
+		test_assert_idx(calls[i].reply_count == 1, i);
+
+	test_teardown(orig_set);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_auth_worker_pipeline_replies,
+		test_auth_worker_pipeline_before_new_worker,
+		NULL
+	};
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_STD_CLIENT |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	int ret;
+
+	master_service = master_service_init("test-auth-worker-connection",
+					     service_flags, &argc, &argv, "");
+	master_service_init_finish(master_service);
+
+	ret = test_run(test_functions);
+
+	master_service_deinit(&master_service);
+	return ret;
+}
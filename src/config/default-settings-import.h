@@ -11,6 +11,11 @@ static const char *stats_metric_defaults =
 "  group_by reason {\n"
 "  }\n"
 "}\n"
+"metric ssl_server_handshakes {\n"
+"  filter = event=ssl_server_handshake_finished\n"
+"  group_by session_reused {\n"
+"  }\n"
+"}\n"
 "}\n"
 
 "group @metric_defaults backend {\n"
@@ -52,7 +52,7 @@ indexer_send_cmd_with_args(const char *cmd, const char *const *args)
 
 static void cmd_indexer_add(struct doveadm_cmd_context *cctx)
 {
-	const char *user, *mailbox, *line;
+	const char *user, *mailbox, *priority, *line;
 	int64_t max_recent;
 	bool head;
 
@@ -60,13 +60,17 @@ static void cmd_indexer_add(struct doveadm_cmd_context *cctx)
 		head = FALSE;
 	if (!doveadm_cmd_param_int64(cctx, "max-recent", &max_recent))
 		max_recent = 0;
+	if (!doveadm_cmd_param_str(cctx, "priority", &priority))
+		priority = NULL;
 	if (!doveadm_cmd_param_str(cctx, "user", &user) ||
 	    !doveadm_cmd_param_str(cctx, "mailbox", &mailbox))
 		help_ver2(&doveadm_cmd_indexer_add);
 
+	/* without an explicit priority, PREPEND is handled as interactive
+	   and APPEND as background */
 	const char *cmd = head ? "PREPEND" : "APPEND";
 	const char *const args[] = {
-		"0", user, mailbox, dec2str(max_recent),
+		"0", user, mailbox, dec2str(max_recent), "", priority,
 		NULL
 	};
 	struct istream *input = indexer_send_cmd_with_args(cmd, args);
@@ -107,7 +111,7 @@ static int cmd_indexer_list_print(const char *const *args)
 		return -1;
 
 	/* <tag> <username> <mailbox> <session-id> <max-recent-msgs> <type>
-	   <flags> */
+	   <flags> [<priority>] */
 	doveadm_print(args[1]);
 	doveadm_print(args[2]);
 	doveadm_print(args[3]);
@@ -131,13 +135,66 @@ static int cmd_indexer_list_print(const char *const *args)
 		doveadm_print("working/tail-queued");
 	else
 		doveadm_print("working");
+	doveadm_print(args[7] != NULL ? args[7] : "");
 	return 0;
 }
 
+static void cmd_indexer_list_stats(const char *const *args)
+{
+	uint64_t started, wait_usecs;
+
+	/* <tag> <priority> <queued> <users> <working> <started> <wait usecs> */
+	if (str_array_length(args) < 7 ||
+	    str_to_uint64(args[5], &started) < 0 ||
+	    str_to_uint64(args[6], &wait_usecs) < 0)
+		i_fatal("Unexpected input: %s", t_strarray_join(args, "\t"));
+
+	doveadm_print(args[1]);
+	doveadm_print(args[2]);
+	doveadm_print(args[3]);
+	doveadm_print(args[4]);
+	doveadm_print(args[5]);
+	doveadm_print(dec2str(started == 0 ? 0 :
+			      wait_usecs / started / 1000));
+}
+
+static void cmd_indexer_stats(void)
+{
+	const char *line;
+	const char *const args[] = { "0", NULL };
+	struct istream *input = indexer_send_cmd_with_args("STATS", args);
+
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	doveadm_print_header_simple("priority");
+	doveadm_print_header_simple("queued");
+	doveadm_print_header_simple("users");
+	doveadm_print_header_simple("working");
+	doveadm_print_header_simple("started");
+	doveadm_print_header_simple("avg_wait_msecs");
+
+	alarm(5);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (strcmp(line, "0") == 0)
+			break;
+		T_BEGIN {
+			cmd_indexer_list_stats(t_strsplit_tabescaped(line));
+		} T_END;
+	}
+	if (line == NULL)
+		i_fatal("read(indexer) failed: %s", i_stream_get_error(input));
+	alarm(0);
+	i_stream_destroy(&input);
+}
+
 static void cmd_indexer_list(struct doveadm_cmd_context *cctx)
 {
 	const char *line, *user_mask;
+	bool stats;
 
+	if (doveadm_cmd_param_bool(cctx, "stats", &stats) && stats) {
+		cmd_indexer_stats();
+		return;
+	}
 	if (!doveadm_cmd_param_str(cctx, "user-mask", &user_mask))
 		user_mask = NULL;
 
@@ -151,6 +208,7 @@ static void cmd_indexer_list(struct doveadm_cmd_context *cctx)
 	doveadm_print_header_simple("max_recent");
 	doveadm_print_header_simple("type");
 	doveadm_print_header_simple("status");
+	doveadm_print_header_simple("priority");
 
 	alarm(30);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
@@ -171,10 +229,11 @@ static void cmd_indexer_list(struct doveadm_cmd_context *cctx)
 struct doveadm_cmd_ver2 doveadm_cmd_indexer_add = {
 	.cmd = cmd_indexer_add,
 	.name = "indexer add",
-	.usage = "[-h] [-n <max recent>] <user> <mailbox>",
+	.usage = "[-h] [-n <max recent>] [-p interactive|delivery|background] <user> <mailbox>",
 DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_PARAM('h', "head", CMD_PARAM_BOOL, 0)
 DOVEADM_CMD_PARAM('n', "max-recent", CMD_PARAM_STR, 0)
+DOVEADM_CMD_PARAM('p', "priority", CMD_PARAM_STR, 0)
 DOVEADM_CMD_PARAM('\0', "user", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
@@ -193,8 +252,9 @@ DOVEADM_CMD_PARAMS_END
 struct doveadm_cmd_ver2 doveadm_cmd_indexer_list = {
 	.cmd = cmd_indexer_list,
 	.name = "indexer list",
-	.usage = "[<user mask>]",
+	.usage = "[-s] [<user mask>]",
 DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_PARAM('s', "stats", CMD_PARAM_BOOL, 0)
 DOVEADM_CMD_PARAM('\0', "user-mask", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
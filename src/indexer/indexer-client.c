@@ -1,6 +1,7 @@
 /* Copyright (c) 2011-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "connection.h"
 #include "istream.h"
 #include "ostream.h"
@@ -41,8 +42,14 @@ indexer_client_request_queue(struct indexer_client *client, bool append,
 	struct indexer_client_request *ctx = NULL;
 	const char *session_id = NULL;
 	unsigned int tag, max_recent_msgs;
-
-	/* <tag> <user> <mailbox> [<max_recent_msgs> [<session ID>]] */
+	/* PREPEND is used when the client is waiting for the indexing to
+	   finish. Others can give the priority explicitly. */
+	enum indexer_request_priority priority = append ?
+		INDEXER_REQUEST_PRIORITY_BACKGROUND :
+		INDEXER_REQUEST_PRIORITY_INTERACTIVE;
+
+	/* <tag> <user> <mailbox> [<max_recent_msgs> [<session ID>
+	   [<priority>]]] */
 	if (str_array_length(args) < 3) {
 		*error_r = "Wrong parameter count";
 		return -1;
@@ -56,8 +63,13 @@ indexer_client_request_queue(struct indexer_client *client, bool append,
 	else if (str_to_uint(args[3], &max_recent_msgs) < 0) {
 		*error_r = "Invalid max_recent_msgs";
 		return -1;
-	} else {
-		session_id = args[4];
+	} else if (args[4] != NULL) {
+		session_id = args[4][0] == '\0' ? NULL : args[4];
+		if (args[5] != NULL &&
+		    indexer_request_priority_parse(args[5], &priority) < 0) {
+			*error_r = "Invalid priority";
+			return -1;
+		}
 	}
 
 	if (tag != 0) {
@@ -67,7 +79,7 @@ indexer_client_request_queue(struct indexer_client *client, bool append,
 		indexer_client_ref(client);
 	}
 
-	indexer_queue_append(client->queue, append, args[1], args[2],
+	indexer_queue_append(client->queue, append, priority, args[1], args[2],
 			     session_id, max_recent_msgs, ctx);
 	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\tOK\n", tag));
 	return 0;
@@ -123,16 +135,26 @@ indexer_client_request_remove(struct indexer_client *client,
 	if (wildcard_is_literal(user_mask))
 		indexer_queue_cancel(client->queue, user_mask, mailbox_mask);
 	else {
+		/* Cancelling frees the requests, so find the users first */
+		ARRAY_TYPE(const_string) usernames;
 		struct indexer_request *request;
 		struct indexer_queue_iter *iter =
 			indexer_queue_iter_init(client->queue, FALSE);
+		t_array_init(&usernames, 8);
 		while ((request = indexer_queue_iter_next(iter)) != NULL) {
 			if (wildcard_match(request->username, user_mask)) {
-				indexer_queue_cancel(client->queue,
-					request->username, mailbox_mask);
+				const char *username =
+					t_strdup(request->username);
+				array_push_back(&usernames, &username);
 			}
 		}
 		indexer_queue_iter_deinit(&iter);
+
+		const char *username;
+		array_foreach_elem(&usernames, username) {
+			indexer_queue_cancel(client->queue, username,
+					     mailbox_mask);
+		}
 	}
 	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\tOK\n", tag));
 	return 0;
@@ -164,6 +186,8 @@ indexer_client_request_list_write(string_t *str,
 		str_append_c(str, 'h');
 	if (request->reindex_tail)
 		str_append_c(str, 't');
+	str_append_c(str, '\t');
+	str_append(str, indexer_request_priority_to_str(request->priority));
 }
 
 static int
@@ -215,6 +239,38 @@ indexer_client_request_list(struct indexer_client *client,
 	return 0;
 }
 
+static int
+indexer_client_request_stats(struct indexer_client *client,
+			     const char *const *args, const char **error_r)
+{
+	struct indexer_queue_stats stats;
+	unsigned int tag;
+
+	/* <tag> */
+	if (str_array_length(args) < 1) {
+		*error_r = "Wrong parameter count";
+		return -1;
+	}
+	if (str_to_uint(args[0], &tag) < 0) {
+		*error_r = "Invalid tag";
+		return -1;
+	}
+
+	/* <tag> <priority> <queued> <users> <working> <started> <wait usecs> */
+	string_t *str = t_str_new(128);
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		indexer_queue_get_stats(client->queue, i, &stats);
+		str_truncate(str, 0);
+		str_printfa(str, "%u\t%s\t%u\t%u\t%u\t%"PRIu64"\t%"PRIu64"\n",
+			    tag, indexer_request_priority_to_str(i),
+			    stats.queued, stats.users, stats.working,
+			    stats.started, stats.wait_usecs);
+		o_stream_nsend(client->conn.output, str_data(str), str_len(str));
+	}
+	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\n", tag));
+	return 0;
+}
+
 static int
 indexer_client_request(struct indexer_client *client,
 		       const char *const *args, const char **error_r)
@@ -233,6 +289,8 @@ indexer_client_request(struct indexer_client *client,
 		return indexer_client_request_remove(client, args, error_r);
 	else if (strcmp(cmd, "LIST") == 0)
 		return indexer_client_request_list(client, args, error_r);
+	else if (strcmp(cmd, "STATS") == 0)
+		return indexer_client_request_stats(client, args, error_r);
 	else {
 		*error_r = t_strconcat("Unknown command: ", cmd, NULL);
 		return -1;
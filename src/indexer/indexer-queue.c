@@ -2,29 +2,72 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "llist.h"
 #include "hash.h"
+#include "time-util.h"
 #include "wildcard-match.h"
 #include "indexer-queue.h"
 
+/* How many requests a user can get started during its turn, if other users
+   are waiting in the same priority class. */
+#define INDEXER_QUEUE_USER_TURN_MAX_REQUESTS 8
+
+struct indexer_queue_user_class {
+	/* Linked list of users having queued requests in this priority class,
+	   in the order of their turns */
+	struct indexer_queue_user_class *prev, *next;
+	struct indexer_queue_user *user;
+
+	/* The user's queued requests in this priority class */
+	struct indexer_request *head, *tail;
+};
+
+struct indexer_queue_user {
+	char *username;
+	/* All of the user's requests, including the ones being worked on */
+	struct indexer_request *requests;
+	/* Number of requests currently being worked on */
+	unsigned int working_count;
+	/* Number of requests started during the user's current turn */
+	unsigned int turn_count;
+
+	struct indexer_queue_user_class classes[INDEXER_REQUEST_PRIORITY_COUNT];
+};
+
+struct indexer_queue_class {
+	struct indexer_queue_user_class *head, *tail;
+	struct indexer_queue_stats stats;
+};
+
 struct indexer_queue {
 	indexer_queue_callback_t *callback;
 	void (*listen_callback)(struct indexer_queue *);
 
 	/* username+mailbox -> indexer_request */
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
-	/* username -> indexer_request */
-	HASH_TABLE(char *, struct indexer_request *) users;
-	struct indexer_request *head, *tail;
+	/* username -> indexer_queue_user */
+	HASH_TABLE(char *, struct indexer_queue_user *) users;
+	struct indexer_queue_class classes[INDEXER_REQUEST_PRIORITY_COUNT];
 };
 
 struct indexer_queue_iter {
 	struct indexer_queue *queue;
 	struct hash_iterate_context *hash_iter;
+	enum indexer_request_priority priority;
+	struct indexer_queue_user_class *user_class;
 	struct indexer_request *next;
 	bool only_working;
 };
 
+static const char *const indexer_request_priority_names[] = {
+	"interactive",
+	"delivery",
+	"background",
+};
+static_assert_array_size(indexer_request_priority_names,
+			 INDEXER_REQUEST_PRIORITY_COUNT);
+
 static unsigned int
 indexer_request_hash(const struct indexer_request *request)
 {
@@ -72,6 +115,25 @@ void indexer_queue_set_listen_callback(struct indexer_queue *queue,
 	queue->listen_callback = callback;
 }
 
+const char *
+indexer_request_priority_to_str(enum indexer_request_priority priority)
+{
+	i_assert(priority < INDEXER_REQUEST_PRIORITY_COUNT);
+	return indexer_request_priority_names[priority];
+}
+
+int indexer_request_priority_parse(const char *str,
+				   enum indexer_request_priority *priority_r)
+{
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		if (strcmp(indexer_request_priority_names[i], str) == 0) {
+			*priority_r = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
 static struct indexer_request *
 indexer_queue_lookup(struct indexer_queue *queue,
 		     const char *username, const char *mailbox)
@@ -83,6 +145,76 @@ indexer_queue_lookup(struct indexer_queue *queue,
 	return hash_table_lookup(queue->requests, &lookup_request);
 }
 
+static struct indexer_queue_user *
+indexer_queue_user_get(struct indexer_queue *queue, const char *username)
+{
+	struct indexer_queue_user *user;
+
+	user = hash_table_lookup(queue->users, username);
+	if (user != NULL)
+		return user;
+
+	user = i_new(struct indexer_queue_user, 1);
+	user->username = i_strdup(username);
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++)
+		user->classes[i].user = user;
+	hash_table_insert(queue->users, user->username, user);
+	return user;
+}
+
+static void
+indexer_queue_user_free(struct indexer_queue *queue,
+			struct indexer_queue_user *user)
+{
+	i_assert(user->requests == NULL);
+	i_assert(user->working_count == 0);
+
+	hash_table_remove(queue->users, user->username);
+	i_free(user->username);
+	i_free(user);
+}
+
+static void
+indexer_queue_request_enqueue(struct indexer_queue *queue,
+			      struct indexer_request *request, bool append)
+{
+	struct indexer_queue_class *class = &queue->classes[request->priority];
+	struct indexer_queue_user_class *user_class =
+		&request->user->classes[request->priority];
+
+	if (user_class->head == NULL) {
+		/* the user gets its turn after the other waiting users */
+		DLLIST2_APPEND(&class->head, &class->tail, user_class);
+		class->stats.users++;
+	}
+	if (append)
+		DLLIST2_APPEND(&user_class->head, &user_class->tail, request);
+	else
+		DLLIST2_PREPEND(&user_class->head, &user_class->tail, request);
+	request->queued_time = ioloop_timeval;
+	class->stats.queued++;
+}
+
+static void
+indexer_queue_request_dequeue(struct indexer_queue *queue,
+			      struct indexer_request *request)
+{
+	struct indexer_queue_class *class = &queue->classes[request->priority];
+	struct indexer_queue_user_class *user_class =
+		&request->user->classes[request->priority];
+
+	i_assert(!request->working);
+
+	DLLIST2_REMOVE(&user_class->head, &user_class->tail, request);
+	i_assert(class->stats.queued > 0);
+	class->stats.queued--;
+	if (user_class->head == NULL) {
+		DLLIST2_REMOVE(&class->head, &class->tail, user_class);
+		i_assert(class->stats.users > 0);
+		class->stats.users--;
+	}
+}
+
 static void request_add_context(struct indexer_request *request, void *context)
 {
 	if (context == NULL)
@@ -95,12 +227,15 @@ static void request_add_context(struct indexer_request *request, void *context)
 
 static struct indexer_request *
 indexer_queue_append_request(struct indexer_queue *queue, bool append,
+			     enum indexer_request_priority priority,
 			     const char *username, const char *mailbox,
 			     const char *session_id,
 			     unsigned int max_recent_msgs, void *context)
 {
-	struct indexer_request *request, *first_request;
-	char *first_username;
+	struct indexer_request *request;
+	struct indexer_queue_user *user;
+
+	i_assert(priority < INDEXER_REQUEST_PRIORITY_COUNT);
 
 	request = indexer_queue_lookup(queue, username, mailbox);
 	if (request != NULL) {
@@ -113,40 +248,44 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 				request->reindex_tail = TRUE;
 			else
 				request->reindex_head = TRUE;
-		} else {
-			if (append) {
-				/* keep the request in its old position */
-			} else {
-				/* move request to beginning of the queue */
-				DLLIST2_REMOVE(&queue->head, &queue->tail, request);
-				DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+			if (request->priority > priority) {
+				queue->classes[request->priority].stats.working--;
+				queue->classes[priority].stats.working++;
+				request->priority = priority;
 			}
+		} else if (request->priority > priority) {
+			/* move the request to the higher priority class */
+			indexer_queue_request_dequeue(queue, request);
+			request->priority = priority;
+			indexer_queue_request_enqueue(queue, request, append);
+		} else if (append) {
+			/* keep the request in its old position */
+		} else {
+			/* move request to the beginning of the user's
+			   queue */
+			struct indexer_queue_user_class *user_class =
+				&request->user->classes[request->priority];
+			DLLIST2_REMOVE(&user_class->head, &user_class->tail,
+				       request);
+			DLLIST2_PREPEND(&user_class->head, &user_class->tail,
+					request);
 		}
 		return request;
 	}
 
+	user = indexer_queue_user_get(queue, username);
 	request = i_new(struct indexer_request, 1);
+	request->user = user;
 	request->username = i_strdup(username);
 	request->mailbox = i_strdup(mailbox);
 	request->session_id = i_strdup(session_id);
 	request->max_recent_msgs = max_recent_msgs;
+	request->priority = priority;
 	request_add_context(request, context);
 	hash_table_insert(queue->requests, request, request);
 
-	if (!hash_table_lookup_full(queue->users, username,
-				    &first_username, &first_request)) {
-		first_username = i_strdup(username);
-		hash_table_insert(queue->users, first_username, request);
-	} else {
-		DLLIST_PREPEND_FULL(&first_request, request,
-				    user_prev, user_next);
-		hash_table_update(queue->users, first_username, request);
-	}
-
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	DLLIST_PREPEND_FULL(&user->requests, request, user_prev, user_next);
+	indexer_queue_request_enqueue(queue, request, append);
 	return request;
 }
 
@@ -158,13 +297,15 @@ static void indexer_queue_append_finish(struct indexer_queue *queue)
 }
 
 void indexer_queue_append(struct indexer_queue *queue, bool append,
+			  enum indexer_request_priority priority,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context)
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, append, username, mailbox,
+	request = indexer_queue_append_request(queue, append, priority,
+					       username, mailbox,
 					       session_id, max_recent_msgs,
 					       context);
 	request->type = INDEXER_REQUEST_TYPE_INDEX;
@@ -177,24 +318,110 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
+	request = indexer_queue_append_request(queue, TRUE,
+					       INDEXER_REQUEST_PRIORITY_BACKGROUND,
+					       username, mailbox,
 					       NULL, 0, context);
 	request->type = INDEXER_REQUEST_TYPE_OPTIMIZE;
 	indexer_queue_append_finish(queue);
 }
 
+static struct indexer_queue_user_class *
+indexer_queue_find_next(struct indexer_queue *queue,
+			const struct indexer_queue_user *skip_user)
+{
+	struct indexer_queue_user_class *user_class;
+
+	/* Skip users who are already being worked on. Their requests are
+	   continued via indexer_queue_request_remove_user(). There can be only
+	   as many of them as there are workers. */
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		user_class = queue->classes[i].head;
+		for (; user_class != NULL; user_class = user_class->next) {
+			if (user_class->user->working_count == 0 &&
+			    user_class->user != skip_user)
+				return user_class;
+		}
+	}
+	return NULL;
+}
+
+static void
+indexer_queue_user_class_move_to_tail(struct indexer_queue *queue,
+				      struct indexer_queue_user *user,
+				      enum indexer_request_priority priority)
+{
+	struct indexer_queue_class *class = &queue->classes[priority];
+	struct indexer_queue_user_class *user_class = &user->classes[priority];
+
+	if (user_class->head != NULL) {
+		/* the rest of the requests wait for the user's next turn */
+		DLLIST2_REMOVE(&class->head, &class->tail, user_class);
+		DLLIST2_APPEND(&class->head, &class->tail, user_class);
+	}
+}
+
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
 {
-	return queue->head;
+	struct indexer_queue_user_class *user_class =
+		indexer_queue_find_next(queue, NULL);
+
+	return user_class == NULL ? NULL : user_class->head;
 }
 
 void indexer_queue_request_remove(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_queue_user_class *user_class =
+		indexer_queue_find_next(queue, NULL);
+	struct indexer_request *request;
+
+	i_assert(user_class != NULL);
 
-	i_assert(request != NULL);
+	request = user_class->head;
+	indexer_queue_request_dequeue(queue, request);
+	indexer_queue_user_class_move_to_tail(queue, request->user,
+					      request->priority);
+	request->user->turn_count = 1;
+}
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+struct indexer_request *
+indexer_queue_request_remove_user(struct indexer_queue *queue,
+				  const char *username)
+{
+	struct indexer_queue_user *user;
+	struct indexer_queue_user_class *next;
+	struct indexer_request *request = NULL;
+
+	user = hash_table_lookup(queue->users, username);
+	if (user == NULL)
+		return NULL;
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		if (user->classes[i].head != NULL) {
+			request = user->classes[i].head;
+			break;
+		}
+	}
+	if (request == NULL)
+		return NULL;
+
+	next = indexer_queue_find_next(queue, user);
+	if (next != NULL) {
+		/* someone else is waiting for a worker */
+		enum indexer_request_priority next_priority =
+			next->head->priority;
+		if (next_priority < request->priority)
+			return NULL;
+		if (next_priority == request->priority &&
+		    user->turn_count >= INDEXER_QUEUE_USER_TURN_MAX_REQUESTS) {
+			indexer_queue_user_class_move_to_tail(queue, user,
+							      request->priority);
+			return NULL;
+		}
+	}
+	indexer_queue_request_dequeue(queue, request);
+	indexer_queue_user_class_move_to_tail(queue, user, request->priority);
+	user->turn_count++;
+	return request;
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -220,26 +447,57 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 
 void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_queue_user_class *user_class =
+		indexer_queue_find_next(queue, NULL);
 
-	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
+	i_assert(user_class != NULL);
+	indexer_queue_user_class_move_to_tail(queue, user_class->user,
+					      user_class->head->priority);
 }
 
-void indexer_queue_request_work(struct indexer_request *request)
+void indexer_queue_request_work(struct indexer_queue *queue,
+				struct indexer_request *request)
 {
+	struct indexer_queue_stats *stats =
+		&queue->classes[request->priority].stats;
+
+	i_assert(!request->working);
+
 	request->working = TRUE;
 	request->working_context_idx =
 		!array_is_created(&request->contexts) ? 0 :
 		array_count(&request->contexts);
+	request->user->working_count++;
+
+	stats->working++;
+	stats->started++;
+	long long wait_usecs =
+		timeval_diff_usecs(&ioloop_timeval, &request->queued_time);
+	if (wait_usecs > 0)
+		stats->wait_usecs += wait_usecs;
+}
+
+static void
+indexer_queue_request_unwork(struct indexer_queue *queue,
+			     struct indexer_request *request)
+{
+	struct indexer_queue_stats *stats =
+		&queue->classes[request->priority].stats;
+
+	i_assert(stats->working > 0);
+	i_assert(request->user->working_count > 0);
+
+	request->working = FALSE;
+	request->user->working_count--;
+	stats->working--;
 }
 
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **_request,
 				  enum indexer_state state)
 {
-	struct indexer_request *first_request, *request = *_request;
-	char *first_username;
+	struct indexer_request *request = *_request;
+	struct indexer_queue_user *user = request->user;
 
 	*_request = NULL;
 
@@ -249,30 +507,23 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 
 	if (request->reindex_head || request->reindex_tail) {
 		i_assert(request->working);
-		request->working = FALSE;
+		indexer_queue_request_unwork(queue, request);
 		if (request->working_context_idx > 0) {
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		indexer_queue_request_enqueue(queue, request,
+					      !request->reindex_head);
 		request->reindex_head = FALSE;
 		request->reindex_tail = FALSE;
 		return;
 	}
 
-	if (!hash_table_lookup_full(queue->users, request->username,
-				    &first_username, &first_request))
-		i_unreached();
-	DLLIST_REMOVE_FULL(&first_request, request, user_prev, user_next);
-	if (first_request != NULL)
-		hash_table_update(queue->users, first_username, first_request);
-	else {
-		hash_table_remove(queue->users, first_username);
-		i_free(first_username);
-	}
+	if (request->working)
+		indexer_queue_request_unwork(queue, request);
+	DLLIST_REMOVE_FULL(&user->requests, request, user_prev, user_next);
+	if (user->requests == NULL)
+		indexer_queue_user_free(queue, user);
 	hash_table_remove(queue->requests, request);
 	if (array_is_created(&request->contexts))
 		array_free(&request->contexts);
@@ -292,21 +543,24 @@ indexer_queue_request_cancel(struct indexer_queue *queue,
 
 	*_request = NULL;
 	request->reindex_head = request->reindex_tail = FALSE;
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_request_dequeue(queue, request);
 	indexer_queue_request_finish(queue, &request, INDEXER_STATE_FAILED);
 }
 
 void indexer_queue_cancel(struct indexer_queue *queue, const char *username,
 			  const char *mailbox_mask)
 {
+	struct indexer_queue_user *user;
 	struct indexer_request *request, *next;
 	bool single_mailbox =
 		mailbox_mask != NULL && wildcard_is_literal(mailbox_mask);
 
 	if (single_mailbox)
 		request = indexer_queue_lookup(queue, username, mailbox_mask);
-	else
-		request = hash_table_lookup(queue->users, username);
+	else {
+		user = hash_table_lookup(queue->users, username);
+		request = user == NULL ? NULL : user->requests;
+	}
 
 	while (request != NULL) {
 		next = request->user_next;
@@ -340,13 +594,21 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 		request->reindex_head = request->reindex_tail = FALSE;
 	hash_table_iterate_deinit(&iter);
 
-	while ((request = indexer_queue_request_peek(queue)) != NULL)
-		indexer_queue_request_cancel(queue, &request);
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		while (queue->classes[i].head != NULL) {
+			request = queue->classes[i].head->head;
+			indexer_queue_request_cancel(queue, &request);
+		}
+	}
 }
 
 bool indexer_queue_is_empty(struct indexer_queue *queue)
 {
-	return queue->head == NULL;
+	for (unsigned int i = 0; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		if (queue->classes[i].head != NULL)
+			return FALSE;
+	}
+	return TRUE;
 }
 
 unsigned int indexer_queue_count(struct indexer_queue *queue)
@@ -354,6 +616,14 @@ unsigned int indexer_queue_count(struct indexer_queue *queue)
 	return hash_table_count(queue->requests);
 }
 
+void indexer_queue_get_stats(struct indexer_queue *queue,
+			     enum indexer_request_priority priority,
+			     struct indexer_queue_stats *stats_r)
+{
+	i_assert(priority < INDEXER_REQUEST_PRIORITY_COUNT);
+	*stats_r = queue->classes[priority].stats;
+}
+
 struct indexer_queue_iter *
 indexer_queue_iter_init(struct indexer_queue *queue, bool only_working)
 {
@@ -383,11 +653,23 @@ struct indexer_request *indexer_queue_iter_next(struct indexer_queue_iter *iter)
 		hash_table_iterate_deinit(&iter->hash_iter);
 		if (iter->only_working)
 			return NULL;
-		iter->next = indexer_queue_request_peek(iter->queue);
+		iter->user_class = iter->queue->classes[0].head;
+		iter->next = iter->user_class == NULL ? NULL :
+			iter->user_class->head;
+	}
+	while (iter->next == NULL) {
+		if (iter->user_class != NULL)
+			iter->user_class = iter->user_class->next;
+		while (iter->user_class == NULL) {
+			if (++iter->priority >= INDEXER_REQUEST_PRIORITY_COUNT)
+				return NULL;
+			iter->user_class =
+				iter->queue->classes[iter->priority].head;
+		}
+		iter->next = iter->user_class->head;
 	}
 	request = iter->next;
-	if (request != NULL)
-		iter->next = request->next;
+	iter->next = request->next;
 	return request;
 }
 
@@ -13,11 +13,39 @@ enum indexer_request_type {
 	INDEXER_REQUEST_TYPE_OPTIMIZE,
 };
 
+/* Requests of a higher priority class are always started before requests of
+   a lower class. Within the same class the users take turns. */
+enum indexer_request_priority {
+	/* a client is waiting for the indexing to finish (e.g. IMAP SEARCH) */
+	INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+	/* new mails were delivered or saved to the mailbox */
+	INDEXER_REQUEST_PRIORITY_DELIVERY,
+	/* bulk indexing (e.g. doveadm index -q) */
+	INDEXER_REQUEST_PRIORITY_BACKGROUND,
+
+	INDEXER_REQUEST_PRIORITY_COUNT
+};
+
+struct indexer_queue_stats {
+	/* number of queued requests */
+	unsigned int queued;
+	/* number of users with queued requests */
+	unsigned int users;
+	/* number of requests currently being worked on */
+	unsigned int working;
+	/* number of requests started since the indexer was started */
+	uint64_t started;
+	/* total time the started requests spent in the queue */
+	uint64_t wait_usecs;
+};
+
 struct indexer_request {
-	/* Linked list of all requests - highest priority first */
+	/* Linked list of the user's queued requests in the same priority
+	   class - highest priority first */
 	struct indexer_request *prev, *next;
 	/* Linked list of the same username's requests */
 	struct indexer_request *user_prev, *user_next;
+	struct indexer_queue_user *user;
 
 	char *username;
 	char *mailbox;
@@ -25,6 +53,9 @@ struct indexer_request {
 	unsigned int max_recent_msgs;
 
 	enum indexer_request_type type;
+	enum indexer_request_priority priority;
+	/* when the request was (re)added to the queue */
+	struct timeval queued_time;
 
 	/* currently indexing this mailbox */
 	bool working:1;
@@ -48,7 +79,10 @@ void indexer_queue_deinit(struct indexer_queue **queue);
 void indexer_queue_set_listen_callback(struct indexer_queue *queue,
 				       void (*callback)(struct indexer_queue *));
 
+/* Add a request to the queue. If append=FALSE, the request is added before
+   the user's other requests in the same priority class. */
 void indexer_queue_append(struct indexer_queue *queue, bool append,
+			  enum indexer_request_priority priority,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context);
@@ -64,27 +98,51 @@ void indexer_queue_cancel_all(struct indexer_queue *queue);
 
 bool indexer_queue_is_empty(struct indexer_queue *queue);
 unsigned int indexer_queue_count(struct indexer_queue *queue);
-
-/* Return the next request from the queue, without removing it. */
+void indexer_queue_get_stats(struct indexer_queue *queue,
+			     enum indexer_request_priority priority,
+			     struct indexer_queue_stats *stats_r);
+
+const char *
+indexer_request_priority_to_str(enum indexer_request_priority priority);
+int indexer_request_priority_parse(const char *str,
+				   enum indexer_request_priority *priority_r);
+
+/* Return the next request from the queue, without removing it. This is the
+   highest priority class's request from the user whose turn it is. Users
+   that already have a request being worked on are skipped. */
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
-/* Remove the next request from the queue. You must call
-   indexer_queue_request_finish() to free its memory. */
+/* Remove the next request from the queue. This starts the user's turn and
+   moves the user after the other users in the same priority class. You must
+   call indexer_queue_request_finish() to free its memory. */
 void indexer_queue_request_remove(struct indexer_queue *queue);
+/* Remove the user's next queued request from the queue and return it, or
+   return NULL if the user has no queued requests or the user's turn is over.
+   The turn is over if other users have higher priority requests waiting, or
+   if the user has already used up its share of requests and other users
+   have requests waiting in the same priority class. You must call
+   indexer_queue_request_finish() to free its memory. */
+struct indexer_request *
+indexer_queue_request_remove_user(struct indexer_queue *queue,
+				  const char *username);
 /* Give a status update about how far the indexing is going on. */
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  const struct indexer_status *status);
-/* Move the next request to the end of the queue. */
+/* Move the next request's user after the other users in the same priority
+   class. */
 void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
 /* Start working on a request */
-void indexer_queue_request_work(struct indexer_request *request);
+void indexer_queue_request_work(struct indexer_queue *queue,
+				struct indexer_request *request);
 /* Finish the request and free its memory. */
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **request,
 				  enum indexer_state state);
 
 /* Iterate through all requests. First it returns the requests currently being
-   worked on, followed by the queued requests in the priority order. If
+   worked on, followed by the queued requests in the priority order (the
+   priority classes in order, and within each class the users in the order
+   of their turns). If
    only_working=TRUE, return only the requests currently being worked on. */
 struct indexer_queue_iter *
 indexer_queue_iter_init(struct indexer_queue *queue, bool only_working);
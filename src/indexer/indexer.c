@@ -15,6 +15,8 @@ static struct indexer_queue *queue;
 
 static void worker_status_callback(const struct indexer_status *status,
 				   struct indexer_request *request);
+static struct indexer_request *
+worker_next_request_callback(const char *username);
 static void worker_avail_callback(void);
 
 void indexer_refresh_proctitle(void)
@@ -43,10 +45,11 @@ static bool worker_send_request(struct indexer_request *request)
 {
 	if (worker_connection_try_create("indexer-worker", request,
 					 worker_status_callback,
+					 worker_next_request_callback,
 					 worker_avail_callback) <= 0)
 		return FALSE;
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	return TRUE;
 }
 
@@ -95,6 +98,17 @@ static void worker_status_callback(const struct indexer_status *status,
 	indexer_queue_request_finish(queue, &request, status->state);
 }
 
+static struct indexer_request *
+worker_next_request_callback(const char *username)
+{
+	struct indexer_request *request;
+
+	request = indexer_queue_request_remove_user(queue, username);
+	if (request != NULL)
+		indexer_queue_request_work(queue, request);
+	return request;
+}
+
 static void worker_avail_callback(void)
 {
 	/* A new worker became available. Try to shrink the queue. */
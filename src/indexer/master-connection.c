@@ -25,6 +25,14 @@
 #define INDEXER_MASTER_NAME "indexer-master-worker"
 #define INDEXER_WORKER_NAME "indexer-worker-master"
 
+/* Deinitialize the kept user if the indexer doesn't send its next request
+   within this time. */
+#define MASTER_CONNECTION_USER_IDLE_MSECS (10*1000)
+/* Reinitialize the kept user once its memory pool has grown this large, so
+   state accumulated while indexing many mailboxes doesn't keep growing.
+   The number of the user's requests is limited by the indexer's queue. */
+#define MASTER_CONNECTION_USER_MAX_POOL_SIZE (1024*1024)
+
 static struct event_category event_category_indexer_worker = {
 	.name = "indexer-worker",
 };
@@ -33,6 +41,17 @@ struct master_connection {
 	struct connection conn;
 	struct mail_storage_service_ctx *storage_service;
 
+	/* The indexer sends all the queued requests for the same user using
+	   the same connection, so the user is kept initialized until the
+	   connection is closed, a request for another user comes or one of
+	   the MASTER_CONNECTION_USER_* limits is reached. */
+	struct mail_user *user;
+	char *username, *session_id;
+	struct master_service_anvil_session anvil_session;
+	guid_128_t anvil_conn_guid;
+	struct timeout *to_user_idle;
+	bool anvil_sent;
+
 	bool version_received:1;
 };
 
@@ -45,6 +64,8 @@ indexer_worker_refresh_proctitle(const char *username, const char *mailbox,
 
 	if (username == NULL)
 		process_title_set("[idling]");
+	else if (mailbox == NULL)
+		process_title_set(t_strdup_printf("[%s]", username));
 	else if (seq1 == 0)
 		process_title_set(t_strdup_printf("[%s %s]", username, mailbox));
 	else {
@@ -292,16 +313,61 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 	return ret;
 }
 
+static void master_connection_user_deinit(struct master_connection *conn)
+{
+	timeout_remove(&conn->to_user_idle);
+	if (conn->user == NULL)
+		return;
+
+	/* refresh proctitle before a potentially long-running
+	   user unref */
+	indexer_worker_refresh_proctitle(conn->user->username, "(deinit)", 0, 0);
+	if (conn->anvil_sent) {
+		master_service_anvil_disconnect(master_service,
+						&conn->anvil_session,
+						conn->anvil_conn_guid);
+		conn->anvil_sent = FALSE;
+	}
+	mail_user_deinit(&conn->user);
+	i_free(conn->username);
+	i_free(conn->session_id);
+	indexer_worker_refresh_proctitle(NULL, NULL, 0, 0);
+}
+
+static void master_connection_user_idle_timeout(struct master_connection *conn)
+{
+	e_debug(conn->conn.event, "Deinitializing idle user %s",
+		conn->username);
+	master_connection_user_deinit(conn);
+}
+
+static void master_connection_user_finish(struct master_connection *conn)
+{
+	if (pool_alloconly_get_total_alloc_size(conn->user->pool) >=
+	    MASTER_CONNECTION_USER_MAX_POOL_SIZE) {
+		master_connection_user_deinit(conn);
+		return;
+	}
+	indexer_worker_refresh_proctitle(conn->user->username, NULL, 0, 0);
+	conn->to_user_idle = timeout_add(MASTER_CONNECTION_USER_IDLE_MSECS,
+					 master_connection_user_idle_timeout,
+					 conn);
+}
+
 static int
-master_connection_cmd_index(struct master_connection *conn,
-			    const char *username, const char *mailbox,
-			    const char *session_id,
-			    unsigned int max_recent_msgs, const char *what)
+master_connection_user_init(struct master_connection *conn,
+			    const char *username, const char *session_id)
 {
 	struct mail_storage_service_input input;
-	struct mail_user *user;
 	const char *error;
-	int ret;
+
+	timeout_remove(&conn->to_user_idle);
+	if (conn->user != NULL) {
+		if (strcmp(conn->username, username) == 0 &&
+		    strcmp(conn->session_id, session_id) == 0)
+			return 0;
+		master_connection_user_deinit(conn);
+	}
 
 	i_zero(&input);
 	input.service = "indexer-worker";
@@ -314,36 +380,43 @@ master_connection_cmd_index(struct master_connection *conn,
 		input.session_id_prefix = session_id;
 
 	if (mail_storage_service_lookup_next(conn->storage_service, &input,
-					     &user, &error) <= 0) {
+					     &conn->user, &error) <= 0) {
 		e_error(conn->conn.event, "User %s lookup failed: %s",
 			username, error);
 		return -1;
 	}
+	conn->username = i_strdup(username);
+	conn->session_id = i_strdup(session_id);
 
-	struct master_service_anvil_session anvil_session;
-	guid_128_t anvil_conn_guid;
-	bool anvil_sent = FALSE;
-	mail_user_get_anvil_session(user, &anvil_session);
-	if (master_service_anvil_connect(master_service, &anvil_session,
-					 TRUE, anvil_conn_guid))
-		anvil_sent = TRUE;
+	mail_user_get_anvil_session(conn->user, &conn->anvil_session);
+	if (master_service_anvil_connect(master_service, &conn->anvil_session,
+					 TRUE, conn->anvil_conn_guid))
+		conn->anvil_sent = TRUE;
+	return 0;
+}
+
+static int
+master_connection_cmd_index(struct master_connection *conn,
+			    const char *username, const char *mailbox,
+			    const char *session_id,
+			    unsigned int max_recent_msgs, const char *what)
+{
+	int ret;
+
+	if (master_connection_user_init(conn, username, session_id) < 0)
+		return -1;
 
-	indexer_worker_refresh_proctitle(user->username, mailbox, 0, 0);
+	indexer_worker_refresh_proctitle(conn->user->username, mailbox, 0, 0);
 	struct event_reason *reason =
 		event_reason_begin("indexer:index_mailbox");
-	ret = index_mailbox(conn, user, mailbox, max_recent_msgs, what);
+	ret = index_mailbox(conn, conn->user, mailbox, max_recent_msgs, what);
 	event_reason_end(&reason);
-	/* refresh proctitle before a potentially long-running
-	   user unref */
-	indexer_worker_refresh_proctitle(user->username, "(deinit)", 0, 0);
-
-	if (anvil_sent) {
-		master_service_anvil_disconnect(master_service, &anvil_session,
-						anvil_conn_guid);
+	if (ret < 0) {
+		/* the indexer disconnects after a failure */
+		master_connection_user_deinit(conn);
+	} else {
+		master_connection_user_finish(conn);
 	}
-
-	mail_user_deinit(&user);
-	indexer_worker_refresh_proctitle(NULL, NULL, 0, 0);
 	return ret;
 }
 
@@ -378,8 +451,12 @@ master_connection_input_args(struct connection *_conn, const char *const *args)
 
 static void master_connection_destroy(struct connection *connection)
 {
+	struct master_connection *conn =
+		container_of(connection, struct master_connection, conn);
+
+	master_connection_user_deinit(conn);
 	connection_deinit(connection);
-	i_free(connection);
+	i_free(conn);
 	master_service_client_connection_destroyed(master_service);
 }
 
@@ -4,6 +4,8 @@
 #include "test-common.h"
 #include "indexer-queue.h"
 
+#define BG INDEXER_REQUEST_PRIORITY_BACKGROUND
+
 void indexer_refresh_proctitle(void) { }
 
 static void
@@ -20,25 +22,26 @@ static void test_indexer_queue(void)
 	test_begin("indexer queue");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
 
 	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->username, "user1");
-	test_assert_strcmp(request->mailbox, "mailbox1");
+	test_assert_strcmp(request->username, "user2");
+	test_assert_strcmp(request->mailbox, "mailbox2");
 
 	indexer_queue_move_head_to_tail(queue);
 
+	/* users take turns */
 	struct {
 		const char *username;
 		const char *mailbox;
 	} expected[] = {
+		{ "user1", "mailbox1" },
 		{ "user2", "mailbox2" },
-		{ "user2", "mailbox3" },
 		{ "user1", "mailbox4" },
-		{ "user1", "mailbox1" },
+		{ "user2", "mailbox3" },
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
 		request = indexer_queue_request_peek(queue);
@@ -62,8 +65,8 @@ static void test_indexer_queue_repeated_prepend(void)
 	test_begin("indexer queue");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
 
 	test_assert_cmp(indexer_queue_count(queue), ==, 1);
 
@@ -86,19 +89,19 @@ static void test_indexer_queue_reindex(void)
 	test_begin("indexer queue reindex");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox2", "session2", 0, NULL);
 
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "mailbox1");
 
 	/* start working on the request */
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	test_assert(request->working);
 
 	/* prepend another request to the same mailbox */
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_head);
 
 	/* finish the request, and it should now be at the head again */
@@ -109,9 +112,9 @@ static void test_indexer_queue_reindex(void)
 
 	/* start working on the request again */
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
+	indexer_queue_request_work(queue, request);
 	/* append another request to the same mailbox */
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_tail);
 
 	/* finish the request, and it should now be at the tail again */
@@ -141,10 +144,10 @@ static void test_indexer_queue_cancel(void)
 	test_begin("indexer queue cancel");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
 
 	/* try to cancel nonexistent user */
 	indexer_queue_cancel(queue, "user-none", "mailbox1");
@@ -153,7 +156,7 @@ static void test_indexer_queue_cancel(void)
 
 	test_assert(indexer_queue_count(queue) == 4);
 	request = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request->mailbox, "mailbox1");
+	test_assert_strcmp(request->mailbox, "mailbox2");
 
 	/* cancel user1's all requests */
 	indexer_queue_cancel(queue, "user1", NULL);
@@ -172,11 +175,11 @@ static void test_indexer_queue_cancel(void)
 	test_assert(indexer_queue_request_peek(queue) == NULL);
 
 	/* cancelling a working request should just drop the reindex-flag */
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", "session1", 0, NULL);
 	request = indexer_queue_request_peek(queue);
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_request_work(queue, request);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", "session1", 0, NULL);
 	test_assert(request->reindex_tail);
 	indexer_queue_cancel(queue, "user1", NULL);
 	test_assert(!request->reindex_tail);
@@ -184,9 +187,9 @@ static void test_indexer_queue_cancel(void)
 	test_assert(indexer_queue_request_peek(queue) == NULL);
 
 	/* test cancelling mailbox wildcards */
-	indexer_queue_append(queue, TRUE, "user1", "testbox1", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "testbox2", "session1", 0, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "notbox", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "testbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "testbox2", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "notbox", "session1", 0, NULL);
 	indexer_queue_cancel(queue, "user1", "testbox*");
 	request = indexer_queue_request_peek(queue);
 	test_assert_strcmp(request->mailbox, "notbox");
@@ -206,23 +209,26 @@ static void test_indexer_queue_iter(void)
 	test_begin("indexer queue iter");
 	queue = indexer_queue_init(indexer_queue_status_callback);
 
-	indexer_queue_append(queue, TRUE, "user2", "mailbox3", "session3", 50, NULL);
-	indexer_queue_append(queue, TRUE, "user1", "mailbox4", "session4", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user2", "mailbox2", "session2", 0, NULL);
-	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox3", "session3", 50, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox4", "session4", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, FALSE, BG, "user1", "mailbox1", "session1", 0, NULL);
 
 	/* start working on the first two requests */
 	request1 = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request1->username, "user1");
-	test_assert_strcmp(request1->mailbox, "mailbox1");
+	test_assert_strcmp(request1->username, "user2");
+	test_assert_strcmp(request1->mailbox, "mailbox2");
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request1);
+	indexer_queue_request_work(queue, request1);
 
 	request2 = indexer_queue_request_peek(queue);
-	test_assert_strcmp(request2->username, "user2");
-	test_assert_strcmp(request2->mailbox, "mailbox2");
+	test_assert_strcmp(request2->username, "user1");
+	test_assert_strcmp(request2->mailbox, "mailbox1");
 	indexer_queue_request_remove(queue);
-	indexer_queue_request_work(request2);
+	indexer_queue_request_work(queue, request2);
+
+	/* both users are being worked on */
+	test_assert(indexer_queue_request_peek(queue) == NULL);
 
 	/* Iteration shows the requests being worked on first. Their order
 	   depends on hash table iteration, so any order is acceptable. */
@@ -232,9 +238,10 @@ static void test_indexer_queue_iter(void)
 	test_assert((iter_request1 == request1 && iter_request2 == request2) ||
 		    (iter_request1 == request2 && iter_request2 == request1));
 
-	request = indexer_queue_request_peek(queue);
-	test_assert(indexer_queue_iter_next(iter) == request);
-	test_assert(indexer_queue_iter_next(iter) == request->next);
+	request = indexer_queue_iter_next(iter);
+	test_assert_strcmp(request->mailbox, "mailbox3");
+	request = indexer_queue_iter_next(iter);
+	test_assert_strcmp(request->mailbox, "mailbox4");
 	test_assert(indexer_queue_iter_next(iter) == NULL);
 	indexer_queue_iter_deinit(&iter);
 
@@ -258,6 +265,257 @@ static void test_indexer_queue_iter(void)
 	test_end();
 }
 
+static void test_indexer_queue_remove_user(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *request2;
+
+	test_begin("indexer queue remove user");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox2", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox3", "session1", 0, NULL);
+
+	test_assert(indexer_queue_request_remove_user(queue, "user3") == NULL);
+
+	/* start working on the first request */
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->mailbox, "mailbox1");
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+
+	/* the user's other requests are returned oldest first, skipping the
+	   one that is being worked on */
+	request2 = indexer_queue_request_remove_user(queue, "user1");
+	test_assert_strcmp(request2->mailbox, "mailbox2");
+	indexer_queue_request_work(queue, request2);
+	indexer_queue_request_finish(queue, &request2, INDEXER_STATE_COMPLETED);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+
+	request = indexer_queue_request_remove_user(queue, "user1");
+	test_assert_strcmp(request->mailbox, "mailbox3");
+	indexer_queue_request_work(queue, request);
+	test_assert(indexer_queue_request_remove_user(queue, "user1") == NULL);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+
+	/* the other user's request is still in the queue */
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->username, "user2");
+	test_assert(request->next == NULL);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_priority(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+	struct indexer_queue_stats stats;
+
+	test_begin("indexer queue priority");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox2", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox3", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, INDEXER_REQUEST_PRIORITY_DELIVERY,
+			     "user2", "INBOX", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+			     "user3", "INBOX", NULL, 0, NULL);
+
+	indexer_queue_get_stats(queue, BG, &stats);
+	test_assert(stats.queued == 3);
+	test_assert(stats.users == 1);
+
+	/* a request for an already queued mailbox raises its priority */
+	indexer_queue_append(queue, TRUE, INDEXER_REQUEST_PRIORITY_DELIVERY,
+			     "user1", "mailbox3", NULL, 0, NULL);
+	indexer_queue_get_stats(queue, BG, &stats);
+	test_assert(stats.queued == 2);
+	/* but not lower it */
+	indexer_queue_append(queue, TRUE, BG, "user2", "INBOX", NULL, 0, NULL);
+	indexer_queue_get_stats(queue, INDEXER_REQUEST_PRIORITY_DELIVERY,
+				&stats);
+	test_assert(stats.queued == 2);
+	test_assert(stats.users == 2);
+
+	struct {
+		const char *username;
+		const char *mailbox;
+		enum indexer_request_priority priority;
+	} expected[] = {
+		{ "user3", "INBOX", INDEXER_REQUEST_PRIORITY_INTERACTIVE },
+		{ "user2", "INBOX", INDEXER_REQUEST_PRIORITY_DELIVERY },
+		{ "user1", "mailbox3", INDEXER_REQUEST_PRIORITY_DELIVERY },
+		{ "user1", "mailbox1", BG },
+		{ "user1", "mailbox2", BG },
+	};
+	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
+		request = indexer_queue_request_peek(queue);
+		test_assert_strcmp_idx(request->username, expected[i].username, i);
+		test_assert_strcmp_idx(request->mailbox, expected[i].mailbox, i);
+		test_assert_idx(request->priority == expected[i].priority, i);
+
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_work(queue, request);
+		indexer_queue_get_stats(queue, expected[i].priority, &stats);
+		test_assert_idx(stats.working == 1, i);
+		indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	}
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	indexer_queue_get_stats(queue, INDEXER_REQUEST_PRIORITY_DELIVERY,
+				&stats);
+	test_assert(stats.queued == 0);
+	test_assert(stats.users == 0);
+	test_assert(stats.working == 0);
+	test_assert(stats.started == 2);
+	indexer_queue_get_stats(queue, BG, &stats);
+	test_assert(stats.started == 2);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_priority_raise_working(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+	struct indexer_queue_stats stats;
+
+	test_begin("indexer queue priority raised while working");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, BG, "user1", "mailbox1", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox1", NULL, 0, NULL);
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+
+	indexer_queue_append(queue, FALSE, INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+			     "user1", "mailbox1", NULL, 0, NULL);
+	indexer_queue_get_stats(queue, INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+				&stats);
+	test_assert(stats.working == 1);
+
+	/* the reindexing is done with the raised priority */
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->username, "user1");
+	test_assert(request->priority == INDEXER_REQUEST_PRIORITY_INTERACTIVE);
+	indexer_queue_get_stats(queue, INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+				&stats);
+	test_assert(stats.working == 0);
+	test_assert(stats.queued == 1);
+
+	indexer_queue_cancel_all(queue);
+	test_assert(indexer_queue_is_empty(queue));
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_fairness(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+	unsigned int i;
+
+	test_begin("indexer queue fairness");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	/* user1 has a lot of mailboxes queued before user2 */
+	for (i = 0; i < 10; i++) {
+		indexer_queue_append(queue, TRUE, BG, "user1",
+				     t_strdup_printf("mailbox%u", i),
+				     NULL, 0, NULL);
+	}
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox0", NULL, 0, NULL);
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox1", NULL, 0, NULL);
+
+	static const char *const expected[] = {
+		"user1", "user2", "user1", "user2", "user1", "user1",
+	};
+	for (i = 0; i < N_ELEMENTS(expected); i++) {
+		request = indexer_queue_request_peek(queue);
+		test_assert_strcmp_idx(request->username, expected[i], i);
+		indexer_queue_request_remove(queue);
+		indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	}
+	test_assert(indexer_queue_count(queue) == 6);
+
+	indexer_queue_cancel_all(queue);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_remove_user_turn(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request, *next;
+	unsigned int i;
+
+	test_begin("indexer queue remove user turn");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	for (i = 0; i < 20; i++) {
+		indexer_queue_append(queue, TRUE, BG, "user1",
+				     t_strdup_printf("mailbox%u", i),
+				     NULL, 0, NULL);
+	}
+	request = indexer_queue_request_peek(queue);
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+
+	/* nobody else is waiting, so the user can continue */
+	for (i = 1; i < 10; i++) {
+		indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+		request = indexer_queue_request_remove_user(queue, "user1");
+		test_assert_idx(request != NULL, i);
+		indexer_queue_request_work(queue, request);
+	}
+
+	/* another user is waiting in the same class, so the user's turn ends
+	   after using up its share */
+	indexer_queue_append(queue, TRUE, BG, "user2", "mailbox1", NULL, 0, NULL);
+	for (i = 0;; i++) {
+		indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+		request = indexer_queue_request_remove_user(queue, "user1");
+		if (request == NULL)
+			break;
+		indexer_queue_request_work(queue, request);
+	}
+	test_assert(i < 10);
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->username, "user2");
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, request);
+
+	/* a higher priority request ends the turn immediately */
+	next = indexer_queue_request_peek(queue);
+	test_assert_strcmp(next->username, "user1");
+	indexer_queue_request_remove(queue);
+	indexer_queue_request_work(queue, next);
+	indexer_queue_append(queue, TRUE, INDEXER_REQUEST_PRIORITY_INTERACTIVE,
+			     "user3", "INBOX", NULL, 0, NULL);
+	indexer_queue_request_finish(queue, &next, INDEXER_STATE_COMPLETED);
+	test_assert(indexer_queue_request_remove_user(queue, "user1") == NULL);
+	/* but not another user's lower priority request */
+	indexer_queue_request_finish(queue, &request, INDEXER_STATE_COMPLETED);
+	request = indexer_queue_request_peek(queue);
+	test_assert_strcmp(request->username, "user3");
+
+	indexer_queue_cancel_all(queue);
+	test_assert(indexer_queue_count(queue) == 0);
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -266,6 +524,11 @@ int main(void)
 		test_indexer_queue_reindex,
 		test_indexer_queue_cancel,
 		test_indexer_queue_iter,
+		test_indexer_queue_remove_user,
+		test_indexer_queue_priority,
+		test_indexer_queue_priority_raise_working,
+		test_indexer_queue_fairness,
+		test_indexer_queue_remove_user_turn,
 		NULL
 	};
 	return test_run(test_functions);
@@ -26,6 +26,7 @@ struct worker_connection {
 	struct connection conn;
 
 	indexer_status_callback_t *callback;
+	worker_next_request_callback_t *next_callback;
 	worker_available_callback_t *avail_callback;
 
 	pid_t pid;
@@ -36,6 +37,10 @@ struct worker_connection {
 static unsigned int worker_last_process_limit = 0;
 static struct connection_list *worker_connections;
 
+static void
+worker_connection_send_request(struct worker_connection *worker,
+			       struct indexer_request *request);
+
 static void worker_connection_call_callback(struct worker_connection *worker,
 					    const struct indexer_status *status)
 {
@@ -127,8 +132,20 @@ worker_connection_input_args(struct connection *conn, const char *const *args)
 		.total = total,
 	};
 	worker_connection_call_callback(worker, &status);
-	if (worker->request == NULL) {
-		/* disconnect after each request */
+	if (worker->request == NULL && ret > 0) {
+		/* Continue with the user's next request. The worker still
+		   has the user initialized, so this is cheaper than
+		   reconnecting. Disconnect once the queue doesn't give the
+		   user any more requests (none left or the user's turn is
+		   over), so the worker can be used for other users. */
+		struct indexer_request *request =
+			worker->next_callback(worker->request_username);
+		if (request != NULL)
+			worker_connection_send_request(worker, request);
+		else
+			ret = -1;
+	} else if (worker->request == NULL) {
+		/* disconnect after a failed request */
 		ret = -1;
 	}
 
@@ -139,7 +156,9 @@ static void
 worker_connection_send_request(struct worker_connection *worker,
 			       struct indexer_request *request)
 {
-	worker->request_username = i_strdup(request->username);
+	if (worker->request_username == NULL)
+		worker->request_username = i_strdup(request->username);
+	i_assert(strcmp(worker->request_username, request->username) == 0);
 	worker->request = request;
 
 	T_BEGIN {
@@ -196,6 +215,7 @@ void worker_connections_deinit(void)
 int worker_connection_try_create(const char *socket_path,
 				 struct indexer_request *request,
 				 indexer_status_callback_t *callback,
+				 worker_next_request_callback_t *next_callback,
 				 worker_available_callback_t *avail_callback)
 {
 	struct worker_connection *conn;
@@ -207,6 +227,7 @@ int worker_connection_try_create(const char *socket_path,
 
 	conn = i_new(struct worker_connection, 1);
 	conn->callback = callback;
+	conn->next_callback = next_callback;
 	conn->avail_callback = avail_callback;
 	connection_init_client_unix(worker_connections, &conn->conn,
 				    socket_path);
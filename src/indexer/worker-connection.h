@@ -7,14 +7,23 @@ struct indexer_request;
 struct worker_connection;
 
 typedef void worker_available_callback_t(void);
+/* Returns the next request for the user that the worker should handle, or
+   NULL if there are none. The returned request must already be marked as
+   being worked on. */
+typedef struct indexer_request *
+worker_next_request_callback_t(const char *username);
 
 /* Try to create a new worker connection and send a new indexing request for
    the given username+mailbox. The status callback is called as necessary.
+   After the request is finished, the next_callback is used to get the next
+   request for the same user, which is sent using the same connection. The
+   connection is closed once there are no more requests for the user.
    Returns 1 if successful, 0 if indexer-worker service's process_limit was
    already reached, -1 on connect error. */
 int worker_connection_try_create(const char *socket_path,
 				 struct indexer_request *request,
 				 indexer_status_callback_t *callback,
+				 worker_next_request_callback_t *next_callback,
 				 worker_available_callback_t *avail_callback);
 
 unsigned int worker_connections_get_count(void);
@@ -0,0 +1,166 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* Small fixed size cache fields (sizes, dates, etc.) can be stored as "cache
+   columns" instead of the cache file. Each column is an index record
+   extension named "cache-<field name>", so the values are stored as a dense
+   array indexed by sequence. Looking them up doesn't need to follow cache
+   record chains, and expunges drop the values automatically.
+
+   The column record begins with a byte that is 1 when the value exists,
+   followed by the field data. New values are written to columns only when
+   mail_index_cache_optimization_settings.fixed_size_columns is enabled, but
+   existing columns are always used for lookups. Cache purging moves the
+   column fields from the old cache file to columns, and clears the columns
+   of fields whose caching decision has become "no". */
+
+#include "lib.h"
+#include "str.h"
+#include "mail-cache-private.h"
+
+#include <ctype.h>
+
+/* Columns are meant for small fields, such as 32bit dates and 64bit sizes.
+   Larger fixed size fields are kept in the cache file. */
+#define MAIL_CACHE_COLUMN_MAX_FIELD_SIZE 16
+
+static bool mail_cache_column_get_ext_name(const char *field_name,
+					   string_t *dest)
+{
+	const char *p;
+
+	str_append(dest, "cache-");
+	for (p = field_name; *p != '\0'; p++) {
+		if (i_isalnum(*p) || *p == '-' || *p == '_')
+			str_append_c(dest, *p);
+		else
+			str_append_c(dest, '_');
+	}
+	return mail_index_ext_name_is_valid(str_c(dest));
+}
+
+void mail_cache_column_register(struct mail_cache *cache,
+				unsigned int field_idx)
+{
+	struct mail_cache_field_private *priv = &cache->fields[field_idx];
+	string_t *name;
+
+	if (priv->field.type != MAIL_CACHE_FIELD_FIXED_SIZE ||
+	    priv->field.field_size == 0 ||
+	    priv->field.field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE)
+		return;
+
+	T_BEGIN {
+		name = t_str_new(64);
+		if (mail_cache_column_get_ext_name(priv->field.name, name)) {
+			priv->column_ext_id =
+				mail_index_ext_register(cache->index,
+					str_c(name), 0,
+					1 + priv->field.field_size, 1);
+			priv->column = TRUE;
+		}
+	} T_END;
+}
+
+static bool
+mail_cache_field_get_column(struct mail_cache *cache, unsigned int field_idx,
+			    uint32_t *ext_id_r)
+{
+	i_assert(field_idx < cache->fields_count);
+
+	*ext_id_r = cache->fields[field_idx].column_ext_id;
+	return cache->fields[field_idx].column;
+}
+
+int mail_cache_column_lookup(struct mail_cache_view *view, uint32_t seq,
+			     unsigned int field_idx, buffer_t *dest_buf)
+{
+	struct mail_index_view *iview;
+	const unsigned char *data;
+	const void *rec;
+	uint32_t ext_id;
+	bool expunged;
+
+	if (!mail_cache_field_get_column(view->cache, field_idx, &ext_id))
+		return 0;
+
+	/* the transaction view sees also the uncommitted values */
+	iview = view->trans_view != NULL ? view->trans_view : view->view;
+	if (seq > mail_index_view_get_messages_count(iview))
+		return 0;
+	mail_index_lookup_ext(iview, seq, ext_id, &rec, &expunged);
+	data = rec;
+	if (data == NULL || data[0] == 0)
+		return 0;
+	if (dest_buf != NULL) {
+		buffer_append(dest_buf, data + 1,
+			      view->cache->fields[field_idx].field.field_size);
+	}
+	return 1;
+}
+
+bool mail_cache_column_add(struct mail_cache *cache,
+			   struct mail_index_transaction *t, uint32_t seq,
+			   unsigned int field_idx,
+			   const void *data, size_t data_size)
+{
+	unsigned char rec[1 + MAIL_CACHE_COLUMN_MAX_FIELD_SIZE];
+	uint32_t ext_id;
+
+	if (!cache->index->optimization_set.cache.fixed_size_columns ||
+	    !mail_cache_field_get_column(cache, field_idx, &ext_id))
+		return FALSE;
+	if (data_size != cache->fields[field_idx].field.field_size) {
+		/* field size was changed - keep the old data in the cache
+		   file */
+		return FALSE;
+	}
+	rec[0] = 1;
+	memcpy(rec + 1, data, data_size);
+	mail_index_update_ext(t, seq, ext_id, rec, NULL);
+	return TRUE;
+}
+
+static bool
+mail_cache_column_has_data(struct mail_index_view *view, uint32_t ext_id)
+{
+	const unsigned char *data;
+	const void *rec;
+	uint32_t seq, messages_count;
+	bool expunged;
+
+	messages_count = mail_index_view_get_messages_count(view);
+	for (seq = 1; seq <= messages_count; seq++) {
+		mail_index_lookup_ext(view, seq, ext_id, &rec, &expunged);
+		data = rec;
+		if (data == NULL)
+			return FALSE;
+		if (data[0] != 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+void mail_cache_columns_drop_unwanted(struct mail_cache *cache,
+				      struct mail_index_transaction *t,
+				      struct mail_index_view *view)
+{
+	struct mail_cache_field_private *priv;
+	const struct mail_index_ext *ext;
+	enum mail_cache_decision_type dec;
+	unsigned int i;
+
+	for (i = 0; i < cache->fields_count; i++) {
+		priv = &cache->fields[i];
+		dec = priv->field.decision &
+			ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
+		if (!priv->column || dec != MAIL_CACHE_DECISION_NO)
+			continue;
+		ext = mail_index_view_get_ext(view, priv->column_ext_id);
+		if (ext == NULL ||
+		    !mail_cache_column_has_data(view, priv->column_ext_id))
+			continue;
+
+		mail_index_ext_reset(t, priv->column_ext_id,
+				     ext->reset_id + 1, TRUE);
+	}
+}
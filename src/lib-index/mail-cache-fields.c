@@ -181,6 +181,7 @@ void mail_cache_register_fields(struct mail_cache *cache,
 
 		if (!field_has_fixed_size(cache->fields[idx].field.type))
 			cache->fields[idx].field.field_size = UINT_MAX;
+		mail_cache_column_register(cache, idx);
 
 		hash_table_insert(cache->field_name_hash, name,
 				  POINTER_CAST(idx));
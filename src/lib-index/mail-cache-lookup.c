@@ -357,6 +357,9 @@ int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 	   fields that don't yet exist in the cache file. So don't add any
 	   fast-paths checking whether the field exists in the file. */
 
+	if (mail_cache_column_lookup(view, seq, field, NULL) > 0)
+		return 1;
+
 	/* FIXME: we should discard the cache if view has been synced */
 	if (view->cached_exists_seq != seq) {
 		if (mail_cache_seq(view, seq) < 0)
@@ -424,6 +427,9 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	if (ret <= 0)
 		return ret;
 
+	if (mail_cache_column_lookup(view, seq, field_idx, dest_buf) > 0)
+		return 1;
+
 	/* the field should exist */
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	if (view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK) {
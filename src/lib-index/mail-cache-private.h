@@ -114,11 +114,16 @@ struct mail_cache_field_private {
 	   decision to change from TEMP to YES. */
 	uint32_t uid_highwater;
 
+	/* Index extension ID for the field's cache column */
+	uint32_t column_ext_id;
+
 	/* Unused fields aren't written to cache file */
 	bool used:1;
 	/* field.decision is pending a write to cache file header. If the
 	   cache header is read from disk, don't overwrite it. */
 	bool decision_dirty:1;
+	/* The field can be stored as a cache column */
+	bool column:1;
 };
 
 struct mail_cache {
@@ -361,6 +366,25 @@ uint32_t mail_cache_get_first_new_seq(struct mail_index_view *view);
 bool mail_cache_track_loops(struct mail_cache_loop_track *loop_track,
 			    uoff_t offset, uoff_t size);
 
+/* Register the cache column extension for a newly registered field, if the
+   field can be stored as a column. */
+void mail_cache_column_register(struct mail_cache *cache,
+				unsigned int field_idx);
+/* Look up the field from its cache column and append it to dest_buf (if not
+   NULL). Returns 1 if found, 0 if not. */
+int mail_cache_column_lookup(struct mail_cache_view *view, uint32_t seq,
+			     unsigned int field_idx, buffer_t *dest_buf);
+/* Write the field to its cache column if columns are enabled. Returns FALSE
+   if the field should be written to the cache file instead. */
+bool mail_cache_column_add(struct mail_cache *cache,
+			   struct mail_index_transaction *t, uint32_t seq,
+			   unsigned int field_idx,
+			   const void *data, size_t data_size);
+/* Clear the cache columns of fields whose decision is "no". */
+void mail_cache_columns_drop_unwanted(struct mail_cache *cache,
+				      struct mail_index_transaction *t,
+				      struct mail_index_view *view);
+
 /* Iterate through a message's cached fields. */
 void mail_cache_lookup_iter_init(struct mail_cache_view *view, uint32_t seq,
 				 struct mail_cache_lookup_iterate_ctx *ctx_r);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "ostream.h"
+#include "time-util.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
 #include "file-dotlock.h"
@@ -15,17 +16,46 @@
 
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
+	struct mail_index_transaction *trans;
 	struct event *event;
 	struct mail_cache_purge_drop_ctx drop_ctx;
 
 	buffer_t *buffer, *field_seen;
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
+	unsigned int orig_fields_count, used_fields_count;
 
 	uint8_t field_seen_value;
+	uint32_t seq, first_new_seq;
+	unsigned int record_count;
 	bool new_msg;
 };
 
+struct mail_cache_purge_online_record {
+	uint32_t uid;
+	/* cache offset in the old file when the record was copied */
+	uint32_t old_offset;
+	/* offset in the new file, 0 if nothing was copied */
+	uint32_t new_offset;
+};
+
+/* Cache file copied without the index being locked. The copy is switched
+   over to by mail_cache_purge_online_switch() while locked. */
+struct mail_cache_purge_online {
+	struct mail_cache_copy_context copy;
+	struct event *event;
+	struct ostream *output;
+	struct mail_cache_header hdr;
+
+	int fd;
+	char *temp_path;
+	uint32_t src_file_seq;
+	struct timeval locked_time;
+
+	/* sorted by uid */
+	ARRAY(struct mail_cache_purge_online_record) records;
+};
+
 static void
 mail_cache_merge_bitmask(struct mail_cache_copy_context *ctx,
 			 const struct mail_cache_iterate_field *field)
@@ -53,6 +83,10 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 	uint32_t file_field_idx, size32;
 	uint8_t *field_seen;
 
+	if (field->field_idx >= ctx->orig_fields_count) {
+		/* field header was re-read while copying without locks */
+		return;
+	}
 	file_field_idx = ctx->field_file_map[field->field_idx];
 	if (file_field_idx == (uint32_t)-1)
 		return;
@@ -78,6 +112,13 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 			return;
 	}
 
+	if (ctx->trans != NULL &&
+	    mail_cache_column_add(ctx->cache, ctx->trans, ctx->seq,
+				  field->field_idx, field->data, field->size)) {
+		/* moved to the cache column */
+		return;
+	}
+
 	buffer_append(ctx->buffer, &file_field_idx, sizeof(file_field_idx));
 
 	if (cache_field->field_size == UINT_MAX) {
@@ -198,153 +239,126 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 	return priv->used;
 }
 
-static int
-mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
-		struct event *event, int fd, const char *reason,
-		uint32_t *file_seq_r, uoff_t *file_size_r, uint32_t *max_uid_r,
-		uint32_t *ext_first_seq_r, ARRAY_TYPE(uint32_t) *ext_offsets)
+static void
+mail_cache_copy_init(struct mail_cache_copy_context *ctx,
+		     struct mail_cache *cache,
+		     struct mail_index_transaction *trans,
+		     struct mail_index_view *view, struct event *event)
 {
-        struct mail_cache_copy_context ctx;
-	struct mail_cache_lookup_iterate_ctx iter;
-	struct mail_cache_iterate_field field;
-	struct mail_index_view *view;
-	struct mail_cache_view *cache_view;
 	const struct mail_index_header *idx_hdr;
-	struct mail_cache_header hdr;
-	struct mail_cache_record cache_rec;
-	struct ostream *output;
-	uint32_t message_count, seq, first_new_seq, ext_offset;
-	unsigned int i, used_fields_count, orig_fields_count, record_count;
-
-	i_assert(reason != NULL);
-
-	*max_uid_r = 0;
-	*ext_first_seq_r = 0;
-
-	/* get the latest info on fields */
-	if (mail_cache_header_fields_read(cache) < 0)
-		return -1;
-
-	view = mail_index_transaction_open_updated_view(trans);
-	cache_view = mail_cache_view_open(cache, view);
-	output = o_stream_create_fd_file(fd, 0, FALSE);
-
-	i_zero(&hdr);
-	hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
-	hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
-	hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
-	hdr.indexid = cache->index->indexid;
-	hdr.file_seq = get_next_file_seq(cache);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	event_add_str(event, "reason", reason);
-	event_add_int(event, "file_seq", hdr.file_seq);
-	event_set_name(event, "mail_cache_purge_started");
-	e_debug(event, "Purging (new file_seq=%u): %s", hdr.file_seq, reason);
+	unsigned int i;
 
-	i_zero(&ctx);
-	ctx.cache = cache;
-	ctx.event = event;
-	ctx.buffer = buffer_create_dynamic(default_pool, 4096);
-	ctx.field_seen = buffer_create_dynamic(default_pool, 64);
-	ctx.field_seen_value = 0;
-	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
-	t_array_init(&ctx.bitmask_pos, 32);
+	i_zero(ctx);
+	ctx->cache = cache;
+	ctx->trans = trans;
+	ctx->event = event;
+	ctx->buffer = buffer_create_dynamic(default_pool, 4096);
+	ctx->field_seen = buffer_create_dynamic(default_pool, 64);
+	ctx->field_seen_value = 0;
+	ctx->field_file_map = t_new(uint32_t, cache->fields_count + 1);
+	t_array_init(&ctx->bitmask_pos, 32);
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
 	idx_hdr = mail_index_get_header(view);
-	mail_cache_purge_drop_init(cache, idx_hdr, &ctx.drop_ctx);
+	mail_cache_purge_drop_init(cache, idx_hdr, &ctx->drop_ctx);
 
-	orig_fields_count = cache->fields_count;
+	ctx->orig_fields_count = cache->fields_count;
 	if (cache->file_fields_count == 0) {
 		/* creating the initial cache file. add all fields. */
-		for (i = 0; i < orig_fields_count; i++)
-			ctx.field_file_map[i] = i;
-		used_fields_count = i;
+		for (i = 0; i < ctx->orig_fields_count; i++)
+			ctx->field_file_map[i] = i;
+		ctx->used_fields_count = i;
 	} else {
-		for (i = used_fields_count = 0; i < orig_fields_count; i++) {
-			if (!mail_cache_purge_check_field(&ctx, i))
-				ctx.field_file_map[i] = (uint32_t)-1;
+		for (i = 0; i < ctx->orig_fields_count; i++) {
+			if (!mail_cache_purge_check_field(ctx, i))
+				ctx->field_file_map[i] = (uint32_t)-1;
 			else
-				ctx.field_file_map[i] = used_fields_count++;
+				ctx->field_file_map[i] = ctx->used_fields_count++;
 		}
 	}
 
+	if (trans != NULL)
+		mail_cache_columns_drop_unwanted(cache, trans, view);
+
 	/* get sequence of first message which doesn't need its temp fields
 	   removed. */
-	first_new_seq = mail_cache_get_first_new_seq(view);
-	message_count = mail_index_view_get_messages_count(view);
-	if (!trans->reset)
-		seq = 1;
-	else {
-		/* Index is being rebuilt. Ignore old messages. */
-		seq = trans->first_new_seq;
-	}
+	ctx->first_new_seq = mail_cache_get_first_new_seq(view);
+}
 
-	*ext_first_seq_r = seq;
-	i_array_init(ext_offsets, message_count); record_count = 0;
-	for (; seq <= message_count; seq++) {
-		if (mail_index_transaction_is_expunged(trans, seq)) {
-			array_append_zero(ext_offsets);
-			continue;
-		}
+static void mail_cache_copy_deinit(struct mail_cache_copy_context *ctx)
+{
+	buffer_free(&ctx->buffer);
+	buffer_free(&ctx->field_seen);
+}
 
-		ctx.new_msg = seq >= first_new_seq;
-		buffer_set_used_size(ctx.buffer, 0);
+/* Copy the message's cached fields to output. Returns the record's offset in
+   the new file, or 0 if nothing was copied. */
+static uint32_t
+mail_cache_copy_record(struct mail_cache_copy_context *ctx,
+		       struct mail_cache_view *cache_view,
+		       struct ostream *output, uint32_t seq)
+{
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_record cache_rec;
+	uint32_t ext_offset;
 
-		ctx.field_seen_value = (ctx.field_seen_value + 1) & UINT8_MAX;
-		if (ctx.field_seen_value == 0) {
-			memset(buffer_get_modifiable_data(ctx.field_seen, NULL),
-			       0, buffer_get_size(ctx.field_seen));
-			ctx.field_seen_value++;
-		}
-		array_clear(&ctx.bitmask_pos);
+	ctx->seq = seq;
+	ctx->new_msg = seq >= ctx->first_new_seq;
+	buffer_set_used_size(ctx->buffer, 0);
 
-		i_zero(&cache_rec);
-		buffer_append(ctx.buffer, &cache_rec, sizeof(cache_rec));
+	ctx->field_seen_value = (ctx->field_seen_value + 1) & UINT8_MAX;
+	if (ctx->field_seen_value == 0) {
+		memset(buffer_get_modifiable_data(ctx->field_seen, NULL),
+		       0, buffer_get_size(ctx->field_seen));
+		ctx->field_seen_value++;
+	}
+	array_clear(&ctx->bitmask_pos);
 
-		mail_cache_lookup_iter_init(cache_view, seq, &iter);
-		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
-			mail_cache_purge_field(&ctx, &field);
+	i_zero(&cache_rec);
+	buffer_append(ctx->buffer, &cache_rec, sizeof(cache_rec));
 
-		if (ctx.buffer->used == sizeof(cache_rec) ||
-		    ctx.buffer->used > cache->index->optimization_set.cache.record_max_size) {
-			/* nothing cached */
-			ext_offset = 0;
-		} else {
-			mail_index_lookup_uid(view, seq, max_uid_r);
-			cache_rec.size = ctx.buffer->used;
-			ext_offset = output->offset;
-			buffer_write(ctx.buffer, 0, &cache_rec,
-				     sizeof(cache_rec));
-			o_stream_nsend(output, ctx.buffer->data, cache_rec.size);
-			record_count++;
-		}
+	mail_cache_lookup_iter_init(cache_view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		mail_cache_purge_field(ctx, &field);
 
-		array_push_back(ext_offsets, &ext_offset);
+	if (ctx->buffer->used == sizeof(cache_rec) ||
+	    ctx->buffer->used > ctx->cache->index->optimization_set.cache.record_max_size) {
+		/* nothing cached */
+		return 0;
 	}
-	i_assert(orig_fields_count == cache->fields_count);
+	cache_rec.size = ctx->buffer->used;
+	ext_offset = output->offset;
+	buffer_write(ctx->buffer, 0, &cache_rec, sizeof(cache_rec));
+	o_stream_nsend(output, ctx->buffer->data, cache_rec.size);
+	ctx->record_count++;
+	return ext_offset;
+}
+
+static int
+mail_cache_copy_finish(struct mail_cache_copy_context *ctx,
+		       struct ostream **_output, int fd,
+		       struct mail_cache_header *hdr, uoff_t *file_size_r)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct ostream *output = *_output;
+
+	*_output = NULL;
 
 	bool file_too_large =
 		output->offset > cache->index->optimization_set.cache.max_size;
 	if (!file_too_large) {
-		hdr.record_count = record_count;
-		hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
-		mail_cache_purge_get_fields(&ctx, used_fields_count);
-		o_stream_nsend(output, ctx.buffer->data, ctx.buffer->used);
+		hdr->field_header_offset =
+			mail_index_uint32_to_offset(output->offset);
+		mail_cache_purge_get_fields(ctx, ctx->used_fields_count);
+		o_stream_nsend(output, ctx->buffer->data, ctx->buffer->used);
 	}
 
-	hdr.backwards_compat_used_file_size = output->offset;
-	buffer_free(&ctx.buffer);
-	buffer_free(&ctx.field_seen);
-
+	hdr->backwards_compat_used_file_size = output->offset;
 	*file_size_r = output->offset;
 	(void)o_stream_seek(output, 0);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	mail_cache_view_close(&cache_view);
-	mail_index_view_close(&view);
+	o_stream_nsend(output, hdr, sizeof(*hdr));
 
 	if (file_too_large || o_stream_finish(output) < 0) {
 		if (!file_too_large) {
@@ -359,7 +373,6 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 			i_unlink(cache->filepath);
 		}
 		o_stream_destroy(&output);
-		array_free(ext_offsets);
 		return -1;
 	}
 	o_stream_destroy(&output);
@@ -367,28 +380,107 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	if (cache->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
 		if (fdatasync(fd) < 0) {
 			mail_cache_set_syscall_error(cache, "fdatasync()");
-			array_free(ext_offsets);
 			return -1;
 		}
 	}
+	return 0;
+}
+
+static struct ostream *
+mail_cache_copy_start(struct mail_cache *cache, struct event *event, int fd,
+		      const char *reason, struct mail_cache_header *hdr_r)
+{
+	struct ostream *output;
+
+	i_assert(reason != NULL);
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+
+	i_zero(hdr_r);
+	hdr_r->major_version = MAIL_CACHE_MAJOR_VERSION;
+	hdr_r->minor_version = MAIL_CACHE_MINOR_VERSION;
+	hdr_r->compat_sizeof_uoff_t = sizeof(uoff_t);
+	hdr_r->indexid = cache->index->indexid;
+	hdr_r->file_seq = get_next_file_seq(cache);
+	o_stream_nsend(output, hdr_r, sizeof(*hdr_r));
+
+	event_add_str(event, "reason", reason);
+	event_add_int(event, "file_seq", hdr_r->file_seq);
+	event_set_name(event, "mail_cache_purge_started");
+	e_debug(event, "Purging (new file_seq=%u): %s", hdr_r->file_seq, reason);
+	return output;
+}
+
+static int
+mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
+		struct event *event, int fd, const char *reason,
+		uint32_t *file_seq_r, uoff_t *file_size_r, uint32_t *max_uid_r,
+		uint32_t *ext_first_seq_r, ARRAY_TYPE(uint32_t) *ext_offsets)
+{
+	struct mail_cache_copy_context ctx;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_header hdr;
+	struct ostream *output;
+	uint32_t message_count, seq, ext_offset;
+	int ret;
+
+	*max_uid_r = 0;
+	*ext_first_seq_r = 0;
+
+	/* get the latest info on fields */
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+
+	view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(cache, view);
+	output = mail_cache_copy_start(cache, event, fd, reason, &hdr);
+	mail_cache_copy_init(&ctx, cache, trans, view, event);
+
+	message_count = mail_index_view_get_messages_count(view);
+	if (!trans->reset)
+		seq = 1;
+	else {
+		/* Index is being rebuilt. Ignore old messages. */
+		seq = trans->first_new_seq;
+	}
+
+	*ext_first_seq_r = seq;
+	i_array_init(ext_offsets, message_count);
+	for (; seq <= message_count; seq++) {
+		if (mail_index_transaction_is_expunged(trans, seq)) {
+			array_append_zero(ext_offsets);
+			continue;
+		}
+
+		ext_offset = mail_cache_copy_record(&ctx, cache_view,
+						    output, seq);
+		if (ext_offset != 0)
+			mail_index_lookup_uid(view, seq, max_uid_r);
+		array_push_back(ext_offsets, &ext_offset);
+	}
+	i_assert(ctx.orig_fields_count == cache->fields_count);
+
+	hdr.record_count = ctx.record_count;
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
 
+	ret = mail_cache_copy_finish(&ctx, &output, fd, &hdr, file_size_r);
+	mail_cache_copy_deinit(&ctx);
+	if (ret < 0) {
+		array_free(ext_offsets);
+		return -1;
+	}
 	*file_seq_r = hdr.file_seq;
 	return 0;
 }
 
-static int
-mail_cache_purge_write(struct mail_cache *cache,
-		       struct mail_index_transaction *trans,
-		       int fd, const char *temp_path, const char *
-		       reason, bool *unlock)
+static struct event *mail_cache_purge_event_create(struct mail_cache *cache)
 {
 	struct event *event;
-	struct stat st;
-	uint32_t prev_file_seq, file_seq, old_offset, max_uid, ext_first_seq;
-	ARRAY_TYPE(uint32_t) ext_offsets;
-	const uint32_t *offsets;
-	uoff_t prev_file_size, file_size;
-	unsigned int i, count, prev_deleted_records;
+	uint32_t prev_file_seq;
+	uoff_t prev_file_size;
+	unsigned int prev_deleted_records;
 
 	if (cache->hdr == NULL) {
 		prev_file_seq = 0;
@@ -403,39 +495,47 @@ mail_cache_purge_write(struct mail_cache *cache,
 	event_add_int(event, "prev_file_seq", prev_file_seq);
 	event_add_int(event, "prev_file_size", prev_file_size);
 	event_add_int(event, "prev_deleted_records", prev_deleted_records);
+	return event;
+}
 
-	if (mail_cache_copy(cache, trans, event, fd, reason,
-			    &file_seq, &file_size, &max_uid,
-			    &ext_first_seq, &ext_offsets) < 0) {
-		event_unref(&event);
-		return -1;
-	}
+/* Replace the cache file with the written temp file and update the
+   messages' cache offsets. */
+static int
+mail_cache_purge_install(struct mail_cache *cache,
+			 struct mail_index_transaction *trans,
+			 struct event *event, int fd, const char *temp_path,
+			 uint32_t file_seq, uoff_t file_size, uint32_t max_uid,
+			 uint32_t ext_first_seq,
+			 const ARRAY_TYPE(uint32_t) *ext_offsets, bool *unlock)
+{
+	struct stat st;
+	uint32_t prev_file_seq, old_offset;
+	uoff_t prev_file_size;
+	const uint32_t *offsets;
+	unsigned int i, count;
 
 	if (fstat(fd, &st) < 0) {
 		mail_cache_set_syscall_error(cache, "fstat()");
-		array_free(&ext_offsets);
-		event_unref(&event);
 		return -1;
 	}
 	if (rename(temp_path, cache->filepath) < 0) {
 		mail_cache_set_syscall_error(cache, "rename()");
-		array_free(&ext_offsets);
-		event_unref(&event);
 		return -1;
 	}
 
+	prev_file_seq = cache->hdr == NULL ? 0 : cache->hdr->file_seq;
+	prev_file_size = cache->hdr == NULL ? 0 : cache->last_stat_size;
 	event_add_int(event, "file_size", file_size);
 	event_add_int(event, "max_uid", max_uid);
 	event_set_name(event, "mail_cache_purge_finished");
 	e_debug(event, "Purging finished, file_seq changed %u -> %u, "
 		"size=%"PRIuUOFF_T" -> %"PRIuUOFF_T", max_uid=%u",
 		prev_file_seq, file_seq, prev_file_size, file_size, max_uid);
-	event_unref(&event);
 
 	/* once we're sure that the purging was successful,
 	   update the offsets */
 	mail_index_ext_reset(trans, cache->ext_id, file_seq, TRUE);
-	offsets = array_get(&ext_offsets, &count);
+	offsets = array_get(ext_offsets, &count);
 	for (i = 0; i < count; i++) {
 		if (offsets[i] != 0) {
 			mail_index_update_ext(trans, ext_first_seq + i,
@@ -443,7 +543,6 @@ mail_cache_purge_write(struct mail_cache *cache,
 					      &offsets[i], &old_offset);
 		}
 	}
-	array_free(&ext_offsets);
 
 	if (*unlock) {
 		mail_cache_unlock(cache);
@@ -459,6 +558,33 @@ mail_cache_purge_write(struct mail_cache *cache,
 	return 0;
 }
 
+static int
+mail_cache_purge_write(struct mail_cache *cache,
+		       struct mail_index_transaction *trans,
+		       int fd, const char *temp_path, const char *
+		       reason, bool *unlock)
+{
+	struct event *event;
+	uint32_t file_seq, max_uid, ext_first_seq;
+	ARRAY_TYPE(uint32_t) ext_offsets;
+	uoff_t file_size;
+	int ret;
+
+	event = mail_cache_purge_event_create(cache);
+	if (mail_cache_copy(cache, trans, event, fd, reason,
+			    &file_seq, &file_size, &max_uid,
+			    &ext_first_seq, &ext_offsets) < 0) {
+		event_unref(&event);
+		return -1;
+	}
+	ret = mail_cache_purge_install(cache, trans, event, fd, temp_path,
+				       file_seq, file_size, max_uid,
+				       ext_first_seq, &ext_offsets, unlock);
+	array_free(&ext_offsets);
+	event_unref(&event);
+	return ret;
+}
+
 static int
 mail_cache_purge_has_file_changed(struct mail_cache *cache,
 				  uint32_t purge_file_seq)
@@ -496,6 +622,32 @@ mail_cache_purge_has_file_changed(struct mail_cache *cache,
 	}
 }
 
+static void mail_cache_purge_stop_map_with_read(struct mail_cache *cache)
+{
+	/* purging isn't very efficient with small read()s */
+	if (cache->map_with_read) {
+		cache->map_with_read = FALSE;
+		if (cache->read_buf != NULL)
+			buffer_set_used_size(cache->read_buf, 0);
+		cache->hdr = NULL;
+		cache->mmap_length = 0;
+	}
+}
+
+static int mail_cache_purge_reopened(struct mail_cache *cache)
+{
+	if (cache->file_cache != NULL)
+		file_cache_set_fd(cache->file_cache, cache->fd);
+
+	if (mail_cache_map_all(cache) <= 0)
+		return -1;
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+
+	mail_cache_purge_later_reset(cache);
+	return 0;
+}
+
 static int mail_cache_purge_locked(struct mail_cache *cache,
 				   uint32_t purge_file_seq,
 				   struct mail_index_transaction *trans,
@@ -536,16 +688,7 @@ static int mail_cache_purge_locked(struct mail_cache *cache,
 		i_unlink(temp_path);
 		return -1;
 	}
-	if (cache->file_cache != NULL)
-		file_cache_set_fd(cache->file_cache, cache->fd);
-
-	if (mail_cache_map_all(cache) <= 0)
-		return -1;
-	if (mail_cache_header_fields_read(cache) < 0)
-		return -1;
-
-	mail_cache_purge_later_reset(cache);
-	return 0;
+	return mail_cache_purge_reopened(cache);
 }
 
 static int
@@ -562,14 +705,7 @@ mail_cache_purge_full(struct mail_cache *cache,
 	if (MAIL_INDEX_IS_IN_MEMORY(cache->index) || cache->index->readonly)
 		return 0;
 
-	/* purging isn't very efficient with small read()s */
-	if (cache->map_with_read) {
-		cache->map_with_read = FALSE;
-		if (cache->read_buf != NULL)
-			buffer_set_used_size(cache->read_buf, 0);
-		cache->hdr = NULL;
-		cache->mmap_length = 0;
-	}
+	mail_cache_purge_stop_map_with_read(cache);
 
 	/* .log lock already prevents other processes from purging cache at
 	   the same time, but locking the cache file itself prevents other
@@ -601,6 +737,292 @@ mail_cache_purge_full(struct mail_cache *cache,
 	return ret;
 }
 
+static int
+mail_cache_purge_online_record_cmp(const uint32_t *uid,
+				   const struct mail_cache_purge_online_record *rec)
+{
+	if (*uid < rec->uid)
+		return -1;
+	if (*uid > rec->uid)
+		return 1;
+	return 0;
+}
+
+bool mail_cache_purge_can_online(struct mail_cache *cache,
+				 uint32_t purge_file_seq)
+{
+	uoff_t min_size =
+		cache->index->optimization_set.cache.purge_online_min_size;
+
+	if (min_size == 0)
+		return FALSE;
+	if (MAIL_INDEX_IS_IN_MEMORY(cache->index) || cache->index->readonly)
+		return FALSE;
+	if (MAIL_CACHE_IS_UNUSABLE(cache))
+		return FALSE;
+	if (purge_file_seq != (uint32_t)-1 &&
+	    cache->hdr->file_seq != purge_file_seq)
+		return FALSE;
+	return cache->last_stat_size >= min_size;
+}
+
+static bool
+mail_cache_purge_want_online(struct mail_cache *cache, uint32_t purge_file_seq)
+{
+	/* With the log already locked there's nothing to gain */
+	return !cache->index->log_sync_locked &&
+		mail_cache_purge_can_online(cache, purge_file_seq);
+}
+
+static void
+mail_cache_purge_online_free(struct mail_cache_purge_online **_online)
+{
+	struct mail_cache_purge_online *online = *_online;
+
+	*_online = NULL;
+	if (online->output != NULL) {
+		o_stream_abort(online->output);
+		o_stream_destroy(&online->output);
+	}
+	if (online->fd != -1) {
+		i_close_fd(&online->fd);
+		i_unlink(online->temp_path);
+	}
+	mail_cache_copy_deinit(&online->copy);
+	array_free(&online->records);
+	event_unref(&online->event);
+	i_free(online->temp_path);
+	i_free(online);
+}
+
+/* Copy the cache file to a temp file without locking the index or the cache.
+   Returns 1 if copied, 0 if the cache can't be copied this way, -1 on
+   error. */
+static int
+mail_cache_purge_online_copy(struct mail_cache *cache, const char *reason,
+			     struct mail_cache_purge_online **online_r)
+{
+	struct mail_cache_purge_online *online;
+	struct mail_cache_purge_online_record *rec;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	uint32_t seq, message_count, reset_id;
+	const char *temp_path;
+	int fd, ret;
+
+	*online_r = NULL;
+
+	/* make sure the view sees the latest cache offsets, so fewer records
+	   need to be recopied while locked */
+	if (mail_index_refresh(cache->index) < 0)
+		return -1;
+	mail_cache_purge_stop_map_with_read(cache);
+	if ((ret = mail_cache_map_all(cache)) <= 0)
+		return ret;
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+	if (cache->file_fields_count == 0)
+		return 0;
+
+	fd = mail_index_create_tmp_file(cache->index, cache->filepath,
+					&temp_path);
+	if (fd == -1)
+		return -1;
+
+	online = i_new(struct mail_cache_purge_online, 1);
+	online->fd = fd;
+	online->temp_path = i_strdup(temp_path);
+	online->src_file_seq = cache->hdr->file_seq;
+	online->event = mail_cache_purge_event_create(cache);
+
+	online->output = mail_cache_copy_start(cache, online->event, fd,
+					       reason, &online->hdr);
+	view = mail_index_view_open(cache->index);
+	cache_view = mail_cache_view_open(cache, view);
+	/* Without a transaction the fields aren't moved to cache columns.
+	   That's left for the following purges. */
+	mail_cache_copy_init(&online->copy, cache, NULL, view, online->event);
+
+	/* don't write field header changes when closing the view */
+	cache->purging = TRUE;
+	message_count = mail_index_view_get_messages_count(view);
+	i_array_init(&online->records, message_count);
+	for (seq = 1; seq <= message_count; seq++) {
+		rec = array_append_space(&online->records);
+		mail_index_lookup_uid(view, seq, &rec->uid);
+		rec->old_offset = mail_cache_lookup_cur_offset(view, seq,
+							       &reset_id);
+		if (rec->old_offset != 0 && reset_id != online->src_file_seq)
+			rec->old_offset = 0;
+		rec->new_offset = mail_cache_copy_record(&online->copy,
+							 cache_view,
+							 online->output, seq);
+	}
+	mail_cache_view_close(&cache_view);
+	cache->purging = FALSE;
+	mail_index_view_close(&view);
+
+	*online_r = online;
+	return 1;
+}
+
+static int
+mail_cache_purge_online_switch_locked(struct mail_cache *cache,
+				      struct mail_index_transaction *trans,
+				      struct mail_cache_purge_online *online,
+				      bool *unlock)
+{
+	struct mail_cache_copy_context *ctx = &online->copy;
+	const struct mail_cache_purge_online_record *rec;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	ARRAY_TYPE(uint32_t) ext_offsets;
+	struct timeval now;
+	uint32_t seq, message_count, uid, cur_offset, reset_id, ext_offset;
+	uint32_t max_uid = 0;
+	unsigned int i, live_count = 0, recopied_count = 0;
+	uoff_t file_size;
+	int ret;
+
+	if (cache->hdr->file_seq != online->src_file_seq) {
+		/* somebody else purged the cache */
+		return 0;
+	}
+
+	/* The fields must still be dropped the same way as while copying.
+	   Otherwise the copied records don't match the new field header. */
+	if (mail_cache_header_fields_read(cache) < 0)
+		return -1;
+	if (cache->fields_count != ctx->orig_fields_count)
+		return 0;
+	for (i = 0; i < ctx->orig_fields_count; i++) {
+		if (mail_cache_purge_check_field(ctx, i) !=
+		    (ctx->field_file_map[i] != (uint32_t)-1))
+			return 0;
+	}
+
+	view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(cache, view);
+	ctx->trans = trans;
+	ctx->first_new_seq = mail_cache_get_first_new_seq(view);
+	mail_cache_columns_drop_unwanted(cache, trans, view);
+
+	/* Use the copied records of messages whose cache offset hasn't
+	   changed since. Copy the rest again. */
+	message_count = mail_index_view_get_messages_count(view);
+	i_array_init(&ext_offsets, message_count);
+	for (seq = 1; seq <= message_count; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		cur_offset = mail_cache_lookup_cur_offset(view, seq, &reset_id);
+		if (cur_offset != 0 && reset_id != online->src_file_seq)
+			cur_offset = 0;
+		rec = array_bsearch(&online->records, &uid,
+				    mail_cache_purge_online_record_cmp);
+		if (rec != NULL && rec->old_offset == cur_offset)
+			ext_offset = rec->new_offset;
+		else {
+			ext_offset = mail_cache_copy_record(ctx, cache_view,
+							    online->output, seq);
+			recopied_count++;
+		}
+		if (ext_offset != 0) {
+			max_uid = uid;
+			live_count++;
+		}
+		array_push_back(&ext_offsets, &ext_offset);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+
+	/* records copied for messages that were expunged or changed since
+	   are left in the new file as deleted */
+	online->hdr.record_count = live_count;
+	online->hdr.deleted_record_count = ctx->record_count - live_count;
+
+	ret = mail_cache_copy_finish(ctx, &online->output, online->fd,
+				     &online->hdr, &file_size);
+	if (ret == 0) {
+		i_gettimeofday(&now);
+		event_add_int(online->event, "recopied_records",
+			      recopied_count);
+		event_add_int(online->event, "locked_msecs",
+			      timeval_diff_msecs(&now, &online->locked_time));
+		ret = mail_cache_purge_install(cache, trans, online->event,
+					       online->fd, online->temp_path,
+					       online->hdr.file_seq, file_size,
+					       max_uid, 1, &ext_offsets, unlock);
+	}
+	array_free(&ext_offsets);
+	if (ret < 0)
+		return -1;
+
+	/* the new cache file now owns the fd */
+	online->fd = -1;
+	return mail_cache_purge_reopened(cache) < 0 ? -1 : 1;
+}
+
+/* Switch over to the cache file copied by mail_cache_purge_online_copy().
+   Returns 1 if done, 0 if the copy can't be used anymore and the cache needs
+   to be purged while locked, -1 on error. */
+static int
+mail_cache_purge_online_switch(struct mail_cache *cache,
+			       struct mail_index_transaction *trans,
+			       struct mail_cache_purge_online *online)
+{
+	bool unlock = FALSE;
+	int ret;
+
+	i_assert(!cache->purging);
+	i_assert(cache->index->log_sync_locked);
+
+	/* prevent other processes from adding more cached data while the
+	   rest of the changes are copied */
+	switch (mail_cache_lock(cache)) {
+	case -1:
+		return -1;
+	case 0:
+		/* cache was just found to be broken */
+		return 0;
+	default:
+		unlock = TRUE;
+	}
+	cache->purging = TRUE;
+	ret = mail_cache_purge_online_switch_locked(cache, trans, online,
+						    &unlock);
+	cache->purging = FALSE;
+	if (unlock)
+		mail_cache_unlock(cache);
+	i_assert(!cache->hdr_modified);
+	if (ret <= 0) {
+		/* the fields may have been updated in memory already.
+		   reverse those changes by re-reading them from file. */
+		(void)mail_cache_header_fields_read(cache);
+	}
+	if (ret == 0) {
+		e_debug(online->event, "Cache changed while purging it "
+			"without locks - purging again while locked");
+	}
+	return ret;
+}
+
+static int
+mail_cache_purge_trans(struct mail_cache *cache,
+		       struct mail_index_transaction *trans,
+		       uint32_t purge_file_seq, const char *reason,
+		       struct mail_cache_purge_online **online)
+{
+	int ret;
+
+	if (*online != NULL) {
+		ret = mail_cache_purge_online_switch(cache, trans, *online);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+		/* the full purge reuses the same temp file path */
+		mail_cache_purge_online_free(online);
+	}
+	return mail_cache_purge_full(cache, trans, purge_file_seq, reason);
+}
+
 int mail_cache_purge_with_trans(struct mail_cache *cache,
 				struct mail_index_transaction *trans,
 				uint32_t purge_file_seq, const char *reason)
@@ -611,31 +1033,49 @@ int mail_cache_purge_with_trans(struct mail_cache *cache,
 int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 		     const char *reason)
 {
+	struct mail_cache_purge_online *online = NULL;
 	struct mail_index_view *view;
 	struct mail_index_transaction *trans;
 	bool lock_log;
 	int ret;
 
 	lock_log = !cache->index->log_sync_locked;
+	if (lock_log && mail_cache_purge_want_online(cache, purge_file_seq)) {
+		/* Copy large cache files before locking the index, so other
+		   sessions aren't blocked for the whole purge. */
+		if (mail_cache_purge_online_copy(cache, reason, &online) < 0)
+			return -1;
+	}
 	if (lock_log) {
 		uint32_t file_seq;
 		uoff_t file_offset;
 
 		if (mail_transaction_log_sync_lock(cache->index->log,
 						   "mail cache purge",
-						   &file_seq, &file_offset) < 0)
+						   &file_seq, &file_offset) < 0) {
+			if (online != NULL) {
+				mail_cache_purge_online_free(&online);
+				/* the online copy updated the fields in
+				   memory already. reverse those changes by
+				   re-reading them from file. */
+				(void)mail_cache_header_fields_read(cache);
+			}
 			return -1;
+		}
 	}
+	if (online != NULL)
+		i_gettimeofday(&online->locked_time);
 	/* make sure we see the latest changes in index */
 	ret = mail_index_refresh(cache->index);
 
 	view = mail_index_view_open(cache->index);
 	trans = mail_index_transaction_begin(view,
 		MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
-	if (ret < 0)
-		;
-	else if ((ret = mail_cache_purge_full(cache, trans, purge_file_seq,
-					      reason)) < 0)
+	if (ret < 0) {
+		if (online != NULL)
+			(void)mail_cache_header_fields_read(cache);
+	} else if ((ret = mail_cache_purge_trans(cache, trans, purge_file_seq,
+					       reason, &online)) < 0)
 		mail_index_transaction_rollback(&trans);
 	else {
 		if (mail_index_transaction_commit(&trans) < 0)
@@ -646,6 +1086,8 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 		mail_transaction_log_sync_unlock(cache->index->log,
 						 "mail cache purge");
 	}
+	if (online != NULL)
+		mail_cache_purge_online_free(&online);
 	return ret;
 }
 
@@ -804,6 +804,10 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	fixed_size = ctx->cache->fields[field_idx].field.field_size;
 	i_assert(fixed_size == UINT_MAX || fixed_size == data_size);
 
+	if (mail_cache_column_add(ctx->cache, ctx->trans, seq, field_idx,
+				  data, data_size))
+		return;
+
 	data_size32 = (uint32_t)data_size;
 	full_size = sizeof(field_idx) + ((data_size + 3) & ~3U);
 	if (fixed_size == UINT_MAX)
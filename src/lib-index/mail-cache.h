@@ -109,6 +109,11 @@ void mail_cache_purge_later_reset(struct mail_cache *cache);
 int mail_cache_purge_with_trans(struct mail_cache *cache,
 				struct mail_index_transaction *trans,
 				uint32_t purge_file_seq, const char *reason);
+/* Returns TRUE if the cache file is large enough to be purged mostly
+   without holding the transaction log lock. The log must not be locked
+   when mail_cache_purge() is called for this to happen. */
+bool mail_cache_purge_can_online(struct mail_cache *cache,
+				 uint32_t purge_file_seq);
 int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 		     const char *reason);
 /* Returns TRUE if there is at least something in the cache. */
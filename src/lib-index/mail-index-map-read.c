@@ -207,6 +207,8 @@ mail_index_try_read_map(struct mail_index_map *map,
 			map->rec_map->buffer =
 				buffer_create_dynamic(default_pool,
 						      records_size);
+		} else {
+			buffer_reserve(map->rec_map->buffer, records_size);
 		}
 
 		/* @UNSAFE */
@@ -7,6 +7,10 @@
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 
+/* When the records buffer needs to grow, grow it by 1/32 of its size */
+#define MAIL_INDEX_RECORD_MAP_GROW_DIVISOR 32
+#define MAIL_INDEX_RECORD_MAP_MIN_GROW 1024
+
 void mail_index_map_init_extbufs(struct mail_index_map *map,
 				 unsigned int initial_count)
 {
@@ -314,20 +318,46 @@ void mail_index_unmap(struct mail_index_map **_map)
 	i_free(map);
 }
 
+static size_t mail_index_record_map_grown_size(size_t size)
+{
+	/* Leave a bit of space to grow. The buffer would normally grow to the
+	   next power of 2, which could waste hundreds of megabytes with huge
+	   mailboxes. Large reallocs are cheap, since they can just remap the
+	   memory. */
+	return size + I_MAX(size / MAIL_INDEX_RECORD_MAP_GROW_DIVISOR,
+			    MAIL_INDEX_RECORD_MAP_MIN_GROW);
+}
+
+void mail_index_record_map_reserve(struct mail_index_map *map,
+				   unsigned int records_count)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	size_t size = (size_t)records_count * map->hdr.record_size;
+
+	i_assert(rec_map->buffer != NULL);
+
+	if (size <= buffer_get_writable_size(rec_map->buffer))
+		return;
+	buffer_reserve(rec_map->buffer, mail_index_record_map_grown_size(size));
+	rec_map->records = buffer_get_modifiable_data(rec_map->buffer, NULL);
+}
+
 static void mail_index_map_copy_records(struct mail_index_record_map *dest,
 					const struct mail_index_record_map *src,
-					unsigned int record_size)
+					unsigned int record_size,
+					unsigned int records_count)
 {
 	size_t size;
 
-	size = src->records_count * record_size;
-	/* +1% so we have a bit of space to grow. useful for huge mailboxes. */
+	i_assert(records_count <= src->records_count);
+
+	size = (size_t)records_count * record_size;
 	dest->buffer = buffer_create_dynamic(default_pool,
-					     size + I_MAX(size/100, 1024));
+		mail_index_record_map_grown_size(size));
 	buffer_append(dest->buffer, src->records, size);
 
 	dest->records = buffer_get_modifiable_data(dest->buffer, NULL);
-	dest->records_count = src->records_count;
+	dest->records_count = records_count;
 }
 
 static void mail_index_map_copy_header(struct mail_index_map *dest,
@@ -423,10 +453,17 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 
 	if (array_count(&map->rec_map->maps) > 1) {
 		/* Multiple references to the rec_map. Create a clone of the
-		   rec_map, which is in memory. */
+		   rec_map, which is in memory. Copy only the records that are
+		   visible in this map. */
 		new_map = mail_index_record_map_alloc(map);
 		mail_index_map_copy_records(new_map, map->rec_map,
-					    map->hdr.record_size);
+					    map->hdr.record_size,
+					    map->hdr.messages_count);
+		if (new_map->records_count < map->rec_map->records_count &&
+		    new_map->records_count > 0) {
+			rec = MAIL_INDEX_MAP_IDX(map, new_map->records_count - 1);
+			new_map->last_appended_uid = rec->uid;
+		}
 		mail_index_record_map_unlink(map);
 		map->rec_map = new_map;
 	} else {
@@ -469,7 +506,8 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 	}
 
 	mail_index_map_copy_records(new_map, map->rec_map,
-				    map->hdr.record_size);
+				    map->hdr.record_size,
+				    map->rec_map->records_count);
 	mail_index_map_copy_header(map, map);
 
 	if (new_map != map->rec_map) {
@@ -367,6 +367,9 @@ void mail_index_unmap(struct mail_index_map **map);
 struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 /* Make sure the map has its own private rec_map, cloning it if necessary. */
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
+/* Make sure the in-memory rec_map has space for records_count records. */
+void mail_index_record_map_reserve(struct mail_index_map *map,
+				   unsigned int records_count);
 /* If map points to mmap()ed index, copy it to the memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
 
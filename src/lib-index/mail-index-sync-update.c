@@ -302,6 +302,7 @@ static void *sync_append_record(struct mail_index_map *map)
 	size_t append_pos;
 	void *ret;
 
+	mail_index_record_map_reserve(map, map->rec_map->records_count + 1);
 	append_pos = map->rec_map->records_count * map->hdr.record_size;
 	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
 				      map->hdr.record_size);
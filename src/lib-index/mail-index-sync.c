@@ -882,8 +882,8 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 {
         struct mail_index_sync_ctx *ctx = *_ctx;
 	struct mail_index *index = ctx->index;
-	const char *reason = NULL;
-	uint32_t next_uid;
+	const char *reason = NULL, *purge_reason = NULL;
+	uint32_t next_uid, purge_file_seq = 0;
 	bool want_rotate, index_undeleted, delete_index;
 	int ret = 0, ret2;
 
@@ -952,20 +952,32 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 	   of updating whether cache needs to be purged. */
 	if (ret == 0 && mail_cache_need_purge(index->cache, &reason) &&
 	    !mail_cache_transactions_have_changes(index->cache)) {
-		if (mail_cache_purge(index->cache,
-				     index->cache->need_purge_file_seq,
-				     reason) < 0) {
-			/* can't really do anything if it fails */
+		if (mail_cache_purge_can_online(index->cache,
+				index->cache->need_purge_file_seq)) {
+			/* The cache file is large enough to be purged
+			   online. Do it after the sync lock is released, so
+			   most of the copying doesn't block other
+			   sessions. */
+			purge_file_seq = index->cache->need_purge_file_seq;
+			purge_reason = reason;
+		} else {
+			if (mail_cache_purge(index->cache,
+					     index->cache->need_purge_file_seq,
+					     reason) < 0) {
+				/* can't really do anything if it fails */
+			}
+			/* Make sure the newly committed cache record offsets
+			   are updated to the current index. This is important
+			   if the dovecot.index gets recreated below, because
+			   rotation of dovecot.index.log also re-maps the
+			   index to make sure everything is up-to-date. But if
+			   it wasn't, mail_index_write() will just
+			   assert-crash because log_file_head_offset
+			   changed. */
+			if (mail_index_map(ctx->index,
+					   MAIL_INDEX_SYNC_HANDLER_FILE) <= 0)
+				ret = -1;
 		}
-		/* Make sure the newly committed cache record offsets are
-		   updated to the current index. This is important if the
-		   dovecot.index gets recreated below, because rotation of
-		   dovecot.index.log also re-maps the index to make sure
-		   everything is up-to-date. But if it wasn't,
-		   mail_index_write() will just assert-crash because
-		   log_file_head_offset changed. */
-		if (mail_index_map(ctx->index, MAIL_INDEX_SYNC_HANDLER_FILE) <= 0)
-			ret = -1;
 	}
 
 	/* Log rotation is allowed only if everything was synced. Note that
@@ -983,6 +995,13 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 		mail_index_write(index, want_rotate, reason);
 	}
 	mail_index_sync_end(_ctx);
+
+	if (purge_reason != NULL) {
+		if (mail_cache_purge(index->cache, purge_file_seq,
+				     purge_reason) < 0) {
+			/* can't really do anything if it fails */
+		}
+	}
 	return ret;
 }
 
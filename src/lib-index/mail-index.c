@@ -214,6 +214,9 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->cache.max_size = set->cache.max_size;
 	if (set->cache.purge_min_size != 0)
 		dest->cache.purge_min_size = set->cache.purge_min_size;
+	if (set->cache.purge_online_min_size != 0)
+		dest->cache.purge_online_min_size =
+			set->cache.purge_online_min_size;
 	if (set->cache.purge_delete_percentage != 0)
 		dest->cache.purge_delete_percentage =
 			set->cache.purge_delete_percentage;
@@ -228,6 +231,7 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 
 	dest->cache.max_header_name_length = set->cache.max_header_name_length;
 	dest->cache.max_headers_count = set->cache.max_headers_count;
+	dest->cache.fixed_size_columns = set->cache.fixed_size_columns;
 }
 
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
@@ -346,6 +346,10 @@ struct mail_index_cache_optimization_settings {
 	uoff_t max_size;
 	/* Never purge the file if it's smaller than this */
 	uoff_t purge_min_size;
+	/* Copy cache files at least this large without locking the index,
+	   and lock it only for switching over to the new file. 0 = always
+	   purge while locked. */
+	uoff_t purge_online_min_size;
 	/* Purge the file when n% of records are deleted */
 	unsigned int purge_delete_percentage;
 	/* Purge the file when n% of rows contain continued rows.
@@ -355,6 +359,10 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+
+	/* Store small fixed size fields as index record extensions instead
+	   of the cache file. */
+	bool fixed_size_columns;
 };
 
 struct mail_index_optimization_settings {
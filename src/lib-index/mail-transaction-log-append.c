@@ -2,10 +2,14 @@
 
 #include "lib.h"
 #include "array.h"
+#include "read-full.h"
 #include "write-full.h"
+#include "file-lock.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
+#include <sys/stat.h>
+
 void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx,
 				     enum mail_transaction_type type,
 				     const void *data, size_t size)
@@ -59,6 +63,14 @@ log_buffer_move_to_memory(struct mail_transaction_log_append_ctx *ctx)
 	return 0;
 }
 
+static bool log_buffer_want_fsync(struct mail_transaction_log_append_ctx *ctx)
+{
+	enum fsync_mode fsync_mode = ctx->log->index->set.fsync_mode;
+
+	return (ctx->want_fsync && fsync_mode != FSYNC_MODE_NEVER) ||
+		fsync_mode == FSYNC_MODE_ALWAYS;
+}
+
 static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 {
 	struct mail_transaction_log_file *file = ctx->log->head;
@@ -84,10 +96,13 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 		return log_buffer_move_to_memory(ctx);
 	}
 
-	if ((ctx->want_fsync &&
-	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
-	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+	if (log_buffer_want_fsync(ctx)) {
+		if (!ctx->log->index->log_sync_locked) {
+			/* do it after the log is unlocked */
+			ctx->fsync_pending = TRUE;
+			ctx->fsync_offset = file->sync_offset +
+				ctx->output->used;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -236,6 +251,129 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 	return 0;
 }
 
+static const char *log_fsync_get_path(struct mail_transaction_log *log)
+{
+	return t_strconcat(log->filepath, MAIL_TRANSACTION_LOG_FSYNC_SUFFIX,
+			   NULL);
+}
+
+static int log_fsync_open(struct mail_transaction_log *log)
+{
+	struct mail_index *index = log->index;
+	const char *path = log_fsync_get_path(log);
+	mode_t old_mask;
+
+	if (log->fsync_fd != -1)
+		return 0;
+	if (log->fsync_open_failed)
+		return -1;
+
+	old_mask = umask(index->set.mode ^ 0666);
+	log->fsync_fd = open(path, O_RDWR | O_CREAT, 0666);
+	umask(old_mask);
+	if (log->fsync_fd == -1) {
+		/* don't log the same error for each commit */
+		mail_index_file_set_syscall_error(index, path, "open()");
+		log->fsync_open_failed = TRUE;
+		return -1;
+	}
+	mail_index_fchown(index, log->fsync_fd, path);
+	return 0;
+}
+
+/* Group commit: The processes that appended to the log take turns holding
+   the .log.fsync lock. The one holding it fdatasync()s everything written
+   to the log so far and records the synced offset to the .log.fsync file.
+   The processes that were waiting for the lock meanwhile usually find their
+   transactions already synced, and skip their own fdatasync().
+
+   Returns 1 if the log is synced up to end_offset, 0 if the group commit
+   couldn't be used, -1 if fdatasync() failed. */
+static int
+log_file_group_fsync(struct mail_transaction_log *log, uoff_t end_offset)
+{
+	struct mail_transaction_log_file *file = log->head;
+	struct mail_index *index = log->index;
+	struct mail_transaction_log_fsync_state state;
+	struct file_lock *lock;
+	struct stat st;
+	const char *path, *error;
+	int ret;
+
+	if (index->set.lock_method == FILE_LOCK_METHOD_DOTLOCK)
+		return 0;
+	if (log_fsync_open(log) < 0)
+		return 0;
+
+	path = log_fsync_get_path(log);
+	struct file_lock_settings lock_set = {
+		.lock_method = index->set.lock_method,
+	};
+	ret = file_wait_lock(log->fsync_fd, path, F_WRLCK, &lock_set,
+			     MAIL_TRANSACTION_LOG_LOCK_TIMEOUT, &lock, &error);
+	if (ret <= 0) {
+		e_error(index->event, "%s", error);
+		return 0;
+	}
+
+	ret = pread_full(log->fsync_fd, &state, sizeof(state), 0);
+	if (ret < 0)
+		mail_index_file_set_syscall_error(index, path, "pread()");
+	else if (ret > 0 && state.indexid == file->hdr.indexid &&
+		 state.file_seq == file->hdr.file_seq &&
+		 state.create_stamp == file->hdr.create_stamp &&
+		 state.offset >= end_offset) {
+		/* synced by another process */
+		file_unlock(&lock);
+		return 1;
+	}
+
+	/* everything written to the log before fdatasync() gets synced */
+	if (fstat(file->fd, &st) < 0) {
+		mail_index_file_set_syscall_error(index, file->filepath,
+						  "fstat()");
+		st.st_size = end_offset;
+	}
+	if (fdatasync(file->fd) < 0) {
+		mail_index_file_set_syscall_error(index, file->filepath,
+						  "fdatasync()");
+		file_unlock(&lock);
+		return -1;
+	}
+
+	i_zero(&state);
+	state.indexid = file->hdr.indexid;
+	state.file_seq = file->hdr.file_seq;
+	state.create_stamp = file->hdr.create_stamp;
+	state.offset = I_MAX((uoff_t)st.st_size, end_offset);
+	if (pwrite_full(log->fsync_fd, &state, sizeof(state), 0) < 0)
+		mail_index_file_set_syscall_error(index, path, "pwrite()");
+	file_unlock(&lock);
+	return 1;
+}
+
+static int
+log_file_fsync_after_unlock(struct mail_transaction_log *log,
+			    uoff_t end_offset)
+{
+	struct mail_transaction_log_file *file = log->head;
+	int ret;
+
+	i_assert(!MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file));
+
+	ret = log_file_group_fsync(log, end_offset);
+	if (ret != 0)
+		return ret < 0 ? -1 : 0;
+
+	if (fdatasync(file->fd) < 0) {
+		mail_index_file_set_syscall_error(log->index,
+						  file->filepath,
+						  "fdatasync()");
+		return -1;
+	}
+	return 0;
+}
+
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **_ctx)
 {
 	struct mail_transaction_log_append_ctx *ctx = *_ctx;
@@ -247,6 +385,15 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
 		mail_transaction_log_file_unlock(index->log->head, "appending");
+	if (ctx->fsync_pending &&
+	    log_file_fsync_after_unlock(ctx->log, ctx->fsync_offset) < 0) {
+		/* The transaction is already visible to other processes and
+		   can't be removed from the log anymore. Still, the caller
+		   needs to know that it may not be durable. Stop using the
+		   index files, since the written data can't be trusted. */
+		(void)mail_index_move_to_memory(index);
+		ret = -1;
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -11,6 +11,8 @@ struct dotlock_settings;
 #define MAIL_TRANSACTION_LOG_LOCK_TIMEOUT (3*60)
 #define MAIL_TRANSACTION_LOG_DOTLOCK_CHANGE_TIMEOUT (3*60)
 
+#define MAIL_TRANSACTION_LOG_FSYNC_SUFFIX ".fsync"
+
 #define MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file) ((file)->fd == -1)
 
 #define LOG_FILE_MODSEQ_CACHE_SIZE 10
@@ -104,6 +106,16 @@ struct mail_transaction_log_file {
 	bool corrupted:1;
 };
 
+/* Contents of the .log.fsync file: The log file was fdatasync()ed up to
+   offset by some process. */
+struct mail_transaction_log_fsync_state {
+	uint32_t indexid;
+	uint32_t file_seq;
+	uint32_t create_stamp;
+	uint32_t unused_padding;
+	uint64_t offset;
+};
+
 struct mail_transaction_log {
 	struct mail_index *index;
 	/* Linked list of all transaction log views */
@@ -133,6 +145,12 @@ struct mail_transaction_log {
 	int dotlock_refcount;
 	struct dotlock *dotlock;
 
+	/* .log.fsync file used for group commits, or -1 if not opened */
+	int fsync_fd;
+	/* Opening .log.fsync failed and the error was logged. Group commits
+	   aren't used by this session. */
+	bool fsync_open_failed:1;
+
 	/* This session has already checked whether an old .log.2 should be
 	   unlinked. */
 	bool log_2_unlink_checked:1;
@@ -32,6 +32,7 @@ mail_transaction_log_alloc(struct mail_index *index)
 
 	log = i_new(struct mail_transaction_log, 1);
 	log->index = index;
+	log->fsync_fd = -1;
 	return log;
 }
 
@@ -144,6 +145,7 @@ void mail_transaction_log_close(struct mail_transaction_log *log)
 		log->head->refcount--;
 	mail_transaction_logs_clean(log);
 	i_assert(log->files == NULL);
+	i_close_fd(&log->fsync_fd);
 }
 
 void mail_transaction_log_free(struct mail_transaction_log **_log)
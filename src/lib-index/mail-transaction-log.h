@@ -369,6 +369,11 @@ struct mail_transaction_log_append_ctx {
 	bool sync_includes_this:1;
 	/* fdatasync() after writing the transaction. */
 	bool want_fsync:1;
+	/* The transaction was written, but fdatasync() is still needed. It's
+	   done after the log is unlocked as a group commit. */
+	bool fsync_pending:1;
+	/* Log offset after the written transaction */
+	uoff_t fsync_offset;
 };
 
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
@@ -457,6 +462,12 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx,
 				     enum mail_transaction_type type,
 				     const void *data, size_t size);
+/* Write the transaction to the log. If it needs to be fdatasync()ed, that's
+   done only after the log is unlocked, so the other processes can append
+   meanwhile and share the fdatasync() (group commit). This means that the
+   transaction is already visible to other processes before it's durable.
+   If the fdatasync() fails, -1 is returned even though the transaction can
+   no longer be rolled back. */
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **ctx);
 
 /* Lock transaction log for index synchronization. This is used as the main
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "array.h"
+#include "lib-event-private.h"
 #include "test-common.h"
 #include "test-mail-cache.h"
 
@@ -975,22 +976,48 @@ static void test_mail_cache_update_need_purge_continued_records2(void)
 	test_end();
 }
 
+static unsigned int test_online_purge_count;
+
+static bool
+test_online_purge_event_callback(struct event *event,
+				 enum event_callback_type type,
+				 struct failure_context *ctx,
+				 const char *fmt ATTR_UNUSED,
+				 va_list args ATTR_UNUSED)
+{
+	if (type != EVENT_CALLBACK_TYPE_SEND)
+		return TRUE;
+	/* only online purges add locked_msecs */
+	if (null_strcmp(event->sending_name,
+			"mail_cache_purge_finished") == 0 &&
+	    event_find_field_recursive(event, "locked_msecs") != NULL)
+		test_online_purge_count++;
+	/* don't log the forced debug messages */
+	return ctx->type != LOG_TYPE_DEBUG;
+}
+
 static void
-test_mail_cache_update_need_purge_deleted_records_int(bool big_min_size)
+test_mail_cache_update_need_purge_deleted_records_int(bool big_min_size,
+						      bool online)
 {
 	struct mail_index_optimization_settings optimization_set = {
 		.cache = {
 			.purge_min_size = big_min_size ? 1024*1024 : 1,
 			.purge_delete_percentage = 30,
+			.purge_online_min_size = online ? 1 : 0,
 		},
 	};
 	char value[30];
 	struct mail_index_transaction *trans;
 	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
 	uint32_t seq;
 
 	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
 	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_online_purge_count = 0;
+	event_set_forced_debug(ctx.cache->event, TRUE);
+	event_register_callback(test_online_purge_event_callback);
 
 	for (seq = 1; seq <= 100; seq++) {
 		i_snprintf(value, sizeof(value), "foo%d", seq);
@@ -1015,7 +1042,8 @@ test_mail_cache_update_need_purge_deleted_records_int(bool big_min_size)
 	trans = mail_index_transaction_begin(ctx.view, 0);
 	mail_index_expunge(trans, 1);
 	test_assert(mail_index_transaction_commit(&trans) == 0);
-	/* syncing will internally purge if !big_min_size */
+	/* syncing will internally purge if !big_min_size. With online
+	   purging it's done after the index is unlocked. */
 	test_mail_cache_index_sync(&ctx);
 
 	test_assert(ctx.cache->need_purge_file_seq == 0);
@@ -1025,7 +1053,16 @@ test_mail_cache_update_need_purge_deleted_records_int(bool big_min_size)
 		test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
 	else
 		test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(test_online_purge_count ==
+		    (online && !big_min_size ? 1 : 0));
+
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field.idx, "foo31"));
+	test_assert(cache_equals(cache_view, 70, ctx.cache_field.idx, "foo100"));
+	mail_cache_view_close(&cache_view);
 
+	event_unregister_callback(test_online_purge_event_callback);
 	test_mail_cache_deinit(&ctx);
 	test_mail_index_delete();
 }
@@ -1033,14 +1070,235 @@ test_mail_cache_update_need_purge_deleted_records_int(bool big_min_size)
 static void test_mail_cache_update_need_purge_deleted_records(void)
 {
 	test_begin("mail cache update need purge deleted records");
-	test_mail_cache_update_need_purge_deleted_records_int(FALSE);
+	test_mail_cache_update_need_purge_deleted_records_int(FALSE, FALSE);
 	test_end();
 }
 
 static void test_mail_cache_update_need_purge_deleted_records2(void)
 {
 	test_begin("mail cache update need purge deleted records (2)");
-	test_mail_cache_update_need_purge_deleted_records_int(TRUE);
+	test_mail_cache_update_need_purge_deleted_records_int(TRUE, FALSE);
+	test_end();
+}
+
+static void test_mail_cache_update_need_purge_deleted_records_online(void)
+{
+	test_begin("mail cache update need purge deleted records (online)");
+	test_mail_cache_update_need_purge_deleted_records_int(FALSE, TRUE);
+	test_end();
+}
+
+static void test_mail_cache_purge_online2(int fd, bool add_new_field)
+{
+	const struct mail_cache_field cache_field_qux = {
+		.name = "qux",
+		.type = MAIL_CACHE_FIELD_STRING,
+		.decision = MAIL_CACHE_DECISION_YES,
+	};
+	struct mail_cache_field new_field = cache_field_qux;
+	struct test_mail_cache_ctx ctx;
+	uint32_t log_seq;
+	uoff_t log_offset;
+
+	i_set_failure_prefix("index2: ");
+	test_mail_cache_init(test_mail_index_open(FALSE), &ctx);
+
+	/* lock the index and let the 1st index start purging */
+	test_assert(mail_transaction_log_sync_lock(ctx.index->log, "test", &log_seq, &log_offset) == 0);
+	if (write(fd, "", 1) != 1)
+		i_fatal("write() failed: %m");
+	/* Wait a bit to make sure the parent has copied the cache. It's then
+	   supposed to be waiting on the locked .log file. */
+	usleep(100000);
+
+	/* change the cache while the copy is being made */
+	if (!add_new_field)
+		test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	else {
+		mail_cache_register_fields(ctx.cache, &new_field, 1,
+					   MAIL_CACHE_TRUNCATE_NAME_FAIL);
+		test_mail_cache_add_field(&ctx, 1, new_field.idx, "qux1");
+	}
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo4");
+	mail_transaction_log_sync_unlock(ctx.index->log, "test");
+	test_mail_cache_deinit(&ctx);
+}
+
+static void test_mail_cache_purge_online_int(bool add_new_field)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_online_min_size = 1,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	int fds[2], status;
+	char c;
+
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+
+	if (pipe(fds) < 0)
+		i_fatal("pipe() failed: %m");
+	switch (fork()) {
+	case (pid_t)-1:
+		i_fatal("fork() failed: %m");
+	case 0:
+		i_close_fd(&fds[0]);
+		test_mail_cache_purge_online2(fds[1], add_new_field);
+		i_close_fd(&fds[1]);
+		/* cleanup so valgrind doesn't complain about memory leaks */
+		test_mail_cache_deinit(&ctx);
+		test_exit(test_has_failed() ? 10 : 0);
+	default:
+		break;
+	}
+	i_close_fd(&fds[1]);
+	if (read(fds[0], &c, 1) != 1)
+		i_fatal("read() failed: %m");
+	i_close_fd(&fds[0]);
+
+	/* the cache is copied while the child has the index locked, and
+	   switched over to after the child has changed it */
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+
+	/* wait for child to finish execution */
+	if (wait(&status) == -1)
+		i_error("wait() failed: %m");
+	test_assert(status == 0);
+
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field.idx, "foo1"));
+	if (!add_new_field)
+		test_assert(cache_equals(cache_view, 1, ctx.cache_field2.idx, "bar1"));
+	test_assert(cache_equals(cache_view, 2, ctx.cache_field.idx, "foo2"));
+	test_assert(cache_equals(cache_view, 3, ctx.cache_field.idx, "foo3"));
+	test_assert(cache_equals(cache_view, 4, ctx.cache_field.idx, "foo4"));
+	mail_cache_view_close(&cache_view);
+
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(ctx.cache->hdr->record_count == 4);
+	/* Without the new field the copy of the changed mail 1 is left as
+	   deleted. With it the cache is purged again while locked. */
+	test_assert(ctx.cache->hdr->deleted_record_count ==
+		    (add_new_field ? 0 : 1));
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+}
+
+static void test_mail_cache_purge_online(void)
+{
+	test_begin("mail cache purge online");
+	test_mail_cache_purge_online_int(FALSE);
+	test_end();
+}
+
+static void test_mail_cache_purge_online_fields_changed(void)
+{
+	test_begin("mail cache purge online (fields changed)");
+	test_mail_cache_purge_online_int(TRUE);
+	test_end();
+}
+
+static void test_mail_cache_purge_online_lock_failed2(int lock_fd, int wait_fd)
+{
+	struct test_mail_cache_ctx ctx;
+	uint32_t log_seq;
+	uoff_t log_offset;
+	char c;
+
+	i_set_failure_prefix("index2: ");
+	test_mail_cache_init(test_mail_index_open(FALSE), &ctx);
+
+	/* keep the index locked until the parent has tried to purge */
+	test_assert(mail_transaction_log_sync_lock(ctx.index->log, "test", &log_seq, &log_offset) == 0);
+	if (write(lock_fd, "", 1) != 1)
+		i_fatal("write() failed: %m");
+	if (read(wait_fd, &c, 1) < 0)
+		i_fatal("read() failed: %m");
+	mail_transaction_log_sync_unlock(ctx.index->log, "test");
+	test_mail_cache_deinit(&ctx);
+}
+
+static void test_mail_cache_purge_online_lock_failed(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_online_min_size = 1,
+			.unaccessed_field_drop_secs = 61,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_field_private *priv;
+	int lock_fds[2], wait_fds[2], status;
+	char c;
+
+	test_begin("mail cache purge online (log lock fails)");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+
+	/* the field hasn't been used for a while, so the purge changes its
+	   decision from yes to temp */
+	uint32_t day_stamp = 123456789;
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, day_stamp),
+		&day_stamp, sizeof(day_stamp), FALSE);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	priv = &ctx.cache->fields[ctx.cache_field.idx];
+	priv->field.last_used = day_stamp -
+		optimization_set.cache.unaccessed_field_drop_secs - 1;
+	/* the yes decision is already in the file */
+	priv->decision_dirty = FALSE;
+
+	if (pipe(lock_fds) < 0 || pipe(wait_fds) < 0)
+		i_fatal("pipe() failed: %m");
+	switch (fork()) {
+	case (pid_t)-1:
+		i_fatal("fork() failed: %m");
+	case 0:
+		i_close_fd(&lock_fds[0]);
+		i_close_fd(&wait_fds[1]);
+		test_mail_cache_purge_online_lock_failed2(lock_fds[1],
+							  wait_fds[0]);
+		i_close_fd(&lock_fds[1]);
+		i_close_fd(&wait_fds[0]);
+		/* cleanup so valgrind doesn't complain about memory leaks */
+		test_mail_cache_deinit(&ctx);
+		test_exit(test_has_failed() ? 10 : 0);
+	default:
+		break;
+	}
+	i_close_fd(&lock_fds[1]);
+	i_close_fd(&wait_fds[0]);
+	if (read(lock_fds[0], &c, 1) != 1)
+		i_fatal("read() failed: %m");
+	i_close_fd(&lock_fds[0]);
+
+	/* the cache is copied, but locking the index fails afterwards */
+	mail_index_set_lock_method(ctx.index, ctx.index->set.lock_method, 0);
+	test_expect_error_string("Timeout (0s) while waiting for lock");
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") < 0);
+	test_expect_no_more_errors();
+	/* the decision changed by the copy is reverted */
+	test_assert(priv->field.decision == MAIL_CACHE_DECISION_YES);
+	i_close_fd(&wait_fds[1]);
+
+	/* wait for child to finish execution */
+	if (wait(&status) == -1)
+		i_error("wait() failed: %m");
+	test_assert(status == 0);
+
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
 	test_end();
 }
 
@@ -1108,6 +1366,10 @@ int main(void)
 		test_mail_cache_update_need_purge_continued_records2,
 		test_mail_cache_update_need_purge_deleted_records,
 		test_mail_cache_update_need_purge_deleted_records2,
+		test_mail_cache_update_need_purge_deleted_records_online,
+		test_mail_cache_purge_online,
+		test_mail_cache_purge_online_fields_changed,
+		test_mail_cache_purge_online_lock_failed,
 		test_mail_cache_purge_deadlines,
 		NULL
 	};
@@ -806,6 +806,134 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static void test_mail_cache_fixed_size_columns(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.fixed_size_columns = TRUE,
+		},
+	};
+	struct mail_cache_field cache_fields[] = {
+		{
+			.name = "fixed.size",
+			.type = MAIL_CACHE_FIELD_FIXED_SIZE,
+			.field_size = 8,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+	};
+	const uint8_t fixed_data1[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	const uint8_t fixed_data2[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	uint32_t ext_id;
+
+	test_begin("mail cache fixed size columns");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_cache_register_fields(ctx.cache, cache_fields,
+				   N_ELEMENTS(cache_fields),
+				   unsafe_data_stack_pool);
+	unsigned int field_idx = cache_fields[0].idx;
+
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+
+	/* mail 1 gets the field written to the cache file */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 1, field_idx,
+		       fixed_data1, sizeof(fixed_data1));
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	/* mail 2 gets the field written to the column */
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 2, field_idx,
+		       fixed_data2, sizeof(fixed_data2));
+	/* the uncommitted value is visible */
+	test_assert(mail_cache_field_exists(cache_view, 2, field_idx) == 1);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_ext_lookup(ctx.index, "cache-fixed_size",
+					  &ext_id));
+	test_mail_cache_view_sync(&ctx);
+
+	const unsigned char *data;
+	const void *rec;
+	bool expunged;
+	mail_index_lookup_ext(ctx.view, 1, ext_id, &rec, &expunged);
+	data = rec;
+	test_assert(data != NULL && data[0] == 0);
+	mail_index_lookup_ext(ctx.view, 2, ext_id, &rec, &expunged);
+	data = rec;
+	test_assert(data != NULL && data[0] == 1);
+
+	buffer_t *buf = t_buffer_create(16);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 1, field_idx) == 1);
+	test_assert(buf->used == sizeof(fixed_data1) &&
+		    memcmp(buf->data, fixed_data1, buf->used) == 0);
+	buffer_set_used_size(buf, 0);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 2, field_idx) == 1);
+	test_assert(buf->used == sizeof(fixed_data2) &&
+		    memcmp(buf->data, fixed_data2, buf->used) == 0);
+	test_assert(mail_cache_field_exists(cache_view, 3, field_idx) == 0);
+
+	/* purging moves mail 1's field to the column */
+	mail_cache_view_close(&cache_view);
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	mail_cache_lookup_iter_init(cache_view, 1, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		test_assert(field.field_idx != field_idx);
+
+	mail_index_lookup_ext(ctx.view, 1, ext_id, &rec, &expunged);
+	data = rec;
+	test_assert(data != NULL && data[0] == 1 &&
+		    memcmp(data + 1, fixed_data1, sizeof(fixed_data1)) == 0);
+
+	buffer_set_used_size(buf, 0);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 1, field_idx) == 1);
+	test_assert(buf->used == sizeof(fixed_data1) &&
+		    memcmp(buf->data, fixed_data1, buf->used) == 0);
+	buffer_set_used_size(buf, 0);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 1,
+					    ctx.cache_field.idx) == 1);
+	test_assert(buf->used == 4 && memcmp(buf->data, "foo1", 4) == 0);
+
+	/* purging clears the column once the field's decision becomes no */
+	mail_cache_view_close(&cache_view);
+	ctx.cache->fields[field_idx].field.decision = MAIL_CACHE_DECISION_NO;
+	ctx.cache->fields[field_idx].decision_dirty = TRUE;
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+
+	mail_index_lookup_ext(ctx.view, 1, ext_id, &rec, &expunged);
+	data = rec;
+	test_assert(data != NULL && data[0] == 0);
+	mail_index_lookup_ext(ctx.view, 2, ext_id, &rec, &expunged);
+	data = rec;
+	test_assert(data != NULL && data[0] == 0);
+	test_assert(mail_cache_field_exists(cache_view, 1, field_idx) == 0);
+	test_assert(mail_cache_field_exists(cache_view, 2, field_idx) == 0);
+	buffer_set_used_size(buf, 0);
+	test_assert(mail_cache_lookup_field(cache_view, buf, 1,
+					    ctx.cache_field.idx) == 1);
+	test_assert(buf->used == 4 && memcmp(buf->data, "foo1", 4) == 0);
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +948,7 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_fixed_size_columns,
 		NULL
 	};
 	return test_run(test_functions);
@@ -9,11 +9,14 @@
 #include <sys/stat.h>
 
 static bool log_lock_failure = FALSE;
+static bool moved_to_memory = FALSE;
+static unsigned int syscall_error_count = 0;
 
 void mail_index_file_set_syscall_error(struct mail_index *index ATTR_UNUSED,
 				       const char *filepath ATTR_UNUSED,
 				       const char *function ATTR_UNUSED)
 {
+	syscall_error_count++;
 }
 
 int mail_transaction_log_lock_head(struct mail_transaction_log *log ATTR_UNUSED,
@@ -36,9 +39,15 @@ void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 
 int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 {
+	moved_to_memory = TRUE;
 	return -1;
 }
 
+void mail_index_fchown(struct mail_index *index ATTR_UNUSED,
+		       int fd ATTR_UNUSED, const char *path ATTR_UNUSED)
+{
+}
+
 static void test_append_expunge(struct mail_transaction_log *log)
 {
 	static unsigned int buf[] = { 0x12345678, 0xabcdef09 };
@@ -116,6 +125,96 @@ static void test_append_sync_offset(struct mail_transaction_log *log)
 	test_end();
 }
 
+static void test_append_fsync_state(struct mail_transaction_log *log,
+				    struct mail_transaction_log_fsync_state *state_r)
+{
+	if (pread(log->fsync_fd, state_r, sizeof(*state_r), 0) != sizeof(*state_r))
+		i_fatal("pread() failed: %m");
+}
+
+static int test_append_one(struct mail_transaction_log *log)
+{
+	static unsigned int buf = 0x12345678;
+	struct mail_transaction_log_append_ctx *ctx;
+
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf, sizeof(buf));
+	return mail_transaction_log_append_commit(&ctx);
+}
+
+static void test_append_group_fsync(struct mail_transaction_log *log)
+{
+	struct mail_transaction_log_file *file = log->head;
+	struct mail_transaction_log_fsync_state state;
+	int fds[2];
+
+	test_begin("transaction log append: group fsync");
+	log->filepath = i_strdup(".test-transaction-log");
+	log->index->set.fsync_mode = FSYNC_MODE_ALWAYS;
+	file->hdr.indexid = 123;
+	file->hdr.file_seq = 2;
+	file->hdr.create_stamp = 1000;
+	file->fd = test_create_temp_fd();
+	file->sync_offset = file->buffer_offset = file->last_size = 0;
+	buffer_set_used_size(file->buffer, 0);
+
+	/* the synced offset is recorded */
+	test_assert(test_append_one(log) == 0);
+	test_append_fsync_state(log, &state);
+	test_assert(state.indexid == 123 && state.file_seq == 2 &&
+		    state.create_stamp == 1000);
+	test_assert(state.offset == file->sync_offset);
+
+	/* transaction already synced by another process */
+	state.offset = 1000000;
+	if (pwrite(log->fsync_fd, &state, sizeof(state), 0) != sizeof(state))
+		i_fatal("pwrite() failed: %m");
+	test_assert(test_append_one(log) == 0);
+	test_append_fsync_state(log, &state);
+	test_assert(state.offset == 1000000);
+	test_assert(file->sync_offset < 1000000);
+
+	/* the state is for a different log file */
+	file->hdr.file_seq = 3;
+	test_assert(test_append_one(log) == 0);
+	test_append_fsync_state(log, &state);
+	test_assert(state.file_seq == 3);
+	test_assert(state.offset == file->sync_offset);
+	i_close_fd(&file->fd);
+
+	/* fdatasync() failure fails the commit, even though it's already
+	   visible */
+	if (pipe(fds) < 0)
+		i_fatal("pipe() failed: %m");
+	file->fd = fds[1];
+	test_assert(test_append_one(log) < 0);
+	test_assert(moved_to_memory);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	file->fd = -1;
+
+	i_close_fd(&log->fsync_fd);
+	i_unlink(t_strconcat(log->filepath, MAIL_TRANSACTION_LOG_FSYNC_SUFFIX,
+			     NULL));
+	i_free(log->filepath);
+
+	/* .log.fsync can't be created: the error is logged only once, and
+	   the commits are synced without the group commit */
+	log->filepath = i_strdup(".test-nonexistent/transaction-log");
+	file->fd = test_create_temp_fd();
+	syscall_error_count = 0;
+	test_assert(test_append_one(log) == 0);
+	test_assert(test_append_one(log) == 0);
+	test_assert(syscall_error_count == 1);
+	test_assert(log->fsync_fd == -1);
+	i_close_fd(&file->fd);
+	i_free(log->filepath);
+
+	log->index->set.fsync_mode = FSYNC_MODE_OPTIMIZED;
+	test_end();
+}
+
 static void test_mail_transaction_log_append(void)
 {
 	struct mail_transaction_log *log;
@@ -130,6 +229,7 @@ static void test_mail_transaction_log_append(void)
 	log = i_new(struct mail_transaction_log, 1);
 	log->index = i_new(struct mail_index, 1);
 	log->index->log = log;
+	log->fsync_fd = -1;
 	log->head = file = i_new(struct mail_transaction_log_file, 1);
 	file->fd = -1;
 
@@ -156,6 +256,8 @@ static void test_mail_transaction_log_append(void)
 	file->fd = -1;
 	test_end();
 
+	test_append_group_fsync(log);
+
 	buffer_free(&log->head->buffer);
 	i_free(log->head);
 	i_free(log->index);
@@ -0,0 +1,278 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "message-parser.h"
+#include "message-part.h"
+#include "message-scan.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**
+ * Parses a corpus of mails with each message scanning implementation
+ * supported by this CPU and prints the throughput of each. The corpus is
+ * given as a list of files and directories (e.g. Maildir's cur/), each file
+ * containing a single mail. Without any parameters a synthetic corpus of
+ * plain text and multipart mails is generated.
+ */
+
+#define DEFAULT_ROUNDS 10
+#define SYNTHETIC_MAIL_COUNT 1000
+
+struct bench_mail {
+	buffer_t *data;
+	struct message_part *parts;
+};
+
+static ARRAY(struct bench_mail) bench_mails;
+static uint64_t bench_total_size;
+
+static void bench_add_mail(buffer_t *data)
+{
+	struct bench_mail *mail = array_append_space(&bench_mails);
+
+	mail->data = data;
+	bench_total_size += data->used;
+}
+
+static void bench_add_file(const char *path)
+{
+	struct istream *input;
+	const unsigned char *data;
+	buffer_t *buf;
+	size_t size;
+	ssize_t ret;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	buf = buffer_create_dynamic(default_pool, 4096);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(buf, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		i_fatal("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+	bench_add_mail(buf);
+}
+
+static void bench_add_path(const char *path)
+{
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	if (!S_ISDIR(st.st_mode)) {
+		bench_add_file(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		T_BEGIN {
+			const char *file_path =
+				t_strconcat(path, "/", d->d_name, NULL);
+
+			if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode))
+				bench_add_file(file_path);
+		} T_END;
+	}
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+}
+
+static void bench_append_text(string_t *str, unsigned int lines)
+{
+	unsigned int i, j, words;
+
+	for (i = 0; i < lines; i++) {
+		words = i_rand_limit(15);
+		for (j = 0; j < words; j++) {
+			str_printfa(str, "%.*s ", (int)i_rand_limit(10) + 1,
+				    "lorem ipsum dolor sit amet");
+		}
+		str_append(str, "\r\n");
+	}
+}
+
+static void bench_append_base64(string_t *str, unsigned int lines)
+{
+	unsigned int i;
+
+	for (i = 0; i < lines; i++) {
+		str_append(str, "VGhpcyBpcyBub3QgYW4gYXR0YWNobWVudCwganVzdCBzb21l"
+			   "IGJhc2U2NCBlbmNvZGVkIHRleHQgZm9yIHRoZSBiZW5jaGEu\r\n");
+	}
+}
+
+static void bench_add_synthetic(unsigned int count)
+{
+	unsigned int i;
+	string_t *str;
+
+	for (i = 0; i < count; i++) {
+		str = str_new(default_pool, 8192);
+		str_printfa(str,
+			"Return-Path: <sender%u@example.org>\r\n"
+			"Received: from mx.example.org (mx.example.org [192.0.2.1])\r\n"
+			"\tby mail.example.com with LMTP id %u\r\n"
+			"\tfor <user@example.com>; Mon, 1 Jun 2026 12:00:00 +0000\r\n"
+			"From: Sender %u <sender%u@example.org>\r\n"
+			"To: User <user@example.com>\r\n"
+			"Subject: Benchmark mail %u\r\n"
+			"Date: Mon, 1 Jun 2026 12:00:00 +0000\r\n"
+			"Message-ID: <%u@example.org>\r\n"
+			"MIME-Version: 1.0\r\n", i, i, i, i, i, i);
+		if (i % 2 == 0) {
+			str_append(str, "Content-Type: text/plain; charset=utf-8\r\n\r\n");
+			bench_append_text(str, i_rand_limit(200) + 1);
+		} else {
+			str_append(str,
+				"Content-Type: multipart/mixed; boundary=\"=-bench-boundary\"\r\n"
+				"\r\n"
+				"This is a multi-part message in MIME format.\r\n"
+				"--=-bench-boundary\r\n"
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n");
+			bench_append_text(str, i_rand_limit(100) + 1);
+			str_append(str,
+				"--=-bench-boundary\r\n"
+				"Content-Type: application/octet-stream; name=\"file.bin\"\r\n"
+				"Content-Transfer-Encoding: base64\r\n"
+				"Content-Disposition: attachment; filename=\"file.bin\"\r\n"
+				"\r\n");
+			bench_append_base64(str, i_rand_limit(1000) + 1);
+			str_append(str, "--=-bench-boundary--\r\n");
+		}
+		bench_add_mail(str);
+	}
+}
+
+static struct message_part *
+bench_parse_mail(pool_t pool, const buffer_t *data)
+{
+	const struct message_parser_settings set = { .flags = 0 };
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct message_part *parts;
+	struct istream *input;
+
+	input = i_stream_create_from_data(data->data, data->used);
+	parser = message_parser_init(pool, input, &set);
+	while (message_parser_parse_next_block(parser, &block) > 0) ;
+	message_parser_deinit(&parser, &parts);
+	i_stream_unref(&input);
+	return parts;
+}
+
+static void
+bench_check_parts(enum message_scan_impl impl, pool_t parts_pool,
+		  struct bench_mail *mail, struct message_part *parts)
+{
+	if (mail->parts == NULL) {
+		/* first implementation: remember the result */
+		mail->parts = bench_parse_mail(parts_pool, mail->data);
+	} else if (!message_part_is_equal(mail->parts, parts)) {
+		i_fatal("%s: parsed message parts differ",
+			message_scan_impl_get_name(impl));
+	}
+}
+
+static void
+bench_message_parser_impl(enum message_scan_impl impl, pool_t parts_pool,
+			  unsigned int rounds)
+{
+	struct bench_mail *mail;
+	struct message_part *parts;
+	uint64_t ts_0, nsecs;
+	unsigned int i;
+	pool_t pool;
+
+	pool = pool_alloconly_create("bench message parser", 10240);
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		array_foreach_modifiable(&bench_mails, mail) {
+			parts = bench_parse_mail(pool, mail->data);
+			if (i == 0)
+				bench_check_parts(impl, parts_pool, mail, parts);
+			p_clear(pool);
+		}
+	}
+	nsecs = i_nanoseconds() - ts_0;
+	pool_unref(&pool);
+
+	printf("%-6s %8.2f MB/s\n", message_scan_impl_get_name(impl),
+	       nsecs == 0 ? 0 :
+	       (double)bench_total_size * rounds * 1000.0 / (double)nsecs);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r rounds] [<mail file or directory> ...]\n",
+		prog);
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	enum message_scan_impl best, impl;
+	unsigned int rounds = DEFAULT_ROUNDS;
+	struct bench_mail *mail;
+	pool_t parts_pool;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "r:")) > 0) {
+		switch (c) {
+		case 'r':
+			if (str_to_uint(optarg, &rounds) < 0 || rounds == 0)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	i_array_init(&bench_mails, 1024);
+	if (optind == argc)
+		bench_add_synthetic(SYNTHETIC_MAIL_COUNT);
+	for (; optind < argc; optind++)
+		bench_add_path(argv[optind]);
+	if (array_count(&bench_mails) == 0)
+		i_fatal("No mails found");
+
+	printf("Corpus is %u mails, %"PRIu64" bytes, %u rounds\n\n",
+	       array_count(&bench_mails), bench_total_size, rounds);
+
+	parts_pool = pool_alloconly_create("bench message parts", 1024*1024);
+	best = message_scan_get_best_impl();
+	for (impl = MESSAGE_SCAN_IMPL_NONE; impl < MESSAGE_SCAN_IMPL_COUNT;
+	     impl++) {
+		if (message_scan_set_impl(impl))
+			bench_message_parser_impl(impl, parts_pool, rounds);
+	}
+	i_assert(message_scan_set_impl(best));
+
+	array_foreach_modifiable(&bench_mails, mail)
+		buffer_free(&mail->data);
+	array_free(&bench_mails);
+	pool_unref(&parts_pool);
+	lib_deinit();
+	return 0;
+}
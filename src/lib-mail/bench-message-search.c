@@ -0,0 +1,339 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "unichar.h"
+#include "message-search.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**
+ * Searches a corpus of mails for multiple keys, the way a SEARCH with
+ * several TEXT and BODY keys does, and prints the throughput. This is done
+ * first with a separate message_search_context for each key (one pass over
+ * each mail per key), and then with a single message_search_init_multi()
+ * context (one pass over each mail). The results are checked to be the
+ * same. The corpus is given as a list of files and directories (e.g.
+ * Maildir's cur/), each file containing a single mail. Without any
+ * parameters a synthetic corpus of plain text, quoted-printable and base64
+ * encoded mails is generated. Keys can be given with -k, the first half of
+ * them is searched with TEXT and the rest with BODY.
+ */
+
+#define DEFAULT_ROUNDS 10
+#define SYNTHETIC_MAIL_COUNT 1000
+
+static const char *const bench_default_keys[] = {
+	"invoice", "meeting", "Sender 42", "quarterly", "unsubscribe",
+	"password", "deadline", "attachment", "budget", "confidential",
+	NULL
+};
+
+static const char *const bench_words[] = {
+	"the", "report", "team", "meeting", "schedule", "project", "update",
+	"please", "review", "numbers", "budget", "customer", "release",
+	"thanks", "regards", "tomorrow", "document", "deadline", "office",
+	"quarterly", "results", "question", "support", "invoice",
+};
+
+static ARRAY(buffer_t *) bench_mails;
+static uint64_t bench_total_size;
+
+static void bench_add_mail(buffer_t *data)
+{
+	array_push_back(&bench_mails, &data);
+	bench_total_size += data->used;
+}
+
+static void bench_add_file(const char *path)
+{
+	struct istream *input;
+	const unsigned char *data;
+	buffer_t *buf;
+	size_t size;
+	ssize_t ret;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	buf = buffer_create_dynamic(default_pool, 4096);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(buf, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		i_fatal("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+	bench_add_mail(buf);
+}
+
+static void bench_add_path(const char *path)
+{
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	if (!S_ISDIR(st.st_mode)) {
+		bench_add_file(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		T_BEGIN {
+			const char *file_path =
+				t_strconcat(path, "/", d->d_name, NULL);
+
+			if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode))
+				bench_add_file(file_path);
+		} T_END;
+	}
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+}
+
+static void bench_append_text(string_t *str, unsigned int lines, bool qp)
+{
+	unsigned int i, j, words;
+
+	for (i = 0; i < lines; i++) {
+		words = i_rand_minmax(1, 12);
+		for (j = 0; j < words; j++) {
+			if (j > 0)
+				str_append_c(str, ' ');
+			str_append(str, bench_words[i_rand_limit(
+				N_ELEMENTS(bench_words))]);
+			if (qp && i_rand_limit(8) == 0)
+				str_append(str, "=E2=80=94");
+		}
+		str_append(str, qp ? "=\r\n" : "\r\n");
+	}
+}
+
+static void bench_append_base64(string_t *str, unsigned int lines)
+{
+	unsigned int i;
+
+	for (i = 0; i < lines; i++) {
+		str_append(str, "VGhpcyBpcyBub3QgYW4gYXR0YWNobWVudCwganVzdCBzb21l"
+			   "IGJhc2U2NCBlbmNvZGVkIHRleHQgZm9yIHRoZSBiZW5jaGEu\r\n");
+	}
+}
+
+static void bench_add_synthetic(unsigned int count)
+{
+	unsigned int i;
+	string_t *str;
+
+	for (i = 0; i < count; i++) {
+		str = str_new(default_pool, 8192);
+		str_printfa(str,
+			"Return-Path: <sender%u@example.org>\r\n"
+			"Received: from mx.example.org (mx.example.org [192.0.2.1])\r\n"
+			"\tby mail.example.com with LMTP id %u\r\n"
+			"\tfor <user@example.com>; Mon, 1 Jun 2026 12:00:00 +0000\r\n"
+			"From: Sender %u <sender%u@example.org>\r\n"
+			"To: User <user@example.com>\r\n"
+			"Subject: =?utf-8?q?Status_update_%u?=\r\n"
+			"Date: Mon, 1 Jun 2026 12:00:00 +0000\r\n"
+			"Message-ID: <%u@example.org>\r\n"
+			"MIME-Version: 1.0\r\n", i, i, i, i, i, i);
+		switch (i % 3) {
+		case 0:
+			str_append(str, "Content-Type: text/plain; charset=utf-8\r\n\r\n");
+			bench_append_text(str, i_rand_limit(200) + 1, FALSE);
+			break;
+		case 1:
+			str_append(str,
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"Content-Transfer-Encoding: quoted-printable\r\n"
+				"\r\n");
+			bench_append_text(str, i_rand_limit(200) + 1, TRUE);
+			break;
+		case 2:
+			str_append(str,
+				"Content-Type: multipart/mixed; boundary=\"=-bench-boundary\"\r\n"
+				"\r\n"
+				"This is a multi-part message in MIME format.\r\n"
+				"--=-bench-boundary\r\n"
+				"Content-Type: text/plain; charset=utf-8\r\n"
+				"\r\n");
+			bench_append_text(str, i_rand_limit(100) + 1, FALSE);
+			str_append(str,
+				"--=-bench-boundary\r\n"
+				"Content-Type: text/plain; charset=utf-8; name=\"notes.txt\"\r\n"
+				"Content-Transfer-Encoding: base64\r\n"
+				"Content-Disposition: attachment; filename=\"notes.txt\"\r\n"
+				"\r\n");
+			bench_append_base64(str, i_rand_limit(500) + 1);
+			str_append(str, "--=-bench-boundary--\r\n");
+			break;
+		}
+		bench_add_mail(str);
+	}
+}
+
+static int bench_search_mail(struct message_search_context *ctx,
+			     const buffer_t *data)
+{
+	struct istream *input;
+	const char *error;
+	int ret;
+
+	input = i_stream_create_from_data(data->data, data->used);
+	ret = message_search_msg(ctx, input, NULL, &error);
+	i_stream_unref(&input);
+	if (ret < 0)
+		i_fatal("Searching mail failed: %s", error);
+	return ret;
+}
+
+static void bench_print_result(const char *name, uint64_t nsecs,
+			       unsigned int rounds)
+{
+	unsigned int mail_count = array_count(&bench_mails);
+
+	printf("%-6s %8.2f MB/s %10.1f mails/s\n", name,
+	       nsecs == 0 ? 0 :
+	       (double)bench_total_size * rounds * 1000.0 / (double)nsecs,
+	       nsecs == 0 ? 0 :
+	       (double)mail_count * rounds * 1000000000.0 / (double)nsecs);
+}
+
+static void
+bench_message_search(const char *const *keys, unsigned int rounds)
+{
+	unsigned int i, j, mail_idx, key_count = str_array_length(keys);
+	struct message_search_context **single_ctx, *multi_ctx;
+	enum message_search_flags *key_flags;
+	buffer_t *const *mails;
+	unsigned int mail_count;
+	bool *single_found;
+	uint64_t ts_0, nsecs;
+
+	key_flags = i_new(enum message_search_flags, key_count);
+	single_ctx = i_new(struct message_search_context *, key_count);
+	for (i = 0; i < key_count; i++) {
+		if (i >= key_count / 2 && key_count > 1)
+			key_flags[i] = MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+		single_ctx[i] = message_search_init(keys[i], NULL, key_flags[i]);
+	}
+	multi_ctx = message_search_init_multi(keys, key_flags, NULL);
+
+	mails = array_get(&bench_mails, &mail_count);
+	single_found = i_new(bool, mail_count * key_count);
+
+	/* separate search for each key */
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		for (mail_idx = 0; mail_idx < mail_count; mail_idx++) {
+			for (j = 0; j < key_count; j++) {
+				single_found[mail_idx * key_count + j] =
+					bench_search_mail(single_ctx[j],
+							  mails[mail_idx]) > 0;
+			}
+		}
+	}
+	nsecs = i_nanoseconds() - ts_0;
+	bench_print_result("single", nsecs, rounds);
+
+	/* all the keys with a single pass */
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		for (mail_idx = 0; mail_idx < mail_count; mail_idx++) {
+			(void)bench_search_mail(multi_ctx, mails[mail_idx]);
+			if (i > 0)
+				continue;
+			for (j = 0; j < key_count; j++) {
+				if (message_search_key_found(multi_ctx, j) !=
+				    single_found[mail_idx * key_count + j]) {
+					i_fatal("Mail %u: Results differ for "
+						"key '%s'", mail_idx, keys[j]);
+				}
+			}
+		}
+	}
+	nsecs = i_nanoseconds() - ts_0;
+	bench_print_result("multi", nsecs, rounds);
+
+	for (i = 0; i < key_count; i++)
+		message_search_deinit(&single_ctx[i]);
+	message_search_deinit(&multi_ctx);
+	i_free(single_ctx);
+	i_free(single_found);
+	i_free(key_flags);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r rounds] [-k key ...] "
+		"[<mail file or directory> ...]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = DEFAULT_ROUNDS;
+	ARRAY_TYPE(const_string) keys;
+	buffer_t *mail;
+	int c;
+
+	lib_init();
+
+	i_array_init(&keys, 16);
+	while ((c = getopt(argc, argv, "r:k:")) > 0) {
+		switch (c) {
+		case 'r':
+			if (str_to_uint(optarg, &rounds) < 0 || rounds == 0)
+				print_usage(argv[0]);
+			break;
+		case 'k':
+			if (optarg[0] == '\0')
+				print_usage(argv[0]);
+			array_push_back(&keys, (const char **)&optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (array_is_empty(&keys)) {
+		array_append(&keys, bench_default_keys,
+			     str_array_length(bench_default_keys));
+	}
+	array_append_zero(&keys);
+
+	i_array_init(&bench_mails, 1024);
+	if (optind == argc)
+		bench_add_synthetic(SYNTHETIC_MAIL_COUNT);
+	for (; optind < argc; optind++)
+		bench_add_path(argv[optind]);
+	if (array_count(&bench_mails) == 0)
+		i_fatal("No mails found");
+
+	printf("Corpus is %u mails, %"PRIu64" bytes, %u keys, %u rounds\n\n",
+	       array_count(&bench_mails), bench_total_size,
+	       array_count(&keys) - 1, rounds);
+
+	bench_message_search(array_front(&keys), rounds);
+
+	array_foreach_elem(&bench_mails, mail)
+		buffer_free(&mail);
+	array_free(&bench_mails);
+	array_free(&keys);
+	lib_deinit();
+	return 0;
+}
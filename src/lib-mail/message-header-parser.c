@@ -7,6 +7,7 @@
 #include "strfuncs.h"
 #include "unichar.h"
 #include "message-size.h"
+#include "message-scan.h"
 #include "message-header-parser.h"
 
 /* RFC 5322 2.1.1 and 2.2 */
@@ -84,7 +85,7 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 	size_t i, size, startpos, colon_pos, parse_size, skip = 0;
 	int ret;
 	bool continued, continues, last_no_newline, last_crlf;
-	bool no_newline, crlf_newline;
+	bool no_newline, crlf_newline, has_nuls = FALSE;
 
 	*hdr_r = NULL;
 	if (line->eoh)
@@ -189,37 +190,24 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 
 		/* find ':' */
 		if (colon_pos == UINT_MAX) {
-			for (i = startpos; i < parse_size; i++) {
-				if (msg[i] > ':')
-					continue;
-
-				if (msg[i] == ':' && !ctx->skip_line) {
-					colon_pos = i;
-					line->full_value_offset =
-						ctx->input->v_offset + i + 1;
-					break;
-				}
-				if (msg[i] == '\n') {
-					/* end of headers, or error */
-					break;
-				}
-
-				if (msg[i] == '\0')
-					ctx->has_nuls = TRUE;
+			i = startpos + message_scan_find_chr2(msg + startpos,
+				parse_size - startpos,
+				ctx->skip_line ? '\n' : ':', '\n', &has_nuls);
+			if (i < parse_size && msg[i] == ':') {
+				colon_pos = i;
+				line->full_value_offset =
+					ctx->input->v_offset + i + 1;
 			}
+			/* otherwise end of headers, or error */
 		} else {
 			i = startpos;
 		}
 
 		/* find '\n' */
-		for (; i < parse_size; i++) {
-			if (msg[i] <= '\n') {
-				if (msg[i] == '\n')
-					break;
-				if (msg[i] == '\0')
-					ctx->has_nuls = TRUE;
-			}
-		}
+		i += message_scan_find_chr2(msg + i, parse_size - i,
+					    '\n', '\n', &has_nuls);
+		if (has_nuls)
+			ctx->has_nuls = TRUE;
 
 		if (i < parse_size && i+1 == size && ret == -2) {
 			/* we don't know if the line continues. */
@@ -6,6 +6,7 @@
 #include "istream.h"
 #include "rfc822-parser.h"
 #include "rfc2231-parser.h"
+#include "message-scan.h"
 #include "message-parser-private.h"
 
 message_part_header_callback_t *null_message_part_header_callback = NULL;
@@ -53,37 +54,24 @@ boundary_find(struct message_boundary *boundaries,
 static void parse_body_add_block(struct message_parser_ctx *ctx,
 				 struct message_block *block)
 {
-	unsigned int missing_cr_count = 0;
-	const unsigned char *cur, *next, *data = block->data;
+	struct message_scan_lines lines;
 
 	i_assert(block->size > 0);
 
 	block->hdr = NULL;
 
-	/* check if we have NULs */
-	if (memchr(data, '\0', block->size) != NULL)
+	/* count number of lines and missing CRs, and check if we have NULs */
+	message_scan_lines(block->data, block->size, ctx->last_chr, &lines);
+	if (lines.has_nuls)
 		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
+	ctx->part->body_size.lines += lines.lines;
 
-	/* count number of lines and missing CRs */
-	if (*data == '\n') {
-		ctx->part->body_size.lines++;
-		if (ctx->last_chr != '\r')
-			missing_cr_count++;
-	}
-
-	cur = data + 1;
-	while ((next = memchr(cur, '\n', block->size - (cur - data))) != NULL) {
-		ctx->part->body_size.lines++;
-		if (next[-1] != '\r')
-			missing_cr_count++;
-
-		cur = next + 1;
-	}
-	ctx->last_chr = data[block->size - 1];
+	ctx->last_chr = block->data[block->size - 1];
 	ctx->skip += block->size;
 
 	ctx->part->body_size.physical_size += block->size;
-	ctx->part->body_size.virtual_size += block->size + missing_cr_count;
+	ctx->part->body_size.virtual_size +=
+		block->size + lines.missing_cr_count;
 }
 
 int message_parser_read_more(struct message_parser_ctx *ctx,
@@ -419,9 +407,10 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	boundary_start = 0;
 
 	/* skip to beginning of the next line. the first line was
-	   handled already. */
+	   handled already. Lines that can't be boundaries are skipped
+	   without looking at them individually. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = message_scan_boundary_lf(cur, end - cur)) != NULL) {
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -443,6 +432,20 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		}
 	}
 
+	if (next == NULL) {
+		/* no more boundary candidates. the data up to the last LF can
+		   be skipped. */
+		const unsigned char *last_lf = end;
+
+		while (last_lf > cur && last_lf[-1] != '\n')
+			last_lf--;
+		if (last_lf > cur) {
+			boundary_start = (last_lf - 1) - data;
+			if (boundary_start > 0 && data[boundary_start-1] == '\r')
+				boundary_start--;
+		}
+	}
+
 	if (next != NULL) {
 		/* found / need more data */
 		i_assert(ret >= 0);
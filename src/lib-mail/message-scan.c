@@ -0,0 +1,528 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "message-scan.h"
+
+/* The kernels compare 16 or 32 bytes at a time against the interesting
+   characters and convert the results into bitmasks. Finding the first match
+   is then a count-trailing-zeros and counting the matches is a popcount.
+   Line counting looks at the preceding byte with a second load that is
+   offset by one, so that CRs are checked without any shuffling. Whatever is
+   left over at the end of the data is handled by the scalar code. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#  define HAVE_MESSAGE_SCAN_X86
+#  include <immintrin.h>
+#  define MESSAGE_SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#  define MESSAGE_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#  define HAVE_MESSAGE_SCAN_NEON
+#  include <arm_neon.h>
+#endif
+
+static const char *message_scan_impl_names[MESSAGE_SCAN_IMPL_COUNT] = {
+	[MESSAGE_SCAN_IMPL_NONE] = "none",
+	[MESSAGE_SCAN_IMPL_SSE2] = "sse2",
+	[MESSAGE_SCAN_IMPL_AVX2] = "avx2",
+	[MESSAGE_SCAN_IMPL_NEON] = "neon",
+};
+
+static enum message_scan_impl message_scan_cur_impl;
+static bool message_scan_initialized = FALSE;
+
+/*
+ * Scalar
+ */
+
+/* Scan data[start..size) for lines. data[start-1] must be accessible. */
+static void
+message_scan_lines_scalar(const unsigned char *data, size_t start,
+			  size_t size, struct message_scan_lines *lines_r)
+{
+	const unsigned char *cur, *next, *end = data + size;
+
+	if (start >= size)
+		return;
+
+	if (memchr(data + start, '\0', size - start) != NULL)
+		lines_r->has_nuls = TRUE;
+
+	cur = data + start;
+	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+		lines_r->lines++;
+		if (next[-1] != '\r')
+			lines_r->missing_cr_count++;
+		cur = next + 1;
+	}
+}
+
+static const unsigned char *
+message_scan_boundary_lf_scalar(const unsigned char *data, size_t size)
+{
+	const unsigned char *cur = data, *next, *end = data + size;
+
+	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+		if (end - next < 3 || (next[1] == '-' && next[2] == '-'))
+			return next;
+		cur = next + 1;
+	}
+	return NULL;
+}
+
+static size_t
+message_scan_find_chr2_scalar(const unsigned char *data, size_t size,
+			      unsigned char chr1, unsigned char chr2,
+			      bool *has_nuls)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == chr1 || data[i] == chr2)
+			break;
+		if (data[i] == '\0')
+			*has_nuls = TRUE;
+	}
+	return i;
+}
+
+#ifdef HAVE_MESSAGE_SCAN_X86
+
+/*
+ * SSE2
+ */
+
+static MESSAGE_SCAN_TARGET_SSE2 void
+message_scan_lines_sse2(const unsigned char *data, size_t start, size_t size,
+			struct message_scan_lines *lines_r)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	__m128i nuls = _mm_setzero_si128();
+	unsigned int lf_mask, cr_mask;
+	size_t i = start;
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		__m128i prev = _mm_loadu_si128((const void *)(data + i - 1));
+
+		lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+		nuls = _mm_or_si128(nuls,
+				    _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		if (lf_mask == 0)
+			continue;
+		cr_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(prev, cr));
+		lines_r->lines += __builtin_popcount(lf_mask);
+		lines_r->missing_cr_count +=
+			__builtin_popcount(lf_mask & ~cr_mask);
+	}
+	if (_mm_movemask_epi8(nuls) != 0)
+		lines_r->has_nuls = TRUE;
+	message_scan_lines_scalar(data, i, size, lines_r);
+}
+
+static MESSAGE_SCAN_TARGET_SSE2 const unsigned char *
+message_scan_boundary_lf_sse2(const unsigned char *data, size_t size)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i dash = _mm_set1_epi8('-');
+	unsigned int mask;
+	size_t i = 0;
+
+	for (; i + 16 + 2 <= size; i += 16) {
+		__m128i v0 = _mm_loadu_si128((const void *)(data + i));
+		__m128i v1 = _mm_loadu_si128((const void *)(data + i + 1));
+		__m128i v2 = _mm_loadu_si128((const void *)(data + i + 2));
+
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(v0, lf),
+			_mm_and_si128(_mm_cmpeq_epi8(v1, dash),
+				      _mm_cmpeq_epi8(v2, dash))));
+		if (mask != 0)
+			return data + i + __builtin_ctz(mask);
+	}
+	return message_scan_boundary_lf_scalar(data + i, size - i);
+}
+
+static MESSAGE_SCAN_TARGET_SSE2 size_t
+message_scan_find_chr2_sse2(const unsigned char *data, size_t size,
+			    unsigned char chr1, unsigned char chr2,
+			    bool *has_nuls)
+{
+	const __m128i c1 = _mm_set1_epi8((char)chr1);
+	const __m128i c2 = _mm_set1_epi8((char)chr2);
+	unsigned int mask, nul_mask;
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, c1),
+						      _mm_cmpeq_epi8(v, c2)));
+		nul_mask = _mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		if (mask != 0) {
+			mask &= -mask;
+			if ((nul_mask & (mask - 1)) != 0)
+				*has_nuls = TRUE;
+			return i + __builtin_ctz(mask);
+		}
+		if (nul_mask != 0)
+			*has_nuls = TRUE;
+	}
+	return i + message_scan_find_chr2_scalar(data + i, size - i,
+						 chr1, chr2, has_nuls);
+}
+
+/*
+ * AVX2
+ */
+
+static MESSAGE_SCAN_TARGET_AVX2 void
+message_scan_lines_avx2(const unsigned char *data, size_t start, size_t size,
+			struct message_scan_lines *lines_r)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	__m256i nuls = _mm256_setzero_si256();
+	unsigned int lf_mask, cr_mask;
+	size_t i = start;
+
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const void *)(data + i));
+		__m256i prev = _mm256_loadu_si256((const void *)(data + i - 1));
+
+		lf_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+		nuls = _mm256_or_si256(nuls,
+			_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		if (lf_mask == 0)
+			continue;
+		cr_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(prev, cr));
+		lines_r->lines += __builtin_popcount(lf_mask);
+		lines_r->missing_cr_count +=
+			__builtin_popcount(lf_mask & ~cr_mask);
+	}
+	if (_mm256_movemask_epi8(nuls) != 0)
+		lines_r->has_nuls = TRUE;
+	message_scan_lines_sse2(data, i, size, lines_r);
+}
+
+static MESSAGE_SCAN_TARGET_AVX2 const unsigned char *
+message_scan_boundary_lf_avx2(const unsigned char *data, size_t size)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i dash = _mm256_set1_epi8('-');
+	unsigned int mask;
+	size_t i = 0;
+
+	for (; i + 32 + 2 <= size; i += 32) {
+		__m256i v0 = _mm256_loadu_si256((const void *)(data + i));
+		__m256i v1 = _mm256_loadu_si256((const void *)(data + i + 1));
+		__m256i v2 = _mm256_loadu_si256((const void *)(data + i + 2));
+
+		mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(v0, lf),
+			_mm256_and_si256(_mm256_cmpeq_epi8(v1, dash),
+					 _mm256_cmpeq_epi8(v2, dash))));
+		if (mask != 0)
+			return data + i + __builtin_ctz(mask);
+	}
+	return message_scan_boundary_lf_sse2(data + i, size - i);
+}
+
+static MESSAGE_SCAN_TARGET_AVX2 size_t
+message_scan_find_chr2_avx2(const unsigned char *data, size_t size,
+			    unsigned char chr1, unsigned char chr2,
+			    bool *has_nuls)
+{
+	const __m256i c1 = _mm256_set1_epi8((char)chr1);
+	const __m256i c2 = _mm256_set1_epi8((char)chr2);
+	unsigned int mask, nul_mask;
+	size_t i = 0;
+
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const void *)(data + i));
+
+		mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, c1), _mm256_cmpeq_epi8(v, c2)));
+		nul_mask = _mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		if (mask != 0) {
+			mask &= -mask;
+			if ((nul_mask & (mask - 1)) != 0)
+				*has_nuls = TRUE;
+			return i + __builtin_ctz(mask);
+		}
+		if (nul_mask != 0)
+			*has_nuls = TRUE;
+	}
+	return i + message_scan_find_chr2_sse2(data + i, size - i,
+					       chr1, chr2, has_nuls);
+}
+
+#endif
+
+#ifdef HAVE_MESSAGE_SCAN_NEON
+
+/*
+ * NEON
+ */
+
+/* NEON has no movemask. Narrowing the comparison result gives a 64-bit mask
+   with 4 bits for each byte instead. */
+static inline uint64_t message_scan_neon_mask(uint8x16_t cmp)
+{
+	uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+
+	return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+static void
+message_scan_lines_neon(const unsigned char *data, size_t start, size_t size,
+			struct message_scan_lines *lines_r)
+{
+	const uint8x16_t lf = vdupq_n_u8('\n');
+	const uint8x16_t cr = vdupq_n_u8('\r');
+	uint8x16_t nuls = vdupq_n_u8(0);
+	size_t i = start;
+
+	for (; i + 16 <= size; i += 16) {
+		uint8x16_t v = vld1q_u8(data + i);
+		uint8x16_t prev = vld1q_u8(data + i - 1);
+		uint8x16_t lf_cmp = vceqq_u8(v, lf);
+
+		nuls = vorrq_u8(nuls, vceqzq_u8(v));
+		if (vmaxvq_u8(lf_cmp) == 0)
+			continue;
+		lines_r->lines += vaddvq_u8(vshrq_n_u8(lf_cmp, 7));
+		lines_r->missing_cr_count += vaddvq_u8(vshrq_n_u8(
+			vbicq_u8(lf_cmp, vceqq_u8(prev, cr)), 7));
+	}
+	if (vmaxvq_u8(nuls) != 0)
+		lines_r->has_nuls = TRUE;
+	message_scan_lines_scalar(data, i, size, lines_r);
+}
+
+static const unsigned char *
+message_scan_boundary_lf_neon(const unsigned char *data, size_t size)
+{
+	const uint8x16_t lf = vdupq_n_u8('\n');
+	const uint8x16_t dash = vdupq_n_u8('-');
+	uint64_t mask;
+	size_t i = 0;
+
+	for (; i + 16 + 2 <= size; i += 16) {
+		uint8x16_t v0 = vld1q_u8(data + i);
+		uint8x16_t v1 = vld1q_u8(data + i + 1);
+		uint8x16_t v2 = vld1q_u8(data + i + 2);
+
+		mask = message_scan_neon_mask(vandq_u8(
+			vceqq_u8(v0, lf),
+			vandq_u8(vceqq_u8(v1, dash), vceqq_u8(v2, dash))));
+		if (mask != 0)
+			return data + i + __builtin_ctzll(mask) / 4;
+	}
+	return message_scan_boundary_lf_scalar(data + i, size - i);
+}
+
+static size_t
+message_scan_find_chr2_neon(const unsigned char *data, size_t size,
+			    unsigned char chr1, unsigned char chr2,
+			    bool *has_nuls)
+{
+	const uint8x16_t c1 = vdupq_n_u8(chr1);
+	const uint8x16_t c2 = vdupq_n_u8(chr2);
+	uint64_t mask, nul_mask;
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16) {
+		uint8x16_t v = vld1q_u8(data + i);
+
+		mask = message_scan_neon_mask(vorrq_u8(vceqq_u8(v, c1),
+						       vceqq_u8(v, c2)));
+		nul_mask = message_scan_neon_mask(vceqzq_u8(v));
+		if (mask != 0) {
+			mask &= -mask;
+			if ((nul_mask & (mask - 1)) != 0)
+				*has_nuls = TRUE;
+			return i + __builtin_ctzll(mask) / 4;
+		}
+		if (nul_mask != 0)
+			*has_nuls = TRUE;
+	}
+	return i + message_scan_find_chr2_scalar(data + i, size - i,
+						 chr1, chr2, has_nuls);
+}
+
+#endif
+
+/*
+ * Dispatching
+ */
+
+static bool message_scan_impl_is_supported(enum message_scan_impl impl)
+{
+	switch (impl) {
+	case MESSAGE_SCAN_IMPL_NONE:
+		return TRUE;
+	case MESSAGE_SCAN_IMPL_SSE2:
+#ifdef HAVE_MESSAGE_SCAN_X86
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2") != 0;
+#else
+		return FALSE;
+#endif
+	case MESSAGE_SCAN_IMPL_AVX2:
+#ifdef HAVE_MESSAGE_SCAN_X86
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#else
+		return FALSE;
+#endif
+	case MESSAGE_SCAN_IMPL_NEON:
+#ifdef HAVE_MESSAGE_SCAN_NEON
+		/* NEON is mandatory on aarch64 */
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case MESSAGE_SCAN_IMPL_COUNT:
+		break;
+	}
+	i_unreached();
+}
+
+enum message_scan_impl message_scan_get_best_impl(void)
+{
+	static const enum message_scan_impl impls[] = {
+		MESSAGE_SCAN_IMPL_AVX2,
+		MESSAGE_SCAN_IMPL_SSE2,
+		MESSAGE_SCAN_IMPL_NEON,
+	};
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (message_scan_impl_is_supported(impls[i]))
+			return impls[i];
+	}
+	return MESSAGE_SCAN_IMPL_NONE;
+}
+
+enum message_scan_impl message_scan_get_impl(void)
+{
+	if (unlikely(!message_scan_initialized)) {
+		message_scan_cur_impl = message_scan_get_best_impl();
+		message_scan_initialized = TRUE;
+	}
+	return message_scan_cur_impl;
+}
+
+bool message_scan_set_impl(enum message_scan_impl impl)
+{
+	i_assert(impl < MESSAGE_SCAN_IMPL_COUNT);
+
+	if (!message_scan_impl_is_supported(impl))
+		return FALSE;
+	message_scan_cur_impl = impl;
+	message_scan_initialized = TRUE;
+	return TRUE;
+}
+
+const char *message_scan_impl_get_name(enum message_scan_impl impl)
+{
+	i_assert(impl < MESSAGE_SCAN_IMPL_COUNT);
+	return message_scan_impl_names[impl];
+}
+
+void message_scan_lines(const unsigned char *data, size_t size,
+			unsigned char prev_chr,
+			struct message_scan_lines *lines_r)
+{
+	i_zero(lines_r);
+	if (size == 0)
+		return;
+
+	/* the first byte is handled here, so the kernels can always look at
+	   the preceding byte */
+	if (data[0] == '\n') {
+		lines_r->lines++;
+		if (prev_chr != '\r')
+			lines_r->missing_cr_count++;
+	} else if (data[0] == '\0') {
+		lines_r->has_nuls = TRUE;
+	}
+
+	switch (message_scan_get_impl()) {
+	case MESSAGE_SCAN_IMPL_NONE:
+		message_scan_lines_scalar(data, 1, size, lines_r);
+		return;
+#ifdef HAVE_MESSAGE_SCAN_X86
+	case MESSAGE_SCAN_IMPL_SSE2:
+		message_scan_lines_sse2(data, 1, size, lines_r);
+		return;
+	case MESSAGE_SCAN_IMPL_AVX2:
+		message_scan_lines_avx2(data, 1, size, lines_r);
+		return;
+#endif
+#ifdef HAVE_MESSAGE_SCAN_NEON
+	case MESSAGE_SCAN_IMPL_NEON:
+		message_scan_lines_neon(data, 1, size, lines_r);
+		return;
+#endif
+	default:
+		break;
+	}
+	i_unreached();
+}
+
+const unsigned char *
+message_scan_boundary_lf(const unsigned char *data, size_t size)
+{
+	switch (message_scan_get_impl()) {
+	case MESSAGE_SCAN_IMPL_NONE:
+		return message_scan_boundary_lf_scalar(data, size);
+#ifdef HAVE_MESSAGE_SCAN_X86
+	case MESSAGE_SCAN_IMPL_SSE2:
+		return message_scan_boundary_lf_sse2(data, size);
+	case MESSAGE_SCAN_IMPL_AVX2:
+		return message_scan_boundary_lf_avx2(data, size);
+#endif
+#ifdef HAVE_MESSAGE_SCAN_NEON
+	case MESSAGE_SCAN_IMPL_NEON:
+		return message_scan_boundary_lf_neon(data, size);
+#endif
+	default:
+		break;
+	}
+	i_unreached();
+}
+
+size_t message_scan_find_chr2(const unsigned char *data, size_t size,
+			      unsigned char chr1, unsigned char chr2,
+			      bool *has_nuls)
+{
+	i_assert(chr1 != '\0' && chr2 != '\0');
+
+	switch (message_scan_get_impl()) {
+	case MESSAGE_SCAN_IMPL_NONE:
+		return message_scan_find_chr2_scalar(data, size, chr1, chr2,
+						     has_nuls);
+#ifdef HAVE_MESSAGE_SCAN_X86
+	case MESSAGE_SCAN_IMPL_SSE2:
+		return message_scan_find_chr2_sse2(data, size, chr1, chr2,
+						   has_nuls);
+	case MESSAGE_SCAN_IMPL_AVX2:
+		return message_scan_find_chr2_avx2(data, size, chr1, chr2,
+						   has_nuls);
+#endif
+#ifdef HAVE_MESSAGE_SCAN_NEON
+	case MESSAGE_SCAN_IMPL_NEON:
+		return message_scan_find_chr2_neon(data, size, chr1, chr2,
+						   has_nuls);
+#endif
+	default:
+		break;
+	}
+	i_unreached();
+}
@@ -0,0 +1,54 @@
+#ifndef MESSAGE_SCAN_H
+#define MESSAGE_SCAN_H
+
+/* Vectorized scanning kernels used internally by the message and header
+   parsers. All the implementations return identical results, so the parsers
+   produce the same output regardless of which one is used. */
+
+enum message_scan_impl {
+	/* Use only the scalar code */
+	MESSAGE_SCAN_IMPL_NONE = 0,
+	MESSAGE_SCAN_IMPL_SSE2,
+	MESSAGE_SCAN_IMPL_AVX2,
+	MESSAGE_SCAN_IMPL_NEON,
+
+	MESSAGE_SCAN_IMPL_COUNT
+};
+
+struct message_scan_lines {
+	/* Number of LFs */
+	unsigned int lines;
+	/* Number of LFs not preceded by CR */
+	unsigned int missing_cr_count;
+	/* TRUE if there were any NULs */
+	bool has_nuls;
+};
+
+/* Count the LFs in data. prev_chr is the character preceding data, which is
+   used to check whether the first LF is missing its CR. */
+void message_scan_lines(const unsigned char *data, size_t size,
+			unsigned char prev_chr,
+			struct message_scan_lines *lines_r);
+/* Find the first LF that may begin a MIME boundary line, i.e. one that is
+   followed by "--" or has less than 2 bytes after it in data. Returns NULL
+   if there is no such LF. */
+const unsigned char *
+message_scan_boundary_lf(const unsigned char *data, size_t size);
+/* Returns the offset of the first chr1 or chr2 in data, or size if neither
+   is found. If there are NULs before the returned offset, *has_nuls is set
+   to TRUE. Otherwise it's left untouched. */
+size_t message_scan_find_chr2(const unsigned char *data, size_t size,
+			      unsigned char chr1, unsigned char chr2,
+			      bool *has_nuls);
+
+/* Returns the best implementation supported by this CPU. */
+enum message_scan_impl message_scan_get_best_impl(void);
+/* Returns the currently used implementation. */
+enum message_scan_impl message_scan_get_impl(void);
+/* Change the used implementation. Returns FALSE if it's not supported by
+   this CPU. This is mainly intended for tests and benchmarks. */
+bool message_scan_set_impl(enum message_scan_impl impl);
+/* Returns human-readable name for the implementation. */
+const char *message_scan_impl_get_name(enum message_scan_impl impl);
+
+#endif
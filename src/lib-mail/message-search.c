@@ -1,20 +1,36 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "istream.h"
 #include "str.h"
 #include "str-find.h"
+#include "str-find-multi.h"
 #include "rfc822-parser.h"
 #include "message-decoder.h"
 #include "message-parser.h"
 #include "message-search.h"
 
+struct message_search_key {
+	/* The key is searched only from the message bodies */
+	bool body_only;
+	/* Index of the key in its str_find_multi_context */
+	unsigned int idx;
+};
+
 struct message_search_context {
 	enum message_search_flags flags;
 	normalizer_func_t *normalizer;
 
 	struct str_find_context *str_find_ctx;
+	/* With multiple keys: the keys searched from both the headers and
+	   the bodies, and the keys searched only from the bodies. Either one
+	   can be NULL if there are no such keys. */
+	struct str_find_multi_context *multi_find_all, *multi_find_body;
+	struct message_search_key *keys;
+	unsigned int key_count;
+
 	struct message_part *prev_part;
 
 	struct message_decoder_context *decoder;
@@ -37,16 +53,87 @@ message_search_init(const char *normalized_key_utf8,
 	return ctx;
 }
 
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  const enum message_search_flags *key_flags,
+			  normalizer_func_t *normalizer)
+{
+	struct message_search_context *ctx;
+	ARRAY_TYPE(const_string) keys_all, keys_body;
+	ARRAY_TYPE(const_string) *keys;
+	unsigned int i;
+
+	ctx = i_new(struct message_search_context, 1);
+	ctx->key_count = str_array_length(normalized_keys_utf8);
+	i_assert(ctx->key_count > 0);
+	ctx->keys = i_new(struct message_search_key, ctx->key_count);
+
+	/* The headers need to be decoded unless all the keys skip them */
+	ctx->flags = MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+	T_BEGIN {
+		t_array_init(&keys_all, ctx->key_count + 1);
+		t_array_init(&keys_body, ctx->key_count + 1);
+		for (i = 0; i < ctx->key_count; i++) {
+			i_assert(*normalized_keys_utf8[i] != '\0');
+			enum message_search_flags skip_headers =
+				MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+
+			if ((key_flags[i] & skip_headers) != 0) {
+				ctx->keys[i].body_only = TRUE;
+				keys = &keys_body;
+			} else {
+				ctx->flags &= ENUM_NEGATE(skip_headers);
+				keys = &keys_all;
+			}
+			ctx->keys[i].idx = array_count(keys);
+			array_push_back(keys, &normalized_keys_utf8[i]);
+		}
+		if (array_not_empty(&keys_all)) {
+			array_append_zero(&keys_all);
+			ctx->multi_find_all = str_find_multi_init(default_pool,
+				array_front(&keys_all));
+		}
+		if (array_not_empty(&keys_body)) {
+			array_append_zero(&keys_body);
+			ctx->multi_find_body = str_find_multi_init(default_pool,
+				array_front(&keys_body));
+		}
+	} T_END;
+	ctx->decoder = message_decoder_init(normalizer, 0);
+	return ctx;
+}
+
 void message_search_deinit(struct message_search_context **_ctx)
 {
 	struct message_search_context *ctx = *_ctx;
 
 	*_ctx = NULL;
-	str_find_deinit(&ctx->str_find_ctx);
+	if (ctx->str_find_ctx != NULL)
+		str_find_deinit(&ctx->str_find_ctx);
+	if (ctx->multi_find_all != NULL)
+		str_find_multi_deinit(&ctx->multi_find_all);
+	if (ctx->multi_find_body != NULL)
+		str_find_multi_deinit(&ctx->multi_find_body);
 	message_decoder_deinit(&ctx->decoder);
+	i_free(ctx->keys);
 	i_free(ctx);
 }
 
+static void message_search_reset_part(struct message_search_context *ctx)
+{
+	/* Content-Type defaults to text/plain */
+	ctx->content_type_text = TRUE;
+
+	ctx->prev_part = NULL;
+	if (ctx->str_find_ctx != NULL)
+		str_find_reset(ctx->str_find_ctx);
+	if (ctx->multi_find_all != NULL)
+		str_find_multi_reset(ctx->multi_find_all);
+	if (ctx->multi_find_body != NULL)
+		str_find_multi_reset(ctx->multi_find_body);
+	message_decoder_decode_reset(ctx->decoder);
+}
+
 static void parse_content_type(struct message_search_context *ctx,
 			       struct message_header_line *hdr)
 {
@@ -94,9 +181,56 @@ static bool search_header(struct message_search_context *ctx,
 		 str_find_more(ctx->str_find_ctx, crlf, 2));
 }
 
+static void search_header_multi(struct str_find_multi_context *find_ctx,
+				const struct message_header_line *hdr)
+{
+	static const unsigned char crlf[2] = { '\r', '\n' };
+
+	(void)str_find_multi_more(find_ctx, (const unsigned char *)hdr->name,
+				  hdr->name_len);
+	(void)str_find_multi_more(find_ctx, hdr->middle, hdr->middle_len);
+	(void)str_find_multi_more(find_ctx, hdr->full_value,
+				  hdr->full_value_len);
+	if (!hdr->no_newline)
+		(void)str_find_multi_more(find_ctx, crlf, 2);
+}
+
+static bool message_search_multi_all_found(struct message_search_context *ctx)
+{
+	unsigned int count = 0;
+
+	if (ctx->multi_find_all != NULL)
+		count += str_find_multi_get_found_count(ctx->multi_find_all);
+	if (ctx->multi_find_body != NULL)
+		count += str_find_multi_get_found_count(ctx->multi_find_body);
+	return count == ctx->key_count;
+}
+
+static bool message_search_multi_more(struct message_search_context *ctx,
+				      struct message_block *block)
+{
+	if (block->hdr != NULL) {
+		if (ctx->multi_find_all != NULL)
+			search_header_multi(ctx->multi_find_all, block->hdr);
+	} else {
+		if (ctx->multi_find_all != NULL) {
+			(void)str_find_multi_more(ctx->multi_find_all,
+						  block->data, block->size);
+		}
+		if (ctx->multi_find_body != NULL) {
+			(void)str_find_multi_more(ctx->multi_find_body,
+						  block->data, block->size);
+		}
+	}
+	return message_search_multi_all_found(ctx);
+}
+
 static bool message_search_more_decoded2(struct message_search_context *ctx,
 					 struct message_block *block)
 {
+	if (ctx->str_find_ctx == NULL)
+		return message_search_multi_more(ctx, block);
+
 	if (block->hdr != NULL) {
 		if (search_header(ctx, block->hdr))
 			return TRUE;
@@ -128,7 +262,7 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 	if (raw_block->part != ctx->prev_part) {
 		/* part changes. we must change this before looking at
 		   content type */
-		message_search_reset(ctx);
+		message_search_reset_part(ctx);
 		ctx->prev_part = raw_block->part;
 
 		if (hdr == NULL) {
@@ -174,7 +308,7 @@ bool message_search_more_decoded(struct message_search_context *ctx,
 {
 	if (block->part != ctx->prev_part) {
 		/* part changes */
-		message_search_reset(ctx);
+		message_search_reset_part(ctx);
 		ctx->prev_part = block->part;
 	}
 
@@ -183,12 +317,24 @@ bool message_search_more_decoded(struct message_search_context *ctx,
 
 void message_search_reset(struct message_search_context *ctx)
 {
-	/* Content-Type defaults to text/plain */
-	ctx->content_type_text = TRUE;
+	message_search_reset_part(ctx);
+	/* keys found from the previous message no longer count */
+	if (ctx->multi_find_all != NULL)
+		str_find_multi_reset_found(ctx->multi_find_all);
+	if (ctx->multi_find_body != NULL)
+		str_find_multi_reset_found(ctx->multi_find_body);
+}
 
-	ctx->prev_part = NULL;
-	str_find_reset(ctx->str_find_ctx);
-	message_decoder_decode_reset(ctx->decoder);
+bool message_search_key_found(struct message_search_context *ctx,
+			      unsigned int key_idx)
+{
+	const struct message_search_key *key;
+
+	i_assert(key_idx < ctx->key_count);
+	key = &ctx->keys[key_idx];
+	return str_find_multi_key_found(key->body_only ?
+					ctx->multi_find_body :
+					ctx->multi_find_all, key->idx);
 }
 
 int message_search_msg(struct message_search_context *ctx,
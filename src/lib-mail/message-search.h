@@ -15,9 +15,18 @@ struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
 		    enum message_search_flags flags);
+/* Search all the keys with a single pass over the message. The keys with
+   MESSAGE_SEARCH_FLAG_SKIP_HEADERS in key_flags[] are searched only from
+   the message bodies. The search is finished once all the keys have been
+   found. Use message_search_key_found() to see which of them were found. */
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  const enum message_search_flags *key_flags,
+			  normalizer_func_t *normalizer);
 void message_search_deinit(struct message_search_context **ctx);
 
-/* Returns TRUE if key is found from input buffer, FALSE if not. */
+/* Returns TRUE if key is found from input buffer, FALSE if not. With
+   message_search_init_multi() returns TRUE once all the keys are found. */
 bool message_search_more(struct message_search_context *ctx,
 			 struct message_block *raw_block);
 /* Same as message_search_more(), but return the decoded block. If the same
@@ -29,8 +38,14 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 /* The data has already passed through decoder. */
 bool message_search_more_decoded(struct message_search_context *ctx,
 				 struct message_block *block);
+/* Reset the search for a new message. */
 void message_search_reset(struct message_search_context *ctx);
-/* Search a full message. Returns 1 if match was found, 0 if not,
+/* Returns TRUE if the key with the given index in
+   message_search_init_multi() has been found since the last reset. */
+bool message_search_key_found(struct message_search_context *ctx,
+			      unsigned int key_idx);
+/* Search a full message. Returns 1 if match was found (all the keys with
+   message_search_init_multi()), 0 if not,
    -1 if error (if stream_error == 0, the parts contained broken data) */
 int message_search_msg(struct message_search_context *ctx,
 		       struct istream *input, struct message_part *parts,
@@ -5,6 +5,7 @@
 #include "istream.h"
 #include "message-parser.h"
 #include "message-part-data.h"
+#include "message-scan.h"
 #include "message-size.h"
 #include "test-common.h"
 
@@ -1521,6 +1522,105 @@ static void test_message_parser_too_many_header_bytes_100(void)
 	test_end();
 }
 
+static void
+test_message_parser_scan_parse(const string_t *msg, size_t max_buffer_size,
+			       pool_t pool, struct message_part **parts_r,
+			       string_t *output)
+{
+	const struct message_parser_settings parser_set = {
+		.flags = MESSAGE_PARSER_FLAG_INCLUDE_MULTIPART_BLOCKS |
+			MESSAGE_PARSER_FLAG_INCLUDE_BOUNDARIES,
+	};
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct istream *input;
+	int ret;
+
+	input = test_istream_create_data(msg->data, msg->used);
+	test_istream_set_max_buffer_size(input, max_buffer_size);
+	parser = message_parser_init(pool, input, &parser_set);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0) {
+		if (block.hdr != NULL) {
+			message_header_line_write(output, block.hdr);
+			if (block.hdr->eoh)
+				str_append_c(output, '|');
+		} else if (block.size > 0) {
+			str_append_data(output, block.data, block.size);
+		}
+	}
+	test_assert(ret < 0);
+	message_parser_deinit(&parser, parts_r);
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+}
+
+static void test_message_parser_scan_impls(void)
+{
+	static const char *const lines[] = {
+		"text line", "", "-", "--", "---", "-- not a boundary",
+		"--b1", "--b1--", "--b2", "--b2--", "--b1x", "a#b",
+		"Header: value", "X-Nul: a#b", "no colon",
+	};
+	static const char *const eols[] = { "\n", "\r\n", "\r" };
+	enum message_scan_impl best = message_scan_get_best_impl();
+	enum message_scan_impl impl;
+	struct message_part *parts, *parts2;
+	string_t *msg, *output, *output2;
+	unsigned int i, j, line_count;
+	size_t max_buffer_size;
+	unsigned char *data;
+	const char *line;
+	pool_t pool;
+
+	test_begin("message parser with scan implementations");
+	pool = pool_alloconly_create("message parser", 10240);
+	msg = str_new(default_pool, 4096);
+	output = str_new(default_pool, 4096);
+	output2 = str_new(default_pool, 4096);
+	for (i = 0; i < 100; i++) {
+		str_truncate(msg, 0);
+		str_append(msg, "Content-Type: multipart/mixed; boundary=b1\n\n"
+			   "--b1\n"
+			   "Content-Type: multipart/mixed; boundary=\"b2\"\n\n");
+		line_count = i_rand_limit(100);
+		for (j = 0; j < line_count; j++) {
+			line = lines[i_rand_limit(N_ELEMENTS(lines))];
+			str_append(msg, line);
+			str_append(msg, eols[i_rand_limit(N_ELEMENTS(eols))]);
+		}
+		/* '#' is a placeholder for NUL */
+		data = buffer_get_modifiable_data(msg, NULL);
+		for (j = 0; j < msg->used; j++) {
+			if (data[j] == '#')
+				data[j] = '\0';
+		}
+		max_buffer_size = i_rand_limit(2) == 0 ? 4096 :
+			i_rand_limit(128) + 1;
+
+		test_assert(message_scan_set_impl(MESSAGE_SCAN_IMPL_NONE));
+		str_truncate(output, 0);
+		test_message_parser_scan_parse(msg, max_buffer_size, pool,
+					       &parts, output);
+		for (impl = MESSAGE_SCAN_IMPL_NONE + 1;
+		     impl < MESSAGE_SCAN_IMPL_COUNT; impl++) {
+			if (!message_scan_set_impl(impl))
+				continue;
+			str_truncate(output2, 0);
+			test_message_parser_scan_parse(msg, max_buffer_size,
+						       pool, &parts2, output2);
+			test_assert_idx(message_part_is_equal(parts, parts2), i);
+			test_assert_idx(str_equals(output, output2), i);
+		}
+		p_clear(pool);
+	}
+	test_assert(message_scan_set_impl(best));
+	str_free(&msg);
+	str_free(&output);
+	str_free(&output2);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -1546,6 +1646,7 @@ int main(void)
 		test_message_parser_mime_version_missing,
 		test_message_parser_too_many_header_bytes_default,
 		test_message_parser_too_many_header_bytes_100,
+		test_message_parser_scan_impls,
 		NULL
 	};
 	return test_run(test_functions);
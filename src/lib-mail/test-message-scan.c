@@ -0,0 +1,135 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "message-scan.h"
+#include "test-common.h"
+
+#define TEST_SCAN_MAX_SIZE 300
+
+static const unsigned char test_scan_chars[] = "\n\n\r\r--::\0ab";
+
+static void test_scan_fill(unsigned char *data, size_t size)
+{
+	size_t i;
+
+	/* mostly text with occasional special characters */
+	for (i = 0; i < size; i++) {
+		if (i_rand_limit(4) == 0)
+			data[i] = test_scan_chars[i_rand_limit(sizeof(test_scan_chars) - 1)];
+		else
+			data[i] = 'a' + i_rand_limit(26);
+	}
+}
+
+static void
+test_scan_impl(enum message_scan_impl impl, const unsigned char *data,
+	       size_t size)
+{
+	struct message_scan_lines lines, lines2;
+	const unsigned char *lf, *lf2;
+	unsigned char prev_chr = i_rand_limit(2) == 0 ? '\r' : 'x';
+	bool has_nuls, has_nuls2;
+	size_t pos, pos2;
+
+	test_assert(message_scan_set_impl(MESSAGE_SCAN_IMPL_NONE));
+	message_scan_lines(data, size, prev_chr, &lines);
+	lf = message_scan_boundary_lf(data, size);
+	has_nuls = FALSE;
+	pos = message_scan_find_chr2(data, size, ':', '\n', &has_nuls);
+
+	test_assert(message_scan_set_impl(impl));
+	message_scan_lines(data, size, prev_chr, &lines2);
+	test_assert_idx(lines.lines == lines2.lines, size);
+	test_assert_idx(lines.missing_cr_count == lines2.missing_cr_count,
+			size);
+	test_assert_idx(lines.has_nuls == lines2.has_nuls, size);
+
+	lf2 = message_scan_boundary_lf(data, size);
+	test_assert_idx(lf == lf2, size);
+
+	has_nuls2 = FALSE;
+	pos2 = message_scan_find_chr2(data, size, ':', '\n', &has_nuls2);
+	test_assert_idx(pos == pos2, size);
+	test_assert_idx(has_nuls == has_nuls2, size);
+}
+
+static void test_message_scan_scalar(void)
+{
+	static const unsigned char data[] = "a\r\nb\n--c:\0d\n-";
+	struct message_scan_lines lines;
+	bool has_nuls = FALSE;
+
+	test_begin("message scan scalar");
+	test_assert(message_scan_set_impl(MESSAGE_SCAN_IMPL_NONE));
+
+	message_scan_lines(data, sizeof(data) - 1, '\r', &lines);
+	test_assert(lines.lines == 3);
+	test_assert(lines.missing_cr_count == 2);
+	test_assert(lines.has_nuls);
+	message_scan_lines(data + 2, 1, '\r', &lines);
+	test_assert(lines.lines == 1 && lines.missing_cr_count == 0);
+	message_scan_lines(data + 2, 1, 'x', &lines);
+	test_assert(lines.lines == 1 && lines.missing_cr_count == 1);
+
+	test_assert(message_scan_boundary_lf(data, sizeof(data) - 1) ==
+		    data + 4);
+	test_assert(message_scan_boundary_lf(data, 4) == data + 2);
+	test_assert(message_scan_boundary_lf(data, 2) == NULL);
+	test_assert(message_scan_boundary_lf(data + 5, sizeof(data) - 6) ==
+		    data + 11);
+
+	test_assert(message_scan_find_chr2(data, sizeof(data) - 1,
+					   ':', '\n', &has_nuls) == 2);
+	test_assert(!has_nuls);
+	test_assert(message_scan_find_chr2(data + 9, sizeof(data) - 10,
+					   ':', '\n', &has_nuls) == 2);
+	test_assert(has_nuls);
+	test_end();
+}
+
+static void test_message_scan_impls(void)
+{
+	enum message_scan_impl best = message_scan_get_best_impl();
+	enum message_scan_impl impl;
+	unsigned char data[TEST_SCAN_MAX_SIZE];
+	unsigned int i;
+	size_t size, offset;
+
+	for (impl = MESSAGE_SCAN_IMPL_NONE + 1;
+	     impl < MESSAGE_SCAN_IMPL_COUNT; impl++) {
+		if (!message_scan_set_impl(impl))
+			continue;
+
+		test_begin(t_strdup_printf("message scan %s",
+					   message_scan_impl_get_name(impl)));
+		for (i = 0; i < 2000; i++) {
+			size = i_rand_limit(TEST_SCAN_MAX_SIZE);
+			offset = i_rand_limit(TEST_SCAN_MAX_SIZE - size + 1);
+			test_scan_fill(data + offset, size);
+			test_scan_impl(impl, data + offset, size);
+		}
+		/* special characters only at the end of long inputs */
+		memset(data, 'a', sizeof(data));
+		for (size = 1; size < 80; size++) {
+			memcpy(data + size - 1, "\n", 1);
+			test_scan_impl(impl, data, size);
+			memcpy(data + size - 1, ":", 1);
+			test_scan_impl(impl, data, size);
+			memcpy(data + size - 1, "\0", 1);
+			test_scan_impl(impl, data, size);
+			data[size - 1] = 'a';
+		}
+		test_end();
+	}
+	test_assert(message_scan_set_impl(best));
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_message_scan_scalar,
+		test_message_scan_impls,
+		NULL
+	};
+	return test_run(test_functions);
+}
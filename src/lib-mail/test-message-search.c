@@ -510,11 +510,58 @@ static void test_message_search_more_get_decoded(void)
 	test_end();
 }
 
+static void test_message_search_multi(void)
+{
+	const char *const keys[] = {
+		"my opinion", "funny hat", "funny hat", "Foobar",
+		"agreeing", "someone@else", NULL
+	};
+	const enum message_search_flags key_flags[] = {
+		0, MESSAGE_SEARCH_FLAG_SKIP_HEADERS, 0, 0,
+		MESSAGE_SEARCH_FLAG_SKIP_HEADERS,
+		MESSAGE_SEARCH_FLAG_SKIP_HEADERS,
+	};
+	const bool expect_found[] = {
+		TRUE, FALSE, TRUE, FALSE, TRUE, FALSE
+	};
+	const char *const found_keys[] = { "my opinion", "funny hat", NULL };
+	struct message_search_context *ctx;
+	struct istream *input;
+	const char *error;
+	unsigned int i, round;
+
+	test_begin("message_search_init_multi()");
+	input = test_istream_create(MULTIPART_DIGEST_CORPUS);
+
+	ctx = message_search_init_multi(keys, key_flags, NULL);
+	for (round = 0; round < 2; round++) {
+		i_stream_seek(input, 0);
+		test_assert(message_search_msg(ctx, input, NULL, &error) == 0);
+		for (i = 0; keys[i] != NULL; i++) {
+			test_assert_idx(message_search_key_found(ctx, i) ==
+					expect_found[i], round*10 + i);
+		}
+	}
+	message_search_deinit(&ctx);
+
+	/* the search stops once all the keys are found */
+	ctx = message_search_init_multi(found_keys, key_flags + 2, NULL);
+	i_stream_seek(input, 0);
+	test_assert(message_search_msg(ctx, input, NULL, &error) == 1);
+	test_assert(message_search_key_found(ctx, 0));
+	test_assert(message_search_key_found(ctx, 1));
+	message_search_deinit(&ctx);
+
+	i_stream_unref(&input);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_search,
 		test_message_search_more_get_decoded,
+		test_message_search_multi,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,306 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "write-full.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-openssl.h"
+#include "iostream-ssl.h"
+#include "iostream-ssl-test.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Sends a file over a TLS connection on the loopback interface with
+ * o_stream_send_istream() and prints the throughput. This is done first
+ * with the default BIO pair I/O and then with ssl_options=ktls, which lets
+ * OpenSSL use the socket directly and enables kernel TLS offload if the
+ * kernel and the negotiated cipher support it. The file can be given as a
+ * parameter, otherwise a random 16 MB file is used.
+ */
+
+#define DEFAULT_ROUNDS 10
+#define SYNTHETIC_FILE_SIZE (16*1024*1024)
+
+struct bench_endpoint {
+	int fd;
+	struct ssl_iostream_context *ctx;
+	struct ssl_iostream *iostream;
+	struct istream *input;
+	struct ostream *output;
+	struct io *io;
+};
+
+struct bench_context {
+	struct bench_endpoint server, client;
+	struct istream *file_input;
+	unsigned int rounds_left;
+	uoff_t received, total_size;
+	bool failed;
+};
+
+static void bench_failed(struct bench_context *ctx, const char *error)
+{
+	i_error("%s", error);
+	ctx->failed = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static int bench_server_flush(struct bench_context *ctx)
+{
+	struct ostream *output = ctx->server.output;
+	int ret;
+
+	if ((ret = o_stream_flush(output)) <= 0) {
+		if (ret < 0)
+			bench_failed(ctx, o_stream_get_error(output));
+		return ret;
+	}
+	while (ctx->rounds_left > 0) {
+		switch (o_stream_send_istream(output, ctx->file_input)) {
+		case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+			i_stream_seek(ctx->file_input, 0);
+			ctx->rounds_left--;
+			break;
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+			i_unreached();
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+			return 0;
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+			bench_failed(ctx, i_stream_get_error(ctx->file_input));
+			return -1;
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+			bench_failed(ctx, o_stream_get_error(output));
+			return -1;
+		}
+	}
+	return o_stream_flush(output);
+}
+
+static void bench_server_input(struct bench_context *ctx)
+{
+	struct istream *input = ctx->server.input;
+
+	/* the client doesn't send anything, but reading is needed to finish
+	   the handshake */
+	if (i_stream_read(input) < 0 && input->stream_errno != 0)
+		bench_failed(ctx, i_stream_get_error(input));
+	i_stream_skip(input, i_stream_get_data_size(input));
+}
+
+static void bench_client_input(struct bench_context *ctx)
+{
+	struct istream *input = ctx->client.input;
+	size_t size;
+	ssize_t ret;
+
+	while ((ret = i_stream_read(input)) > 0) {
+		size = i_stream_get_data_size(input);
+		ctx->received += size;
+		i_stream_skip(input, size);
+	}
+	if (ret < 0)
+		bench_failed(ctx, i_stream_get_error(input));
+	else if (ctx->received == ctx->total_size)
+		io_loop_stop(current_ioloop);
+}
+
+static void bench_connect(int *server_fd_r, int *client_fd_r)
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("listen(127.0.0.1) failed: %m");
+	*client_fd_r = net_connect_ip_blocking(&ip, port, NULL);
+	if (*client_fd_r == -1)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+	net_set_nonblock(listen_fd, FALSE);
+	*server_fd_r = net_accept(listen_fd, NULL, NULL);
+	if (*server_fd_r < 0)
+		i_fatal("accept() failed: %m");
+	net_set_nonblock(*server_fd_r, TRUE);
+	net_set_nonblock(*client_fd_r, TRUE);
+	i_close_fd(&listen_fd);
+}
+
+static void
+bench_endpoint_init(struct bench_endpoint *ep, int fd, bool client, bool ktls)
+{
+	struct ssl_iostream_settings set;
+	const char *error;
+	int ret;
+
+	ep->fd = fd;
+	ep->input = i_stream_create_fd(fd, IO_BLOCK_SIZE);
+	ep->output = o_stream_create_fd(fd, IO_BLOCK_SIZE);
+
+	if (client) {
+		ssl_iostream_test_settings_client(&set);
+		set.allow_invalid_cert = TRUE;
+	} else {
+		ssl_iostream_test_settings_server(&set);
+	}
+	set.ktls = ktls;
+
+	if (client) {
+		if (ssl_iostream_context_init_client(&set, &ep->ctx, &error) < 0)
+			i_fatal("client: %s", error);
+		ret = io_stream_create_ssl_client(ep->ctx, "localhost", NULL, 0,
+						  &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	} else {
+		if (ssl_iostream_context_init_server(&set, &ep->ctx, &error) < 0)
+			i_fatal("server: %s", error);
+		ret = io_stream_create_ssl_server(ep->ctx, NULL,
+						  &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	}
+	if (ret < 0)
+		i_fatal("%s: %s", client ? "client" : "server", error);
+}
+
+static void bench_endpoint_deinit(struct bench_endpoint *ep)
+{
+	io_remove(&ep->io);
+	i_stream_unref(&ep->input);
+	o_stream_unref(&ep->output);
+	ssl_iostream_destroy(&ep->iostream);
+	ssl_iostream_context_unref(&ep->ctx);
+	i_close_fd(&ep->fd);
+}
+
+static void
+bench_iostream_ssl(const char *name, bool ktls, struct istream *file_input,
+		   uoff_t file_size, unsigned int rounds)
+{
+	struct bench_context ctx;
+	struct ioloop *ioloop;
+	int server_fd, client_fd;
+	uint64_t ts_0, nsecs;
+	const char *ktls_status = "";
+
+	i_zero(&ctx);
+	ctx.file_input = file_input;
+	ctx.rounds_left = rounds;
+	ctx.total_size = file_size * rounds;
+	i_stream_seek(file_input, 0);
+
+	ioloop = io_loop_create();
+	bench_connect(&server_fd, &client_fd);
+	bench_endpoint_init(&ctx.server, server_fd, FALSE, ktls);
+	bench_endpoint_init(&ctx.client, client_fd, TRUE, ktls);
+
+	o_stream_set_flush_callback(ctx.server.output, bench_server_flush,
+				    &ctx);
+	ctx.server.io = io_add_istream(ctx.server.input, bench_server_input,
+				       &ctx);
+	ctx.client.io = io_add_istream(ctx.client.input, bench_client_input,
+				       &ctx);
+
+	ts_0 = i_nanoseconds();
+	if (ssl_iostream_handshake(ctx.client.iostream) < 0) {
+		i_fatal("client: %s",
+			ssl_iostream_get_last_error(ctx.client.iostream));
+	}
+	o_stream_set_flush_pending(ctx.server.output, TRUE);
+	io_loop_run(ioloop);
+	nsecs = i_nanoseconds() - ts_0;
+
+	if (ctx.server.iostream->direct_fd) {
+		ktls_status = ctx.server.iostream->ktls_send ?
+			" (kTLS send enabled)" : " (kTLS not available)";
+	}
+	if (!ctx.failed) {
+		printf("%-10s %8.2f MB/s%s\n", name, nsecs == 0 ? 0 :
+		       (double)ctx.total_size * 1000.0 / (double)nsecs,
+		       ktls_status);
+	}
+
+	bench_endpoint_deinit(&ctx.client);
+	bench_endpoint_deinit(&ctx.server);
+	io_loop_destroy(&ioloop);
+}
+
+static struct istream *bench_create_synthetic_file(void)
+{
+	const char *path = ".bench-iostream-ssl.tmp";
+	unsigned char buf[IO_BLOCK_SIZE];
+	unsigned int i;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", path);
+	i_unlink(path);
+	for (i = 0; i < SYNTHETIC_FILE_SIZE / sizeof(buf); i++) {
+		random_fill(buf, sizeof(buf));
+		if (write_full(fd, buf, sizeof(buf)) < 0)
+			i_fatal("write(%s) failed: %m", path);
+	}
+	return i_stream_create_fd_autoclose(&fd, IO_BLOCK_SIZE);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r rounds] [<file>]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = DEFAULT_ROUNDS;
+	struct istream *file_input;
+	uoff_t file_size;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "r:")) > 0) {
+		switch (c) {
+		case 'r':
+			if (str_to_uint(optarg, &rounds) < 0 || rounds == 0)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	if (optind == argc)
+		file_input = bench_create_synthetic_file();
+	else if (optind + 1 == argc)
+		file_input = i_stream_create_file(argv[optind], IO_BLOCK_SIZE);
+	else
+		print_usage(argv[0]);
+	if (i_stream_get_size(file_input, TRUE, &file_size) <= 0) {
+		i_fatal("%s: Couldn't get file size: %s",
+			i_stream_get_name(file_input),
+			i_stream_get_error(file_input));
+	}
+	if (file_size == 0)
+		i_fatal("%s: File is empty", i_stream_get_name(file_input));
+
+	printf("Sending %"PRIuUOFF_T" bytes, %u rounds\n\n", file_size, rounds);
+
+	ssl_iostream_openssl_init();
+	bench_iostream_ssl("bio pair", FALSE, file_input, file_size, rounds);
+	bench_iostream_ssl("ktls", TRUE, file_input, file_size, rounds);
+	ssl_iostream_openssl_deinit();
+
+	i_stream_unref(&file_input);
+	lib_deinit();
+	return 0;
+}
@@ -833,6 +833,11 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 #ifdef SSL_OP_NO_TICKET
 	if (!set->tickets)
 		ssl_ops |= SSL_OP_NO_TICKET;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+	/* SSL_OP_ENABLE_KTLS is set only for the connections that use the
+	   socket directly. Without kTLS support the setting is ignored. */
+	ctx->ktls = set->ktls;
 #endif
 	SSL_CTX_set_options(ctx->ssl_ctx, ssl_ops);
 #ifdef SSL_MODE_RELEASE_BUFFERS
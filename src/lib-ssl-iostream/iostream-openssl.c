@@ -135,6 +135,50 @@ openssl_iostream_set(struct ssl_iostream *ssl_io)
 	}
 }
 
+static bool
+openssl_iostream_can_use_fd(struct ssl_iostream_context *ctx,
+			    struct istream *input, struct ostream *output)
+{
+	int fd = i_stream_get_fd(input);
+
+	if (!ctx->ktls)
+		return FALSE;
+	/* OpenSSL can use the socket directly only if the plain streams
+	   don't do anything else than read/write the same fd (e.g. rawlog
+	   isn't enabled), and they don't have any data buffered. */
+	return fd != -1 && input->readable_fd &&
+		o_stream_get_fd(output) == fd &&
+		input->real_stream->parent == NULL &&
+		output->real_stream->parent == NULL &&
+		i_stream_get_data_size(input) == 0 &&
+		o_stream_get_buffer_used_size(output) == 0;
+}
+
+static long
+openssl_iostream_direct_bio_callback(BIO *bio, int oper,
+				     const char *argp ATTR_UNUSED,
+				     size_t len ATTR_UNUSED,
+				     int argi ATTR_UNUSED, long argl ATTR_UNUSED,
+				     int ret, size_t *processed)
+{
+	struct ssl_iostream *ssl_io = (void *)BIO_get_callback_arg(bio);
+
+	if (ret <= 0 || processed == NULL)
+		return ret;
+
+	/* OpenSSL bypasses the plain streams. Keep their offsets updated
+	   anyway, since they're used as the connection's byte counters. */
+	switch (oper) {
+	case BIO_CB_READ | BIO_CB_RETURN:
+		ssl_io->plain_input->v_offset += *processed;
+		break;
+	case BIO_CB_WRITE | BIO_CB_RETURN:
+		ssl_io->plain_output->offset += *processed;
+		break;
+	}
+	return ret;
+}
+
 static int
 openssl_iostream_create(struct ssl_iostream_context *ctx,
 			struct event *event_parent, const char *host,
@@ -146,7 +190,8 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 {
 	struct ssl_iostream *ssl_io;
 	SSL *ssl;
-	BIO *bio_int, *bio_ext;
+	BIO *bio_int, *bio_ext = NULL;
+	bool direct_fd;
 
 	/* Don't allow an existing io_add_istream() to be use on the input.
 	   It would seem to work, but it would also cause hangs. */
@@ -159,16 +204,39 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 		return -1;
 	}
 
-	/* BIO pairs use default buffer sizes (17 kB in OpenSSL 0.9.8e).
-	   Each of the BIOs have one "write buffer". BIO_write() copies data
-	   to them, while BIO_read() reads from the other BIO's write buffer
-	   into the given buffer. The bio_int is used by OpenSSL and bio_ext
-	   is used by this library. */
-	if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
-		*error_r = t_strdup_printf("BIO_new_bio_pair() failed: %s",
-					   openssl_iostream_error());
-		SSL_free(ssl);
-		return -1;
+	o_stream_uncork(*output);
+	direct_fd = openssl_iostream_can_use_fd(ctx, *input, *output);
+	if (direct_fd) {
+		/* OpenSSL reads and writes the socket itself, which allows
+		   it to enable kTLS once the handshake is finished. */
+		bio_int = BIO_new_socket(i_stream_get_fd(*input), BIO_NOCLOSE);
+		if (bio_int == NULL) {
+			*error_r = t_strdup_printf("BIO_new_socket() failed: %s",
+						   openssl_iostream_error());
+			SSL_free(ssl);
+			return -1;
+		}
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		/* handle disconnections the same way as with BIO pairs */
+		SSL_set_options(ssl, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	} else {
+		/* BIO pairs use default buffer sizes (17 kB in OpenSSL
+		   0.9.8e). Each of the BIOs have one "write buffer".
+		   BIO_write() copies data to them, while BIO_read() reads
+		   from the other BIO's write buffer into the given buffer.
+		   The bio_int is used by OpenSSL and bio_ext is used by this
+		   library. */
+		if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
+			*error_r = t_strdup_printf(
+				"BIO_new_bio_pair() failed: %s",
+				openssl_iostream_error());
+			SSL_free(ssl);
+			return -1;
+		}
 	}
 
 	ssl_io = i_new(struct ssl_iostream, 1);
@@ -177,6 +245,7 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	ssl_iostream_context_ref(ssl_io->ctx);
 	ssl_io->ssl = ssl;
 	ssl_io->bio_ext = bio_ext;
+	ssl_io->direct_fd = direct_fd;
 	ssl_io->plain_input = *input;
 	ssl_io->plain_output = *output;
 	ssl_io->connected_host = i_strdup(host);
@@ -191,6 +260,11 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 		event_set_append_log_prefix(ssl_io->event,
 					    t_strdup_printf("%s: ", host));
 	}
+	if (direct_fd) {
+		BIO_set_callback_ex(bio_int,
+				    openssl_iostream_direct_bio_callback);
+		BIO_set_callback_arg(bio_int, (char *)ssl_io);
+	}
 	/* bio_int will be freed by SSL_free() */
 	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
@@ -198,8 +272,6 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 
 	openssl_iostream_set(ssl_io);
 
-	o_stream_uncork(ssl_io->plain_output);
-
 	*input = openssl_i_stream_create_ssl(ssl_io);
 	ssl_io->ssl_input = *input;
 
@@ -461,6 +533,11 @@ int openssl_iostream_bio_sync(struct ssl_iostream *ssl_io,
 
 	i_assert(type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE);
 
+	if (ssl_io->direct_fd) {
+		/* OpenSSL reads and writes the socket itself */
+		return 0;
+	}
+
 	ret = openssl_iostream_bio_output(ssl_io);
 	if (ret >= 0 && openssl_iostream_bio_input(ssl_io, type) > 0)
 		ret = 1;
@@ -490,6 +567,12 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	err = SSL_get_error(ssl_io->ssl, ret);
 	switch (err) {
 	case SSL_ERROR_WANT_WRITE:
+		if (ssl_io->direct_fd) {
+			/* wait until the socket is writable again */
+			ssl_io->want_read = FALSE;
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+			return 0;
+		}
 		if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE &&
 		    openssl_iostream_bio_sync(ssl_io, type) == 0) {
 			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
@@ -638,6 +721,25 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	i_free_and_null(ssl_io->last_error);
 	ssl_io->handshaked = TRUE;
 
+	if (!ssl_io->ctx->client_ctx) {
+		bool reused = SSL_session_reused(ssl_io->ssl) != 0;
+		struct event_passthrough *e =
+			event_create_passthrough(ssl_io->event)->
+			set_name("ssl_server_handshake_finished")->
+			add_str("session_reused", reused ? "yes" : "no")->
+			add_str("protocol", SSL_get_version(ssl_io->ssl));
+		e_debug(e->event(), "SSL: Handshake finished%s",
+			reused ? " (session reused)" : "");
+	}
+
+	if (ssl_io->direct_fd) {
+		ssl_io->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl_io->ssl));
+		e_debug(ssl_io->event, "SSL: kTLS send %s, receive %s",
+			ssl_io->ktls_send ? "enabled" : "disabled",
+			BIO_get_ktls_recv(SSL_get_rbio(ssl_io->ssl)) ?
+			"enabled" : "disabled");
+	}
+
 	const char *alpn_proto = ssl_iostream_get_application_protocol(ssl_io);
 	if (alpn_proto != NULL && *alpn_proto != '\0')
 		e_debug(ssl_io->event, "SSL: Chosen application protocol %s", alpn_proto);
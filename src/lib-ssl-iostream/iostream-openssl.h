@@ -34,6 +34,7 @@ struct ssl_iostream_context {
 	bool client_ctx:1;
 	bool verify_remote_cert:1;
 	bool allow_invalid_cert:1;
+	bool ktls:1;
 };
 
 struct ssl_iostream {
@@ -77,6 +78,11 @@ struct ssl_iostream {
 	   error won't show up. */
 	bool last_error_is_fallback:1;
 	bool ostream_flush_waiting_input:1;
+	/* OpenSSL reads and writes the plain streams' socket directly
+	   instead of bio_ext (which is NULL). This is needed for kTLS. */
+	bool direct_fd:1;
+	/* Kernel TLS offload is enabled for sending */
+	bool ktls_send:1;
 	bool closed:1;
 	bool destroyed:1;
 };
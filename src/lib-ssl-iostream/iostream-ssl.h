@@ -84,6 +84,9 @@ struct ssl_iostream_settings {
 	bool compression;
 	/* If FALSE, set SSL_OP_NO_TICKET. See OpenSSL documentation. */
 	bool tickets;
+	/* Let OpenSSL use the socket directly and try to enable kernel TLS
+	   offload for it. */
+	bool ktls;
 };
 
 /* Load SSL module */
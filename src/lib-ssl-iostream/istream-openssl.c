@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream-private.h"
+#include "ostream.h"
 #include "iostream-openssl.h"
 
 struct ssl_istream {
@@ -40,6 +41,12 @@ static ssize_t i_stream_ssl_read(struct istream_private *stream)
 		stream->istream.eof = TRUE;
 		return -1;
 	}
+	if (ssl_io->direct_fd && ssl_io->ostream_flush_waiting_input) {
+		/* There's no bio_input() to notice that more input was
+		   read, so just let the ostream try again. */
+		ssl_io->ostream_flush_waiting_input = FALSE;
+		o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+	}
 
 	if (!ssl_io->handshaked) {
 		if ((ret = ssl_iostream_handshake(ssl_io)) <= 0) {
@@ -12,6 +12,7 @@ struct ssl_ostream {
 	buffer_t *buffer;
 
 	bool shutdown:1;
+	bool no_sendfile:1;
 };
 
 static void
@@ -209,6 +210,115 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+#ifdef HAVE_SSL_sendfile
+static bool
+o_stream_ssl_sendfile(struct ssl_ostream *sstream, struct istream *instream,
+		      int in_fd, enum ostream_send_istream_result *res_r)
+{
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	uoff_t in_size, v_offset, abs_start_offset;
+	ossl_ssize_t ret = 0;
+	bool sendfile_not_supported = FALSE;
+	int ret2;
+
+	if ((ret2 = i_stream_get_size(instream, TRUE, &in_size)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+		return TRUE;
+	}
+	if (ret2 == 0) {
+		/* size unknown. we can't use sendfile(). */
+		return FALSE;
+	}
+
+	/* flush out any data in buffer */
+	if (sstream->buffer != NULL && sstream->buffer->used > 0) {
+		if (o_stream_ssl_flush_buffer(sstream) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+		if (sstream->buffer->used > 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+
+	v_offset = instream->v_offset;
+	abs_start_offset = i_stream_get_absolute_offset(instream) - v_offset;
+	while (v_offset < in_size) {
+		/* with kTLS the kernel encrypts the file's data while
+		   sending it, so it's never copied to userspace */
+		openssl_iostream_clear_errors();
+		ret = SSL_sendfile(ssl_io->ssl, in_fd,
+				   abs_start_offset + v_offset,
+				   I_MIN(in_size - v_offset, SSIZE_T_MAX), 0);
+		if (ret == 0) {
+			/* Unexpectedly early EOF at input */
+			i_stream_seek(instream, v_offset);
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINVAL) {
+				/* sendfile() not supported with this fd */
+				openssl_iostream_clear_errors();
+				sendfile_not_supported = TRUE;
+				break;
+			}
+			ret2 = openssl_iostream_handle_error(ssl_io, ret,
+				OPENSSL_IOSTREAM_SYNC_TYPE_WRITE,
+				"SSL_sendfile");
+			if (ret2 < 0) {
+				io_stream_set_error(&sstream->ostream.iostream,
+						    "%s", ssl_io->last_error);
+				sstream->ostream.ostream.stream_errno = errno;
+			}
+			break;
+		}
+		v_offset += ret;
+		sstream->ostream.ostream.offset += ret;
+		/* the kernel's TLS record overhead isn't visible here */
+		ssl_io->plain_output->offset += ret;
+	}
+
+	i_stream_seek(instream, v_offset);
+	if (v_offset == in_size) {
+		instream->eof = TRUE;
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+		return TRUE;
+	}
+	if (sendfile_not_supported)
+		return FALSE;
+	if (sstream->ostream.ostream.stream_errno != 0)
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+	else
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+	return TRUE;
+}
+
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	enum ostream_send_istream_result res;
+	int in_fd;
+
+	in_fd = !instream->readable_fd ? -1 : i_stream_get_fd(instream);
+	if (sstream->ssl_io->ktls_send && !sstream->no_sendfile &&
+	    in_fd != -1 && in_fd != o_stream_get_fd(&outstream->ostream) &&
+	    instream->seekable) {
+		if (o_stream_ssl_sendfile(sstream, instream, in_fd, &res))
+			return res;
+
+		/* sendfile() not supported (with this fd), fallback to
+		   regular sending. */
+		sstream->no_sendfile = TRUE;
+	}
+	return io_stream_copy(&outstream->ostream, instream);
+}
+#endif
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -222,10 +332,16 @@ o_stream_ssl_get_buffer_used_size(const struct ostream_private *stream)
 {
 	const struct ssl_ostream *sstream = (const struct ssl_ostream *)stream;
 	BIO *bio = SSL_get_wbio(sstream->ssl_io->ssl);
-	size_t wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
-	size_t wbuf_total_size = BIO_get_write_buf_size(bio, 0);
 	size_t buffer_used = (sstream->buffer == NULL ? 0 :
 			      sstream->buffer->used);
+
+	if (sstream->ssl_io->direct_fd) {
+		/* OpenSSL writes directly to the socket */
+		return buffer_used;
+	}
+
+	size_t wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
+	size_t wbuf_total_size = BIO_get_write_buf_size(bio, 0);
 	i_assert(wbuf_avail <= wbuf_total_size);
 	return buffer_used + (wbuf_total_size - wbuf_avail) +
 		o_stream_get_buffer_used_size(sstream->ssl_io->plain_output);
@@ -277,6 +393,11 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+#ifdef HAVE_SSL_sendfile
+	/* SSL_sendfile() is used only when kTLS send was enabled for the
+	   connection. Otherwise this falls back to io_stream_copy(). */
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
+#endif
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
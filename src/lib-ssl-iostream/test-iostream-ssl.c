@@ -2,13 +2,17 @@
 
 #include "test-lib.h"
 #include "buffer.h"
+#include "net.h"
 #include "randgen.h"
+#include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
 #include "iostream-openssl.h"
 #include "iostream-ssl.h"
 #include "iostream-ssl-test.h"
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/socket.h>
 
 #define MAX_SENT_BYTES 10000
@@ -381,7 +385,7 @@ static void test_iostream_ssl_handshake(void)
 	test_end();
 }
 
-static void test_iostream_ssl_get_buffer_avail_size(void)
+static void test_iostream_ssl_get_buffer_avail_size_real(bool ktls)
 {
 	struct ssl_iostream_settings set;
 	struct test_endpoint *server, *client;
@@ -389,7 +393,8 @@ static void test_iostream_ssl_get_buffer_avail_size(void)
 	int fd[2];
 	const char *error;
 
-	test_begin("ssl: o_stream_get_buffer_avail_size");
+	test_begin(t_strdup_printf("ssl: o_stream_get_buffer_avail_size%s",
+				   ktls ? " (ktls)" : ""));
 
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
 		i_fatal("socketpair() failed: %m");
@@ -399,9 +404,11 @@ static void test_iostream_ssl_get_buffer_avail_size(void)
 	ioloop = io_loop_create();
 
 	ssl_iostream_test_settings_server(&set);
+	set.ktls = ktls;
 	server = create_test_endpoint(fd[0], &set);
 	ssl_iostream_test_settings_client(&set);
 	set.allow_invalid_cert = TRUE;
+	set.ktls = ktls;
 	client = create_test_endpoint(fd[1], &set);
 	client->client = TRUE;
 
@@ -473,6 +480,12 @@ static void test_iostream_ssl_get_buffer_avail_size(void)
 	test_end();
 }
 
+static void test_iostream_ssl_get_buffer_avail_size(void)
+{
+	test_iostream_ssl_get_buffer_avail_size_real(FALSE);
+	test_iostream_ssl_get_buffer_avail_size_real(TRUE);
+}
+
 static void test_iostream_ssl_small_packets(void)
 {
 	struct ssl_iostream_settings set;
@@ -548,12 +561,299 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+struct send_istream_context {
+	struct test_endpoint *server, *client;
+	struct istream *file_input;
+	buffer_t *received;
+};
+
+static int send_istream_flush_callback(struct send_istream_context *ctx)
+{
+	struct test_endpoint *server = ctx->server;
+	int ret;
+
+	if (server->finished)
+		return flush_output(server, TRUE);
+	if ((ret = flush_output(server, FALSE)) <= 0)
+		return ret;
+	switch (o_stream_send_istream(server->output, ctx->file_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		return flush_output(server, TRUE);
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 0;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		break;
+	}
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+	return -1;
+}
+
+static void send_istream_input_callback(struct send_istream_context *ctx)
+{
+	struct test_endpoint *client = ctx->client;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(client->input, &data, &size)) > 0) {
+		buffer_append(ctx->received, data, size);
+		i_stream_skip(client->input, size);
+	}
+	if (ret < 0) {
+		test_assert(client->input->stream_errno == 0);
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_tcp_socketpair(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("listen(127.0.0.1) failed: %m");
+	fd[1] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd[1] == -1)
+		i_fatal("connect(127.0.0.1:%u) failed: %m", port);
+	fd[0] = net_accept(listen_fd, NULL, NULL);
+	if (fd[0] < 0)
+		i_fatal("accept() failed: %m");
+	i_close_fd(&listen_fd);
+}
+
+static void test_iostream_ssl_send_istream_real(bool tcp)
+{
+	struct send_istream_context ctx;
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	const char *error;
+	unsigned char *data;
+	size_t data_size = 1024*1024;
+	int fd[2], file_fd;
+
+	test_begin(t_strdup_printf(
+		"ssl: o_stream_send_istream() from file (ktls, %s)",
+		tcp ? "tcp" : "unix"));
+
+	i_zero(&ctx);
+	data = i_malloc(data_size);
+	random_fill(data, data_size);
+	file_fd = open(".temp.istream", O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (file_fd == -1)
+		i_fatal("creat(.temp.istream) failed: %m");
+	if (write_full(file_fd, data, data_size) < 0)
+		i_fatal("write(.temp.istream) failed: %m");
+	ctx.file_input = i_stream_create_fd_autoclose(&file_fd, IO_BLOCK_SIZE);
+	ctx.received = buffer_create_dynamic(default_pool, data_size);
+
+	/* kTLS can be enabled only for TCP sockets, and only if the kernel
+	   supports it. Otherwise the file is sent via the regular SSL_write()
+	   path. */
+	if (!tcp) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+			i_fatal("socketpair() failed: %m");
+	} else {
+		test_tcp_socketpair(fd);
+	}
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = TRUE;
+	server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	set.ktls = TRUE;
+	client = create_test_endpoint(fd[1], &set);
+	client->client = TRUE;
+
+	client->other = server;
+	server->other = client;
+	ctx.server = server;
+	ctx.client = client;
+
+	test_assert(ssl_iostream_context_init_server(server->set, &server->ctx,
+		    &error) == 0);
+	test_assert(ssl_iostream_context_init_client(client->set, &client->ctx,
+		    &error) == 0);
+	test_assert(io_stream_create_ssl_server(server->ctx, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client->ctx, "localhost", NULL, 0,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+	/* OpenSSL uses the socket directly with or without kTLS support */
+	test_assert(server->iostream->direct_fd);
+	test_assert(client->iostream->direct_fd);
+
+	o_stream_set_flush_callback(server->output, send_istream_flush_callback,
+				    &ctx);
+	server->io = io_add_istream(server->input, bufsize_discard_callback,
+				    server);
+	client->io = io_add_istream(client->input, send_istream_input_callback,
+				    &ctx);
+
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	test_assert(ssl_iostream_handshake(server->iostream) == 0);
+	o_stream_set_flush_pending(server->output, TRUE);
+
+	to = timeout_add(10000, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(server->finished);
+	test_assert(ctx.received->used == data_size &&
+		    memcmp(ctx.received->data, data, data_size) == 0);
+	/* the plain streams' offsets count the encrypted bytes, even though
+	   OpenSSL doesn't use the streams */
+	test_assert(server->iostream->plain_output->offset > data_size);
+	if (!server->iostream->ktls_send) {
+		test_assert(client->iostream->plain_input->v_offset ==
+			    server->iostream->plain_output->offset);
+	} else {
+		/* SSL_sendfile() can't see the TLS record overhead */
+		test_assert(tcp);
+		test_assert(client->iostream->plain_input->v_offset >
+			    server->iostream->plain_output->offset);
+	}
+	test_assert(client->iostream->plain_output->offset > 0);
+
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+
+	destroy_test_endpoint(&client);
+	destroy_test_endpoint(&server);
+
+	io_loop_destroy(&ioloop);
+	ssl_iostream_context_cache_free();
+
+	i_stream_unref(&ctx.file_input);
+	buffer_free(&ctx.received);
+	i_free(data);
+	i_unlink(".temp.istream");
+	test_end();
+}
+
+static void test_iostream_ssl_send_istream(void)
+{
+	test_iostream_ssl_send_istream_real(FALSE);
+	test_iostream_ssl_send_istream_real(TRUE);
+}
+
+static bool
+test_iostream_ssl_session_handshake(struct ssl_iostream_context *server_ctx,
+				    struct ssl_iostream_context *client_ctx,
+				    const struct ssl_iostream_settings *set,
+				    SSL_SESSION **session)
+{
+	struct test_endpoint *server, *client;
+	const char *error;
+	bool reused = FALSE;
+	int fd[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+
+	server = create_test_endpoint(fd[0], set);
+	client = create_test_endpoint(fd[1], set);
+	client->client = TRUE;
+	server->other = client;
+	client->other = server;
+
+	test_assert(io_stream_create_ssl_server(server_ctx, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client_ctx, "localhost", NULL, 0,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+	/* TLSv1.2 sends the session ID or ticket during the handshake */
+	SSL_set_max_proto_version(client->iostream->ssl, TLS1_2_VERSION);
+	if (*session != NULL)
+		SSL_set_session(client->iostream->ssl, *session);
+
+	client->io = io_add_istream(client->input, handshake_input_callback, client);
+	server->io = io_add_istream(server->input, handshake_input_callback, server);
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(!client->failed && !server->failed);
+
+	if (ssl_iostream_is_handshaked(server->iostream)) {
+		reused = SSL_session_reused(server->iostream->ssl) != 0;
+		SSL_SESSION_free(*session);
+		*session = SSL_get1_session(client->iostream->ssl);
+	}
+	/* shut down both before closing the fds */
+	ssl_iostream_destroy(&client->iostream);
+	ssl_iostream_destroy(&server->iostream);
+	destroy_test_endpoint(&client);
+	destroy_test_endpoint(&server);
+	return reused;
+}
+
+static void test_iostream_ssl_session_resume_real(bool tickets)
+{
+	struct ssl_iostream_settings server_set, client_set;
+	struct ssl_iostream_context *server_ctx, *client_ctx;
+	SSL_SESSION *session = NULL;
+	struct ioloop *ioloop;
+	const char *error;
+
+	test_begin(t_strdup_printf("ssl: session resumption (tickets=%s)",
+				   tickets ? "yes" : "no"));
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.tickets = tickets;
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+
+	ioloop = io_loop_create();
+	test_assert(ssl_iostream_context_init_server(&server_set, &server_ctx,
+						     &error) == 0);
+	test_assert(ssl_iostream_context_init_client(&client_set, &client_ctx,
+						     &error) == 0);
+
+	test_assert(!test_iostream_ssl_session_handshake(server_ctx,
+		client_ctx, &server_set, &session));
+	test_assert(session != NULL);
+	test_assert(test_iostream_ssl_session_handshake(server_ctx,
+		client_ctx, &server_set, &session));
+
+	SSL_SESSION_free(session);
+	ssl_iostream_context_unref(&client_ctx);
+	ssl_iostream_context_unref(&server_ctx);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_iostream_ssl_session_resume(void)
+{
+	test_iostream_ssl_session_resume_real(TRUE);
+	test_iostream_ssl_session_resume_real(FALSE);
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_send_istream,
+		test_iostream_ssl_session_resume,
 		NULL
 	};
 	ssl_iostream_openssl_init();
@@ -222,7 +222,11 @@ static int dbox_file_open_full(struct dbox_file *file, bool try_altpath,
 	/* we're manually checking at dbox_file_close() if we need to close the
 	   fd or not. */
 	fd = file->fd;
-	file->input = i_stream_create_fd_autoclose(&fd, DBOX_READ_BLOCK_SIZE);
+	/* With io_uring the file is read ahead asynchronously. The mail
+	   streams are expected to be blocking though. */
+	file->input = i_stream_create_fd_async_autoclose(&fd,
+							 DBOX_READ_BLOCK_SIZE);
+	file->input->blocking = TRUE;
 	i_stream_set_name(file->input, file->cur_path);
 	i_stream_set_init_buffer_size(file->input, DBOX_READ_BLOCK_SIZE);
 	return dbox_file_read_header(file);
@@ -24,6 +24,12 @@ struct index_search_context {
 	struct mail_thread_context *thread_ctx;
 	pool_t temp_pool;
 
+	/* BODY and TEXT args are searched with a single pass over the mail
+	   using body_search_ctx. Each arg's context is its key index + 1, or
+	   NULL if it wasn't added. body_search_ctx is NULL if there are no
+	   keys. */
+	struct message_search_context *body_search_ctx;
+
 	struct timeval last_nonblock_timeval;
 	struct timeval interrupt_start_time;
 	unsigned long long cost, next_time_check_cost;
@@ -34,6 +40,7 @@ struct index_search_context {
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
 	bool have_nonmatch_always:1;
+	bool body_search_initialized:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
@@ -55,10 +55,16 @@ struct search_header_context {
 	bool threading:1;
 };
 
+ARRAY_DEFINE_TYPE(message_search_flags, enum message_search_flags);
+
 struct search_body_context {
         struct index_search_context *index_ctx;
 	struct istream *input;
 	struct message_part *part;
+
+	/* message_search_msg() result for index_ctx->body_search_ctx */
+	int body_search_ret;
+	bool body_searched:1;
 };
 
 static void search_parse_msgset_args(unsigned int messages_count,
@@ -702,26 +708,75 @@ static void search_header(struct message_header_line *hdr,
 	}
 }
 
-static void search_body(struct mail_search_arg *arg,
-			struct search_body_context *ctx)
+static void
+search_body_args_collect(struct index_search_context *ctx,
+			 struct mail_search_arg *arg,
+			 ARRAY_TYPE(const_string) *keys,
+			 ARRAY_TYPE(message_search_flags) *key_flags)
 {
-	struct message_search_context *msg_search_ctx;
-	const char *error;
-	int ret;
+	enum message_search_flags flags;
+	string_t *dtc;
+	const char *key;
 
-	switch (arg->type) {
-	case SEARCH_BODY:
-	case SEARCH_TEXT:
-		break;
-	default:
-		return;
-	}
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			search_body_args_collect(ctx, arg->value.subargs,
+						 keys, key_flags);
+			continue;
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			break;
+		default:
+			continue;
+		}
 
-	msg_search_ctx = msg_search_arg_context(ctx->index_ctx, arg);
-	if (msg_search_ctx == NULL) {
-		ARG_SET_RESULT(arg, 0);
-		return;
+		dtc = t_str_new(128);
+		if (ctx->mail_ctx.normalizer(arg->value.str,
+					     strlen(arg->value.str), dtc) < 0)
+			i_panic("search key not utf8: %s", arg->value.str);
+		/* searches where dtc is "" are left to search_body(),
+		   which returns them as non-matched. */
+		if (str_len(dtc) == 0)
+			continue;
+
+		flags = arg->type == SEARCH_BODY ?
+			MESSAGE_SEARCH_FLAG_SKIP_HEADERS : 0;
+		key = str_c(dtc);
+		i_assert(arg->context == NULL);
+		arg->context = POINTER_CAST(array_count(keys) + 1);
+		array_push_back(keys, &key);
+		array_push_back(key_flags, &flags);
 	}
+}
+
+static void search_body_init(struct index_search_context *ctx)
+{
+	ARRAY_TYPE(const_string) keys;
+	ARRAY_TYPE(message_search_flags) key_flags;
+
+	/* Search all the BODY and TEXT keys with a single pass, so the mail
+	   doesn't need to be parsed and decoded once for each of them. */
+	t_array_init(&keys, 8);
+	t_array_init(&key_flags, 8);
+	search_body_args_collect(ctx, ctx->mail_ctx.args->args,
+				 &keys, &key_flags);
+	if (array_not_empty(&keys)) {
+		array_append_zero(&keys);
+		ctx->body_search_ctx =
+			message_search_init_multi(array_front(&keys),
+						  array_front(&key_flags),
+						  ctx->mail_ctx.normalizer);
+	}
+	ctx->body_search_initialized = TRUE;
+}
+
+static int search_body_msg(struct search_body_context *ctx,
+			   struct message_search_context *msg_search_ctx)
+{
+	const char *error;
+	int ret;
 
 	i_stream_seek(ctx->input, 0);
 	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part, &error);
@@ -738,7 +793,41 @@ static void search_body(struct mail_search_arg *arg,
 			"read(%s) failed: %s", i_stream_get_name(ctx->input),
 			i_stream_get_error(ctx->input));
 	}
+	return ret;
+}
+
+static void search_body(struct mail_search_arg *arg,
+			struct search_body_context *ctx)
+{
+	struct message_search_context *msg_search_ctx;
+	unsigned int idx;
+	int ret;
+
+	switch (arg->type) {
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		break;
+	default:
+		return;
+	}
+
+	if (!ctx->index_ctx->body_search_initialized) T_BEGIN {
+		search_body_init(ctx->index_ctx);
+	} T_END;
+	if (arg->context == NULL) {
+		/* the normalized key was empty */
+		ARG_SET_RESULT(arg, 0);
+		return;
+	}
+	idx = POINTER_CAST_TO(arg->context, unsigned int) - 1;
 
+	msg_search_ctx = ctx->index_ctx->body_search_ctx;
+	if (!ctx->body_searched) {
+		ctx->body_search_ret = search_body_msg(ctx, msg_search_ctx);
+		ctx->body_searched = TRUE;
+	}
+	ret = ctx->body_search_ret < 0 ? -1 :
+		(message_search_key_found(msg_search_ctx, idx) ? 1 : 0);
 	ARG_SET_RESULT(arg, ret);
 }
 
@@ -1363,6 +1452,11 @@ search_arg_deinit(struct mail_search_arg *arg,
 	case SEARCH_MIMEPART:
 		index_search_mime_arg_deinit(arg, ctx);
 		break;
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		/* key index in body_search_ctx */
+		arg->context = NULL;
+		break;
 	default:
 		if (arg->context != NULL) {
 			struct message_search_context *search_ctx = arg->context;
@@ -1383,6 +1477,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
+	if (ctx->body_search_ctx != NULL)
+		message_search_deinit(&ctx->body_search_ctx);
 
 	mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
 	if (ctx->mail_ctx.sort_program != NULL) {
@@ -0,0 +1,283 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* Number based primary sort keys (ARRIVAL, DATE and SIZE) are stored as
+   32bit integers to per-mailbox index extensions, so the following sorts
+   don't need to look them up from the cache. A stored value of 0 means that
+   the key isn't known yet, otherwise the value is the key plus one. Keys
+   that don't fit into 32 bits are never stored.
+
+   The extension header keeps track of how much of the mailbox is already in
+   sorted order: all the mails up to sorted_uid have nondecreasing keys in
+   UID order. Sorting them is then only a matter of walking through them in
+   sequence order. Mails are normally appended in the order they arrive, so
+   for ARRIVAL this is usually the whole mailbox and for DATE most of it.
+   Expunges can't break the ordering, and new mails grow the sorted range as
+   long as their keys aren't smaller than the largest key within it.
+*/
+#include "lib.h"
+#include "array.h"
+#include "mail-index.h"
+#include "index-storage.h"
+#include "index-sort-private.h"
+
+struct index_sort_keys_header {
+	uint32_t sorted_uid;
+	/* the largest stored value (key+1) within the sorted range */
+	uint32_t sorted_max_value;
+};
+
+struct index_sort_keys {
+	struct mail_search_sort_program *program;
+	uint32_t ext_id;
+
+	struct index_sort_keys_header hdr;
+	/* sequence of the last mail within the sorted range */
+	uint32_t sorted_seq;
+
+	/* seq-1 => key+1 of the keys that were looked up during this sort,
+	   but weren't stored yet */
+	ARRAY(uint32_t) new_values;
+	/* the looked up keys aren't reliable */
+	bool failed;
+};
+
+struct index_sort_keys *
+index_sort_keys_init(struct mail_search_sort_program *program)
+{
+	struct index_sort_keys *keys;
+	const char *name;
+	const void *data;
+	size_t size;
+	uint32_t seq1;
+
+	switch (program->sort_program[0] & MAIL_SORT_MASK) {
+	case MAIL_SORT_ARRIVAL:
+		name = "sort-a";
+		break;
+	case MAIL_SORT_DATE:
+		name = "sort-d";
+		break;
+	case MAIL_SORT_SIZE:
+		name = "sort-z";
+		break;
+	default:
+		return NULL;
+	}
+
+	keys = i_new(struct index_sort_keys, 1);
+	keys->program = program;
+	keys->ext_id = mail_index_ext_register(program->t->box->index, name,
+				sizeof(struct index_sort_keys_header),
+				sizeof(uint32_t), sizeof(uint32_t));
+	mail_index_get_header_ext(program->t->view, keys->ext_id,
+				  &data, &size);
+	if (size >= sizeof(keys->hdr))
+		memcpy(&keys->hdr, data, sizeof(keys->hdr));
+	if (keys->hdr.sorted_uid != 0) {
+		if (!mail_index_lookup_seq_range(program->t->view, 1,
+						 keys->hdr.sorted_uid,
+						 &seq1, &keys->sorted_seq))
+			keys->sorted_seq = 0;
+	}
+	i_array_init(&keys->new_values, 128);
+	return keys;
+}
+
+static bool
+index_sort_keys_get_value(struct index_sort_keys *keys, uint32_t seq,
+			  uint32_t *value_r)
+{
+	const uint32_t *valuep;
+	const void *data;
+	bool expunged;
+
+	if (seq <= array_count(&keys->new_values)) {
+		valuep = array_idx(&keys->new_values, seq - 1);
+		if (*valuep != 0) {
+			*value_r = *valuep;
+			return TRUE;
+		}
+	}
+	mail_index_lookup_ext(keys->program->t->view, seq, keys->ext_id,
+			      &data, &expunged);
+	if (data == NULL || *(const uint32_t *)data == 0)
+		return FALSE;
+	*value_r = *(const uint32_t *)data;
+	return TRUE;
+}
+
+bool index_sort_keys_lookup(struct index_sort_keys *keys, uint32_t seq,
+			    uint64_t *key_r)
+{
+	const void *data;
+	uint32_t value;
+	bool expunged;
+
+	mail_index_lookup_ext(keys->program->t->view, seq, keys->ext_id,
+			      &data, &expunged);
+	if (data == NULL)
+		return FALSE;
+	value = *(const uint32_t *)data;
+	if (value == 0)
+		return FALSE;
+	*key_r = value - 1;
+	return TRUE;
+}
+
+void index_sort_keys_set(struct index_sort_keys *keys, uint32_t seq,
+			 int64_t key)
+{
+	uint32_t value;
+
+	if (key < 0 || key >= (uint32_t)-1) {
+		/* doesn't fit */
+		return;
+	}
+	value = key + 1;
+	array_idx_set(&keys->new_values, seq - 1, &value);
+}
+
+void index_sort_keys_set_failed(struct index_sort_keys *keys)
+{
+	keys->failed = TRUE;
+}
+
+static unsigned int
+index_sort_keys_get_presorted_count(struct index_sort_keys *keys,
+				    const void *nodes, unsigned int count,
+				    size_t node_size,
+				    int (*key_cmp)(const void *, const void *))
+{
+	const unsigned char *p = nodes;
+	uint32_t seq, prev_seq = 0;
+	unsigned int i;
+
+	if (keys->failed)
+		return 0;
+	for (i = 0; i < count; i++) {
+		/* all node structs begin with the sequence */
+		memcpy(&seq, p + i * node_size, sizeof(seq));
+		if (seq > keys->sorted_seq)
+			break;
+		/* nodes are normally added in ascending sequence order, but
+		   don't trust that or the stored keys blindly */
+		if (seq <= prev_seq)
+			return 0;
+		if (i > 0 && key_cmp(p + (i - 1) * node_size,
+				     p + i * node_size) > 0)
+			return 0;
+		prev_seq = seq;
+	}
+	return i;
+}
+
+void index_sort_keys_sort(struct index_sort_keys *keys,
+			  void *nodes, unsigned int count, size_t node_size,
+			  int (*key_cmp)(const void *, const void *),
+			  int (*cmp)(const void *, const void *))
+{
+	unsigned char *p = nodes, *tmp, *dest;
+	unsigned int presorted, i, j, n;
+	const unsigned char *a, *b, *a_end, *b_end;
+	bool reverse;
+
+	presorted = index_sort_keys_get_presorted_count(keys, nodes, count,
+							node_size, key_cmp);
+	if (presorted < 2) {
+		qsort(nodes, count, node_size, cmp);
+		return;
+	}
+
+	tmp = i_malloc(MALLOC_MULTIPLY(count, node_size));
+	reverse = (keys->program->sort_program[0] &
+		   MAIL_SORT_FLAG_REVERSE) != 0;
+	if (reverse) {
+		/* reverse the presorted nodes, but keep the nodes with equal
+		   keys in ascending sequence order */
+		dest = tmp;
+		for (i = presorted; i > 0; i = j) {
+			for (j = i - 1; j > 0; j--) {
+				if (key_cmp(p + (j - 1) * node_size,
+					    p + (i - 1) * node_size) != 0)
+					break;
+			}
+			n = i - j;
+			memcpy(dest, p + j * node_size, n * node_size);
+			dest += n * node_size;
+		}
+		memcpy(p, tmp, presorted * node_size);
+	}
+
+	/* sort the rest and merge them with the presorted nodes */
+	p += presorted * node_size;
+	qsort(p, count - presorted, node_size, cmp);
+	a = nodes; a_end = p;
+	b = p; b_end = p + (count - presorted) * node_size;
+	dest = tmp;
+	while (a < a_end && b < b_end) {
+		if (cmp(b, a) < 0) {
+			memcpy(dest, b, node_size);
+			b += node_size;
+		} else {
+			memcpy(dest, a, node_size);
+			a += node_size;
+		}
+		dest += node_size;
+	}
+	memcpy(dest, a, a_end - a);
+	dest += a_end - a;
+	memcpy(dest, b, b_end - b);
+	memcpy(nodes, tmp, MALLOC_MULTIPLY(count, node_size));
+	i_free(tmp);
+}
+
+static void index_sort_keys_update_header(struct index_sort_keys *keys)
+{
+	struct mail_index_view *view = keys->program->t->view;
+	struct index_sort_keys_header hdr = keys->hdr;
+	uint32_t seq, count, value, uid;
+
+	if (keys->failed)
+		return;
+
+	/* grow the sorted range as far as the keys are known and in order */
+	count = mail_index_view_get_messages_count(view);
+	for (seq = keys->sorted_seq + 1; seq <= count; seq++) {
+		if (!index_sort_keys_get_value(keys, seq, &value) ||
+		    value < hdr.sorted_max_value)
+			break;
+		mail_index_lookup_uid(view, seq, &uid);
+		if (uid == 0) {
+			/* uncommitted append */
+			break;
+		}
+		hdr.sorted_uid = uid;
+		hdr.sorted_max_value = value;
+	}
+	if (hdr.sorted_uid != keys->hdr.sorted_uid) {
+		mail_index_update_header_ext(keys->program->t->itrans,
+					     keys->ext_id, 0,
+					     &hdr, sizeof(hdr));
+	}
+}
+
+void index_sort_keys_deinit(struct index_sort_keys **_keys)
+{
+	struct index_sort_keys *keys = *_keys;
+	const uint32_t *values;
+	unsigned int i, count;
+
+	*_keys = NULL;
+
+	values = array_get(&keys->new_values, &count);
+	for (i = 0; i < count; i++) {
+		if (values[i] == 0 ||
+		    mail_index_is_expunged(keys->program->t->view, i + 1))
+			continue;
+		mail_index_update_ext(keys->program->t->itrans, i + 1,
+				      keys->ext_id, &values[i], NULL);
+	}
+	index_sort_keys_update_header(keys);
+	array_free(&keys->new_values);
+	i_free(keys);
+}
@@ -13,6 +13,8 @@ struct mail_search_sort_program {
 			      struct mail *mail);
 	void (*sort_list_finish)(struct mail_search_sort_program *program);
 	void *context;
+	/* stored ARRIVAL/DATE/SIZE keys for the primary sort condition */
+	struct index_sort_keys *keys;
 
 	ARRAY_TYPE(uint32_t) seqs;
 	unsigned int iter_idx;
@@ -32,4 +34,27 @@ void index_sort_list_add_string(struct mail_search_sort_program *program,
 				struct mail *mail);
 void index_sort_list_finish_string(struct mail_search_sort_program *program);
 
+/* Returns NULL if the primary sort condition doesn't have stored keys. */
+struct index_sort_keys *
+index_sort_keys_init(struct mail_search_sort_program *program);
+/* Write the keys looked up during the sort to the index. */
+void index_sort_keys_deinit(struct index_sort_keys **keys);
+/* Returns TRUE if the mail's key was found from the index. */
+bool index_sort_keys_lookup(struct index_sort_keys *keys, uint32_t seq,
+			    uint64_t *key_r);
+/* Remember the key looked up for the mail. */
+void index_sort_keys_set(struct index_sort_keys *keys, uint32_t seq,
+			 int64_t key);
+/* Some key lookup failed, so the added nodes can't be trusted to be in
+   sorted order. */
+void index_sort_keys_set_failed(struct index_sort_keys *keys);
+/* Sort the nodes like qsort() would, but without comparing the nodes that
+   are known to be already in sorted order. key_cmp() compares only the
+   primary keys in ascending order. cmp() is the full comparison, which must
+   break ties with ascending sequences. */
+void index_sort_keys_sort(struct index_sort_keys *keys,
+			  void *nodes, unsigned int count, size_t node_size,
+			  int (*key_cmp)(const void *, const void *),
+			  int (*cmp)(const void *, const void *));
+
 #endif
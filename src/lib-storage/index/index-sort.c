@@ -40,6 +40,9 @@ static void
 index_sort_program_set_mail_failed(struct mail_search_sort_program *program,
 				   struct mail *mail)
 {
+	if (program->keys != NULL)
+		index_sort_keys_set_failed(program->keys);
+
 	switch (mailbox_get_last_mail_error(mail->box)) {
 	case MAIL_ERROR_EXPUNGED:
 		break;
@@ -77,11 +80,16 @@ index_sort_list_add_arrival(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	uint64_t key;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_received_date(mail, &node->date) < 0)
+	if (index_sort_keys_lookup(program->keys, mail->seq, &key))
+		node->date = key;
+	else if (mail_get_received_date(mail, &node->date) < 0)
 		node->date = index_sort_program_set_date_failed(program, mail);
+	else
+		index_sort_keys_set(program->keys, mail->seq, node->date);
 }
 
 static void
@@ -90,16 +98,26 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	uint64_t key;
 	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
+	if (index_sort_keys_lookup(program->keys, mail->seq, &key)) {
+		node->date = key;
+		return;
+	}
+	if (mail_get_date(mail, &node->date, &tz) < 0) {
 		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
+		return;
+	}
+	if (node->date == 0) {
+		if (mail_get_received_date(mail, &node->date) < 0) {
 			node->date = index_sort_program_set_date_failed(program, mail);
+			return;
+		}
 	}
+	index_sort_keys_set(program->keys, mail->seq, node->date);
 }
 
 static void
@@ -108,12 +126,17 @@ index_sort_list_add_size(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
 	struct mail_sort_node_size *node;
+	uint64_t key;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_virtual_size(mail, &node->size) < 0) {
+	if (index_sort_keys_lookup(program->keys, mail->seq, &key))
+		node->size = key;
+	else if (mail_get_virtual_size(mail, &node->size) < 0) {
 		index_sort_program_set_mail_failed(program, mail);
 		node->size = 0;
+	} else {
+		index_sort_keys_set(program->keys, mail->seq, node->size);
 	}
 }
 
@@ -211,12 +234,35 @@ static int sort_node_date_cmp(const struct mail_sort_node_date *n1,
 					n1->seq, n2->seq);
 }
 
+static int sort_node_date_key_cmp(const struct mail_sort_node_date *n1,
+				  const struct mail_sort_node_date *n2)
+{
+	if (n1->date < n2->date)
+		return -1;
+	if (n1->date > n2->date)
+		return 1;
+	return 0;
+}
+
 static void
 index_sort_list_finish_date(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
-
-	array_sort(nodes, sort_node_date_cmp);
+	struct mail_sort_node_date *node_arr;
+	unsigned int count;
+
+	if (program->keys != NULL &&
+	    program->sort_program[1] == MAIL_SORT_END) {
+		/* ties are sorted by sequence - the stored keys can be used
+		   to skip sorting the mails that are already in order */
+		node_arr = array_get_modifiable(nodes, &count);
+		index_sort_keys_sort(program->keys, node_arr, count,
+			sizeof(*node_arr),
+			(int (*)(const void *, const void *))sort_node_date_key_cmp,
+			(int (*)(const void *, const void *))sort_node_date_cmp);
+	} else {
+		array_sort(nodes, sort_node_date_cmp);
+	}
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -237,12 +283,33 @@ static int sort_node_size_cmp(const struct mail_sort_node_size *n1,
 					n1->seq, n2->seq);
 }
 
+static int sort_node_size_key_cmp(const struct mail_sort_node_size *n1,
+				  const struct mail_sort_node_size *n2)
+{
+	if (n1->size < n2->size)
+		return -1;
+	if (n1->size > n2->size)
+		return 1;
+	return 0;
+}
+
 static void
 index_sort_list_finish_size(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
-
-	array_sort(nodes, sort_node_size_cmp);
+	struct mail_sort_node_size *node_arr;
+	unsigned int count;
+
+	if (program->keys != NULL &&
+	    program->sort_program[1] == MAIL_SORT_END) {
+		node_arr = array_get_modifiable(nodes, &count);
+		index_sort_keys_sort(program->keys, node_arr, count,
+			sizeof(*node_arr),
+			(int (*)(const void *, const void *))sort_node_size_key_cmp,
+			(int (*)(const void *, const void *))sort_node_size_cmp);
+	} else {
+		array_sort(nodes, sort_node_size_cmp);
+	}
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -418,6 +485,7 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 			program->sort_list_add = index_sort_list_add_date;
 		program->sort_list_finish = index_sort_list_finish_date;
 		program->context = nodes;
+		program->keys = index_sort_keys_init(program);
 		break;
 	}
 	case MAIL_SORT_SIZE: {
@@ -428,6 +496,7 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 		program->sort_list_add = index_sort_list_add_size;
 		program->sort_list_finish = index_sort_list_finish_size;
 		program->context = nodes;
+		program->keys = index_sort_keys_init(program);
 		break;
 	}
 	case MAIL_SORT_CC:
@@ -474,6 +543,8 @@ int index_sort_program_deinit(struct mail_search_sort_program **_program)
 
 	if (program->context != NULL)
 		index_sort_list_finish(program);
+	if (program->keys != NULL)
+		index_sort_keys_deinit(&program->keys);
 	mail_free(&program->temp_mail);
 	array_free(&program->seqs);
 
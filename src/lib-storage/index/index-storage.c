@@ -294,9 +294,11 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.max_headers_count = set->mail_cache_max_headers_count,
 			.max_size = set->mail_cache_max_size,
 			.purge_min_size = set->mail_cache_purge_min_size,
+			.purge_online_min_size = set->mail_cache_purge_online_min_size,
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.fixed_size_columns = set->mail_cache_fixed_size_columns,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -218,8 +218,9 @@ static void gather_base_subjects(struct thread_finish_context *ctx)
 	gather_ctx.subject_pool =
 		pool_alloconly_create(MEMPOOL_GROWING"base subjects",
 				      nearest_power(count * 20));
-	hash_table_create(&gather_ctx.subject_hash, gather_ctx.subject_pool,
-			  count * 2, str_hash, strcmp);
+	hash_table_create_open(&gather_ctx.subject_hash,
+			       gather_ctx.subject_pool, count,
+			       str_hash, strcmp);
 
 	i_array_init(&sorted_children, 64);
 	for (i = 0; i < count; i++) {
@@ -90,7 +90,10 @@ maildir_open_mail(struct maildir_mailbox *mbox, struct mail *mail,
 		return NULL;
 	}
 
-	input = i_stream_create_fd_autoclose(&ctx.fd, 0);
+	/* With io_uring the mail is read ahead asynchronously. The mail
+	   streams are expected to be blocking though. */
+	input = i_stream_create_fd_async_autoclose(&ctx.fd, 0);
+	input->blocking = TRUE;
 	if (input->stream_errno == EISDIR) {
 		i_stream_destroy(&input);
 		if (maildir_lose_unexpected_dir(&mbox->storage->storage,
@@ -0,0 +1,265 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "str.h"
+#include "time-util.h"
+#include "master-service.h"
+#include "mail-index.h"
+#include "mail-search-build.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#define TEST_TIME_BASE 1000000000
+
+struct test_mail {
+	const char *subject;
+	time_t received;
+	time_t date;
+	unsigned int body_size;
+};
+
+/* The headers have the same length in all the mails, so the sizes are
+   ordered by the body size. */
+static const struct test_mail test_mails[] = {
+	{ "m1", 1000, 5000, 10 },
+	{ "m2", 2000, 3000, 30 },
+	{ "m3", 3000, 4000, 20 },
+	{ "m4", 4000, 6000, 40 },
+};
+/* appended after m3 is expunged: m5 arrives out of order */
+static const struct test_mail test_mails_appended[] = {
+	{ "m5", 500, 7000, 25 },
+	{ "m6", 6000, 2000, 5 },
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+
+static void test_save_mail(struct mailbox_transaction_context *trans,
+			   const struct test_mail *test_mail)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *mail = t_str_new(128);
+	unsigned int i;
+	ssize_t ret;
+
+	str_printfa(mail, "From: user@example.com\n"
+		    "Subject: %s\n"
+		    "Date: %s\n\n", test_mail->subject,
+		    t_strfgmtime("%a, %d %b %Y %H:%M:%S +0000",
+				 TEST_TIME_BASE + test_mail->date));
+	for (i = 0; i < test_mail->body_size; i++)
+		str_append_c(mail, 'x');
+	str_append_c(mail, '\n');
+	input = i_stream_create_from_data(str_data(mail), str_len(mail));
+	save_ctx = mailbox_save_alloc(trans);
+	mailbox_save_set_received_date(save_ctx,
+				       TEST_TIME_BASE + test_mail->received, 0);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	do {
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	} while ((ret = i_stream_read(input)) > 0);
+	test_assert(ret == -1);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	i_stream_unref(&input);
+}
+
+static void
+test_save_mails(struct mailbox *box, const struct test_mail *mails,
+		unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	unsigned int i;
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = 0; i < count; i++) T_BEGIN {
+		test_save_mail(trans, &mails[i]);
+	} T_END;
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void test_expunge_uid(struct mailbox *box, uint32_t uid)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	test_assert(mail_set_uid(mail, uid));
+	mail_expunge(mail);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+/* Sort all the mails and return their subjects in the sorted order. */
+static const char *
+test_sort(struct mailbox *box, enum mail_sort_type sort_type)
+{
+	const enum mail_sort_type sort_program[] = {
+		sort_type, MAIL_SORT_END
+	};
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+	const char *subject;
+	string_t *str = t_str_new(64);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	ctx = mailbox_search_init(trans, args, sort_program, 0, NULL);
+	mail_search_args_unref(&args);
+	while (mailbox_search_next(ctx, &mail)) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		test_assert(mail_get_first_header(mail, "Subject",
+						  &subject) > 0);
+		str_append(str, subject);
+	}
+	test_assert(mailbox_search_deinit(&ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	return str_c(str);
+}
+
+/* Returns the number of mails that have a stored key. */
+static unsigned int
+test_sort_keys_count(struct mailbox *box, const char *ext_name,
+		     uint32_t *sorted_uid_r)
+{
+	struct mail_index_view *view;
+	const void *data;
+	size_t size;
+	uint32_t seq, ext_id;
+	unsigned int count = 0;
+	bool expunged;
+
+	*sorted_uid_r = 0;
+	if (!mail_index_ext_lookup(box->index, ext_name, &ext_id))
+		return 0;
+
+	view = mail_index_view_open(box->index);
+	mail_index_get_header_ext(view, ext_id, &data, &size);
+	if (size >= sizeof(*sorted_uid_r))
+		memcpy(sorted_uid_r, data, sizeof(*sorted_uid_r));
+	for (seq = 1; seq <= mail_index_view_get_messages_count(view); seq++) {
+		mail_index_lookup_ext(view, seq, ext_id, &data, &expunged);
+		if (data != NULL && *(const uint32_t *)data != 0)
+			count++;
+	}
+	mail_index_view_close(&view);
+	return count;
+}
+
+static struct mailbox *test_sort_init(void)
+{
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	struct mailbox *box;
+
+	test_ctx = test_mail_storage_init();
+	test_mail_storage_init_user(test_ctx, &set);
+
+	box = mailbox_alloc(test_ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_save_mails(box, test_mails, N_ELEMENTS(test_mails));
+	return box;
+}
+
+static void test_sort_deinit(struct mailbox **box)
+{
+	mailbox_free(box);
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+}
+
+static void test_index_sort_keys(void)
+{
+	static const struct {
+		enum mail_sort_type type;
+		const char *ext_name;
+		const char *sorted, *sorted_reverse;
+		uint32_t sorted_uid;
+		const char *appended, *appended_reverse;
+		uint32_t appended_sorted_uid;
+	} tests[] = {
+		{ MAIL_SORT_ARRIVAL, "sort-a",
+		  "m1,m2,m3,m4", "m4,m3,m2,m1", 4,
+		  "m5,m1,m2,m4,m6", "m6,m4,m2,m1,m5", 4 },
+		{ MAIL_SORT_DATE, "sort-d",
+		  "m2,m3,m1,m4", "m4,m1,m3,m2", 1,
+		  "m6,m2,m1,m4,m5", "m5,m4,m1,m2,m6", 1 },
+		{ MAIL_SORT_SIZE, "sort-z",
+		  "m1,m3,m2,m4", "m4,m2,m3,m1", 2,
+		  "m6,m1,m5,m2,m4", "m4,m2,m5,m1,m6", 4 },
+	};
+	struct mailbox *box;
+	uint32_t sorted_uid;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		test_begin(t_strdup_printf("index sort keys %s",
+					   tests[i].ext_name));
+		box = test_sort_init();
+
+		/* keys are missing: looked up and stored by the sort */
+		test_assert_idx(test_sort_keys_count(box, tests[i].ext_name,
+						     &sorted_uid) == 0, i);
+		test_assert_strcmp_idx(test_sort(box, tests[i].type),
+				       tests[i].sorted, i);
+		test_assert_idx(test_sort_keys_count(box, tests[i].ext_name,
+						     &sorted_uid) == 4, i);
+		test_assert_idx(sorted_uid == tests[i].sorted_uid, i);
+
+		/* keys are present */
+		test_assert_strcmp_idx(test_sort(box, tests[i].type),
+				       tests[i].sorted, i);
+		test_assert_strcmp_idx(test_sort(box, tests[i].type |
+						 MAIL_SORT_FLAG_REVERSE),
+				       tests[i].sorted_reverse, i);
+
+		/* expunge and append: the new mails' keys are missing */
+		test_expunge_uid(box, 3);
+		test_save_mails(box, test_mails_appended,
+				N_ELEMENTS(test_mails_appended));
+		test_assert_idx(test_sort_keys_count(box, tests[i].ext_name,
+						     &sorted_uid) == 3, i);
+		test_assert_strcmp_idx(test_sort(box, tests[i].type),
+				       tests[i].appended, i);
+		test_assert_idx(test_sort_keys_count(box, tests[i].ext_name,
+						     &sorted_uid) == 5, i);
+		test_assert_idx(sorted_uid == tests[i].appended_sorted_uid, i);
+		test_assert_strcmp_idx(test_sort(box, tests[i].type |
+						 MAIL_SORT_FLAG_REVERSE),
+				       tests[i].appended_reverse, i);
+
+		test_sort_deinit(&box);
+		test_end();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_index_sort_keys,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-index-sort",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(test_functions);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -8,7 +8,8 @@
 
 #define CACHED_STATUS_ITEMS \
 	(STATUS_MESSAGES | STATUS_UNSEEN | STATUS_RECENT | \
-	 STATUS_UIDNEXT | STATUS_UIDVALIDITY | STATUS_HIGHESTMODSEQ)
+	 STATUS_UIDNEXT | STATUS_UIDVALIDITY | STATUS_HIGHESTMODSEQ | \
+	 STATUS_FIRST_RECENT_UID)
 
 struct index_list_changes {
 	struct mailbox_status status;
@@ -20,6 +21,7 @@ struct index_list_changes {
 	bool rec_changed;
 	bool msgs_changed;
 	bool hmodseq_changed;
+	bool first_recent_changed;
 	bool vsize_changed;
 	bool first_saved_changed;
 };
@@ -122,6 +124,19 @@ bool mailbox_list_index_status(struct mailbox_list *list,
 		else
 			status_r->highest_modseq = *rec;
 	}
+	if ((items & STATUS_FIRST_RECENT_UID) != 0) {
+		const uint32_t *rec;
+
+		mail_index_lookup_ext(view, seq, ilist->first_recent_ext_id,
+				      &data, &expunged);
+		rec = data;
+		if (rec == NULL)
+			reason = "Record for first recent UID";
+		else if (*rec == 0)
+			reason = "First recent UID=0";
+		else
+			status_r->first_recent_uid = *rec;
+	}
 	if (vsize_r != NULL) {
 		mail_index_lookup_ext(view, seq, ilist->vsize_ext_id,
 				      &data, &expunged);
@@ -383,6 +398,10 @@ index_list_update_fill_vsize(struct mailbox *box,
 	const void *data;
 	size_t size;
 
+	/* The vsize header exists only after the vsize has been calculated
+	   for the mailbox once (e.g. STATUS SIZE). Until then the list index
+	   can't serve it either. It's not calculated here, since that would
+	   require looking up the size of every mail at sync time. */
 	mail_index_get_header_ext(view, box->vsize_hdr_ext_id,
 				  &data, &size);
 	if (size == sizeof(changes_r->vsize))
@@ -420,6 +439,7 @@ index_list_update_fill_changes(struct mailbox *box,
 		hdr->messages_count - hdr->seen_messages_count;
 	changes_r->status.uidvalidity = hdr->uid_validity;
 	changes_r->status.uidnext = hdr->next_uid;
+	changes_r->status.first_recent_uid = hdr->first_recent_uid;
 
 	if (!mail_index_lookup_seq_range(view, hdr->first_recent_uid,
 					 (uint32_t)-1, &seq1, &seq2))
@@ -508,12 +528,15 @@ index_list_has_changed(struct mailbox *box, struct mail_index_view *list_view,
 	} else {
 		changes->hmodseq_changed = TRUE;
 	}
+	changes->first_recent_changed =
+		old_status.first_recent_uid != changes->status.first_recent_uid;
 	if (memcmp(&old_vsize, &changes->vsize, sizeof(old_vsize)) != 0)
 		changes->vsize_changed = TRUE;
 	index_list_first_saved_update_changes(box, list_view, changes);
 
 	return changes->rec_changed || changes->msgs_changed ||
-		changes->hmodseq_changed || changes->vsize_changed ||
+		changes->hmodseq_changed || changes->first_recent_changed ||
+		changes->vsize_changed ||
 		changes->first_saved_changed;
 }
 
@@ -602,6 +625,11 @@ index_list_update(struct mailbox *box, struct mail_index_view *list_view,
 				      ilist->hmodseq_ext_id,
 				      &changes->status.highest_modseq, NULL);
 	}
+	if (changes->first_recent_changed) {
+		mail_index_update_ext(list_trans, changes->seq,
+				      ilist->first_recent_ext_id,
+				      &changes->status.first_recent_uid, NULL);
+	}
 	if (changes->vsize_changed) {
 		mail_index_update_ext(list_trans, changes->seq,
 				      ilist->vsize_ext_id,
@@ -734,6 +762,7 @@ void mailbox_list_index_update_mailbox_index(struct mailbox *box,
 		   their correct values. */
 		changes.msgs_changed = TRUE;
 		changes.hmodseq_changed = TRUE;
+		changes.first_recent_changed = TRUE;
 	}
 	list_trans = mail_index_transaction_begin(list_view,
 					MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
@@ -860,4 +889,7 @@ void mailbox_list_index_status_init_finish(struct mailbox_list *list)
 	ilist->first_saved_ext_id =
 		mail_index_ext_register(ilist->index, "1saved", 0,
 			sizeof(struct mailbox_index_first_saved), sizeof(uint32_t));
+	ilist->first_recent_ext_id =
+		mail_index_ext_register(ilist->index, "1recent", 0,
+					sizeof(uint32_t), sizeof(uint32_t));
 }
@@ -12,6 +12,12 @@ struct index_list_mailbox {
 	uint32_t pre_sync_log_file_seq;
 	uoff_t pre_sync_log_file_head_offset;
 
+	/* The list index record was verified to be up-to-date during this
+	   ioloop run, while the list index was at this log position. */
+	struct timeval verified_timeval;
+	uint32_t verified_log_file_seq;
+	uoff_t verified_log_file_head_offset;
+
 	bool have_backend:1;
 };
 
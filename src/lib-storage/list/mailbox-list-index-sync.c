@@ -82,10 +82,8 @@ mailbox_list_index_node_add(struct mailbox_list_index_sync_context *ctx,
 		node->next = ctx->ilist->mailbox_tree;
 		ctx->ilist->mailbox_tree = node;
 	}
-	hash_table_insert(ctx->ilist->mailbox_hash,
-			  POINTER_CAST(node->uid), node);
-	hash_table_insert(ctx->ilist->mailbox_names,
-			  POINTER_CAST(node->name_id), dup_name);
+	mailbox_list_index_add_node(ctx->ilist, node);
+	mailbox_list_index_set_name(ctx->ilist, node->name_id, dup_name);
 
 	node_add_to_index(ctx, node, seq_r);
 	return node;
@@ -169,8 +167,7 @@ mailbox_list_index_sync_names(struct mailbox_list_index_sync_context *ctx)
 	array_foreach_elem(&existing_name_ids, id) {
 		if (id != prev_id) {
 			buffer_append(hdr_buf, &id, sizeof(id));
-			name = hash_table_lookup(ilist->mailbox_names,
-						 POINTER_CAST(id));
+			name = mailbox_list_index_lookup_name(ilist, id);
 			i_assert(name != NULL);
 			buffer_append(hdr_buf, name, strlen(name) + 1);
 			prev_id = id;
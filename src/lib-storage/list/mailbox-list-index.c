@@ -2,6 +2,8 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "array.h"
+#include "bsearch-insert-pos.h"
 #include "hash.h"
 #include "str.h"
 #include "mail-index-view-private.h"
@@ -35,14 +37,12 @@ void mailbox_list_index_set_index_error(struct mailbox_list *list)
 static void mailbox_list_index_init_pool(struct mailbox_list_index *ilist)
 {
 	ilist->mailbox_pool = pool_alloconly_create("mailbox list index", 4096);
-	hash_table_create_direct(&ilist->mailbox_names, ilist->mailbox_pool, 0);
-	hash_table_create_direct(&ilist->mailbox_hash, ilist->mailbox_pool, 0);
+	p_array_init(&ilist->mailbox_names, ilist->mailbox_pool, 16);
+	p_array_init(&ilist->mailbox_nodes, ilist->mailbox_pool, 16);
 }
 
 void mailbox_list_index_reset(struct mailbox_list_index *ilist)
 {
-	hash_table_destroy(&ilist->mailbox_names);
-	hash_table_destroy(&ilist->mailbox_hash);
 	pool_unref(&ilist->mailbox_pool);
 
 	ilist->mailbox_tree = NULL;
@@ -167,10 +167,75 @@ mailbox_list_index_lookup(struct mailbox_list *list, const char *name)
 	return node;
 }
 
+static int
+mailbox_list_index_node_uid_cmp(const uint32_t *uid,
+				struct mailbox_list_index_node *const *node)
+{
+	if (*uid < (*node)->uid)
+		return -1;
+	if (*uid > (*node)->uid)
+		return 1;
+	return 0;
+}
+
 struct mailbox_list_index_node *
 mailbox_list_index_lookup_uid(struct mailbox_list_index *ilist, uint32_t uid)
 {
-	return hash_table_lookup(ilist->mailbox_hash, POINTER_CAST(uid));
+	struct mailbox_list_index_node *const *nodep;
+
+	nodep = array_bsearch(&ilist->mailbox_nodes, &uid,
+			      mailbox_list_index_node_uid_cmp);
+	return nodep == NULL ? NULL : *nodep;
+}
+
+void mailbox_list_index_add_node(struct mailbox_list_index *ilist,
+				 struct mailbox_list_index_node *node)
+{
+	unsigned int count = array_count(&ilist->mailbox_nodes);
+
+	i_assert(count == 0 ||
+		 array_idx_elem(&ilist->mailbox_nodes, count-1)->uid < node->uid);
+	array_push_back(&ilist->mailbox_nodes, &node);
+}
+
+static int
+mailbox_list_index_name_id_cmp(const uint32_t *id,
+			       const struct mailbox_list_index_name *name)
+{
+	if (*id < name->id)
+		return -1;
+	if (*id > name->id)
+		return 1;
+	return 0;
+}
+
+const char *
+mailbox_list_index_lookup_name(struct mailbox_list_index *ilist,
+			       uint32_t name_id)
+{
+	const struct mailbox_list_index_name *name;
+
+	name = array_bsearch(&ilist->mailbox_names, &name_id,
+			     mailbox_list_index_name_id_cmp);
+	return name == NULL ? NULL : name->name;
+}
+
+void mailbox_list_index_set_name(struct mailbox_list_index *ilist,
+				 uint32_t name_id, const char *name)
+{
+	struct mailbox_list_index_name *iname;
+	unsigned int idx;
+
+	if (array_bsearch_insert_pos(&ilist->mailbox_names, &name_id,
+				     mailbox_list_index_name_id_cmp, &idx)) {
+		iname = array_idx_modifiable(&ilist->mailbox_names, idx);
+	} else {
+		/* usually the name IDs are added in increasing order, so
+		   this is an append */
+		iname = array_insert_space(&ilist->mailbox_names, idx);
+		iname->id = name_id;
+	}
+	iname->name = name;
 }
 
 void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node,
@@ -200,16 +265,27 @@ static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
 					   struct mail_index_view *view)
 {
 	const void *data, *name_start, *p;
+	struct mailbox_list_index_name *iname;
 	size_t i, len, size;
 	uint32_t id, prev_id = 0;
+	const char *names;
 	string_t *str;
-	char *name;
 	int ret = 0;
 
 	mail_index_map_get_header_ext(view, view->map, ilist->ext_id, &data, &size);
 	if (size == 0)
 		return 0;
 
+	/* Copy all the names at once and point to them, instead of
+	   allocating each name separately. With large folder trees there can
+	   be tens of thousands of them. */
+	names = p_memdup(ilist->mailbox_pool, data, size);
+	/* each name takes at least 5 bytes */
+	i_assert(array_is_empty(&ilist->mailbox_names));
+	array_free(&ilist->mailbox_names);
+	p_array_init(&ilist->mailbox_names, ilist->mailbox_pool,
+		     (size - sizeof(struct mailbox_list_index_header)) / 5 + 1);
+
 	str = t_str_new(128);
 	for (i = sizeof(struct mailbox_list_index_header); i < size; ) {
 		/* get id */
@@ -231,19 +307,19 @@ static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
 		name_start = CONST_PTR_OFFSET(data, i);
 		len = (const char *)p - (const char *)name_start;
 
-		if (uni_utf8_get_valid_data(name_start, len, str)) {
-			name = p_strndup(ilist->mailbox_pool, name_start, len);
-		} else {
+		/* the IDs are increasing, so this keeps the array sorted */
+		iname = array_append_space(&ilist->mailbox_names);
+		iname->id = id;
+		if (uni_utf8_get_valid_data(name_start, len, str))
+			iname->name = names + i;
+		else {
 			/* corrupted index. fix the name. */
-			name = p_strdup(ilist->mailbox_pool, str_c(str));
+			iname->name = p_strdup(ilist->mailbox_pool, str_c(str));
 			str_truncate(str, 0);
 			ret = -1;
 		}
 
 		i += len + 1;
-
-		/* add id => name to hash table */
-		hash_table_insert(ilist->mailbox_names, POINTER_CAST(id), name);
 		ilist->highest_name_id = id;
 	}
 	i_assert(i == size);
@@ -266,8 +342,7 @@ mailbox_list_index_generate_name(struct mailbox_list_index *ilist,
 	node->raw_name = name;
 	node->flags |= MAILBOX_LIST_INDEX_FLAG_CORRUPTED_NAME;
 
-	hash_table_insert(ilist->mailbox_names,
-			  POINTER_CAST(node->name_id), name);
+	mailbox_list_index_set_name(ilist, node->name_id, name);
 	if (ilist->highest_name_id < node->name_id)
 		ilist->highest_name_id = node->name_id;
 }
@@ -302,7 +377,7 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 					    struct mail_index_view *view,
 					    const char **error_r)
 {
-	struct mailbox_list_index_node *node, *parent;
+	struct mailbox_list_index_node *nodes, *node, *parent;
 	HASH_TABLE(struct mailbox_list_index_node *,
 		   struct mailbox_list_index_node *) duplicate_hash;
 	const struct mail_index_record *rec;
@@ -314,19 +389,26 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 
 	*error_r = NULL;
 
+	count = mail_index_view_get_messages_count(view);
 	pool_t dup_pool =
 		pool_alloconly_create(MEMPOOL_GROWING"duplicate pool", 2048);
-	hash_table_create(&duplicate_hash, dup_pool, 0,
+	hash_table_create(&duplicate_hash, dup_pool, count,
 			  mailbox_list_index_node_hash,
 			  mailbox_list_index_node_cmp);
-	count = mail_index_view_get_messages_count(view);
 	if (!ilist->has_backing_store)
 		hash_table_create(&duplicate_guid, dup_pool, 0, guid_128_hash,
 				  guid_128_cmp);
 
+	/* All the nodes are allocated at once. The records are sorted by
+	   uid, so appending them keeps mailbox_nodes sorted. */
+	nodes = p_new(ilist->mailbox_pool, struct mailbox_list_index_node,
+		      I_MAX(count, 1));
+	i_assert(array_is_empty(&ilist->mailbox_nodes));
+	array_free(&ilist->mailbox_nodes);
+	p_array_init(&ilist->mailbox_nodes, ilist->mailbox_pool, count + 16);
+
 	for (seq = 1; seq <= count; seq++) {
-		node = p_new(ilist->mailbox_pool,
-			     struct mailbox_list_index_node, 1);
+		node = &nodes[seq-1];
 		rec = mail_index_lookup(view, seq);
 		node->uid = rec->uid;
 		node->flags = rec->flags;
@@ -348,8 +430,8 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 			node->name_id = ++ilist->highest_name_id;
 			node->corrupted_ext = TRUE;
 		}
-		node->raw_name = hash_table_lookup(ilist->mailbox_names,
-					       POINTER_CAST(irec->name_id));
+		node->raw_name = mailbox_list_index_lookup_name(ilist,
+								irec->name_id);
 		if (node->raw_name == NULL) {
 			*error_r = t_strdup_printf(
 				"name_id=%u not in index header", irec->name_id);
@@ -398,8 +480,7 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 			}
 		}
 
-		hash_table_insert(ilist->mailbox_hash,
-				  POINTER_CAST(node->uid), node);
+		mailbox_list_index_add_node(ilist, node);
 	}
 
 	/* do a second scan to create the actual mailbox tree hierarchy.
@@ -413,8 +494,8 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 				      &data, &expunged);
 		irec = data;
 
-		node = mailbox_list_index_lookup_uid(ilist, uid);
-		i_assert(node != NULL);
+		node = &nodes[seq-1];
+		i_assert(node->uid == uid);
 
 		if (irec->parent_uid != 0) {
 			/* node should have a parent */
@@ -812,6 +893,34 @@ bool mailbox_list_index_get_index(struct mailbox_list *list,
 	return TRUE;
 }
 
+static bool
+mailbox_list_index_view_is_verified(struct mailbox *box,
+				    struct mail_index_view *view)
+{
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+	const struct mail_index_header *hdr = mail_index_get_header(view);
+
+	/* Only trust the earlier check within the same ioloop run, the same
+	   way as mailbox_list_index_refresh() does. */
+	return !box->opened &&
+		ibox->verified_timeval.tv_sec == ioloop_timeval.tv_sec &&
+		ibox->verified_timeval.tv_usec == ioloop_timeval.tv_usec &&
+		ibox->verified_log_file_seq == hdr->log_file_seq &&
+		ibox->verified_log_file_head_offset == hdr->log_file_head_offset;
+}
+
+static void
+mailbox_list_index_view_set_verified(struct mailbox *box,
+				     struct mail_index_view *view)
+{
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+	const struct mail_index_header *hdr = mail_index_get_header(view);
+
+	ibox->verified_timeval = ioloop_timeval;
+	ibox->verified_log_file_seq = hdr->log_file_seq;
+	ibox->verified_log_file_head_offset = hdr->log_file_head_offset;
+}
+
 int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 				 struct mail_index_view **view_r,
 				 uint32_t *seq_r)
@@ -859,11 +968,19 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 	} else if (!require_refreshed) {
 		/* this operation doesn't need the index to be up-to-date */
 		ret = 0;
+	} else if (mailbox_list_index_view_is_verified(box, view)) {
+		/* e.g. STATUS with SIZE or LIST-STATUS looks up the same
+		   mailbox multiple times. Nothing has changed in the list
+		   index since it was verified, so don't check the mailbox
+		   again. */
+		ret = 0;
 	} else {
 		ret = box->v.list_index_has_changed == NULL ? 0 :
 			box->v.list_index_has_changed(box, view, seq, FALSE,
 						      &reason);
 		i_assert(ret <= 0 || reason != NULL);
+		if (ret == 0)
+			mailbox_list_index_view_set_verified(box, view);
 	}
 
 	if (ret != 0) {
@@ -892,8 +1009,6 @@ static void mailbox_list_index_deinit(struct mailbox_list *list)
 
 	timeout_remove(&ilist->to_refresh);
 	if (ilist->index != NULL) {
-		hash_table_destroy(&ilist->mailbox_hash);
-		hash_table_destroy(&ilist->mailbox_names);
 		pool_unref(&ilist->mailbox_pool);
 		if (ilist->opened)
 			mail_index_close(ilist->index);
@@ -96,18 +96,24 @@ struct mailbox_list_index_node {
 	const char *raw_name;
 };
 
+struct mailbox_list_index_name {
+	uint32_t id;
+	const char *name;
+};
+
 struct mailbox_list_index {
 	union mailbox_list_module_context module_ctx;
 
 	const char *path;
 	struct mail_index *index;
 	uint32_t ext_id, msgs_ext_id, hmodseq_ext_id, subs_hdr_ext_id;
-	uint32_t vsize_ext_id, first_saved_ext_id;
+	uint32_t vsize_ext_id, first_saved_ext_id, first_recent_ext_id;
 	struct timeval last_refresh_timeval;
 
 	pool_t mailbox_pool;
-	/* uin32_t id => name */
-	HASH_TABLE(void *, char *) mailbox_names;
+	/* id => name, sorted by id. The names parsed from the index header
+	   point to a single copy of the header's name area. */
+	ARRAY(struct mailbox_list_index_name) mailbox_names;
 	uint32_t highest_name_id;
 
 	struct mailbox_list_index_sync_context *sync_ctx;
@@ -116,8 +122,8 @@ struct mailbox_list_index {
 	uint32_t sync_stamp;
 	struct timeout *to_refresh;
 
-	/* uint32_t uid => node */
-	HASH_TABLE(void *, struct mailbox_list_index_node *) mailbox_hash;
+	/* All nodes sorted by uid. Looked up with a binary search. */
+	ARRAY(struct mailbox_list_index_node *) mailbox_nodes;
 	struct mailbox_list_index_node *mailbox_tree;
 
 	enum mail_index_error_code index_error_code;
@@ -161,6 +167,17 @@ struct mailbox_list_index_node *
 mailbox_list_index_lookup(struct mailbox_list *list, const char *name);
 struct mailbox_list_index_node *
 mailbox_list_index_lookup_uid(struct mailbox_list_index *ilist, uint32_t uid);
+/* Add a new node. Its uid must be higher than any existing node's. */
+void mailbox_list_index_add_node(struct mailbox_list_index *ilist,
+				 struct mailbox_list_index_node *node);
+/* Returns name for the name_id, or NULL if it doesn't exist. */
+const char *
+mailbox_list_index_lookup_name(struct mailbox_list_index *ilist,
+			       uint32_t name_id);
+/* Add or replace the name for the name_id. The name must stay valid as long
+   as mailbox_pool. */
+void mailbox_list_index_set_name(struct mailbox_list_index *ilist,
+				 uint32_t name_id, const char *name);
 void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node,
 				      char sep, string_t *str);
 void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
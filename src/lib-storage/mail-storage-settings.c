@@ -54,9 +54,11 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SIZE_HIDDEN, mail_cache_max_size),
 	DEF(UINT_HIDDEN, mail_cache_min_mail_count),
 	DEF(SIZE_HIDDEN, mail_cache_purge_min_size),
+	DEF(SIZE_HIDDEN, mail_cache_purge_online_min_size),
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(BOOL_HIDDEN, mail_cache_fixed_size_columns),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
@@ -128,9 +130,11 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_max_headers_count = 100,
 	.mail_cache_max_size = 1024 * 1024 * 1024,
 	.mail_cache_purge_min_size = 32 * 1024,
+	.mail_cache_purge_online_min_size = 0,
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_fixed_size_columns = FALSE,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
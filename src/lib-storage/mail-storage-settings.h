@@ -45,6 +45,7 @@ struct mail_storage_settings {
 	unsigned int mail_cache_max_headers_count;
 	uoff_t mail_cache_max_size;
 	uoff_t mail_cache_purge_min_size;
+	uoff_t mail_cache_purge_online_min_size;
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
@@ -60,6 +61,7 @@ struct mail_storage_settings {
 	unsigned int mail_temp_scan_interval;
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
+	bool mail_cache_fixed_size_columns;
 	bool mail_save_crlf;
 	const char *mail_fsync;
 	bool mmap_disable;
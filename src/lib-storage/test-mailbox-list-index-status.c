@@ -0,0 +1,204 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "master-service.h"
+#include "mail-storage-private.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <sys/stat.h>
+#include <utime.h>
+
+#define TEST_MAILBOX_NAME "box"
+#define TEST_MAIL_COUNT 3
+
+static struct test_mail_storage_ctx *test_ctx;
+
+static void test_save_mails(struct mailbox *box, unsigned int count)
+{
+	static const char mail[] =
+		"From: user@example.com\n"
+		"Subject: test\n\nbody\n";
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	unsigned int i;
+	ssize_t ret;
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = 0; i < count; i++) {
+		input = i_stream_create_from_data(mail, sizeof(mail) - 1);
+		save_ctx = mailbox_save_alloc(trans);
+		test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+		do {
+			test_assert(mailbox_save_continue(save_ctx) == 0);
+		} while ((ret = i_stream_read(input)) > 0);
+		test_assert(ret == -1);
+		test_assert(mailbox_save_finish(&save_ctx) == 0);
+		i_stream_unref(&input);
+	}
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static struct mailbox *test_mailbox_alloc(enum mailbox_flags flags)
+{
+	return mailbox_alloc(test_ctx->user->namespaces->list,
+			     TEST_MAILBOX_NAME, flags);
+}
+
+static void test_list_index_status_init(void)
+{
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	struct mailbox *box;
+
+	test_ctx = test_mail_storage_init();
+	test_mail_storage_init_user(test_ctx, &set);
+
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_create(box, NULL, FALSE) == 0);
+	test_assert(mailbox_open(box) == 0);
+	test_save_mails(box, TEST_MAIL_COUNT);
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_free(&box);
+}
+
+static void test_list_index_status_deinit(void)
+{
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+}
+
+/* Change the mailbox's transaction log mtime without changing the list index.
+   The list index record no longer matches the mailbox then. */
+static void test_mailbox_log_touch(struct mailbox *box)
+{
+	static time_t mtime = 1000000000;
+	struct utimbuf ut;
+	const char *dir, *path;
+
+	ut.actime = ut.modtime = mtime++;
+	test_assert(mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir) > 0);
+	path = t_strconcat(dir, "/", box->index_prefix, ".log", NULL);
+	test_assert(utime(path, &ut) == 0);
+}
+
+static void test_list_index_status_first_recent_uid(void)
+{
+	struct mailbox_status status;
+	struct mailbox *box;
+
+	test_begin("mailbox list index status first recent uid");
+	test_list_index_status_init();
+
+	/* nothing has dropped the recent flags yet */
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_FIRST_RECENT_UID |
+				       STATUS_MESSAGES, &status) == 0);
+	test_assert(!box->opened);
+	test_assert(status.first_recent_uid == 1);
+	test_assert(status.messages == TEST_MAIL_COUNT);
+	mailbox_free(&box);
+
+	/* SELECT drops the recent flags. The new first recent UID is cached
+	   in the list index when the mailbox is closed. */
+	box = test_mailbox_alloc(MAILBOX_FLAG_DROP_RECENT);
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_free(&box);
+
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_FIRST_RECENT_UID,
+				       &status) == 0);
+	test_assert(!box->opened);
+	test_assert(status.first_recent_uid == TEST_MAIL_COUNT + 1);
+	mailbox_free(&box);
+
+	/* a new mail is recent */
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_open(box) == 0);
+	test_save_mails(box, 1);
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_free(&box);
+
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_FIRST_RECENT_UID |
+				       STATUS_MESSAGES, &status) == 0);
+	test_assert(!box->opened);
+	test_assert(status.first_recent_uid == TEST_MAIL_COUNT + 1);
+	test_assert(status.messages == TEST_MAIL_COUNT + 1);
+	mailbox_free(&box);
+
+	test_list_index_status_deinit();
+	test_end();
+}
+
+static void test_list_index_status_verified(void)
+{
+	struct mailbox_status status;
+	struct mailbox *box, *box2;
+
+	test_begin("mailbox list index status verified");
+	test_list_index_status_init();
+
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(!box->opened);
+	test_assert(status.messages == TEST_MAIL_COUNT);
+
+	/* The list index hasn't changed within this ioloop run, so the
+	   mailbox isn't checked again and the change isn't noticed. */
+	test_mailbox_log_touch(box);
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(!box->opened);
+
+	/* The list index changes: the mailbox is checked again, and its
+	   status is looked up from the mailbox itself. */
+	box2 = mailbox_alloc(test_ctx->user->namespaces->list, "box2", 0);
+	test_assert(mailbox_create(box2, NULL, FALSE) == 0);
+	mailbox_free(&box2);
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(box->opened);
+	test_assert(status.messages == TEST_MAIL_COUNT);
+	mailbox_free(&box);
+
+	/* a new mailbox instance doesn't trust the earlier check */
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(!box->opened);
+	test_mailbox_log_touch(box);
+	mailbox_free(&box);
+
+	box = test_mailbox_alloc(0);
+	test_assert(mailbox_get_status(box, STATUS_MESSAGES, &status) == 0);
+	test_assert(box->opened);
+	test_assert(status.messages == TEST_MAIL_COUNT);
+	mailbox_free(&box);
+
+	test_list_index_status_deinit();
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_list_index_status_first_recent_uid,
+		test_list_index_status_verified,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-mailbox-list-index-status",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(test_functions);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,537 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "base64.h"
+#include "base64-simd.h"
+
+/* The kernels are scheme-agnostic: instead of computing the characters
+   arithmetically for one fixed alphabet, they do table lookups directly
+   from the scheme's encmap and decmap. This way the same code handles the
+   standard, URL-safe and IMAP variants and the output is guaranteed to be
+   identical to the scalar code.
+
+   Encoding uses the well-known pshufb + mulhi/mullo trick to split 12 input
+   bytes into 16 6-bit indexes, which are then translated with 4 16-byte
+   lookups. Decoding translates the characters with 8 16-byte lookups over
+   decmap[0..127] and packs the 6-bit values back into bytes with
+   pmaddubsw + pmaddwd + pshufb. Any block containing characters that are
+   not part of the alphabet (whitespace, padding, invalid characters) stops
+   the vectorized decoding and the rest is left for the scalar code. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#  define HAVE_BASE64_SIMD_X86
+#  include <immintrin.h>
+#  define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#  define HAVE_BASE64_SIMD_NEON
+#  include <arm_neon.h>
+#endif
+
+static const char *base64_simd_impl_names[BASE64_SIMD_IMPL_COUNT] = {
+	[BASE64_SIMD_IMPL_NONE] = "none",
+	[BASE64_SIMD_IMPL_SSSE3] = "ssse3",
+	[BASE64_SIMD_IMPL_AVX2] = "avx2",
+	[BASE64_SIMD_IMPL_NEON] = "neon",
+};
+
+static enum base64_simd_impl base64_simd_cur_impl;
+static bool base64_simd_initialized = FALSE;
+
+#ifdef HAVE_BASE64_SIMD_X86
+
+/*
+ * SSSE3
+ */
+
+static inline __m128i BASE64_TARGET_SSSE3
+base64_enc_reshuffle_ssse3(__m128i in)
+{
+	__m128i t0, t1, t2, t3;
+
+	/* [bbbbcccc|ccdddddd|aaaaaabb|bbbbcccc] for each 3-byte group */
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	/* move the 6-bit values to the low bits of each byte */
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+static inline __m128i BASE64_TARGET_SSSE3
+base64_enc_translate_ssse3(__m128i idx, const __m128i lut[4])
+{
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(idx, 4),
+				   _mm_set1_epi8(0x0f));
+	__m128i out = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		__m128i sel = _mm_cmpeq_epi8(hi, _mm_set1_epi8(i));
+		out = _mm_or_si128(out, _mm_and_si128(
+			_mm_shuffle_epi8(lut[i], idx), sel));
+	}
+	return out;
+}
+
+static size_t BASE64_TARGET_SSSE3
+base64_encode_ssse3(const unsigned char *encmap,
+		    const unsigned char *src, size_t src_size,
+		    unsigned char *dest, size_t dest_size)
+{
+	size_t src_pos = 0, dest_pos = 0;
+	__m128i lut[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		lut[i] = _mm_loadu_si128((const void *)(encmap + i*16));
+
+	/* Each round reads 16 bytes, but uses only 12 of them */
+	while (src_size - src_pos >= 16 && dest_size - dest_pos >= 16) {
+		__m128i in = _mm_loadu_si128((const void *)(src + src_pos));
+		__m128i out = base64_enc_translate_ssse3(
+			base64_enc_reshuffle_ssse3(in), lut);
+
+		_mm_storeu_si128((void *)(dest + dest_pos), out);
+		src_pos += 12;
+		dest_pos += 16;
+	}
+	return src_pos;
+}
+
+static inline __m128i BASE64_TARGET_SSSE3
+base64_dec_translate_ssse3(__m128i in, const __m128i lut[8])
+{
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4),
+				   _mm_set1_epi8(0x0f));
+	__m128i out = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		__m128i sel = _mm_cmpeq_epi8(hi, _mm_set1_epi8(i));
+		out = _mm_or_si128(out, _mm_and_si128(
+			_mm_shuffle_epi8(lut[i], in), sel));
+	}
+	return out;
+}
+
+static inline __m128i BASE64_TARGET_SSSE3
+base64_dec_pack_ssse3(__m128i values)
+{
+	/* [00aaaaaa|00bbbbbb|00cccccc|00dddddd] ->
+	   [aaaaaabb|bbbbcccc|ccdddddd|00000000] */
+	values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(values, _mm_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static size_t BASE64_TARGET_SSSE3
+base64_decode_ssse3(const unsigned char *decmap,
+		    const unsigned char *src, size_t src_size,
+		    unsigned char *dest, size_t dest_size)
+{
+	size_t src_pos = 0, dest_pos = 0;
+	__m128i lut[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		lut[i] = _mm_loadu_si128((const void *)(decmap + i*16));
+
+	while (src_size - src_pos >= 16 && dest_size - dest_pos >= 12) {
+		__m128i in = _mm_loadu_si128((const void *)(src + src_pos));
+		__m128i values, out;
+
+		/* 8bit characters are never part of the alphabet */
+		if (_mm_movemask_epi8(in) != 0)
+			break;
+		values = base64_dec_translate_ssse3(in, lut);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+			values, _mm_set1_epi8((char)0xff))) != 0)
+			break;
+		out = base64_dec_pack_ssse3(values);
+
+		/* Each round writes 16 bytes, but only 12 of them are valid */
+		if (dest_size - dest_pos >= 16)
+			_mm_storeu_si128((void *)(dest + dest_pos), out);
+		else {
+			unsigned char tmp[16];
+
+			_mm_storeu_si128((void *)tmp, out);
+			memcpy(dest + dest_pos, tmp, 12);
+		}
+		src_pos += 16;
+		dest_pos += 12;
+	}
+	return src_pos;
+}
+
+/*
+ * AVX2
+ */
+
+static inline __m256i BASE64_TARGET_AVX2
+base64_enc_reshuffle_avx2(__m256i in)
+{
+	__m256i t0, t1, t2, t3;
+
+	in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t1, t3);
+}
+
+static inline __m256i BASE64_TARGET_AVX2
+base64_enc_translate_avx2(__m256i idx, const __m256i lut[4])
+{
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(idx, 4),
+				      _mm256_set1_epi8(0x0f));
+	__m256i out = _mm256_setzero_si256();
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		__m256i sel = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(i));
+		out = _mm256_or_si256(out, _mm256_and_si256(
+			_mm256_shuffle_epi8(lut[i], idx), sel));
+	}
+	return out;
+}
+
+static size_t BASE64_TARGET_AVX2
+base64_encode_avx2(const unsigned char *encmap,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size)
+{
+	size_t src_pos = 0, dest_pos = 0;
+	__m256i lut[4];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		lut[i] = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const void *)(encmap + i*16)));
+	}
+
+	/* Each round reads 12 bytes into both of the 128bit lanes */
+	while (src_size - src_pos >= 28 && dest_size - dest_pos >= 32) {
+		__m128i lo = _mm_loadu_si128((const void *)(src + src_pos));
+		__m128i hi = _mm_loadu_si128((const void *)(src + src_pos + 12));
+		__m256i in = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(lo), hi, 1);
+		__m256i out = base64_enc_translate_avx2(
+			base64_enc_reshuffle_avx2(in), lut);
+
+		_mm256_storeu_si256((void *)(dest + dest_pos), out);
+		src_pos += 24;
+		dest_pos += 32;
+	}
+	return src_pos + base64_encode_ssse3(encmap, src + src_pos,
+					     src_size - src_pos,
+					     dest + dest_pos,
+					     dest_size - dest_pos);
+}
+
+static inline __m256i BASE64_TARGET_AVX2
+base64_dec_translate_avx2(__m256i in, const __m256i lut[8])
+{
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 4),
+				      _mm256_set1_epi8(0x0f));
+	__m256i out = _mm256_setzero_si256();
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		__m256i sel = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(i));
+		out = _mm256_or_si256(out, _mm256_and_si256(
+			_mm256_shuffle_epi8(lut[i], in), sel));
+	}
+	return out;
+}
+
+static inline __m256i BASE64_TARGET_AVX2
+base64_dec_pack_avx2(__m256i values)
+{
+	values = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+	values = _mm256_madd_epi16(values, _mm256_set1_epi32(0x00011000));
+	values = _mm256_shuffle_epi8(values, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	/* move the 12 bytes of both lanes next to each other */
+	return _mm256_permutevar8x32_epi32(values, _mm256_setr_epi32(
+		0, 1, 2, 4, 5, 6, -1, -1));
+}
+
+static size_t BASE64_TARGET_AVX2
+base64_decode_avx2(const unsigned char *decmap,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size)
+{
+	size_t src_pos = 0, dest_pos = 0;
+	__m256i lut[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		lut[i] = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const void *)(decmap + i*16)));
+	}
+
+	while (src_size - src_pos >= 32 && dest_size - dest_pos >= 24) {
+		__m256i in = _mm256_loadu_si256((const void *)(src + src_pos));
+		__m256i values, out;
+
+		if (_mm256_movemask_epi8(in) != 0)
+			break;
+		values = base64_dec_translate_avx2(in, lut);
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			values, _mm256_set1_epi8((char)0xff))) != 0)
+			break;
+		out = base64_dec_pack_avx2(values);
+
+		if (dest_size - dest_pos >= 32)
+			_mm256_storeu_si256((void *)(dest + dest_pos), out);
+		else {
+			unsigned char tmp[32];
+
+			_mm256_storeu_si256((void *)tmp, out);
+			memcpy(dest + dest_pos, tmp, 24);
+		}
+		src_pos += 32;
+		dest_pos += 24;
+	}
+	return src_pos + base64_decode_ssse3(decmap, src + src_pos,
+					     src_size - src_pos,
+					     dest + dest_pos,
+					     dest_size - dest_pos);
+}
+
+#endif
+
+#ifdef HAVE_BASE64_SIMD_NEON
+
+/*
+ * NEON
+ */
+
+static size_t
+base64_encode_neon(const unsigned char *encmap,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size)
+{
+	const uint8x16_t mask6 = vdupq_n_u8(0x3f);
+	size_t src_pos = 0, dest_pos = 0;
+	uint8x16x4_t lut;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		lut.val[i] = vld1q_u8(encmap + i*16);
+
+	while (src_size - src_pos >= 48 && dest_size - dest_pos >= 64) {
+		/* de-interleave 16 3-byte groups */
+		uint8x16x3_t in = vld3q_u8(src + src_pos);
+		uint8x16x4_t out;
+
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4),
+					       vshrq_n_u8(in.val[1], 4)), mask6);
+		out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2),
+					       vshrq_n_u8(in.val[2], 6)), mask6);
+		out.val[3] = vandq_u8(in.val[2], mask6);
+		for (i = 0; i < 4; i++)
+			out.val[i] = vqtbl4q_u8(lut, out.val[i]);
+		vst4q_u8(dest + dest_pos, out);
+		src_pos += 48;
+		dest_pos += 64;
+	}
+	return src_pos;
+}
+
+static size_t
+base64_decode_neon(const unsigned char *decmap,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size)
+{
+	const uint8x16_t offset = vdupq_n_u8(64);
+	size_t src_pos = 0, dest_pos = 0;
+	uint8x16x4_t lut_lo, lut_hi;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		lut_lo.val[i] = vld1q_u8(decmap + i*16);
+		lut_hi.val[i] = vld1q_u8(decmap + 64 + i*16);
+	}
+
+	while (src_size - src_pos >= 64 && dest_size - dest_pos >= 48) {
+		uint8x16x4_t in = vld4q_u8(src + src_pos);
+		uint8x16_t chars_or, values_max;
+		uint8x16x3_t out;
+
+		chars_or = vorrq_u8(vorrq_u8(in.val[0], in.val[1]),
+				    vorrq_u8(in.val[2], in.val[3]));
+		if (vmaxvq_u8(chars_or) >= 0x80)
+			break;
+		for (i = 0; i < 4; i++) {
+			/* characters 64..127 are out of range for the first
+			   lookup, and 0..63 for the second one */
+			in.val[i] = vqtbx4q_u8(vqtbl4q_u8(lut_lo, in.val[i]),
+					       lut_hi,
+					       vsubq_u8(in.val[i], offset));
+		}
+		values_max = vmaxq_u8(vmaxq_u8(in.val[0], in.val[1]),
+				      vmaxq_u8(in.val[2], in.val[3]));
+		if (vmaxvq_u8(values_max) == 0xff)
+			break;
+
+		out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2),
+				      vshrq_n_u8(in.val[1], 4));
+		out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4),
+				      vshrq_n_u8(in.val[2], 2));
+		out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+		vst3q_u8(dest + dest_pos, out);
+		src_pos += 64;
+		dest_pos += 48;
+	}
+	return src_pos;
+}
+
+#endif
+
+/*
+ * Dispatching
+ */
+
+static bool base64_simd_impl_is_supported(enum base64_simd_impl impl)
+{
+	switch (impl) {
+	case BASE64_SIMD_IMPL_NONE:
+		return TRUE;
+	case BASE64_SIMD_IMPL_SSSE3:
+#ifdef HAVE_BASE64_SIMD_X86
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("ssse3") != 0;
+#else
+		return FALSE;
+#endif
+	case BASE64_SIMD_IMPL_AVX2:
+#ifdef HAVE_BASE64_SIMD_X86
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#else
+		return FALSE;
+#endif
+	case BASE64_SIMD_IMPL_NEON:
+#ifdef HAVE_BASE64_SIMD_NEON
+		/* NEON is mandatory on aarch64 */
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case BASE64_SIMD_IMPL_COUNT:
+		break;
+	}
+	i_unreached();
+}
+
+enum base64_simd_impl base64_simd_get_best_impl(void)
+{
+	static const enum base64_simd_impl impls[] = {
+		BASE64_SIMD_IMPL_AVX2,
+		BASE64_SIMD_IMPL_SSSE3,
+		BASE64_SIMD_IMPL_NEON,
+	};
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (base64_simd_impl_is_supported(impls[i]))
+			return impls[i];
+	}
+	return BASE64_SIMD_IMPL_NONE;
+}
+
+enum base64_simd_impl base64_simd_get_impl(void)
+{
+	if (unlikely(!base64_simd_initialized)) {
+		base64_simd_cur_impl = base64_simd_get_best_impl();
+		base64_simd_initialized = TRUE;
+	}
+	return base64_simd_cur_impl;
+}
+
+bool base64_simd_set_impl(enum base64_simd_impl impl)
+{
+	i_assert(impl < BASE64_SIMD_IMPL_COUNT);
+
+	if (!base64_simd_impl_is_supported(impl))
+		return FALSE;
+	base64_simd_cur_impl = impl;
+	base64_simd_initialized = TRUE;
+	return TRUE;
+}
+
+const char *base64_simd_impl_get_name(enum base64_simd_impl impl)
+{
+	i_assert(impl < BASE64_SIMD_IMPL_COUNT);
+	return base64_simd_impl_names[impl];
+}
+
+size_t base64_encode_simd(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size)
+{
+	const unsigned char *encmap ATTR_UNUSED =
+		(const unsigned char *)b64->encmap;
+
+	switch (base64_simd_get_impl()) {
+	case BASE64_SIMD_IMPL_NONE:
+		return 0;
+#ifdef HAVE_BASE64_SIMD_X86
+	case BASE64_SIMD_IMPL_SSSE3:
+		return base64_encode_ssse3(encmap, src, src_size,
+					   dest, dest_size);
+	case BASE64_SIMD_IMPL_AVX2:
+		return base64_encode_avx2(encmap, src, src_size,
+					  dest, dest_size);
+#endif
+#ifdef HAVE_BASE64_SIMD_NEON
+	case BASE64_SIMD_IMPL_NEON:
+		return base64_encode_neon(encmap, src, src_size,
+					  dest, dest_size);
+#endif
+	default:
+		break;
+	}
+	i_unreached();
+}
+
+size_t base64_decode_simd(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size)
+{
+	const unsigned char *decmap ATTR_UNUSED = b64->decmap;
+
+	switch (base64_simd_get_impl()) {
+	case BASE64_SIMD_IMPL_NONE:
+		return 0;
+#ifdef HAVE_BASE64_SIMD_X86
+	case BASE64_SIMD_IMPL_SSSE3:
+		return base64_decode_ssse3(decmap, src, src_size,
+					   dest, dest_size);
+	case BASE64_SIMD_IMPL_AVX2:
+		return base64_decode_avx2(decmap, src, src_size,
+					  dest, dest_size);
+#endif
+#ifdef HAVE_BASE64_SIMD_NEON
+	case BASE64_SIMD_IMPL_NEON:
+		return base64_decode_neon(decmap, src, src_size,
+					  dest, dest_size);
+#endif
+	default:
+		break;
+	}
+	i_unreached();
+}
@@ -0,0 +1,51 @@
+#ifndef BASE64_SIMD_H
+#define BASE64_SIMD_H
+
+struct base64_scheme;
+
+/* Vectorized Base64 kernels used internally by base64.c. The kernels only
+   handle the bulk of the data: full blocks without whitespace, padding or
+   invalid characters. Everything else is left for the scalar code, which
+   means the output is always identical to the scalar implementation. */
+
+enum base64_simd_impl {
+	/* Use only the scalar code */
+	BASE64_SIMD_IMPL_NONE = 0,
+	BASE64_SIMD_IMPL_SSSE3,
+	BASE64_SIMD_IMPL_AVX2,
+	BASE64_SIMD_IMPL_NEON,
+
+	BASE64_SIMD_IMPL_COUNT
+};
+
+/* Minimum input sizes for the kernels to do anything. Callers can use these
+   to skip calling them for short inputs. */
+#define BASE64_SIMD_ENCODE_MIN_SIZE 16
+#define BASE64_SIMD_DECODE_MIN_SIZE 16
+
+/* Encode as many 3-byte groups from src into dest as possible. Returns the
+   number of source bytes consumed, which is always a multiple of 3. The
+   number of bytes written to dest is 4/3 of that. */
+size_t base64_encode_simd(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size);
+/* Decode as many 4-character groups from src into dest as possible. Stops
+   at the first block containing anything else than characters of the
+   scheme's alphabet. Returns the number of source characters consumed,
+   which is always a multiple of 4. The number of bytes written to dest is
+   3/4 of that. */
+size_t base64_decode_simd(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size);
+
+/* Returns the best implementation supported by this CPU. */
+enum base64_simd_impl base64_simd_get_best_impl(void);
+/* Returns the currently used implementation. */
+enum base64_simd_impl base64_simd_get_impl(void);
+/* Change the used implementation. Returns FALSE if it's not supported by
+   this CPU. This is mainly intended for tests and benchmarks. */
+bool base64_simd_set_impl(enum base64_simd_impl impl);
+/* Returns human-readable name for the implementation. */
+const char *base64_simd_impl_get_name(enum base64_simd_impl impl);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "base64.h"
+#include "base64-simd.h"
 #include "buffer.h"
 
 /*
@@ -307,6 +308,13 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
+	if (src_size - src_pos >= BASE64_SIMD_ENCODE_MIN_SIZE) {
+		size_t n = base64_encode_simd(b64, src_c + src_pos,
+					      src_size - src_pos,
+					      ptr, end - ptr);
+		src_pos += n;
+		ptr += n / 3 * 4;
+	}
 	for (; src_size - src_pos > 2 && &ptr[3] < end;
 	     src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
@@ -599,6 +607,29 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+static size_t
+base64_decode_more_simd(struct base64_decoder *dec,
+			const unsigned char *src, size_t src_size,
+			size_t dst_avail, buffer_t *dest)
+{
+	/* Decode via a small stack buffer rather than reserving space from
+	   dest: the vectorized decoder often stops early (e.g. at line
+	   endings), and the unused reserved space would then be cleared
+	   again by each following call. */
+	unsigned char tmp[768];
+	size_t src_pos = 0, dest_size, n;
+
+	do {
+		dest_size = I_MIN(sizeof(tmp), dst_avail);
+		n = base64_decode_simd(dec->b64, src + src_pos,
+				       src_size - src_pos, tmp, dest_size);
+		buffer_append(dest, tmp, n / 4 * 3);
+		src_pos += n;
+		dst_avail -= n / 4 * 3;
+	} while (n / 4 * 3 == sizeof(tmp));
+	return src_pos;
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -661,6 +692,19 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
+		if (dec->sub_pos == 0 &&
+		    src_size - src_pos >= BASE64_SIMD_DECODE_MIN_SIZE &&
+		    dst_avail >= BASE64_SIMD_DECODE_MIN_SIZE / 4 * 3) {
+			size_t n = base64_decode_more_simd(
+				dec, src_c + src_pos, src_size - src_pos,
+				dst_avail, dest);
+
+			src_pos += n;
+			dst_avail -= n / 4 * 3;
+			if (src_pos == src_size)
+				break;
+		}
+
 		unsigned char in = src_c[src_pos];
 		unsigned char dm = b64->decmap[in];
 
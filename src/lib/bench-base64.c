@@ -0,0 +1,103 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "base64.h"
+#include "base64-simd.h"
+
+#include <stdio.h>
+
+/**
+ * Encodes and decodes a block of random data with each Base64 implementation
+ * supported by this CPU and prints the throughput of each. The throughput is
+ * calculated from the size of the binary data in both directions.
+ */
+
+#define DEFAULT_DATA_SIZE (16*1024*1024)
+#define DEFAULT_ROUNDS 10
+
+static double bench_base64_gbps(uint64_t bytes, uint64_t nsecs)
+{
+	return nsecs == 0 ? 0 : (double)bytes / (double)nsecs;
+}
+
+static void
+bench_base64_impl(enum base64_simd_impl impl, const buffer_t *data,
+		  unsigned int rounds)
+{
+	buffer_t *encoded, *decoded;
+	uint64_t ts_0, enc_nsecs = 0, dec_nsecs = 0;
+	unsigned int i;
+
+	encoded = buffer_create_dynamic(default_pool,
+					MAX_BASE64_ENCODED_SIZE(data->used));
+	decoded = buffer_create_dynamic(default_pool, data->used);
+
+	for (i = 0; i < rounds; i++) {
+		buffer_set_used_size(encoded, 0);
+		ts_0 = i_nanoseconds();
+		base64_encode(data->data, data->used, encoded);
+		enc_nsecs += i_nanoseconds() - ts_0;
+
+		buffer_set_used_size(decoded, 0);
+		ts_0 = i_nanoseconds();
+		if (base64_decode(encoded->data, encoded->used, decoded) < 0)
+			i_fatal("base64_decode() failed");
+		dec_nsecs += i_nanoseconds() - ts_0;
+
+		if (!buffer_cmp(data, decoded))
+			i_fatal("%s: decoded data differs",
+				base64_simd_impl_get_name(impl));
+	}
+
+	printf("%-8s encode %6.2f GB/s   decode %6.2f GB/s\n",
+	       base64_simd_impl_get_name(impl),
+	       bench_base64_gbps((uint64_t)data->used * rounds, enc_nsecs),
+	       bench_base64_gbps((uint64_t)data->used * rounds, dec_nsecs));
+
+	buffer_free(&encoded);
+	buffer_free(&decoded);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [data size [rounds]]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	enum base64_simd_impl best, impl;
+	unsigned long data_size = DEFAULT_DATA_SIZE;
+	unsigned int rounds = DEFAULT_ROUNDS;
+	buffer_t *data;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if (argc > 1 && (str_to_ulong(argv[1], &data_size) < 0 ||
+			  data_size == 0))
+		print_usage(argv[0]);
+	if (argc > 2 && (str_to_uint(argv[2], &rounds) < 0 || rounds == 0))
+		print_usage(argv[0]);
+
+	data = buffer_create_dynamic(default_pool, data_size);
+	random_fill(buffer_append_space_unsafe(data, data_size), data_size);
+	printf("Input data is %lu bytes, %u rounds\n\n", data_size, rounds);
+
+	best = base64_simd_get_best_impl();
+	for (impl = BASE64_SIMD_IMPL_NONE; impl < BASE64_SIMD_IMPL_COUNT;
+	     impl++) {
+		if (base64_simd_set_impl(impl))
+			bench_base64_impl(impl, data, rounds);
+	}
+	i_assert(base64_simd_set_impl(best));
+
+	buffer_free(&data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "crc32.h"
+#include "hash.h"
+
+#include <stdio.h>
+
+/**
+ * Compares the CRC32 implementations supported by this CPU, as well as the
+ * old and fast string hash functions, using buffer sizes typically seen in
+ * index records, cache fields, log records and mail bodies.
+ */
+
+#define DEFAULT_TOTAL_BYTES (256*1024*1024)
+
+static const size_t crc32_sizes[] = {
+	16, 64, 256, 1024, 4096, 65536
+};
+static const size_t hash_sizes[] = {
+	8, 16, 32, 64, 256
+};
+
+static volatile uint32_t bench_sink;
+
+static double bench_gbps(uint64_t bytes, uint64_t nsecs)
+{
+	return nsecs == 0 ? 0 : (double)bytes / (double)nsecs;
+}
+
+static void
+bench_crc32_size(const unsigned char *data, size_t size, uint64_t total)
+{
+	uint64_t ts_0, nsecs, loops = total / size;
+	enum crc32_impl impl;
+	uint32_t crc = 0;
+	uint64_t i;
+
+	printf("crc32 %6zu bytes:", size);
+	for (impl = 0; impl < CRC32_IMPL_COUNT; impl++) {
+		if (!crc32_set_impl(impl))
+			continue;
+		ts_0 = i_nanoseconds();
+		for (i = 0; i < loops; i++)
+			crc = crc32_data_more(crc, data, size);
+		nsecs = i_nanoseconds() - ts_0;
+		bench_sink = crc;
+		printf("  %s %6.2f GB/s", crc32_impl_get_name(impl),
+		       bench_gbps(loops * size, nsecs));
+	}
+	printf("\n");
+}
+
+static void
+bench_hash_size(const unsigned char *data, size_t size, uint64_t total)
+{
+	uint64_t ts_0, nsecs_old, nsecs_new, loops = total / size / 4;
+	char *str = i_malloc(size + 1);
+	unsigned int hash = 0;
+	uint64_t i;
+
+	/* use printable characters, since str_hash() is mostly used for
+	   strings */
+	for (i = 0; i < size; i++)
+		str[i] = 'a' + data[i] % 26;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < loops; i++) {
+		str[0] = 'a' + i % 26;
+		hash += str_hash(str);
+	}
+	nsecs_old = i_nanoseconds() - ts_0;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < loops; i++) {
+		str[0] = 'a' + i % 26;
+		hash += str_hash_fast(str);
+	}
+	nsecs_new = i_nanoseconds() - ts_0;
+	bench_sink = hash;
+
+	printf("str_hash %4zu bytes:  str_hash %6.2f ns  str_hash_fast %6.2f ns\n",
+	       size, (double)nsecs_old / loops, (double)nsecs_new / loops);
+	i_free(str);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [total bytes per test]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	enum crc32_impl best = crc32_get_best_impl();
+	uint64_t total = DEFAULT_TOTAL_BYTES;
+	unsigned char *data;
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 2)
+		print_usage(argv[0]);
+	if (argc > 1 && (str_to_uint64(argv[1], &total) < 0 || total == 0))
+		print_usage(argv[0]);
+
+	data = i_malloc(crc32_sizes[N_ELEMENTS(crc32_sizes)-1]);
+	random_fill(data, crc32_sizes[N_ELEMENTS(crc32_sizes)-1]);
+	printf("Processing %"PRIu64" bytes per test\n\n", total);
+
+	for (i = 0; i < N_ELEMENTS(crc32_sizes); i++)
+		bench_crc32_size(data, crc32_sizes[i], total);
+	i_assert(crc32_set_impl(best));
+	printf("\n");
+
+	for (i = 0; i < N_ELEMENTS(hash_sizes); i++)
+		bench_hash_size(data, hash_sizes[i], total);
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
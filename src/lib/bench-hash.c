@@ -0,0 +1,172 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "hash.h"
+
+#include <stdio.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+/**
+ * Compares the chained and the open addressing hash tables: throughput of
+ * inserts, successful and failed lookups and removes, as well as the memory
+ * used per node. Both integer keys with direct hashing and string keys with
+ * str_hash() are tested.
+ */
+
+#define DEFAULT_KEY_COUNT 1000000
+
+enum bench_key_type {
+	BENCH_KEY_DIRECT,
+	BENCH_KEY_STRING,
+};
+
+static size_t bench_get_heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static double bench_mops(unsigned int count, uint64_t nsecs)
+{
+	return nsecs == 0 ? 0 : (double)count * 1000.0 / (double)nsecs;
+}
+
+static void
+bench_hash_table(const char *name, bool open_addressing,
+		 enum bench_key_type key_type, char **keys, char **missing_keys,
+		 unsigned int count)
+{
+	HASH_TABLE(char *, char *) hash;
+	uint64_t ts_0, insert_nsecs, hit_nsecs, miss_nsecs, remove_nsecs;
+	size_t heap_before, heap_used;
+	unsigned int i, found = 0;
+
+	heap_before = bench_get_heap_used();
+	if (key_type == BENCH_KEY_STRING && open_addressing)
+		hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	else if (key_type == BENCH_KEY_STRING)
+		hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+	else if (open_addressing)
+		hash_table_create_open_direct(&hash, default_pool, 0);
+	else
+		hash_table_create_direct(&hash, default_pool, 0);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_insert(hash, keys[i], keys[i]);
+	insert_nsecs = i_nanoseconds() - ts_0;
+	heap_used = bench_get_heap_used() - heap_before;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			found++;
+	}
+	hit_nsecs = i_nanoseconds() - ts_0;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, missing_keys[i]) != NULL)
+			found++;
+	}
+	miss_nsecs = i_nanoseconds() - ts_0;
+	i_assert(found == count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_remove(hash, keys[i]);
+	remove_nsecs = i_nanoseconds() - ts_0;
+	hash_table_destroy(&hash);
+
+	printf("%-14s insert %6.2f  hit %6.2f  miss %6.2f  remove %6.2f Mops/s",
+	       name, bench_mops(count, insert_nsecs),
+	       bench_mops(count, hit_nsecs), bench_mops(count, miss_nsecs),
+	       bench_mops(count, remove_nsecs));
+	if (heap_used > 0)
+		printf("  %5.1f bytes/node", (double)heap_used / count);
+	printf("\n");
+}
+
+static void bench_shuffle(char **keys, unsigned int count)
+{
+	unsigned int i, j;
+	char *tmp;
+
+	for (i = count - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = keys[i]; keys[i] = keys[j]; keys[j] = tmp;
+	}
+}
+
+static void
+bench_hash_key_type(enum bench_key_type key_type, unsigned int count)
+{
+	char **keys, **missing_keys;
+	unsigned int i;
+
+	keys = i_new(char *, count);
+	missing_keys = i_new(char *, count);
+	for (i = 0; i < count; i++) {
+		if (key_type == BENCH_KEY_STRING) {
+			keys[i] = i_strdup_printf("user%u@example.com", i);
+			missing_keys[i] = i_strdup_printf("user%u@example.org", i);
+		} else {
+			/* mimic pointers to allocated structs */
+			keys[i] = POINTER_CAST(0x10000 + (uintptr_t)i * 64);
+			missing_keys[i] = POINTER_CAST(0x10000 + (uintptr_t)(i + count) * 64);
+		}
+	}
+
+	/* access the keys in random order, like real callers would */
+	bench_shuffle(keys, count);
+	bench_shuffle(missing_keys, count);
+
+	printf("%s keys:\n", key_type == BENCH_KEY_STRING ?
+	       "string" : "direct");
+	bench_hash_table("chained", FALSE, key_type, keys, missing_keys, count);
+	bench_hash_table("open", TRUE, key_type, keys, missing_keys, count);
+	printf("\n");
+
+	if (key_type == BENCH_KEY_STRING) {
+		for (i = 0; i < count; i++) {
+			i_free(keys[i]);
+			i_free(missing_keys[i]);
+		}
+	}
+	i_free(keys);
+	i_free(missing_keys);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [key count]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int count = DEFAULT_KEY_COUNT;
+
+	lib_init();
+
+	if (argc > 2)
+		print_usage(argv[0]);
+	if (argc > 1 && (str_to_uint(argv[1], &count) < 0 || count == 0))
+		print_usage(argv[0]);
+
+	printf("Using %u keys\n\n", count);
+	bench_hash_key_type(BENCH_KEY_DIRECT, count);
+	bench_hash_key_type(BENCH_KEY_STRING, count);
+
+	lib_deinit();
+	return 0;
+}
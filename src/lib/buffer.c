@@ -418,6 +418,20 @@ void buffer_set_used_size(buffer_t *_buf, size_t used_size)
 	buf->used = used_size;
 }
 
+void buffer_reserve(buffer_t *_buf, size_t size)
+{
+	struct real_buffer *buf = container_of(_buf, struct real_buffer, buf);
+
+	i_assert(buf->dynamic);
+
+	if (size <= buf->writable_size)
+		return;
+	if (unlikely(size > buf->max_size))
+		i_panic("Buffer reserve out of range (%zu)", size);
+	/* +1 for str_c() NUL */
+	buffer_alloc(buf, size + 1);
+}
+
 void buffer_clear_safe(buffer_t *_buf)
 {
 	struct real_buffer *buf = container_of(_buf, struct real_buffer, buf);
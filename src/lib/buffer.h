@@ -134,6 +134,11 @@ void *buffer_get_modifiable_data(const buffer_t *buf, size_t *used_size_r)
    be effectively lost, because e.g. buffer_get_space_unsafe() will zero out
    the contents. */
 void buffer_set_used_size(buffer_t *buf, size_t used_size);
+/* Make sure at least size bytes can be written to the dynamic buffer without
+   it growing. Unlike the automatic growing, this allocates only the requested
+   size instead of rounding it up to the nearest power of 2. This is useful
+   for avoiding wasting memory with very large buffers. */
+void buffer_reserve(buffer_t *buf, size_t size);
 
 /* Clear the buffer. */
 static inline void buffer_clear(buffer_t *buf)
@@ -1,9 +1,46 @@
 /* Copyright (c) 2006-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "byteorder.h"
 #include "crc32.h"
 
-static uint32_t crc32tab[256] = {
+/* All the implementations calculate the same standard (zlib/IEEE 802.3)
+   CRC32, which is also stored in various on-disk formats. The SSE4.2 and
+   ARMv8 "CRC32C" instructions use a different polynomial and can't be used
+   for this. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#  define HAVE_CRC32_PCLMUL
+#  include <immintrin.h>
+#  define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#if defined(__aarch64__) && defined(__linux__) && \
+	(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 10))
+#  define HAVE_CRC32_ARMV8
+#  include <arm_acle.h>
+#  include <sys/auxv.h>
+#  ifdef __clang__
+#    define CRC32_TARGET_ARMV8 __attribute__((target("crc")))
+#  else
+#    define CRC32_TARGET_ARMV8 __attribute__((target("+crc")))
+#  endif
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1 << 7)
+#  endif
+#endif
+
+static const char *crc32_impl_names[CRC32_IMPL_COUNT] = {
+	[CRC32_IMPL_TABLE] = "table",
+	[CRC32_IMPL_SLICE8] = "slice8",
+	[CRC32_IMPL_PCLMUL] = "pclmul",
+	[CRC32_IMPL_ARMV8] = "armv8",
+};
+
+static enum crc32_impl crc32_cur_impl;
+static bool crc32_initialized = FALSE;
+
+static const uint32_t crc32tab[256] = {
 	0x00000000,
 	0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
 	0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E,
@@ -58,6 +95,230 @@ static uint32_t crc32tab[256] = {
 	0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
+/* crc32tab_slice[0] is crc32tab, and crc32tab_slice[n][i] is the CRC of
+   byte i followed by n zero bytes. */
+static uint32_t crc32tab_slice[8][256];
+static bool crc32tab_slice_initialized = FALSE;
+
+static void crc32tab_slice_init(void)
+{
+	unsigned int i, n;
+	uint32_t crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32tab[i];
+		crc32tab_slice[0][i] = crc;
+		for (n = 1; n < 8; n++) {
+			crc = (crc >> 8) ^ crc32tab[crc & 0xff];
+			crc32tab_slice[n][i] = crc;
+		}
+	}
+	crc32tab_slice_initialized = TRUE;
+}
+
+static uint32_t
+crc32_update_table(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const uint8_t *end = p + size;
+
+	for (; p != end; p++)
+		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
+	return crc;
+}
+
+static uint32_t
+crc32_update_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32tab_slice;
+	uint32_t lo, hi;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		lo = crc ^ le32_to_cpu_unaligned(p);
+		hi = le32_to_cpu_unaligned(p + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+			t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+			t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	return crc32_update_table(crc, p, size);
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+/* Folding with carry-less multiplication, as described in Intel's "Fast
+   CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+   The constants are for the bit-reflected CRC32 polynomial. size must be
+   at least 64 and a multiple of 16. */
+static uint32_t CRC32_TARGET_PCLMUL
+crc32_fold_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	i_assert(size >= 64 && size % 16 == 0);
+
+	x1 = _mm_loadu_si128((const void *)(p + 0x00));
+	x2 = _mm_loadu_si128((const void *)(p + 0x10));
+	x3 = _mm_loadu_si128((const void *)(p + 0x20));
+	x4 = _mm_loadu_si128((const void *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64; size -= 64;
+
+	/* fold 4x128 bits in parallel */
+	for (; size >= 64; p += 64, size -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const void *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				   _mm_loadu_si128((const void *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				   _mm_loadu_si128((const void *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				   _mm_loadu_si128((const void *)(p + 0x30)));
+	}
+
+	/* fold into 128 bits */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold the remaining 16 byte blocks */
+	for (; size >= 16; p += 16, size -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const void *)p));
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t
+crc32_update_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	size_t n;
+
+	if (size >= 64) {
+		n = size & ~(size_t)15;
+		crc = crc32_fold_pclmul(crc, p, n);
+		p += n;
+		size -= n;
+	}
+	return crc32_update_slice8(crc, p, size);
+}
+#endif
+
+#ifdef HAVE_CRC32_ARMV8
+static uint32_t CRC32_TARGET_ARMV8
+crc32_update_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	for (; size >= 8; p += 8, size -= 8)
+		crc = __crc32d(crc, le64_to_cpu_unaligned(p));
+	for (; size > 0; p++, size--)
+		crc = __crc32b(crc, *p);
+	return crc;
+}
+#endif
+
+static bool crc32_impl_is_supported(enum crc32_impl impl)
+{
+	switch (impl) {
+	case CRC32_IMPL_TABLE:
+	case CRC32_IMPL_SLICE8:
+		return TRUE;
+	case CRC32_IMPL_PCLMUL:
+#ifdef HAVE_CRC32_PCLMUL
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("pclmul") != 0 &&
+			__builtin_cpu_supports("sse4.1") != 0;
+#else
+		return FALSE;
+#endif
+	case CRC32_IMPL_ARMV8:
+#ifdef HAVE_CRC32_ARMV8
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+		return FALSE;
+#endif
+	case CRC32_IMPL_COUNT:
+		break;
+	}
+	i_unreached();
+}
+
+enum crc32_impl crc32_get_best_impl(void)
+{
+	if (crc32_impl_is_supported(CRC32_IMPL_PCLMUL))
+		return CRC32_IMPL_PCLMUL;
+	if (crc32_impl_is_supported(CRC32_IMPL_ARMV8))
+		return CRC32_IMPL_ARMV8;
+	return CRC32_IMPL_SLICE8;
+}
+
+static void crc32_init(void)
+{
+	if (!crc32tab_slice_initialized)
+		crc32tab_slice_init();
+	if (!crc32_initialized) {
+		crc32_cur_impl = crc32_get_best_impl();
+		crc32_initialized = TRUE;
+	}
+}
+
+enum crc32_impl crc32_get_impl(void)
+{
+	if (unlikely(!crc32_initialized))
+		crc32_init();
+	return crc32_cur_impl;
+}
+
+bool crc32_set_impl(enum crc32_impl impl)
+{
+	i_assert(impl < CRC32_IMPL_COUNT);
+
+	if (!crc32_impl_is_supported(impl))
+		return FALSE;
+	crc32_init();
+	crc32_cur_impl = impl;
+	return TRUE;
+}
+
+const char *crc32_impl_get_name(enum crc32_impl impl)
+{
+	i_assert(impl < CRC32_IMPL_COUNT);
+	return crc32_impl_names[impl];
+}
+
 uint32_t crc32_data(const void *data, size_t size)
 {
 	return crc32_data_more(0, data, size);
@@ -65,11 +326,29 @@ uint32_t crc32_data(const void *data, size_t size)
 
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 {
-	const uint8_t *p = data, *end = p + size;
+	const uint8_t *p = data;
 
 	crc ^= 0xffffffff;
-	for (; p != end; p++)
-		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
+	switch (crc32_get_impl()) {
+	case CRC32_IMPL_TABLE:
+		crc = crc32_update_table(crc, p, size);
+		break;
+	case CRC32_IMPL_SLICE8:
+		crc = crc32_update_slice8(crc, p, size);
+		break;
+#ifdef HAVE_CRC32_PCLMUL
+	case CRC32_IMPL_PCLMUL:
+		crc = crc32_update_pclmul(crc, p, size);
+		break;
+#endif
+#ifdef HAVE_CRC32_ARMV8
+	case CRC32_IMPL_ARMV8:
+		crc = crc32_update_armv8(crc, p, size);
+		break;
+#endif
+	default:
+		i_unreached();
+	}
 	crc ^= 0xffffffff;
 	return crc;
 }
@@ -81,11 +360,5 @@ uint32_t crc32_str(const char *str)
 
 uint32_t crc32_str_more(uint32_t crc, const char *str)
 {
-	const uint8_t *p = (const uint8_t *)str;
-
-	crc ^= 0xffffffff;
-	for (; *p != '\0'; p++)
-		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
-	crc ^= 0xffffffff;
-	return crc;
+	return crc32_data_more(crc, str, strlen(str));
 }
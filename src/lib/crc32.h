@@ -1,10 +1,36 @@
 #ifndef CRC32_H
 #define CRC32_H
 
-uint32_t crc32_data(const void *data, size_t size) ATTR_PURE;
-uint32_t crc32_str(const char *str) ATTR_PURE;
+enum crc32_impl {
+	/* Byte-at-a-time table lookups */
+	CRC32_IMPL_TABLE = 0,
+	/* Slice-by-8 table lookups */
+	CRC32_IMPL_SLICE8,
+	/* x86 PCLMULQDQ carry-less multiplication */
+	CRC32_IMPL_PCLMUL,
+	/* ARMv8 CRC32 instructions */
+	CRC32_IMPL_ARMV8,
 
-uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
-uint32_t crc32_str_more(uint32_t crc, const char *str) ATTR_PURE;
+	CRC32_IMPL_COUNT
+};
+
+/* These aren't ATTR_PURE, since the first call initializes the lookup tables
+   and selects the implementation. */
+uint32_t crc32_data(const void *data, size_t size);
+uint32_t crc32_str(const char *str);
+
+uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size);
+uint32_t crc32_str_more(uint32_t crc, const char *str);
+
+/* Returns the fastest implementation supported by this CPU. It's used by
+   default. */
+enum crc32_impl crc32_get_best_impl(void);
+/* Returns the currently used implementation. */
+enum crc32_impl crc32_get_impl(void);
+/* Change the used implementation. Returns FALSE if it's not supported by
+   this CPU. This is mainly intended for tests and benchmarks. */
+bool crc32_set_impl(enum crc32_impl impl);
+/* Returns human-readable name for the implementation. */
+const char *crc32_impl_get_name(enum crc32_impl impl);
 
 #endif
@@ -0,0 +1,438 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash-private.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/* Open addressing hash table, based on the design of Abseil's "Swiss table".
+
+   Keys and values are stored directly in the slots array. In addition to it
+   there is one control byte for each slot, which is either EMPTY, DELETED or
+   the lowest 7 bits of the key's hash ("h2"). Lookups scan the control bytes
+   in groups of 16 starting from the key's home position, which with SSE2
+   happens with a couple of instructions. Only slots with a matching h2 need
+   to have their keys compared, so in practise a lookup typically touches a
+   single cache line of control bytes and a single slot.
+
+   The capacity is always a power of 2. The first GROUP_SIZE-1 control bytes
+   are mirrored after the last control byte, so that a group can be loaded
+   from any position without wrapping around. */
+
+#define HASH_OPEN_GROUP_SIZE 16
+#define HASH_OPEN_CTRL_EMPTY 0x80
+#define HASH_OPEN_CTRL_DELETED 0xfe
+#define HASH_OPEN_MIN_SHIFT 4
+#define HASH_OPEN_MAX_SHIFT 31
+
+#define HASH_OPEN_CAPACITY(table) (1U << (table)->shift)
+/* Maximum number of used (full or deleted) slots: 7/8 of the capacity */
+#define HASH_OPEN_MAX_USED(capacity) ((capacity) - (capacity) / 8)
+
+#define HASH_OPEN_CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
+struct hash_open_hash {
+	unsigned int pos;
+	unsigned char h2;
+};
+
+static inline struct hash_open_hash
+hash_open_get_hash_shift(unsigned int shift, unsigned int hash)
+{
+	/* The hash callbacks don't always distribute the bits well (e.g.
+	   direct_hash() with aligned pointers), so mix all of them into the
+	   high bits with Fibonacci hashing. The position comes from the
+	   highest bits and h2 from the 7 bits below them. */
+	uint64_t mixed = (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+	struct hash_open_hash ret;
+
+	ret.pos = mixed >> (64 - shift);
+	ret.h2 = (mixed >> (64 - shift - 7)) & 0x7f;
+	return ret;
+}
+
+static inline struct hash_open_hash
+hash_open_get_hash(const struct hash_table *table, unsigned int hash)
+{
+	return hash_open_get_hash_shift(table->shift, hash);
+}
+
+#ifdef __SSE2__
+static inline unsigned int
+hash_open_group_match(const unsigned char *group, unsigned char c)
+{
+	__m128i g = _mm_loadu_si128((const void *)group);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+}
+
+static inline unsigned int
+hash_open_group_match_empty_or_deleted(const unsigned char *group)
+{
+	return _mm_movemask_epi8(_mm_loadu_si128((const void *)group));
+}
+#else
+static inline unsigned int
+hash_open_group_match(const unsigned char *group, unsigned char c)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if (group[i] == c)
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+static inline unsigned int
+hash_open_group_match_empty_or_deleted(const unsigned char *group)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if (!HASH_OPEN_CTRL_IS_FULL(group[i]))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+#endif
+
+static inline unsigned int
+hash_open_group_match_empty(const unsigned char *group)
+{
+	return hash_open_group_match(group, HASH_OPEN_CTRL_EMPTY);
+}
+
+static inline void
+hash_open_ctrl_set(unsigned char *ctrl, unsigned int capacity,
+		   unsigned int idx, unsigned char c)
+{
+	ctrl[idx] = c;
+	if (idx < HASH_OPEN_GROUP_SIZE - 1)
+		ctrl[capacity + idx] = c;
+}
+
+static inline void
+hash_open_set_ctrl(struct hash_table *table, unsigned int idx, unsigned char c)
+{
+	hash_open_ctrl_set(table->ctrl, HASH_OPEN_CAPACITY(table), idx, c);
+}
+
+static void hash_open_alloc(struct hash_table *table, unsigned int shift)
+{
+	unsigned int capacity = 1U << shift;
+
+	table->shift = shift;
+	table->slots = i_malloc(MALLOC_ADD(
+		MALLOC_MULTIPLY(sizeof(struct hash_open_slot), capacity),
+		capacity + HASH_OPEN_GROUP_SIZE - 1));
+	table->ctrl = (unsigned char *)(table->slots + capacity);
+	memset(table->ctrl, HASH_OPEN_CTRL_EMPTY,
+	       capacity + HASH_OPEN_GROUP_SIZE - 1);
+}
+
+static unsigned int hash_open_get_shift(unsigned int count)
+{
+	unsigned int shift = HASH_OPEN_MIN_SHIFT;
+
+	while (count > HASH_OPEN_MAX_USED(1U << shift)) {
+		if (shift == HASH_OPEN_MAX_SHIFT)
+			i_panic("hash table too large (%u nodes)", count);
+		shift++;
+	}
+	return shift;
+}
+
+void hash_open_table_init(struct hash_table *table)
+{
+	table->initial_shift = hash_open_get_shift(table->initial_size);
+	hash_open_alloc(table, table->initial_shift);
+}
+
+static void hash_open_free_retired(struct hash_table *table)
+{
+	struct hash_open_retired *retired;
+
+	if (!array_is_created(&table->retired))
+		return;
+	array_foreach_modifiable(&table->retired, retired)
+		i_free(retired->slots);
+	array_clear(&table->retired);
+}
+
+void hash_open_table_deinit(struct hash_table *table)
+{
+	hash_open_free_retired(table);
+	array_free(&table->retired);
+	i_free(table->slots);
+}
+
+void hash_open_table_clear(struct hash_table *table)
+{
+	memset(table->ctrl, HASH_OPEN_CTRL_EMPTY,
+	       HASH_OPEN_CAPACITY(table) + HASH_OPEN_GROUP_SIZE - 1);
+	table->nodes_count = 0;
+	table->removed_count = 0;
+}
+
+static unsigned int
+hash_open_find_free(struct hash_table *table, unsigned int hash)
+{
+	struct hash_open_hash h = hash_open_get_hash(table, hash);
+	unsigned int mask = HASH_OPEN_CAPACITY(table) - 1;
+	unsigned int stride = 0, match;
+
+	for (;;) {
+		match = hash_open_group_match_empty_or_deleted(
+			table->ctrl + h.pos);
+		if (match != 0)
+			return (h.pos + __builtin_ctz(match)) & mask;
+		stride += HASH_OPEN_GROUP_SIZE;
+		h.pos = (h.pos + stride) & mask;
+	}
+}
+
+static void hash_open_resize(struct hash_table *table, unsigned int shift)
+{
+	struct hash_open_slot *old_slots = table->slots;
+	const unsigned char *old_ctrl = table->ctrl;
+	unsigned int i, idx, hash, old_capacity = HASH_OPEN_CAPACITY(table);
+	unsigned int old_shift = table->shift;
+
+	hash_open_alloc(table, shift);
+	for (i = 0; i < old_capacity; i++) {
+		if (!HASH_OPEN_CTRL_IS_FULL(old_ctrl[i]))
+			continue;
+		hash = table->hash_cb(old_slots[i].key);
+		idx = hash_open_find_free(table, hash);
+		hash_open_set_ctrl(table, idx,
+				   hash_open_get_hash(table, hash).h2);
+		table->slots[idx] = old_slots[i];
+	}
+	table->removed_count = 0;
+	table->generation++;
+
+	if (table->frozen == 0)
+		i_free(old_slots);
+	else {
+		/* iterators may still be using the old storage */
+		struct hash_open_retired *retired;
+
+		if (!array_is_created(&table->retired))
+			i_array_init(&table->retired, 4);
+		retired = array_append_space(&table->retired);
+		retired->slots = old_slots;
+		retired->shift = old_shift;
+	}
+}
+
+/* Mark the key deleted in the retired storage, so iterators using it won't
+   access the key anymore. The key may already be freed by the time the
+   iterator gets there, so it's found by its pointer. */
+static void
+hash_open_retired_remove(const struct hash_open_retired *retired,
+			 const void *key, unsigned int hash)
+{
+	struct hash_open_hash h = hash_open_get_hash_shift(retired->shift, hash);
+	unsigned int capacity = 1U << retired->shift, mask = capacity - 1;
+	unsigned char *ctrl = (unsigned char *)(retired->slots + capacity);
+	unsigned int stride = 0, idx, match;
+
+	for (;;) {
+		match = hash_open_group_match(ctrl + h.pos, h.h2);
+		while (match != 0) {
+			idx = (h.pos + __builtin_ctz(match)) & mask;
+			if (retired->slots[idx].key == key) {
+				hash_open_ctrl_set(ctrl, capacity, idx,
+						   HASH_OPEN_CTRL_DELETED);
+				return;
+			}
+			match &= match - 1;
+		}
+		if (hash_open_group_match_empty(ctrl + h.pos) != 0) {
+			/* inserted after the resize */
+			return;
+		}
+		stride += HASH_OPEN_GROUP_SIZE;
+		h.pos = (h.pos + stride) & mask;
+	}
+}
+
+static struct hash_open_slot *
+hash_open_lookup_hash(const struct hash_table *table, const void *key,
+		      unsigned int hash)
+{
+	struct hash_open_hash h = hash_open_get_hash(table, hash);
+	unsigned int mask = HASH_OPEN_CAPACITY(table) - 1;
+	unsigned int stride = 0, idx, match;
+	const unsigned char *group;
+
+	/* The key is usually found in or near its home slot. Start loading
+	   it in parallel with the control bytes. */
+	__builtin_prefetch(&table->slots[h.pos]);
+	for (;;) {
+		group = table->ctrl + h.pos;
+		match = hash_open_group_match(group, h.h2);
+		while (match != 0) {
+			idx = (h.pos + __builtin_ctz(match)) & mask;
+			if (table->key_compare_cb(table->slots[idx].key,
+						  key) == 0)
+				return &table->slots[idx];
+			match &= match - 1;
+		}
+		if (hash_open_group_match_empty(group) != 0)
+			return NULL;
+		stride += HASH_OPEN_GROUP_SIZE;
+		h.pos = (h.pos + stride) & mask;
+	}
+}
+
+struct hash_open_slot *
+hash_open_table_lookup(const struct hash_table *table, const void *key)
+{
+	return hash_open_lookup_hash(table, key, table->hash_cb(key));
+}
+
+void hash_open_table_insert(struct hash_table *table, void *key, void *value,
+			    bool update)
+{
+	struct hash_open_slot *slot;
+	unsigned int hash, idx;
+
+	i_assert(key != NULL);
+
+	hash = table->hash_cb(key);
+	slot = hash_open_lookup_hash(table, key, hash);
+	if (slot != NULL) {
+		i_assert(update);
+		slot->value = value;
+		return;
+	}
+
+	if (table->nodes_count + table->removed_count + 1 >
+	    HASH_OPEN_MAX_USED(HASH_OPEN_CAPACITY(table))) {
+		/* If a lot of the used slots are deleted, just rehash
+		   into the same size. Otherwise double the size. */
+		if (table->removed_count >= HASH_OPEN_CAPACITY(table) / 8)
+			hash_open_resize(table, table->shift);
+		else {
+			if (table->shift == HASH_OPEN_MAX_SHIFT) {
+				i_panic("hash table too large (%u nodes)",
+					table->nodes_count);
+			}
+			hash_open_resize(table, table->shift + 1);
+		}
+	}
+
+	idx = hash_open_find_free(table, hash);
+	if (table->ctrl[idx] == HASH_OPEN_CTRL_DELETED)
+		table->removed_count--;
+	hash_open_set_ctrl(table, idx, hash_open_get_hash(table, hash).h2);
+	table->slots[idx].key = key;
+	table->slots[idx].value = value;
+	table->nodes_count++;
+}
+
+static void hash_open_try_shrink(struct hash_table *table)
+{
+	i_assert(table->frozen == 0);
+
+	if (table->shift > table->initial_shift &&
+	    table->nodes_count < HASH_OPEN_CAPACITY(table) / 8) {
+		hash_open_resize(table, I_MAX(table->initial_shift,
+			hash_open_get_shift(table->nodes_count * 2)));
+	}
+}
+
+bool hash_open_table_try_remove(struct hash_table *table, const void *key)
+{
+	const struct hash_open_retired *retired;
+	struct hash_open_slot *slot;
+	unsigned int idx, hash, mask = HASH_OPEN_CAPACITY(table) - 1;
+	unsigned int empty_before, empty_after;
+
+	hash = table->hash_cb(key);
+	slot = hash_open_lookup_hash(table, key, hash);
+	if (slot == NULL)
+		return FALSE;
+	idx = slot - table->slots;
+
+	if (array_is_created(&table->retired)) {
+		array_foreach(&table->retired, retired)
+			hash_open_retired_remove(retired, slot->key, hash);
+	}
+
+	/* The slot can be marked empty only if no lookup could have ever
+	   seen a full group covering this slot. Otherwise a lookup would
+	   stop too early. */
+	empty_before = hash_open_group_match_empty(
+		table->ctrl + ((idx - HASH_OPEN_GROUP_SIZE) & mask));
+	empty_after = hash_open_group_match_empty(table->ctrl + idx);
+	if (empty_before != 0 && empty_after != 0 &&
+	    __builtin_ctz(empty_after) + __builtin_clz(empty_before << 16) <
+	    HASH_OPEN_GROUP_SIZE)
+		hash_open_set_ctrl(table, idx, HASH_OPEN_CTRL_EMPTY);
+	else {
+		hash_open_set_ctrl(table, idx, HASH_OPEN_CTRL_DELETED);
+		table->removed_count++;
+	}
+	slot->key = NULL;
+	slot->value = NULL;
+	table->nodes_count--;
+
+	if (table->frozen == 0)
+		hash_open_try_shrink(table);
+	return TRUE;
+}
+
+void hash_open_table_thaw(struct hash_table *table)
+{
+	hash_open_free_retired(table);
+	hash_open_try_shrink(table);
+}
+
+void hash_open_table_iterate_init(struct hash_iterate_context *ctx)
+{
+	struct hash_table *table = ctx->table;
+
+	ctx->slots = table->slots;
+	ctx->ctrl = table->ctrl;
+	ctx->capacity = HASH_OPEN_CAPACITY(table);
+	ctx->generation = table->generation;
+}
+
+bool hash_open_table_iterate(struct hash_iterate_context *ctx,
+			     void **key_r, void **value_r)
+{
+	struct hash_open_slot *slot;
+
+	for (; ctx->pos < ctx->capacity; ctx->pos++) {
+		if (!HASH_OPEN_CTRL_IS_FULL(ctx->ctrl[ctx->pos]))
+			continue;
+		if (ctx->generation == ctx->table->generation) {
+			*key_r = ctx->slots[ctx->pos].key;
+			*value_r = ctx->slots[ctx->pos].value;
+			ctx->pos++;
+			return TRUE;
+		}
+		/* The table was resized while iterating. We're still
+		   iterating the old storage, where the nodes removed
+		   afterwards are marked deleted. Return the node's current
+		   value. */
+		slot = hash_open_table_lookup(ctx->table,
+					      ctx->slots[ctx->pos].key);
+		if (slot != NULL) {
+			*key_r = slot->key;
+			*value_r = slot->value;
+			ctx->pos++;
+			return TRUE;
+		}
+	}
+	*key_r = *value_r = NULL;
+	return FALSE;
+}
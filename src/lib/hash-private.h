@@ -0,0 +1,76 @@
+#ifndef HASH_PRIVATE_H
+#define HASH_PRIVATE_H
+
+#include "array.h"
+#include "hash.h"
+
+struct hash_node {
+	struct hash_node *next;
+	void *key;
+	void *value;
+};
+
+struct hash_open_slot {
+	void *key;
+	void *value;
+};
+
+struct hash_open_retired {
+	struct hash_open_slot *slots;
+	unsigned int shift;
+};
+
+struct hash_table {
+	pool_t node_pool;
+
+	int frozen;
+	unsigned int initial_size, nodes_count, removed_count;
+
+	hash_callback_t *hash_cb;
+	hash_cmp_callback_t *key_compare_cb;
+
+	/* chained table */
+	unsigned int size;
+	struct hash_node *nodes;
+	struct hash_node *free_nodes;
+
+	/* open addressing table. removed_count is the number of deleted
+	   control bytes. The slots and ctrl are allocated together with
+	   slots pointing to the beginning of the allocation. */
+	bool open_addressing;
+	unsigned int initial_shift, shift;
+	struct hash_open_slot *slots;
+	unsigned char *ctrl;
+	/* increased every time the table is resized */
+	unsigned int generation;
+	/* storage of resized tables, which are still used by iterators.
+	   Removals are applied also to their control bytes. */
+	ARRAY(struct hash_open_retired) retired;
+};
+
+struct hash_iterate_context {
+	struct hash_table *table;
+	struct hash_node *next;
+	unsigned int pos;
+
+	/* open addressing table */
+	const struct hash_open_slot *slots;
+	const unsigned char *ctrl;
+	unsigned int capacity, generation;
+};
+
+void hash_open_table_init(struct hash_table *table);
+void hash_open_table_deinit(struct hash_table *table);
+void hash_open_table_clear(struct hash_table *table);
+struct hash_open_slot *
+hash_open_table_lookup(const struct hash_table *table, const void *key);
+void hash_open_table_insert(struct hash_table *table, void *key, void *value,
+			    bool update);
+bool hash_open_table_try_remove(struct hash_table *table, const void *key);
+void hash_open_table_thaw(struct hash_table *table);
+
+void hash_open_table_iterate_init(struct hash_iterate_context *ctx);
+bool hash_open_table_iterate(struct hash_iterate_context *ctx,
+			     void **key_r, void **value_r);
+
+#endif
@@ -3,7 +3,8 @@
 /* @UNSAFE: whole file */
 
 #include "lib.h"
-#include "hash.h"
+#include "byteorder.h"
+#include "hash-private.h"
 #include "primes.h"
 
 #include <ctype.h>
@@ -12,6 +13,8 @@
 
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_open
+#undef hash_table_create_open_direct
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -26,32 +29,6 @@
 #undef hash_table_thaw
 #undef hash_table_copy
 
-struct hash_node {
-	struct hash_node *next;
-	void *key;
-	void *value;
-};
-
-struct hash_table {
-	pool_t node_pool;
-
-	int frozen;
-	unsigned int initial_size, nodes_count, removed_count;
-
-	unsigned int size;
-	struct hash_node *nodes;
-	struct hash_node *free_nodes;
-
-	hash_callback_t *hash_cb;
-	hash_cmp_callback_t *key_compare_cb;
-};
-
-struct hash_iterate_context {
-	struct hash_table *table;
-	struct hash_node *next;
-	unsigned int pos;
-};
-
 enum hash_table_operation{
 	HASH_TABLE_OP_INSERT,
 	HASH_TABLE_OP_UPDATE,
@@ -60,26 +37,51 @@ enum hash_table_operation{
 
 static bool hash_table_resize(struct hash_table *table, bool grow);
 
-void hash_table_create(struct hash_table **table_r, pool_t node_pool,
-		       unsigned int initial_size, hash_callback_t *hash_cb,
-		       hash_cmp_callback_t *key_compare_cb)
+static void
+hash_table_create_common(struct hash_table **table_r, pool_t node_pool,
+			 unsigned int initial_size, hash_callback_t *hash_cb,
+			 hash_cmp_callback_t *key_compare_cb,
+			 bool open_addressing)
 {
 	struct hash_table *table;
 
 	pool_ref(node_pool);
 	table = i_new(struct hash_table, 1);
 	table->node_pool = node_pool;
-	table->initial_size =
-		I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
 
 	table->hash_cb = hash_cb;
 	table->key_compare_cb = key_compare_cb;
 
-	table->size = table->initial_size;
-	table->nodes = i_new(struct hash_node, table->size);
+	if (open_addressing) {
+		table->open_addressing = TRUE;
+		table->initial_size = initial_size;
+		hash_open_table_init(table);
+	} else {
+		table->initial_size = I_MAX(primes_closest(initial_size),
+					    HASH_TABLE_MIN_SIZE);
+		table->size = table->initial_size;
+		table->nodes = i_new(struct hash_node, table->size);
+	}
 	*table_r = table;
 }
 
+void hash_table_create(struct hash_table **table_r, pool_t node_pool,
+		       unsigned int initial_size, hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb)
+{
+	hash_table_create_common(table_r, node_pool, initial_size,
+				 hash_cb, key_compare_cb, FALSE);
+}
+
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	hash_table_create_common(table_r, node_pool, initial_size,
+				 hash_cb, key_compare_cb, TRUE);
+}
+
 static unsigned int direct_hash(const void *p)
 {
 	/* NOTE: may truncate the value, but that doesn't matter. */
@@ -98,6 +100,14 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+void hash_table_create_open_direct(struct hash_table **table_r,
+				   pool_t node_pool,
+				   unsigned int initial_size)
+{
+	hash_table_create_open(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,7 +149,9 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->open_addressing)
+		hash_open_table_deinit(table);
+	else if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
@@ -153,6 +165,11 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->open_addressing) {
+		hash_open_table_clear(table);
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +208,12 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_open_slot *slot =
+			hash_open_table_lookup(table, key);
+		return slot != NULL ? slot->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +224,16 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_open_slot *slot =
+			hash_open_table_lookup(table, lookup_key);
+		if (slot == NULL)
+			return FALSE;
+		*orig_key = slot->key;
+		*value = slot->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +330,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->open_addressing)
+		hash_open_table_insert(table, key, value, FALSE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->open_addressing)
+		hash_open_table_insert(table, key, value, TRUE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +386,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->open_addressing)
+		return hash_open_table_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,7 +418,10 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->open_addressing)
+		hash_open_table_iterate_init(ctx);
+	else
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -403,6 +448,9 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (ctx->table->open_addressing)
+		return hash_open_table_iterate(ctx, key_r, value_r);
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -441,6 +489,11 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->open_addressing) {
+		hash_open_table_thaw(table);
+		return;
+	}
+
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -591,3 +644,42 @@ strfastcase_hash(const char *p)
 
 	return h;
 }
+
+#define HASH_FAST_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t ATTR_NO_SANITIZE_INTEGER
+hash_fast_finalize(uint64_t h)
+{
+	/* MurmurHash3 fmix64 */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+unsigned int ATTR_NO_SANITIZE_INTEGER
+mem_hash_fast(const void *p, unsigned int size)
+{
+	const unsigned char *s = p;
+	uint64_t w, h = 0;
+	unsigned int i, left;
+
+	for (left = size; left >= 8; s += 8, left -= 8) {
+		h = (h ^ le64_to_cpu_unaligned(s)) * HASH_FAST_MULTIPLIER;
+		h ^= h >> 32;
+	}
+	if (left > 0) {
+		w = 0;
+		for (i = 0; i < left; i++)
+			w |= (uint64_t)s[i] << (i * 8);
+		h = (h ^ w) * HASH_FAST_MULTIPLIER;
+	}
+	return (unsigned int)hash_fast_finalize(h ^ size);
+}
+
+unsigned int str_hash_fast(const char *p)
+{
+	return mem_hash_fast(p, strlen(p));
+}
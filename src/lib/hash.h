@@ -22,8 +22,7 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size,
 		       hash_callback_t *hash_cb,
 		       hash_cmp_callback_t *key_compare_cb);
-#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
-	TYPE_CHECKS(void, \
+#define HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb) \
 	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
 	COMPILE_ERROR_IF_TRUE( \
 		sizeof((*table)._key) != sizeof(void *) || \
@@ -37,8 +36,11 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
 			unsigned int (*)(typeof((*table)._key))) && \
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
-		unsigned int (*)(typeof((*table)._const_key)))), \
-	/* NOLINTEND(bugprone-sizeof-expression) */ \
+		unsigned int (*)(typeof((*table)._const_key)))) \
+	/* NOLINTEND(bugprone-sizeof-expression) */
+#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
 	hash_table_create(&(*table)._table, pool, size, \
 		(hash_callback_t *)hash_cb, \
 		(hash_cmp_callback_t *)key_cmp_cb))
@@ -55,6 +57,39 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 	/* NOLINTEND(bugprone-sizeof-expression) */ \
 	hash_table_create_direct(&(*table)._table, pool, size))
 
+/* Same as hash_table_create() and hash_table_create_direct(), but create a
+   table using open addressing. The keys and values are stored directly in
+   the table's array instead of in separately allocated nodes, and lookups
+   compare 16 slots' hash bits at a time (with SSE2 when available). This
+   makes lookups, inserts and removes faster and uses less memory per node
+   than the default chained table, especially for large tables. node_pool
+   isn't used for anything.
+
+   All the other hash_table_*() functions work the same way for both table
+   types, so callers can switch by only changing the create call. The only
+   difference is that the table may be resized even while it's frozen. */
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_open(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
+	hash_table_create_open(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+void hash_table_create_open_direct(struct hash_table **table_r,
+				   pool_t node_pool,
+				   unsigned int initial_size);
+#define hash_table_create_open_direct(table, pool, size) \
+	TYPE_CHECKS(void, \
+	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)), \
+	/* NOLINTEND(bugprone-sizeof-expression) */ \
+	hash_table_create_open_direct(&(*table)._table, pool, size))
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
@@ -180,4 +215,11 @@ unsigned int strfastcase_hash(const char *p) ATTR_PURE;
 /* a generic hash for a given memory block */
 unsigned int mem_hash(const void *p, unsigned int size) ATTR_PURE;
 
+/* Faster hash functions, which process the input 8 bytes at a time and
+   distribute the bits better than str_hash() and mem_hash(). The returned
+   values differ from them, so these can't be used as a drop-in replacement
+   where the hash values are stored anywhere. */
+unsigned int str_hash_fast(const char *p) ATTR_PURE;
+unsigned int mem_hash_fast(const void *p, unsigned int size) ATTR_PURE;
+
 #endif
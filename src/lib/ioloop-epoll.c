@@ -3,6 +3,17 @@
 #include "lib.h"
 #include "array.h"
 #include "sleep.h"
+
+#ifdef IOLOOP_URING
+/* ioloop-uring.c falls back to epoll when the kernel lacks io_uring */
+#  define IOLOOP_EPOLL
+#  define io_loop_handler_init io_loop_epoll_handler_init
+#  define io_loop_handler_deinit io_loop_epoll_handler_deinit
+#  define io_loop_handle_add io_loop_epoll_handle_add
+#  define io_loop_handle_remove io_loop_epoll_handle_remove
+#  define io_loop_handler_run_internal io_loop_epoll_handler_run_internal
+#endif
+
 #include "ioloop-private.h"
 #include "ioloop-iolist.h"
 
@@ -0,0 +1,951 @@
+/* Copyright (c) 2025 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "array.h"
+#include "llist.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Linux io_uring based ioloop handler.
+ *
+ * Each fd with ios has a single one-shot IORING_OP_POLL_ADD request armed in
+ * the kernel. One-shot polls keep the same level-triggered semantics as the
+ * other handlers: when a poll completes, the callbacks are called and the
+ * poll is re-armed, which checks the readiness again. Changes to the poll
+ * masks and the re-arming of completed polls are not sent to the kernel
+ * immediately. Instead they're queued to the submission ring and submitted
+ * all at once with the same io_uring_enter() call that waits for the next
+ * events. So io_add()/io_remove() flipping within a single ioloop run (e.g.
+ * for partial writes) costs no syscalls.
+ *
+ * The exceptions are adding the first io to an fd and removing the last io
+ * from it. The first poll is submitted immediately, because callers expect
+ * the fds to be handled in the order they became ready (as with epoll). The
+ * kernel holds a reference to the file for as long as the poll is armed, so
+ * the poll removal is submitted immediately to allow the fd to really be
+ * closed.
+ *
+ * The same ring is also used for asynchronous regular file reads and writes
+ * (io_loop_file_pread() and io_loop_file_pwrite()). These are also queued
+ * and submitted with the next io_uring_enter() call.
+ *
+ * If the kernel doesn't support io_uring (or the required features), or
+ * io_uring is disabled, the epoll handler is used instead.
+ */
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+/* The ring sizes don't limit the number of fds, only how many changes can be
+   queued before they need to be submitted. */
+#define IO_URING_MIN_ENTRIES 64
+#define IO_URING_MAX_ENTRIES 4096
+
+/* user_data of POLL_REMOVE requests. Poll request user_data always has a
+   non-zero generation, so it can never be 0. */
+#define IO_URING_USER_DATA_IGNORE 0
+/* user_data of file operations has this bit set, and the rest is the
+   struct io_file_op pointer. Poll generations never use this bit. */
+#define IO_URING_USER_DATA_FILE_OP (1ULL << 63)
+#define IO_URING_GEN_MASK 0x7fffffff
+
+/* Maximum size of a single file operation. Larger reads and writes are
+   simply returned as partial. */
+#define IO_URING_FILE_OP_MAX_SIZE (1024*1024*16)
+
+#define IO_URING_USER_DATA(fd, gen) \
+	(((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define IO_URING_USER_DATA_FD(user_data) \
+	((int)(uint32_t)(user_data))
+#define IO_URING_USER_DATA_GEN(user_data) \
+	((uint32_t)((user_data) >> 32))
+
+enum uring_support {
+	URING_SUPPORT_UNKNOWN = 0,
+	URING_SUPPORT_YES,
+	URING_SUPPORT_NO,
+};
+
+struct uring_fd {
+	struct io_list list;
+
+	/* Poll events currently armed in the kernel, 0 if nothing */
+	unsigned int armed_events;
+	/* Generation of the currently armed poll. Used to detect completions
+	   of already removed polls. */
+	uint32_t gen;
+	/* fd is in changed_fds */
+	bool changed:1;
+};
+
+struct io_file_op {
+	struct io_file_op *prev, *next;
+	struct ioloop_handler_context *ctx;
+
+	io_file_op_callback_t *callback;
+	void *context;
+
+	void *buf;
+	size_t size;
+
+	/* io_file_op_wait() is waiting for this op - don't free it */
+	bool waiting:1;
+	bool finished:1;
+};
+
+/* Completion that was read from the ring while waiting for a file operation,
+   but which can be handled only by the next ioloop run. */
+struct uring_cqe_result {
+	uint64_t user_data;
+	int res;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_khead, *sq_ktail, *sq_array;
+	unsigned int sq_mask, sq_entries;
+	/* local SQ tail, which is published to sq_ktail on submit */
+	unsigned int sq_tail;
+
+	unsigned int *cq_khead, *cq_ktail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* number of fds with a poll armed in the kernel */
+	unsigned int armed_count;
+
+	ARRAY(struct uring_fd *) fd_index;
+	ARRAY(int) changed_fds;
+
+	/* file operations that haven't finished yet */
+	struct io_file_op *file_ops;
+	unsigned int file_op_count;
+	ARRAY(struct uring_cqe_result) deferred_cqes;
+};
+
+static enum uring_support uring_support = URING_SUPPORT_UNKNOWN;
+
+static int
+uring_sys_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_sys_enter(int ring_fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags,
+		const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			    min_complete, flags, arg, argsz);
+}
+
+static void uring_unmap(struct ioloop_handler_context *ctx)
+{
+	if (ctx->sqes != NULL) {
+		if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+			i_error("munmap(io_uring sqes) failed: %m");
+		ctx->sqes = NULL;
+	}
+	if (ctx->cq_ring != NULL && ctx->cq_ring != ctx->sq_ring) {
+		if (munmap(ctx->cq_ring, ctx->cq_ring_size) < 0)
+			i_error("munmap(io_uring cq ring) failed: %m");
+	}
+	ctx->cq_ring = NULL;
+	if (ctx->sq_ring != NULL) {
+		if (munmap(ctx->sq_ring, ctx->sq_ring_size) < 0)
+			i_error("munmap(io_uring sq ring) failed: %m");
+		ctx->sq_ring = NULL;
+	}
+	if (ctx->ring_fd != -1) {
+		if (close(ctx->ring_fd) < 0)
+			i_error("close(io_uring) failed: %m");
+		ctx->ring_fd = -1;
+	}
+}
+
+static int
+uring_ring_init(struct ioloop_handler_context *ctx, unsigned int entries)
+{
+	struct io_uring_params params;
+	unsigned int i;
+	int fd;
+
+	i_zero(&params);
+	params.flags = IORING_SETUP_CLAMP;
+	fd = uring_sys_setup(entries, &params);
+	if (fd < 0)
+		return -1;
+	ctx->ring_fd = fd;
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (params.features & IORING_FEAT_NODROP) == 0) {
+		/* too old kernel (< 5.11) */
+		uring_unmap(ctx);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ctx->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ring_size = I_MAX(ctx->sq_ring_size,
+					  ctx->cq_ring_size);
+		ctx->cq_ring_size = ctx->sq_ring_size;
+	}
+
+	ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			    IORING_OFF_SQ_RING);
+	if (ctx->sq_ring == MAP_FAILED) {
+		ctx->sq_ring = NULL;
+		uring_unmap(ctx);
+		return -1;
+	}
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ctx->cq_ring = ctx->sq_ring;
+	else {
+		ctx->cq_ring = mmap(NULL, ctx->cq_ring_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+				    IORING_OFF_CQ_RING);
+		if (ctx->cq_ring == MAP_FAILED) {
+			ctx->cq_ring = NULL;
+			uring_unmap(ctx);
+			return -1;
+		}
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			 IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED) {
+		ctx->sqes = NULL;
+		uring_unmap(ctx);
+		return -1;
+	}
+
+	ctx->sq_khead = PTR_OFFSET(ctx->sq_ring, params.sq_off.head);
+	ctx->sq_ktail = PTR_OFFSET(ctx->sq_ring, params.sq_off.tail);
+	ctx->sq_array = PTR_OFFSET(ctx->sq_ring, params.sq_off.array);
+	ctx->sq_mask = *(unsigned int *)
+		PTR_OFFSET(ctx->sq_ring, params.sq_off.ring_mask);
+	ctx->sq_entries = params.sq_entries;
+	ctx->sq_tail = *ctx->sq_ktail;
+
+	ctx->cq_khead = PTR_OFFSET(ctx->cq_ring, params.cq_off.head);
+	ctx->cq_ktail = PTR_OFFSET(ctx->cq_ring, params.cq_off.tail);
+	ctx->cq_mask = *(unsigned int *)
+		PTR_OFFSET(ctx->cq_ring, params.cq_off.ring_mask);
+	ctx->cqes = PTR_OFFSET(ctx->cq_ring, params.cq_off.cqes);
+
+	/* SQEs are always used in order, so the index array is fixed */
+	for (i = 0; i < ctx->sq_entries; i++)
+		ctx->sq_array[i] = i;
+	return 0;
+}
+
+static bool uring_try_init(struct ioloop_handler_context *ctx,
+			   unsigned int initial_fd_count)
+{
+	unsigned int entries;
+
+	if (uring_support == URING_SUPPORT_NO)
+		return FALSE;
+
+	entries = nearest_power(I_MIN(I_MAX(initial_fd_count,
+					    IO_URING_MIN_ENTRIES),
+				      IO_URING_MAX_ENTRIES));
+	if (uring_ring_init(ctx, entries) == 0) {
+		uring_support = URING_SUPPORT_YES;
+		return TRUE;
+	}
+
+	if (uring_support == URING_SUPPORT_YES) {
+		/* io_uring worked earlier, so this isn't about kernel
+		   support */
+		if (errno != EMFILE && errno != ENOMEM)
+			i_fatal("io_uring_setup() failed: %m");
+		i_fatal("io_uring_setup() failed: %m (you may need to "
+			"increase RLIMIT_MEMLOCK or RLIMIT_NOFILE)");
+	}
+	/* ENOSYS = not compiled into kernel or too old kernel,
+	   EPERM = disabled by kernel.io_uring_disabled sysctl or seccomp,
+	   EINVAL = unsupported setup flags */
+	uring_support = URING_SUPPORT_NO;
+	return FALSE;
+}
+
+static int uring_submit(struct ioloop_handler_context *ctx)
+{
+	unsigned int to_submit;
+	int ret;
+
+	__atomic_store_n(ctx->sq_ktail, ctx->sq_tail, __ATOMIC_RELEASE);
+	to_submit = ctx->sq_tail -
+		__atomic_load_n(ctx->sq_khead, __ATOMIC_ACQUIRE);
+	if (to_submit == 0)
+		return 0;
+
+	do {
+		ret = uring_sys_enter(ctx->ring_fd, to_submit, 0, 0,
+					 NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		/* EAGAIN/EBUSY: kernel is short of memory or the CQ
+		   overflow backlog is full. The entries stay in the ring
+		   and are submitted with the next io_uring_enter() call. */
+		if (errno != EAGAIN && errno != EBUSY)
+			i_panic("io_uring_enter(submit) failed: %m");
+	}
+	return ret;
+}
+
+/* Move all the completions from the ring to deferred_cqes. They're handled
+   by the next ioloop run. */
+static void uring_defer_cqes(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct uring_cqe_result *result;
+	unsigned int head, tail;
+
+	head = *ctx->cq_khead;
+	tail = __atomic_load_n(ctx->cq_ktail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & ctx->cq_mask];
+		if (cqe->user_data != IO_URING_USER_DATA_IGNORE) {
+			result = array_append_space(&ctx->deferred_cqes);
+			result->user_data = cqe->user_data;
+			result->res = cqe->res;
+		}
+	}
+	__atomic_store_n(ctx->cq_khead, head, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head;
+
+	head = __atomic_load_n(ctx->sq_khead, __ATOMIC_ACQUIRE);
+	while (ctx->sq_tail - head >= ctx->sq_entries) {
+		/* ring is full - flush the queued changes */
+		if (uring_submit(ctx) < 0) {
+			/* EAGAIN/EBUSY: the completions need to be reaped
+			   before the kernel accepts more. This may be called
+			   from io or file op callbacks, so don't handle the
+			   completions here. */
+			uring_defer_cqes(ctx);
+		}
+		head = __atomic_load_n(ctx->sq_khead, __ATOMIC_ACQUIRE);
+	}
+
+	sqe = &ctx->sqes[ctx->sq_tail & ctx->sq_mask];
+	i_zero(sqe);
+	ctx->sq_tail++;
+	return sqe;
+}
+
+static void
+uring_queue_poll_add(struct ioloop_handler_context *ctx, int fd,
+		     unsigned int events, uint32_t gen)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	/* all the events we use fit into the 16bit poll_events, so there's
+	   no need to deal with poll32_events' byte order */
+	sqe->poll_events = events;
+	sqe->user_data = IO_URING_USER_DATA(fd, gen);
+}
+
+static void
+uring_queue_poll_remove(struct ioloop_handler_context *ctx, int fd,
+			uint32_t gen)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = IO_URING_USER_DATA(fd, gen);
+	sqe->user_data = IO_URING_USER_DATA_IGNORE;
+}
+
+static unsigned int uring_event_mask(const struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static void
+uring_fd_changed(struct ioloop_handler_context *ctx,
+		 struct uring_fd *ufd, int fd)
+{
+	if (ufd->changed)
+		return;
+	ufd->changed = TRUE;
+	array_push_back(&ctx->changed_fds, &fd);
+}
+
+/* Queue the requests needed to make the armed poll match the fd's ios. */
+static void
+uring_fd_update(struct ioloop_handler_context *ctx,
+		struct uring_fd *ufd, int fd)
+{
+	unsigned int events = uring_event_mask(&ufd->list);
+
+	ufd->changed = FALSE;
+	if (events == ufd->armed_events)
+		return;
+
+	if (ufd->armed_events != 0) {
+		uring_queue_poll_remove(ctx, fd, ufd->gen);
+		ufd->armed_events = 0;
+		i_assert(ctx->armed_count > 0);
+		ctx->armed_count--;
+	}
+	if (events != 0) {
+		/* a new generation makes sure that a late completion of the
+		   old poll isn't confused with the new one */
+		ufd->gen = (ufd->gen + 1) & IO_URING_GEN_MASK;
+		if (ufd->gen == 0)
+			ufd->gen++;
+		uring_queue_poll_add(ctx, fd, events, ufd->gen);
+		ufd->armed_events = events;
+		ctx->armed_count++;
+	}
+}
+
+static void uring_flush_changes(struct ioloop_handler_context *ctx)
+{
+	struct uring_fd *ufd;
+	const int *fdp;
+
+	array_foreach(&ctx->changed_fds, fdp) {
+		ufd = array_idx_elem(&ctx->fd_index, *fdp);
+		if (ufd->changed)
+			uring_fd_update(ctx, ufd, *fdp);
+	}
+	array_clear(&ctx->changed_fds);
+}
+
+static void
+uring_file_op_finish(struct ioloop_handler_context *ctx,
+		     struct io_file_op *op, int res)
+{
+	i_assert(ctx->file_op_count > 0);
+
+	DLLIST_REMOVE(&ctx->file_ops, op);
+	ctx->file_op_count--;
+
+	if (op->callback != NULL) {
+		if (res >= 0)
+			op->callback(res, op->buf, op->context);
+		else {
+			errno = -res;
+			op->callback(-1, NULL, op->context);
+		}
+	}
+	op->finished = TRUE;
+	if (!op->waiting) {
+		i_free(op->buf);
+		i_free(op);
+	}
+}
+
+/* Finish the file operations whose completions are already in
+   deferred_cqes. Returns TRUE if any were found. */
+static bool uring_finish_deferred_file_ops(struct ioloop_handler_context *ctx)
+{
+	const struct uring_cqe_result *result;
+	unsigned int i = 0;
+	uint64_t user_data;
+	bool found = FALSE;
+	int res;
+
+	while (i < array_count(&ctx->deferred_cqes)) {
+		result = array_idx(&ctx->deferred_cqes, i);
+		if ((result->user_data & IO_URING_USER_DATA_FILE_OP) == 0) {
+			i++;
+			continue;
+		}
+		user_data = result->user_data;
+		res = result->res;
+		array_delete(&ctx->deferred_cqes, i, 1);
+		uring_file_op_finish(ctx, (struct io_file_op *)
+			(uintptr_t)(user_data & ~IO_URING_USER_DATA_FILE_OP),
+			res);
+		found = TRUE;
+	}
+	return found;
+}
+
+/* Wait for at least one completion. File operations are finished
+   immediately, other completions are left for the next ioloop run. */
+static void uring_wait_file_ops(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct uring_cqe_result *result;
+	unsigned int head, tail, to_submit;
+	uint64_t user_data;
+	int ret, res;
+
+	i_assert(ctx->file_op_count > 0);
+
+	/* The operations failed by io_loop_recreate() are never going to
+	   show up in the ring. */
+	if (uring_finish_deferred_file_ops(ctx))
+		return;
+
+	__atomic_store_n(ctx->sq_ktail, ctx->sq_tail, __ATOMIC_RELEASE);
+	to_submit = ctx->sq_tail -
+		__atomic_load_n(ctx->sq_khead, __ATOMIC_ACQUIRE);
+	ret = uring_sys_enter(ctx->ring_fd, to_submit, 1,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+	if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		i_fatal("io_uring_enter(): %m");
+
+	head = *ctx->cq_khead;
+	tail = __atomic_load_n(ctx->cq_ktail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & ctx->cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(ctx->cq_khead, head + 1, __ATOMIC_RELEASE);
+
+		if ((user_data & IO_URING_USER_DATA_FILE_OP) != 0) {
+			uring_file_op_finish(ctx, (struct io_file_op *)
+				(uintptr_t)(user_data & ~IO_URING_USER_DATA_FILE_OP),
+				res);
+		} else if (user_data != IO_URING_USER_DATA_IGNORE) {
+			result = array_append_space(&ctx->deferred_cqes);
+			result->user_data = user_data;
+			result->res = res;
+		}
+	}
+}
+
+static struct io_file_op *
+uring_file_op_queue(struct ioloop *ioloop, int opcode, int fd,
+		    void *buf, size_t size, uoff_t offset,
+		    io_file_op_callback_t *callback, void *context)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_sqe *sqe;
+	struct io_file_op *op;
+
+	i_assert(uring_support == URING_SUPPORT_YES);
+	i_assert(fd >= 0);
+	i_assert(size <= IO_URING_FILE_OP_MAX_SIZE);
+
+	op = i_new(struct io_file_op, 1);
+	op->ctx = ctx;
+	op->callback = callback;
+	op->context = context;
+	op->buf = buf;
+	op->size = size;
+	i_assert(((uintptr_t)op & IO_URING_USER_DATA_FILE_OP) == 0);
+
+	sqe = uring_get_sqe(ctx);
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)op->buf;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->user_data = IO_URING_USER_DATA_FILE_OP | (uintptr_t)op;
+
+	DLLIST_PREPEND(&ctx->file_ops, op);
+	ctx->file_op_count++;
+	return op;
+}
+
+bool io_loop_handler_have_file_ops(struct ioloop *ioloop ATTR_UNUSED)
+{
+	return uring_support == URING_SUPPORT_YES;
+}
+
+bool io_loop_handler_have_pending_file_ops(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+
+	return uring_support == URING_SUPPORT_YES &&
+		(ctx->file_op_count > 0 ||
+		 array_count(&ctx->deferred_cqes) > 0);
+}
+
+struct io_file_op *
+io_loop_file_pread(struct ioloop *ioloop, int fd, size_t size, uoff_t offset,
+		   io_file_op_callback_t *callback, void *context)
+{
+	size = I_MIN(size, IO_URING_FILE_OP_MAX_SIZE);
+	return uring_file_op_queue(ioloop, IORING_OP_READ, fd,
+				   i_malloc(I_MAX(size, 1)), size, offset,
+				   callback, context);
+}
+
+struct io_file_op *
+io_loop_file_pwrite(struct ioloop *ioloop, int fd, const void *data,
+		    size_t size, uoff_t offset,
+		    io_file_op_callback_t *callback, void *context)
+{
+	size = I_MIN(size, IO_URING_FILE_OP_MAX_SIZE);
+	return uring_file_op_queue(ioloop, IORING_OP_WRITE, fd,
+				   i_memdup(data, size), size, offset,
+				   callback, context);
+}
+
+void io_file_op_wait(struct io_file_op *op)
+{
+	struct ioloop_handler_context *ctx = op->ctx;
+
+	i_assert(!op->waiting);
+
+	op->waiting = TRUE;
+	while (!op->finished)
+		uring_wait_file_ops(ctx);
+	i_free(op->buf);
+	i_free(op);
+}
+
+void io_file_op_abort(struct io_file_op **_op)
+{
+	struct io_file_op *op = *_op;
+
+	*_op = NULL;
+	/* the buffer must stay allocated until the kernel is done with it */
+	op->callback = NULL;
+	op->context = NULL;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+
+	ctx = i_new(struct ioloop_handler_context, 1);
+	ctx->ring_fd = -1;
+	if (!uring_try_init(ctx, initial_fd_count)) {
+		i_free(ctx);
+		io_loop_epoll_handler_init(ioloop, initial_fd_count);
+		return;
+	}
+	ioloop->handler_context = ctx;
+
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->changed_fds, initial_fd_count);
+	i_array_init(&ctx->deferred_cqes, 8);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct uring_fd **list;
+	struct io_file_op *op;
+	unsigned int i, count;
+
+	if (uring_support != URING_SUPPORT_YES) {
+		io_loop_epoll_handler_deinit(ioloop);
+		return;
+	}
+
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	/* The kernel may still be using the file operation buffers, so wait
+	   for the operations to finish before freeing them. */
+	for (op = ctx->file_ops; op != NULL; op = op->next)
+		op->callback = NULL;
+	while (ctx->file_ops != NULL)
+		io_file_op_wait(ctx->file_ops);
+
+	/* closing the ring cancels all the armed polls */
+	uring_unmap(ctx);
+	array_free(&ctx->fd_index);
+	array_free(&ctx->changed_fds);
+	array_free(&ctx->deferred_cqes);
+	i_free(ioloop->handler_context);
+}
+
+void io_loop_recreate(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx;
+	struct uring_fd **list;
+	struct uring_cqe_result *result;
+	struct io_file_op *op;
+	unsigned int i, count;
+
+	if (ioloop == NULL || ioloop->handler_context == NULL ||
+	    uring_support != URING_SUPPORT_YES)
+		return;
+	ctx = ioloop->handler_context;
+
+	/* the ring memory is shared with the parent process after fork() -
+	   create a new ring and re-arm all the polls there */
+	uring_unmap(ctx);
+	if (uring_ring_init(ctx, ctx->sq_entries) < 0)
+		i_fatal("io_uring_setup() failed: %m");
+
+	ctx->armed_count = 0;
+	array_clear(&ctx->changed_fds);
+	array_clear(&ctx->deferred_cqes);
+
+	/* The file operations were submitted to the parent's ring, so they
+	   won't finish here. Fail them in the next ioloop run. */
+	for (op = ctx->file_ops; op != NULL; op = op->next) {
+		result = array_append_space(&ctx->deferred_cqes);
+		result->user_data = IO_URING_USER_DATA_FILE_OP |
+			(uintptr_t)op;
+		result->res = -ECANCELED;
+	}
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++) {
+		if (list[i] == NULL)
+			continue;
+		list[i]->armed_events = 0;
+		list[i]->changed = FALSE;
+		uring_fd_changed(ctx, list[i], (int)i);
+	}
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd **ufdp;
+
+	if (uring_support != URING_SUPPORT_YES) {
+		io_loop_epoll_handle_add(io);
+		return;
+	}
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL)
+		*ufdp = i_new(struct uring_fd, 1);
+
+	(void)ioloop_iolist_add(&(*ufdp)->list, io);
+	if ((*ufdp)->armed_events == 0 && !(*ufdp)->changed) {
+		/* Arm the first poll immediately, so the completions are
+		   returned in the same order as the fds became ready. */
+		uring_fd_update(ctx, *ufdp, io->fd);
+		(void)uring_submit(ctx);
+	} else {
+		uring_fd_changed(ctx, *ufdp, io->fd);
+	}
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd *ufd;
+
+	if (uring_support != URING_SUPPORT_YES) {
+		io_loop_epoll_handle_remove(io, closed);
+		return;
+	}
+
+	ufd = array_idx_elem(&ctx->fd_index, io->fd);
+	if (!ioloop_iolist_del(&ufd->list, io))
+		uring_fd_changed(ctx, ufd, io->fd);
+	else if (ufd->armed_events != 0) {
+		/* Unlike with epoll, closing the fd doesn't remove the poll,
+		   and the poll keeps the file open. Remove it immediately,
+		   even if the fd was already closed. */
+		uring_fd_update(ctx, ufd, io->fd);
+		(void)uring_submit(ctx);
+	}
+	i_free(io);
+}
+
+static void
+uring_handle_cqe(struct ioloop *ioloop, struct ioloop_handler_context *ctx,
+		 uint64_t user_data, int res)
+{
+	struct uring_fd *ufd;
+	struct io_file *io;
+	unsigned int events;
+	int fd, i;
+	bool call;
+
+	if (user_data == IO_URING_USER_DATA_IGNORE)
+		return;
+	if ((user_data & IO_URING_USER_DATA_FILE_OP) != 0) {
+		uring_file_op_finish(ctx, (struct io_file_op *)
+			(uintptr_t)(user_data & ~IO_URING_USER_DATA_FILE_OP),
+			res);
+		return;
+	}
+
+	fd = IO_URING_USER_DATA_FD(user_data);
+	if (fd < 0 || (unsigned int)fd >= array_count(&ctx->fd_index))
+		return;
+	ufd = array_idx_elem(&ctx->fd_index, fd);
+	if (ufd == NULL || ufd->armed_events == 0 ||
+	    ufd->gen != IO_URING_USER_DATA_GEN(user_data)) {
+		/* completion of an already removed poll */
+		return;
+	}
+
+	/* the poll is one-shot, so it needs to be re-armed */
+	ufd->armed_events = 0;
+	i_assert(ctx->armed_count > 0);
+	ctx->armed_count--;
+	uring_fd_changed(ctx, ufd, fd);
+
+	events = res < 0 ? POLLERR : (unsigned int)res;
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = ufd->list.ios[i];
+		if (io == NULL)
+			continue;
+
+		call = FALSE;
+		if ((events & (POLLHUP | POLLERR)) != 0)
+			call = TRUE;
+		else if ((io->io.condition & IO_READ) != 0)
+			call = (events & (POLLIN | POLLPRI)) != 0;
+		else if ((io->io.condition & IO_WRITE) != 0)
+			call = (events & POLLOUT) != 0;
+		else if ((io->io.condition & IO_ERROR) != 0)
+			call = (events & IO_URING_ERROR) != 0;
+
+		if (call) {
+			io_loop_call_io(&io->io);
+			if (!ioloop->running)
+				return;
+		}
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	const struct io_uring_cqe *cqe;
+	struct uring_cqe_result result;
+	struct timeval tv;
+	unsigned int i, count, head, tail, to_submit;
+	uint64_t user_data;
+	int msecs, ret, res;
+
+	i_assert(ctx != NULL);
+
+	if (uring_support != URING_SUPPORT_YES) {
+		io_loop_epoll_handler_run_internal(ioloop);
+		return;
+	}
+
+        /* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	/* re-arm the completed polls and apply the io changes */
+	uring_flush_changes(ctx);
+
+	if ((ioloop->io_files != NULL && ctx->armed_count > 0) ||
+	    ctx->file_op_count > 0 || array_count(&ctx->deferred_cqes) > 0) {
+		__atomic_store_n(ctx->sq_ktail, ctx->sq_tail,
+				 __ATOMIC_RELEASE);
+		to_submit = ctx->sq_tail -
+			__atomic_load_n(ctx->sq_khead, __ATOMIC_ACQUIRE);
+
+		i_zero(&arg);
+		if (array_count(&ctx->deferred_cqes) > 0) {
+			/* there are already completions to handle */
+			i_zero(&ts);
+			arg.ts = (uintptr_t)&ts;
+		} else if (msecs >= 0) {
+			ts.tv_sec = tv.tv_sec;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			arg.ts = (uintptr_t)&ts;
+		}
+		ret = uring_sys_enter(ctx->ring_fd, to_submit, 1,
+					 IORING_ENTER_GETEVENTS |
+					 IORING_ENTER_EXT_ARG,
+					 &arg, sizeof(arg));
+		if (ret < 0 && errno != EINTR && errno != ETIME &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		(void)uring_submit(ctx);
+		i_assert(msecs >= 0);
+		i_sleep_intr_msecs(msecs);
+	}
+
+	/* execute timeout handlers */
+        io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	/* Handle first the completions read while waiting for file
+	   operations. Each one is removed from the array before its callback
+	   is called: the callback may wait for file operations, which finishes
+	   the file operations still in the array and adds new completions to
+	   it. */
+	count = array_count(&ctx->deferred_cqes);
+	for (i = 0; i < count && array_count(&ctx->deferred_cqes) > 0; i++) {
+		result = *array_front(&ctx->deferred_cqes);
+		array_pop_front(&ctx->deferred_cqes);
+		uring_handle_cqe(ioloop, ctx, result.user_data, result.res);
+		if (!ioloop->running)
+			return;
+	}
+
+	/* Handle only the completions that exist now. Any completions left
+	   unhandled if the ioloop is stopped stay in the ring for the next
+	   run. */
+	head = *ctx->cq_khead;
+	tail = __atomic_load_n(ctx->cq_ktail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & ctx->cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(ctx->cq_khead, head + 1, __ATOMIC_RELEASE);
+
+		uring_handle_cqe(ioloop, ctx, user_data, res);
+		if (!ioloop->running)
+			return;
+	}
+}
+
+#endif	/* IOLOOP_URING */
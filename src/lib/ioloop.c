@@ -119,9 +119,13 @@ struct io *io_add_istream_to(struct ioloop *ioloop, struct istream *input,
 			     unsigned int source_linenum,
 			     io_callback_t *callback, void *context)
 {
+	struct istream *root = i_stream_get_root_io(input);
 	struct io_file *io;
+	int fd;
 
-	io = io_add_file(ioloop, i_stream_get_fd(input), IO_READ,
+	fd = root->real_stream->io_nonpollable_fd ? -1 :
+		i_stream_get_fd(input);
+	io = io_add_file(ioloop, fd, IO_READ,
 			 source_filename, source_linenum, callback, context);
 	io->istream = input;
 	i_stream_ref(io->istream);
@@ -548,10 +552,21 @@ static bool io_loop_have_waitable_io_files(struct ioloop *ioloop)
 	return FALSE;
 }
 
+static bool io_loop_have_pending_file_ops(struct ioloop *ioloop ATTR_UNUSED)
+{
+#ifdef IOLOOP_URING
+	return ioloop->handler_context != NULL &&
+		io_loop_handler_have_pending_file_ops(ioloop);
+#else
+	return FALSE;
+#endif
+}
+
 int io_loop_run_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
 	int msecs = io_loop_get_wait_time(ioloop, tv_r);
-	if (msecs < 0 && !io_loop_have_waitable_io_files(ioloop))
+	if (msecs < 0 && !io_loop_have_waitable_io_files(ioloop) &&
+	    !io_loop_have_pending_file_ops(ioloop))
 		i_panic("BUG: No IOs or timeouts set. Not waiting for infinity.");
 	return msecs;
 }
@@ -1319,6 +1334,48 @@ enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd)
 	return conditions;
 }
 
+bool io_loop_have_file_ops(struct ioloop *ioloop ATTR_UNUSED)
+{
+#ifdef IOLOOP_URING
+	if (ioloop->handler_context == NULL)
+		io_loop_initialize_handler(ioloop);
+	return io_loop_handler_have_file_ops(ioloop);
+#else
+	return FALSE;
+#endif
+}
+
+#ifndef IOLOOP_URING
+struct io_file_op *
+io_loop_file_pread(struct ioloop *ioloop ATTR_UNUSED, int fd ATTR_UNUSED,
+		   size_t size ATTR_UNUSED, uoff_t offset ATTR_UNUSED,
+		   io_file_op_callback_t *callback ATTR_UNUSED,
+		   void *context ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+struct io_file_op *
+io_loop_file_pwrite(struct ioloop *ioloop ATTR_UNUSED, int fd ATTR_UNUSED,
+		    const void *data ATTR_UNUSED, size_t size ATTR_UNUSED,
+		    uoff_t offset ATTR_UNUSED,
+		    io_file_op_callback_t *callback ATTR_UNUSED,
+		    void *context ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void io_file_op_wait(struct io_file_op *op ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void io_file_op_abort(struct io_file_op **op ATTR_UNUSED)
+{
+	i_unreached();
+}
+#endif
+
 #undef io_wait_timer_add_to
 struct io_wait_timer *
 io_wait_timer_add_to(struct ioloop *ioloop, const char *source_filename,
@@ -321,7 +321,37 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
 
-#ifdef IOLOOP_KQUEUE
+/* Asynchronous regular file I/O. This is supported only by the io_uring
+   ioloop handler, and only if the kernel supports io_uring. The callback is
+   called from the ioloop once the operation is finished. ret is the
+   pread()/pwrite() return value, and errno is set if it's -1. For reads the
+   data points to the read data, which is valid only during the callback. */
+struct io_file_op;
+typedef void io_file_op_callback_t(ssize_t ret, const void *data,
+				   void *context);
+
+/* Returns TRUE if io_loop_file_pread() and io_loop_file_pwrite() can be
+   used with the ioloop. */
+bool io_loop_have_file_ops(struct ioloop *ioloop);
+/* Read up to size bytes from the file at the given offset. */
+struct io_file_op *
+io_loop_file_pread(struct ioloop *ioloop, int fd, size_t size, uoff_t offset,
+		   io_file_op_callback_t *callback, void *context);
+/* Write the data to the file at the given offset. The data is copied, so it
+   doesn't need to stay valid after this call. */
+struct io_file_op *
+io_loop_file_pwrite(struct ioloop *ioloop, int fd, const void *data,
+		    size_t size, uoff_t offset,
+		    io_file_op_callback_t *callback, void *context);
+/* Wait until the operation is finished and its callback has been called.
+   Other finished file operations' callbacks may also be called, but no io
+   or timeout callbacks are. */
+void io_file_op_wait(struct io_file_op *op);
+/* Don't call the operation's callback. The operation itself may still finish
+   in the background. */
+void io_file_op_abort(struct io_file_op **op);
+
+#if defined(IOLOOP_KQUEUE) || defined(IOLOOP_URING)
 void io_loop_recreate(struct ioloop *ioloop);
 #else
 #  define io_loop_recreate(x)
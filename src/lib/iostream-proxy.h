@@ -19,6 +19,10 @@ indicate whether it ended with error.
 The istreams and ostreams are reffed on creation and unrefed
 on unref.
 
+When an istream and the other side's ostream are both plain
+socket fds, the data is moved between them with splice(), so it
+isn't copied through userspace (see o_stream_send_istream()).
+
 **/
 
 struct istream;
@@ -14,6 +14,9 @@ struct rawlog_iostream {
 	bool line_continued;
 };
 
+/* Create the ostream for writing to the rawlog fd. */
+struct ostream *
+iostream_rawlog_create_output(const char *path, int fd, bool autoclose_fd);
 void iostream_rawlog_init(struct rawlog_iostream *rstream,
 			  enum iostream_rawlog_flags flags, bool input);
 void iostream_rawlog_write(struct rawlog_iostream *rstream,
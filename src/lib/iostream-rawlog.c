@@ -18,6 +18,7 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #define RAWLOG_MAX_LINE_LEN 8192
 
@@ -42,6 +43,29 @@ rawlog_write_timestamp(struct rawlog_iostream *rstream, bool line_ends)
 	o_stream_nsend(rstream->rawlog_output, buf.data, buf.used);
 }
 
+struct ostream *
+iostream_rawlog_create_output(const char *path, int fd, bool autoclose_fd)
+{
+	struct ostream *output;
+	struct stat st;
+
+	if (current_ioloop != NULL && current_ioloop == io_loop_get_root() &&
+	    fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		/* Write the file asynchronously if the ioloop supports it, so
+		   a slow disk doesn't stall the process. The writes are kept
+		   in the root ioloop, because the rawlog may outlive any
+		   temporary ioloops. */
+		output = o_stream_create_fd_file_async(fd, UOFF_T_MAX,
+						       SIZE_MAX, autoclose_fd);
+		o_stream_switch_ioloop_to(output, current_ioloop);
+	} else if (autoclose_fd)
+		output = o_stream_create_fd_autoclose(&fd, 0);
+	else
+		output = o_stream_create_fd(fd, 0);
+	o_stream_set_name(output, t_strdup_printf("rawlog(%s)", path));
+	return output;
+}
+
 void iostream_rawlog_init(struct rawlog_iostream *rstream,
 			  enum iostream_rawlog_flags flags, bool input)
 {
@@ -9,9 +9,18 @@ struct file_istream {
 	struct iostream_fd *fd_ref;
 	uoff_t skip_left;
 
+	/* Asynchronous reads: the pending read, or the result of the
+	   finished read for async_offset. */
+	struct io_file_op *async_op;
+	uoff_t async_offset;
+	buffer_t *async_data;
+	int async_errno;
+
 	bool file:1;
 	bool autoclose_fd:1;
 	bool seen_eof:1;
+	bool async:1;
+	bool async_eof:1;
 };
 
 struct istream *
@@ -3,6 +3,7 @@
 /* @UNSAFE: whole file */
 
 #include "lib.h"
+#include "buffer.h"
 #include "ioloop.h"
 #include "istream-file-private.h"
 #include "net.h"
@@ -20,6 +21,9 @@ void i_stream_file_close(struct iostream_private *stream,
 	struct file_istream *fstream =
 		container_of(_stream, struct file_istream, istream);
 
+	if (fstream->async_op != NULL)
+		io_file_op_abort(&fstream->async_op);
+
 	bool refs_left = fstream->fd_ref != NULL &&
 		iostream_fd_unref(&fstream->fd_ref);
 	if (fstream->autoclose_fd && _stream->fd != -1 && !refs_left) {
@@ -48,6 +52,100 @@ static int i_stream_file_open(struct istream_private *stream)
 	return 0;
 }
 
+static void
+i_stream_file_async_reset(struct file_istream *fstream, uoff_t offset)
+{
+	if (fstream->async_op != NULL)
+		io_file_op_abort(&fstream->async_op);
+	buffer_set_used_size(fstream->async_data, 0);
+	fstream->async_offset = offset;
+	fstream->async_errno = 0;
+	fstream->async_eof = FALSE;
+}
+
+static void
+i_stream_file_async_read_callback(ssize_t ret, const void *data,
+				  void *context)
+{
+	struct file_istream *fstream = context;
+
+	fstream->async_op = NULL;
+	if (ret > 0)
+		buffer_append(fstream->async_data, data, ret);
+	else if (ret == 0)
+		fstream->async_eof = TRUE;
+	else if (errno != EINTR && errno != EAGAIN)
+		fstream->async_errno = errno;
+	/* with EINTR/EAGAIN the next read() just tries again */
+	i_stream_set_input_pending(&fstream->istream.istream, TRUE);
+}
+
+static void
+i_stream_file_async_read_start(struct file_istream *fstream, size_t size)
+{
+	struct istream_private *stream = &fstream->istream;
+
+	i_assert(fstream->async_op == NULL);
+	i_assert(fstream->async_data->used == 0);
+
+	/* read a bit more than necessary - the rest is kept in async_data for
+	   the following reads */
+	fstream->async_op = io_loop_file_pread(
+		io_stream_get_ioloop(&stream->iostream), stream->fd,
+		I_MAX(size, IO_BLOCK_SIZE), fstream->async_offset,
+		i_stream_file_async_read_callback, fstream);
+}
+
+/* Returns TRUE and the pread() return value if the asynchronous read for the
+   offset has finished, FALSE if it's still pending. */
+static bool
+i_stream_file_read_async(struct file_istream *fstream, size_t size,
+			 uoff_t offset, ssize_t *ret_r)
+{
+	struct istream_private *stream = &fstream->istream;
+
+	if (fstream->async_offset != offset) {
+		/* seeked elsewhere */
+		i_stream_file_async_reset(fstream, offset);
+	}
+
+	while (fstream->async_data->used == 0 &&
+	       fstream->async_errno == 0 && !fstream->async_eof) {
+		if (fstream->async_op == NULL)
+			i_stream_file_async_read_start(fstream, size);
+		if (!stream->istream.blocking)
+			return FALSE;
+		/* blocking reader - wait for the read to finish */
+		io_file_op_wait(fstream->async_op);
+	}
+
+	if (fstream->async_data->used > 0) {
+		size = I_MIN(size, fstream->async_data->used);
+		memcpy(stream->w_buffer + stream->pos,
+		       fstream->async_data->data, size);
+		buffer_delete(fstream->async_data, 0, size);
+		fstream->async_offset += size;
+		if (fstream->async_data->used == 0 &&
+		    fstream->async_op == NULL) {
+			/* read ahead the next block while the caller is
+			   processing this one */
+			i_stream_file_async_read_start(fstream, size);
+		}
+		*ret_r = size;
+		return TRUE;
+	}
+	if (fstream->async_errno != 0) {
+		errno = fstream->async_errno;
+		fstream->async_errno = 0;
+		*ret_r = -1;
+		return TRUE;
+	}
+	i_assert(fstream->async_eof);
+	fstream->async_eof = FALSE;
+	*ret_r = 0;
+	return TRUE;
+}
+
 ssize_t i_stream_file_read(struct istream_private *stream)
 {
 	struct file_istream *fstream =
@@ -67,7 +165,10 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 
 	offset = stream->istream.v_offset + (stream->pos - stream->skip);
 
-	if (fstream->file) {
+	if (fstream->async) {
+		if (!i_stream_file_read_async(fstream, size, offset, &ret))
+			return 0;
+	} else if (fstream->file) {
 		ret = pread(stream->fd, stream->w_buffer + stream->pos,
 			    size, offset);
 	} else if (fstream->seen_eof) {
@@ -149,15 +250,44 @@ static void i_stream_file_seek(struct istream_private *stream, uoff_t v_offset,
 
 static void i_stream_file_sync(struct istream_private *stream)
 {
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
 	if (!stream->istream.seekable) {
 		/* can't do anything or data would be lost */
 		return;
 	}
 
+	if (fstream->async)
+		i_stream_file_async_reset(fstream, 0);
 	stream->skip = stream->pos = 0;
 	stream->istream.eof = FALSE;
 }
 
+static void i_stream_file_destroy(struct iostream_private *stream)
+{
+	struct istream_private *_stream =
+		container_of(stream, struct istream_private, iostream);
+	struct file_istream *fstream =
+		container_of(_stream, struct file_istream, istream);
+
+	buffer_free(&fstream->async_data);
+}
+
+static void
+i_stream_file_switch_ioloop_to(struct istream_private *stream,
+			       struct ioloop *ioloop ATTR_UNUSED)
+{
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
+	if (fstream->async_op != NULL) {
+		/* the read was submitted to the old ioloop - do it again */
+		io_file_op_abort(&fstream->async_op);
+		i_stream_set_input_pending(&stream->istream, TRUE);
+	}
+}
+
 static int
 i_stream_file_stat(struct istream_private *stream, bool exact ATTR_UNUSED)
 {
@@ -283,6 +413,53 @@ struct istream *i_stream_create_fd_ref_autoclose(struct iostream_fd *ref,
 					   max_buffer_size, TRUE);
 }
 
+static struct istream *
+i_stream_create_fd_async_common(int fd, size_t max_buffer_size,
+				bool autoclose_fd)
+{
+	struct file_istream *fstream;
+	struct istream *input;
+
+	fstream = i_new(struct file_istream, 1);
+	input = i_stream_create_file_common(fstream, fd, NULL,
+					    max_buffer_size, autoclose_fd);
+	if (!fstream->file)
+		return input;
+
+	if (current_ioloop != NULL && io_loop_have_file_ops(current_ioloop)) {
+		/* io_add_istream() waits for the async reads instead of
+		   polling the fd */
+		fstream->istream.io_nonpollable_fd = TRUE;
+		fstream->async = TRUE;
+		fstream->async_data =
+			buffer_create_dynamic(default_pool, IO_BLOCK_SIZE);
+		fstream->istream.iostream.destroy = i_stream_file_destroy;
+		fstream->istream.switch_ioloop_to =
+			i_stream_file_switch_ioloop_to;
+		input->blocking = FALSE;
+	}
+	return input;
+}
+
+struct istream *i_stream_create_fd_async(int fd, size_t max_buffer_size)
+{
+	i_assert(fd != -1);
+
+	return i_stream_create_fd_async_common(fd, max_buffer_size, FALSE);
+}
+
+struct istream *i_stream_create_fd_async_autoclose(int *fd,
+						   size_t max_buffer_size)
+{
+	struct istream *input;
+
+	i_assert(*fd != -1);
+
+	input = i_stream_create_fd_async_common(*fd, max_buffer_size, TRUE);
+	*fd = -1;
+	return input;
+}
+
 struct istream *i_stream_create_file(const char *path, size_t max_buffer_size)
 {
 	struct file_istream *fstream;
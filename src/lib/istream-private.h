@@ -79,6 +79,11 @@ struct istream_private {
 	   This is especially necessary when the istream doesn't otherwise make
 	   it visible that it has buffered data, such as ssl-istream. */
 	bool io_pending_until_read:1;
+	/* The fd can't be polled for input, e.g. because it's a regular file
+	   that is read asynchronously. io_add_istream() won't add the fd to the
+	   ioloop, so the stream must call i_stream_set_input_pending() when
+	   it has more input. */
+	bool io_nonpollable_fd:1;
 };
 
 struct istream_snapshot {
@@ -79,6 +79,8 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 					    max_buffer_size, FALSE);
 	input->real_stream->iostream.close = i_stream_unix_close;
 	input->real_stream->read = i_stream_unix_read;
+	/* reading the fd directly would lose the passed fds */
+	input->readable_fd = FALSE;
 	return input;
 }
 
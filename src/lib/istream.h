@@ -49,6 +49,17 @@ struct istream *i_stream_create_fd_ref_autoclose(struct iostream_fd *ref,
 /* Open the given path only when something is actually tried to be read from
    the stream. */
 struct istream *i_stream_create_file(const char *path, size_t max_buffer_size);
+/* Like i_stream_create_fd(), but if the fd is a regular file and the ioloop
+   supports asynchronous file I/O (see io_loop_have_file_ops()), the reads are
+   done asynchronously. The stream is then non-blocking: i_stream_read()
+   returns 0 until the data has been read, and io_add_istream() callback is
+   called when it's available. If the reader expects blocking reads, it can
+   set the stream's blocking=TRUE. i_stream_read() then waits for the data,
+   but the next block is still read ahead asynchronously while the reader
+   processes the current one. */
+struct istream *i_stream_create_fd_async(int fd, size_t max_buffer_size);
+struct istream *i_stream_create_fd_async_autoclose(int *fd,
+						   size_t max_buffer_size);
 /* Create an input stream using the provided data block. That data block must
 remain allocated during the full lifetime of the stream. */
 struct istream *i_stream_create_from_data(const void *data, size_t size);
@@ -13,6 +13,13 @@ struct file_ostream {
 	int fd;
 	struct iostream_fd *fd_ref;
 	struct io *io;
+	/* Asynchronous writes: the pending write and the timeout for calling
+	   the flush callback, since regular files can't be polled. */
+	struct io_file_op *async_op;
+	struct timeout *to_async;
+	/* Pipe for splice()ing data from an istream. It's always empty
+	   between the o_stream_send_istream() calls. */
+	int splice_pipe[2];
 	uoff_t buffer_offset;
 	uoff_t real_offset;
 
@@ -29,7 +36,9 @@ struct file_ostream {
 	bool no_socket_quickack:1;
 	bool no_delay_enabled:1;
 	bool no_sendfile:1;
+	bool no_splice:1;
 	bool autoclose_fd:1;
+	bool async:1;
 };
 
 struct ostream *
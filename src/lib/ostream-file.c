@@ -2,6 +2,7 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() and pipe2() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
@@ -29,11 +30,18 @@
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
+/* Linux's default pipe capacity */
+#define MAX_SPLICE_SIZE (64*1024)
+
 static void stream_send_io(struct file_ostream *fstream);
+static int buffer_flush_wait(struct file_ostream *fstream);
 
 static void stream_closed(struct file_ostream *fstream)
 {
 	io_remove(&fstream->io);
+	timeout_remove(&fstream->to_async);
+	if (fstream->async_op != NULL)
+		io_file_op_abort(&fstream->async_op);
 
 	bool refs_left = fstream->fd_ref != NULL &&
 		iostream_fd_unref(&fstream->fd_ref);
@@ -57,6 +65,12 @@ void o_stream_file_close(struct iostream_private *stream,
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream.iostream);
 
+	if (fstream->async && !fstream->ostream.corked &&
+	    !fstream->ostream.ostream.closed) {
+		/* Blocking file streams have already written everything that
+		   wasn't corked. Do the same by finishing the writes. */
+		(void)buffer_flush_wait(fstream);
+	}
 	stream_closed(fstream);
 }
 
@@ -65,6 +79,9 @@ static void o_stream_file_destroy(struct iostream_private *stream)
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream.iostream);
 
+	timeout_remove(&fstream->to_async);
+	i_close_fd(&fstream->splice_pipe[0]);
+	i_close_fd(&fstream->splice_pipe[1]);
 	i_free(fstream->buffer);
 }
 
@@ -345,12 +362,84 @@ static int o_stream_fill_iovec(struct file_ostream *fstream,
 	}
 }
 
+static void o_stream_file_add_io(struct file_ostream *fstream)
+{
+	struct iostream_private *iostream = &fstream->ostream.iostream;
+
+	if (fstream->async) {
+		/* Regular files can't be polled. The pending write calls this
+		   again when it's finished, otherwise call the flush callback
+		   on the next ioloop run. */
+		if (fstream->async_op == NULL && fstream->to_async == NULL) {
+			fstream->to_async = timeout_add_short_to(
+				io_stream_get_ioloop(iostream), 0,
+				stream_send_io, fstream);
+		}
+	} else if (fstream->io == NULL) {
+		fstream->io = io_add_to(io_stream_get_ioloop(iostream),
+					fstream->fd, IO_WRITE,
+					stream_send_io, fstream);
+	}
+}
+
+static void
+o_stream_file_async_written(ssize_t ret, const void *data ATTR_UNUSED,
+			    void *context)
+{
+	struct file_ostream *fstream = context;
+	struct ostream_private *stream = &fstream->ostream;
+
+	fstream->async_op = NULL;
+	if (ret < 0) {
+		io_stream_set_error(&stream->iostream, "pwrite() failed: %m");
+		stream->ostream.stream_errno = errno;
+		stream_closed(fstream);
+	} else if (ret == 0) {
+		/* assume out of disk space */
+		stream->ostream.stream_errno = ENOSPC;
+		stream_closed(fstream);
+	} else {
+		fstream->buffer_offset += ret;
+		update_buffer(fstream, ret);
+	}
+
+	/* continue flushing, and let the flush callback know about it
+	   (including the error) */
+	if (stream->ostream.closed ||
+	    (!stream->corked &&
+	     (fstream->flush_pending || !IS_STREAM_EMPTY(fstream))))
+		o_stream_file_add_io(fstream);
+}
+
+static int buffer_flush_async(struct file_ostream *fstream)
+{
+	struct iostream_private *iostream = &fstream->ostream.iostream;
+	struct const_iovec iov[2];
+
+	if (fstream->ostream.ostream.closed)
+		return -1;
+	if (fstream->async_op != NULL)
+		return 0;
+	if (o_stream_fill_iovec(fstream, iov) == 0)
+		return 1;
+
+	/* write only the first part of a wrapped buffer - the rest is
+	   written after it's finished */
+	fstream->async_op = io_loop_file_pwrite(io_stream_get_ioloop(iostream),
+		fstream->fd, iov[0].iov_base, iov[0].iov_len,
+		fstream->buffer_offset, o_stream_file_async_written, fstream);
+	return 0;
+}
+
 static int buffer_flush(struct file_ostream *fstream)
 {
 	struct const_iovec iov[2];
 	int iov_len;
 	ssize_t ret;
 
+	if (fstream->async)
+		return buffer_flush_async(fstream);
+
 	iov_len = o_stream_fill_iovec(fstream, iov);
 	if (iov_len > 0) {
 		ret = o_stream_file_writev_full(fstream, iov, iov_len);
@@ -363,6 +452,16 @@ static int buffer_flush(struct file_ostream *fstream)
 	return IS_STREAM_EMPTY(fstream) ? 1 : 0;
 }
 
+/* Flush the buffer fully, waiting for the asynchronous writes to finish. */
+static int buffer_flush_wait(struct file_ostream *fstream)
+{
+	int ret;
+
+	while ((ret = buffer_flush(fstream)) == 0 && fstream->async_op != NULL)
+		io_file_op_wait(fstream->async_op);
+	return ret;
+}
+
 static void o_stream_tcp_flush_via_nodelay(struct file_ostream *fstream)
 {
 	if (net_set_tcp_nodelay(fstream->fd, TRUE) < 0) {
@@ -381,24 +480,19 @@ static void o_stream_file_cork(struct ostream_private *stream, bool set)
 {
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream);
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 	int ret;
 
 	if (stream->corked != set && !stream->ostream.closed) {
-		if (set && fstream->io != NULL)
+		if (set) {
 			io_remove(&fstream->io);
-		else if (!set) {
+			timeout_remove(&fstream->to_async);
+		} else {
 			/* buffer flushing might close the stream */
 			ret = buffer_flush(fstream);
 			stream->last_errors_not_checked = TRUE;
-			if (fstream->io == NULL &&
-			    (ret == 0 || fstream->flush_pending) &&
-			    !stream->ostream.closed) {
-				fstream->io = io_add_to(
-					io_stream_get_ioloop(iostream),
-					fstream->fd, IO_WRITE,
-					stream_send_io, fstream);
-			}
+			if ((ret == 0 || fstream->flush_pending) &&
+			    !stream->ostream.closed)
+				o_stream_file_add_io(fstream);
 		}
 		if (stream->ostream.closed) {
 			/* flushing may have closed the stream already */
@@ -439,14 +533,10 @@ o_stream_file_flush_pending(struct ostream_private *stream, bool set)
 {
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream);
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 
 	fstream->flush_pending = set;
-	if (set && !stream->corked && fstream->io == NULL) {
-		fstream->io = io_add_to(io_stream_get_ioloop(iostream),
-					fstream->fd, IO_WRITE,
-					stream_send_io, fstream);
-	}
+	if (set && !stream->corked)
+		o_stream_file_add_io(fstream);
 }
 
 static size_t get_unused_space(const struct file_ostream *fstream)
@@ -486,7 +576,7 @@ static int o_stream_file_seek(struct ostream_private *stream, uoff_t offset)
 		return -1;
 	}
 
-	if (buffer_flush(fstream) < 0)
+	if (buffer_flush_wait(fstream) < 0)
 		return -1;
 
 	stream->ostream.offset = offset;
@@ -531,10 +621,11 @@ static void o_stream_grow_buffer(struct file_ostream *fstream, size_t bytes)
 static void stream_send_io(struct file_ostream *fstream)
 {
 	struct ostream *ostream = &fstream->ostream.ostream;
-	struct iostream_private *iostream = &fstream->ostream.iostream;
 	bool use_cork = !fstream->ostream.corked;
 	int ret;
 
+	timeout_remove(&fstream->to_async);
+
 	/* Set flush_pending = FALSE first before calling the flush callback,
 	   and change it to TRUE only if callback returns 0. That way the
 	   callback can call o_stream_set_flush_pending() again and we don't
@@ -556,15 +647,12 @@ static void stream_send_io(struct file_ostream *fstream)
 
 	if (!fstream->flush_pending && IS_STREAM_EMPTY(fstream)) {
 		io_remove(&fstream->io);
+		timeout_remove(&fstream->to_async);
 	} else if (!fstream->ostream.ostream.closed) {
 		/* Add the IO handler if it's not there already. Callback
 		   might have just returned 0 without there being any data
 		   to be sent. */
-		if (fstream->io == NULL) {
-			fstream->io = io_add_to(io_stream_get_ioloop(iostream),
-						fstream->fd, IO_WRITE,
-						stream_send_io, fstream);
-		}
+		o_stream_file_add_io(fstream);
 	}
 
 	o_stream_unref(&ostream);
@@ -633,7 +721,7 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 
 	optimal_size = I_MIN(fstream->optimal_block_size,
 			     fstream->ostream.max_buffer_size);
-	if (IS_STREAM_EMPTY(fstream) &&
+	if (IS_STREAM_EMPTY(fstream) && !fstream->async &&
 	    (!stream->corked || size >= optimal_size)) {
 		/* send immediately */
 		ret = o_stream_file_writev_full(fstream, iov, iov_count);
@@ -675,7 +763,9 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 	}
 	stream->ostream.offset += ret;
 	i_assert((size_t)ret <= total_size);
-	i_assert((size_t)ret == total_size || !fstream->file);
+	i_assert((size_t)ret == total_size || !fstream->file || fstream->async);
+	if (fstream->async && !stream->corked)
+		(void)buffer_flush_async(fstream);
 	return ret;
 }
 
@@ -715,6 +805,10 @@ o_stream_file_write_at(struct ostream_private *stream,
 		container_of(stream, struct file_ostream, ostream);
 	size_t used, pos, skip, left;
 
+	/* the pending write has its own copy of the buffer's beginning */
+	if (fstream->async_op != NULL)
+		io_file_op_wait(fstream->async_op);
+
 	/* update buffer if the write overlaps it */
 	used = file_buffer_get_used_size(fstream);
 	if (used > 0 &&
@@ -755,7 +849,7 @@ o_stream_file_write_at(struct ostream_private *stream,
 
 	/* we couldn't write everything to the buffer. flush the buffer
 	   and pwrite() the rest. */
-	if (o_stream_file_flush(stream) < 0)
+	if (buffer_flush_wait(fstream) < 0)
 		return -1;
 
 	if (pwrite_full(fstream->fd, data, size, offset) < 0) {
@@ -952,6 +1046,8 @@ static enum ostream_send_istream_result
 io_stream_copy_same_stream(struct ostream_private *outstream,
 			   struct istream *instream)
 {
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
 	uoff_t in_size;
 	off_t in_abs_offset, ret = 0;
 
@@ -978,6 +1074,8 @@ io_stream_copy_same_stream(struct ostream_private *outstream,
 	if (ret > 0 && in_size > (uoff_t)ret) {
 		/* overlapping */
 		i_assert(instream->seekable);
+		if (buffer_flush_wait(foutstream) < 0)
+			return OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
 		return io_stream_copy_backwards(outstream, instream, in_size);
 	} else {
 		/* non-overlapping */
@@ -985,6 +1083,147 @@ io_stream_copy_same_stream(struct ostream_private *outstream,
 	}
 }
 
+#ifdef HAVE_SPLICE
+static int
+io_stream_splice_buffer_pipe(struct ostream_private *outstream, size_t size)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	unsigned char *data;
+	size_t added;
+	ssize_t ret;
+
+	/* Move the data from the pipe to the buffer, so the pipe is empty
+	   again and the data gets sent in the right order with any further
+	   writes. */
+	data = t_malloc_no0(size);
+	ret = read(foutstream->splice_pipe[0], data, size);
+	if (ret != (ssize_t)size) {
+		if (ret >= 0)
+			errno = EIO;
+		outstream->ostream.stream_errno = errno;
+		io_stream_set_error(&outstream->iostream,
+				    "read(splice pipe) failed: %m");
+		return -1;
+	}
+	added = o_stream_add(foutstream, data, size);
+	i_assert(added == size);
+	outstream->ostream.offset += size;
+	return 0;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	size_t max_size, size;
+	ssize_t ret;
+	int ret2;
+
+	if (i_stream_get_data_size(instream) > 0) {
+		/* send the already buffered data first */
+		*res_r = io_stream_copy(&outstream->ostream, instream);
+		return TRUE;
+	}
+
+	/* flush out any data in buffer */
+	if ((ret2 = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret2 == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	if (foutstream->splice_pipe[0] == -1) {
+		if (pipe2(foutstream->splice_pipe, O_CLOEXEC) < 0) {
+			i_error("pipe2() failed: %m");
+			return FALSE;
+		}
+	}
+	/* whatever can't be sent is buffered, so don't splice more than
+	   fits into the buffer */
+	max_size = I_MIN(outstream->max_buffer_size, MAX_SPLICE_SIZE);
+	if (max_size == 0)
+		max_size = IO_BLOCK_SIZE;
+
+	for (;;) {
+		ret = splice(in_fd, NULL, foutstream->splice_pipe[1], NULL,
+			     max_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL) {
+				/* splice() not supported with this fd */
+				return FALSE;
+			}
+			instream->stream_errno = errno;
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+		/* the data was read directly from the fd, bypassing the
+		   istream's (empty) buffer */
+		instream->v_offset += ret;
+		instream->real_stream->last_read_timeval = ioloop_timeval;
+
+		size = ret;
+		while (size > 0) {
+			ret = splice(foutstream->splice_pipe[0], NULL,
+				     foutstream->fd, NULL, size,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret > 0) {
+				size -= ret;
+				foutstream->real_offset += ret;
+				foutstream->buffer_offset += ret;
+				outstream->ostream.offset += ret;
+				continue;
+			}
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EINVAL)) {
+				bool not_supported = errno == EINVAL;
+
+				if (io_stream_splice_buffer_pipe(outstream,
+								 size) < 0)
+					break;
+				if (not_supported)
+					return FALSE;
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+				return TRUE;
+			}
+			if (ret == 0)
+				errno = EPIPE;
+			outstream->ostream.stream_errno = errno;
+			io_stream_set_error(&outstream->iostream,
+					    "splice() failed: %m");
+			break;
+		}
+		if (size > 0) {
+			/* output failed. the pipe may still have data. */
+			stream_closed(foutstream);
+			i_close_fd(&foutstream->splice_pipe[0]);
+			i_close_fd(&foutstream->splice_pipe[1]);
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 o_stream_file_send_istream(struct ostream_private *outstream,
 			   struct istream *instream)
@@ -1005,6 +1244,22 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	/* splice() only non-seekable fds, such as sockets and pipes.
+	   sendfile() already handles files. The istream must be the fd's own
+	   stream, not one that modifies or buffers the data or that needs to
+	   read the fd itself (e.g. istream-unix, which receives fds). While the ostream is
+	   corked, copy the data to its buffer so it's sent together with the
+	   rest of the corked data. */
+	if (!foutstream->no_splice && !outstream->corked && in_fd != -1 &&
+	    in_fd != foutstream->fd && !instream->seekable &&
+	    instream->real_stream->parent == NULL &&
+	    !foutstream->file && !foutstream->async) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -1021,6 +1276,13 @@ static void o_stream_file_switch_ioloop_to(struct ostream_private *stream,
 
 	if (fstream->io != NULL)
 		fstream->io = io_loop_move_io_to(ioloop, &fstream->io);
+	/* the write was submitted to the old ioloop */
+	if (fstream->async_op != NULL)
+		io_file_op_wait(fstream->async_op);
+	if (fstream->to_async != NULL) {
+		fstream->to_async =
+			io_loop_move_timeout_to(ioloop, &fstream->to_async);
+	}
 }
 
 struct ostream *
@@ -1032,6 +1294,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 	fstream->fd = fd;
 	fstream->autoclose_fd = autoclose_fd;
 	fstream->optimal_block_size = DEFAULT_OPTIMAL_BLOCK_SIZE;
+	fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
 
 	fstream->ostream.iostream.close = o_stream_file_close;
 	fstream->ostream.iostream.destroy = o_stream_file_destroy;
@@ -1171,6 +1434,26 @@ struct ostream *o_stream_create_fd_file_autoclose(int *fd, uoff_t offset)
 	return output;
 }
 
+struct ostream *
+o_stream_create_fd_file_async(int fd, uoff_t offset, size_t max_buffer_size,
+			      bool autoclose_fd)
+{
+	struct file_ostream *fstream;
+	struct ostream *output;
+
+	output = o_stream_create_fd_file(fd, offset, autoclose_fd);
+	fstream = container_of(output->real_stream, struct file_ostream,
+			       ostream);
+	if (fstream->file && current_ioloop != NULL &&
+	    io_loop_have_file_ops(current_ioloop)) {
+		fstream->async = TRUE;
+		if (max_buffer_size != 0)
+			fstream->ostream.max_buffer_size = max_buffer_size;
+		output->blocking = FALSE;
+	}
+	return output;
+}
+
 struct ostream *o_stream_create_file(const char *path, uoff_t offset, mode_t mode,
 				     enum ostream_create_file_flags flags)
 {
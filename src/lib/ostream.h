@@ -70,6 +70,13 @@ struct ostream *o_stream_create_fd_ref_autoclose(struct iostream_fd *ref,
 struct ostream *
 o_stream_create_fd_file(int fd, uoff_t offset, bool autoclose_fd);
 struct ostream *o_stream_create_fd_file_autoclose(int *fd, uoff_t offset);
+/* Like o_stream_create_fd_file(), but if the ioloop supports asynchronous
+   file I/O (see io_loop_have_file_ops()), the writes are done asynchronously.
+   The stream is then non-blocking: up to max_buffer_size bytes are buffered,
+   and the flush callback is called when the writes have finished. */
+struct ostream *
+o_stream_create_fd_file_async(int fd, uoff_t offset, size_t max_buffer_size,
+			      bool autoclose_fd);
 /* Create ostream for file. If append flag is not set, file will be truncated. */
 struct ostream *o_stream_create_file(const char *path, uoff_t offset, mode_t mode,
 				     enum ostream_create_file_flags flags);
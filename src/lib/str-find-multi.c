@@ -0,0 +1,263 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "str-find.h"
+#include "str-find-multi.h"
+
+/* Set in a transition when the next state ends at least one key */
+#define STATE_HAS_KEY 0x80000000U
+#define STATE_OFFSET_MASK (STATE_HAS_KEY - 1)
+#define NO_KEY UINT_MAX
+/* The keys come from client input, so limit the DFA's transition table.
+   With larger keys each key is searched separately with str_find(). */
+#define STR_FIND_MULTI_MAX_DFA_SIZE (1024*1024)
+
+struct str_find_multi_context {
+	pool_t pool;
+
+	unsigned int key_count, found_count;
+	bool *found;
+	/* The next key with the same contents, or NO_KEY */
+	unsigned int *key_next_dup;
+	/* Used instead of the DFA when it would be too large */
+	struct str_find_context **key_find;
+
+	/* The bytes used by the keys are mapped to classes 1..n. All the
+	   other bytes are class 0. */
+	unsigned char byte_class[UCHAR_MAX+1];
+	unsigned int class_count;
+
+	unsigned int state_count;
+	/* transitions[state * class_count + class] is the next state's
+	   offset (state * class_count), possibly with STATE_HAS_KEY. Keeping
+	   the offsets avoids a multiplication for each input byte. */
+	uint32_t *transitions;
+	/* The first key ending in the state, or NO_KEY */
+	unsigned int *state_key;
+	/* The next state in the failure chain which ends a key, or 0 */
+	unsigned int *state_key_link;
+
+	/* Offset of the current state */
+	uint32_t state_offset;
+};
+
+static void str_find_multi_build_dfa(struct str_find_multi_context *ctx)
+{
+	unsigned int class_count = ctx->class_count;
+	unsigned int *queue, *fail, head = 0, tail = 0;
+	unsigned int i, c, state, next;
+	uint32_t *row;
+	const uint32_t *fail_row;
+
+	/* Missing transitions from the root stay in the root. Its children
+	   fail back to the root. */
+	queue = t_new(unsigned int, ctx->state_count);
+	fail = t_new(unsigned int, ctx->state_count);
+	for (c = 0; c < class_count; c++) {
+		if (ctx->transitions[c] != 0)
+			queue[tail++] = ctx->transitions[c];
+	}
+
+	/* Walk the trie in breadth-first order, so the failure state (which
+	   is always shallower) already has all of its transitions filled. */
+	while (head < tail) {
+		state = queue[head++];
+		row = &ctx->transitions[state * class_count];
+		fail_row = &ctx->transitions[fail[state] * class_count];
+		for (c = 0; c < class_count; c++) {
+			if (row[c] == 0) {
+				row[c] = fail_row[c];
+				continue;
+			}
+			next = row[c];
+			fail[next] = fail_row[c];
+			ctx->state_key_link[next] =
+				ctx->state_key[fail[next]] != NO_KEY ?
+				fail[next] : ctx->state_key_link[fail[next]];
+			queue[tail++] = next;
+		}
+	}
+
+	for (i = 0; i < ctx->state_count * class_count; i++) {
+		next = ctx->transitions[i];
+		ctx->transitions[i] = next * class_count;
+		if (ctx->state_key[next] != NO_KEY ||
+		    ctx->state_key_link[next] != 0)
+			ctx->transitions[i] |= STATE_HAS_KEY;
+	}
+}
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys)
+{
+	struct str_find_multi_context *ctx;
+	unsigned int i, j, idx, state, class_count = 1;
+	size_t max_states = 1;
+
+	ctx = p_new(pool, struct str_find_multi_context, 1);
+	ctx->pool = pool;
+	ctx->key_count = str_array_length(keys);
+	i_assert(ctx->key_count > 0);
+
+	for (i = 0; i < ctx->key_count; i++) {
+		const unsigned char *key = (const unsigned char *)keys[i];
+
+		i_assert(key[0] != '\0');
+		for (j = 0; key[j] != '\0'; j++) {
+			if (ctx->byte_class[key[j]] == 0)
+				ctx->byte_class[key[j]] = class_count++;
+		}
+		max_states += j;
+	}
+	/* NUL can't be in the keys, so there are at most 256 classes */
+	i_assert(class_count <= UCHAR_MAX+1);
+	ctx->class_count = class_count;
+
+	ctx->found = p_new(pool, bool, ctx->key_count);
+	if (max_states > STR_FIND_MULTI_MAX_DFA_SIZE /
+			 (class_count * sizeof(uint32_t))) {
+		ctx->key_find = p_new(pool, struct str_find_context *,
+				      ctx->key_count);
+		for (i = 0; i < ctx->key_count; i++)
+			ctx->key_find[i] = str_find_init(pool, keys[i]);
+		return ctx;
+	}
+	i_assert(max_states <= STATE_OFFSET_MASK / class_count);
+	ctx->key_next_dup = p_new(pool, unsigned int, ctx->key_count);
+	ctx->transitions = p_new(pool, uint32_t,
+				 MALLOC_MULTIPLY(max_states, class_count));
+	ctx->state_key = p_new(pool, unsigned int, max_states);
+	ctx->state_key_link = p_new(pool, unsigned int, max_states);
+	for (i = 0; i < max_states; i++)
+		ctx->state_key[i] = NO_KEY;
+
+	/* Build the trie. Transition 0 means there is none yet, since
+	   nothing points back to the root before the DFA is built. */
+	ctx->state_count = 1;
+	for (i = 0; i < ctx->key_count; i++) {
+		const unsigned char *key = (const unsigned char *)keys[i];
+
+		state = 0;
+		for (j = 0; key[j] != '\0'; j++) {
+			idx = state * class_count + ctx->byte_class[key[j]];
+			if (ctx->transitions[idx] == 0)
+				ctx->transitions[idx] = ctx->state_count++;
+			state = ctx->transitions[idx];
+		}
+		ctx->key_next_dup[i] = ctx->state_key[state];
+		ctx->state_key[state] = i;
+	}
+	T_BEGIN {
+		str_find_multi_build_dfa(ctx);
+	} T_END;
+	return ctx;
+}
+
+void str_find_multi_deinit(struct str_find_multi_context **_ctx)
+{
+	struct str_find_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	if (ctx->key_find != NULL) {
+		for (unsigned int i = 0; i < ctx->key_count; i++)
+			str_find_deinit(&ctx->key_find[i]);
+		p_free(ctx->pool, ctx->key_find);
+	}
+	p_free(ctx->pool, ctx->found);
+	p_free(ctx->pool, ctx->key_next_dup);
+	p_free(ctx->pool, ctx->transitions);
+	p_free(ctx->pool, ctx->state_key);
+	p_free(ctx->pool, ctx->state_key_link);
+	p_free(ctx->pool, ctx);
+}
+
+static void
+str_find_multi_add_found(struct str_find_multi_context *ctx,
+			 unsigned int state)
+{
+	unsigned int key;
+
+	do {
+		for (key = ctx->state_key[state]; key != NO_KEY;
+		     key = ctx->key_next_dup[key]) {
+			if (!ctx->found[key]) {
+				ctx->found[key] = TRUE;
+				ctx->found_count++;
+			}
+		}
+		state = ctx->state_key_link[state];
+	} while (state != 0);
+}
+
+static bool
+str_find_multi_more_keys(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->key_count; i++) {
+		if (!ctx->found[i] &&
+		    str_find_more(ctx->key_find[i], data, size)) {
+			ctx->found[i] = TRUE;
+			ctx->found_count++;
+		}
+	}
+	return ctx->found_count == ctx->key_count;
+}
+
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	const uint32_t *transitions = ctx->transitions;
+	const unsigned char *byte_class = ctx->byte_class;
+	uint32_t offset = ctx->state_offset;
+	size_t i;
+
+	if (ctx->found_count == ctx->key_count)
+		return TRUE;
+	if (ctx->key_find != NULL)
+		return str_find_multi_more_keys(ctx, data, size);
+
+	for (i = 0; i < size; i++) {
+		offset = transitions[offset + byte_class[data[i]]];
+		if ((offset & STATE_HAS_KEY) != 0) {
+			offset &= STATE_OFFSET_MASK;
+			str_find_multi_add_found(ctx,
+						 offset / ctx->class_count);
+			if (ctx->found_count == ctx->key_count)
+				break;
+		}
+	}
+	ctx->state_offset = offset;
+	return ctx->found_count == ctx->key_count;
+}
+
+bool str_find_multi_key_found(struct str_find_multi_context *ctx,
+			      unsigned int key_idx)
+{
+	i_assert(key_idx < ctx->key_count);
+	return ctx->found[key_idx];
+}
+
+unsigned int str_find_multi_get_found_count(struct str_find_multi_context *ctx)
+{
+	return ctx->found_count;
+}
+
+void str_find_multi_reset(struct str_find_multi_context *ctx)
+{
+	ctx->state_offset = 0;
+	if (ctx->key_find != NULL) {
+		for (unsigned int i = 0; i < ctx->key_count; i++)
+			str_find_reset(ctx->key_find[i]);
+	}
+}
+
+void str_find_multi_reset_found(struct str_find_multi_context *ctx)
+{
+	str_find_multi_reset(ctx);
+	ctx->found_count = 0;
+	memset(ctx->found, 0, sizeof(ctx->found[0]) * ctx->key_count);
+}
@@ -0,0 +1,31 @@
+#ifndef STR_FIND_MULTI_H
+#define STR_FIND_MULTI_H
+
+/* Find multiple keys with a single pass over the data. This is an
+   Aho-Corasick automaton compiled into a DFA, so each input byte costs a
+   single table lookup regardless of the number of keys. If the keys are
+   too large for the DFA to fit in its size limit, each key is searched
+   separately with str_find() instead. */
+
+struct str_find_multi_context;
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys);
+void str_find_multi_deinit(struct str_find_multi_context **ctx);
+
+/* Returns TRUE once all the keys have been found. It's possible to send the
+   data in arbitrary blocks and have the keys still match. */
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size);
+/* Returns TRUE if the key with the given index has been found. */
+bool str_find_multi_key_found(struct str_find_multi_context *ctx,
+			      unsigned int key_idx);
+/* Returns the number of keys found so far. */
+unsigned int str_find_multi_get_found_count(struct str_find_multi_context *ctx);
+/* Reset input data. The next str_find_multi_more() call won't try to match
+   the keys to earlier data. The keys that were already found stay found. */
+void str_find_multi_reset(struct str_find_multi_context *ctx);
+/* Reset input data and forget about the keys found so far. */
+void str_find_multi_reset_found(struct str_find_multi_context *ctx);
+
+#endif
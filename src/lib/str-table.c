@@ -13,7 +13,7 @@ struct str_table *str_table_init(void)
 	struct str_table *table;
 
 	table = i_new(struct str_table, 1);
-	hash_table_create(&table->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&table->hash, default_pool, 0, str_hash_fast, strcmp);
 	return table;
 }
 
@@ -3,6 +3,7 @@
 #include "test-lib.h"
 #include "str.h"
 #include "base64.h"
+#include "base64-simd.h"
 
 static unsigned int loop_count;
 
@@ -1304,6 +1305,85 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static int
+test_base64_simd_decode(const struct base64_scheme *b64,
+			const unsigned char *src, size_t src_size,
+			size_t *src_pos_r, buffer_t *dest)
+{
+	struct base64_decoder dec;
+	int ret;
+
+	buffer_set_used_size(dest, 0);
+	base64_decode_init(&dec, b64, 0);
+	ret = base64_decode_more(&dec, src, src_size, src_pos_r, dest);
+	if (ret >= 0)
+		ret = base64_decode_finish(&dec);
+	return ret;
+}
+
+static void test_base64_simd_impl(enum base64_simd_impl impl)
+{
+	static const char garbage[] = " \r\n\t=*~\x80";
+	const struct base64_scheme *b64;
+	buffer_t *ref_enc, *enc, *ref_dec, *dec;
+	unsigned char buf[512];
+	size_t size, max_line_len, ref_pos, pos;
+	unsigned int i, j;
+	int ref_ret, ret;
+
+	test_begin(t_strdup_printf("base64 simd (%s)",
+				   base64_simd_impl_get_name(impl)));
+	for (i = 0; i < loop_count; i++) T_BEGIN {
+		b64 = i % 2 == 0 ? &base64_scheme : &base64url_scheme;
+		size = i_rand_limit(sizeof(buf));
+		for (j = 0; j < size; j++)
+			buf[j] = i_rand_uchar();
+		max_line_len = i % 3 == 0 ? 16 + i_rand_limit(100) : SIZE_MAX;
+		ref_dec = t_buffer_create(sizeof(buf));
+		dec = t_buffer_create(sizeof(buf));
+
+		/* encoded output must be identical to the scalar code */
+		test_assert(base64_simd_set_impl(BASE64_SIMD_IMPL_NONE));
+		ref_enc = t_base64_scheme_encode(b64, 0, max_line_len,
+						 buf, size);
+		test_assert(base64_simd_set_impl(impl));
+		enc = t_base64_scheme_encode(b64, 0, max_line_len, buf, size);
+		test_assert_idx(buffer_cmp(ref_enc, enc), i);
+
+		/* sprinkle some characters into the encoded data, which
+		   the vectorized decoder must leave for the scalar code */
+		for (j = i_rand_limit(4); j > 0 && enc->used > 0; j--) {
+			buffer_write(enc, i_rand_limit(enc->used),
+				     &garbage[i_rand_limit(sizeof(garbage)-1)],
+				     1);
+		}
+
+		test_assert(base64_simd_set_impl(BASE64_SIMD_IMPL_NONE));
+		ref_ret = test_base64_simd_decode(b64, enc->data, enc->used,
+						  &ref_pos, ref_dec);
+		test_assert(base64_simd_set_impl(impl));
+		ret = test_base64_simd_decode(b64, enc->data, enc->used,
+					      &pos, dec);
+		test_assert_idx(ret == ref_ret, i);
+		test_assert_idx(pos == ref_pos, i);
+		test_assert_idx(buffer_cmp(ref_dec, dec), i);
+	} T_END;
+	test_end();
+}
+
+static void test_base64_simd(void)
+{
+	enum base64_simd_impl best = base64_simd_get_best_impl();
+	enum base64_simd_impl impl;
+
+	for (impl = BASE64_SIMD_IMPL_NONE + 1;
+	     impl < BASE64_SIMD_IMPL_COUNT; impl++) {
+		if (base64_simd_set_impl(impl))
+			test_base64_simd_impl(impl);
+	}
+	test_assert(base64_simd_set_impl(best));
+}
+
 void test_base64(void)
 {
 	loop_count = ON_VALGRIND ? 100 : 1000;
@@ -1317,4 +1397,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_simd();
 }
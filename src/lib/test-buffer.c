@@ -185,6 +185,30 @@ static void test_buffer_set_used_size(void)
 	test_end();
 }
 
+static void test_buffer_reserve(void)
+{
+	buffer_t *buf;
+
+	test_begin("buffer_reserve");
+	buf = buffer_create_dynamic(default_pool, 8);
+	buffer_append(buf, "abcd", 4);
+	buffer_reserve(buf, 4);
+	test_assert(buffer_get_writable_size(buf) == 8);
+	buffer_reserve(buf, 1000);
+	test_assert(buffer_get_writable_size(buf) == 1000);
+	test_assert(buf->used == 4 && memcmp(buf->data, "abcd", 4) == 0);
+	/* the reserved space can be used without growing */
+	memset(buffer_append_space_unsafe(buf, 996), 'x', 996);
+	test_assert(buffer_get_writable_size(buf) == 1000);
+	/* growing beyond it works as usual */
+	buffer_append_c(buf, 'y');
+	test_assert(buf->used == 1001 &&
+		    ((const char *)buf->data)[1000] == 'y');
+	test_assert(buffer_get_writable_size(buf) > 1000);
+	buffer_free(&buf);
+	test_end();
+}
+
 
 #if 0
 
@@ -332,6 +356,7 @@ void test_buffer(void)
 	test_buffer_random();
 	test_buffer_write();
 	test_buffer_set_used_size();
+	test_buffer_reserve();
 	test_buffer_truncate_bits();
 	test_buffer_replace();
 }
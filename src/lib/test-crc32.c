@@ -3,12 +3,45 @@
 #include "test-lib.h"
 #include "crc32.h"
 
-void test_crc32(void)
+static void test_crc32_impl(enum crc32_impl impl)
 {
 	const char str[] = "foo\0bar";
+	unsigned char buf[1024+16];
+	uint32_t crc, ref_crc;
+	size_t i, offset, size, split;
 
-	test_begin("crc32");
+	test_begin(t_strdup_printf("crc32 (%s)", crc32_impl_get_name(impl)));
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	test_assert(crc32_str("123456789") == 0xcbf43926);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i_rand_uchar();
+	for (i = 0; i < 500; i++) {
+		offset = i_rand_limit(16);
+		size = i_rand_limit(sizeof(buf) - offset + 1);
+		split = i_rand_limit(size + 1);
+
+		test_assert(crc32_set_impl(CRC32_IMPL_TABLE));
+		ref_crc = crc32_data(buf + offset, size);
+		test_assert(crc32_set_impl(impl));
+		test_assert_idx(crc32_data(buf + offset, size) == ref_crc, i);
+
+		crc = crc32_data(buf + offset, split);
+		crc = crc32_data_more(crc, buf + offset + split, size - split);
+		test_assert_idx(crc == ref_crc, i);
+	}
 	test_end();
 }
+
+void test_crc32(void)
+{
+	enum crc32_impl best = crc32_get_best_impl();
+	enum crc32_impl impl;
+
+	for (impl = 0; impl < CRC32_IMPL_COUNT; impl++) {
+		if (crc32_set_impl(impl))
+			test_crc32_impl(impl);
+	}
+	test_assert(crc32_set_impl(best));
+}
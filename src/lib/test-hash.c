@@ -1,6 +1,8 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "array.h"
+#include "strnum.h"
 #include "hash.h"
 
 
@@ -35,6 +37,224 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_open_random(void)
+{
+	const unsigned int keymax = ON_VALGRIND ? 2000 : 20000;
+	HASH_TABLE(void *, void *) ref, hash;
+	void *key, *value, *orig_key;
+	unsigned int i, count;
+
+	test_begin("hash table open addressing (random)");
+	hash_table_create_direct(&ref, default_pool, 0);
+	hash_table_create_open_direct(&hash, default_pool, 0);
+	for (i = 0; i < keymax * 5; i++) {
+		key = POINTER_CAST(i_rand_limit(keymax) + 1);
+		value = POINTER_CAST(i_rand_limit(1000) + 1);
+		switch (i_rand_limit(4)) {
+		case 0:
+		case 1:
+			hash_table_update(ref, key, value);
+			hash_table_update(hash, key, value);
+			break;
+		case 2:
+			test_assert_idx(hash_table_try_remove(ref, key) ==
+					hash_table_try_remove(hash, key), i);
+			break;
+		case 3:
+			test_assert_idx(hash_table_lookup(ref, key) ==
+					hash_table_lookup(hash, key), i);
+			break;
+		}
+		test_assert_idx(hash_table_count(ref) ==
+				hash_table_count(hash), i);
+	}
+
+	/* iterating returns everything exactly once */
+	struct hash_iterate_context *iter =
+		hash_table_iterate_init(hash);
+	count = 0;
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		test_assert(hash_table_lookup(ref, key) == value);
+		hash_table_remove(ref, key);
+		count++;
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == hash_table_count(hash));
+	test_assert(hash_table_count(ref) == 0);
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(!hash_table_lookup_full(hash, POINTER_CAST(1),
+					    &orig_key, &value));
+	hash_table_destroy(&ref);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_open_iterate_modify(void)
+{
+	HASH_TABLE(char *, char *) hash;
+	struct hash_iterate_context *iter;
+	bool seen[100];
+	char *key, *value, *orig_key;
+	unsigned int i, n;
+
+	test_begin("hash table open addressing (modify while iterating)");
+	hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < N_ELEMENTS(seen); i++) {
+		key = i_strdup_printf("%u", i);
+		hash_table_insert(hash, key, key);
+	}
+	const char *lookup_key = "42";
+	test_assert(hash_table_lookup_full(hash, lookup_key, &orig_key, &value) &&
+		    strcmp(orig_key, "42") == 0 && orig_key == value);
+
+	/* remove odd keys while iterating and add so many new keys that the
+	   table is resized */
+	memset(seen, 0, sizeof(seen));
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		if (str_to_uint(key, &n) < 0 || n >= N_ELEMENTS(seen))
+			continue;
+		test_assert(!seen[n]);
+		seen[n] = TRUE;
+		if (n % 2 == 0 && n + 1 < N_ELEMENTS(seen)) {
+			const char *odd = t_strdup_printf("%u", n + 1);
+			if (hash_table_lookup_full(hash, odd, &orig_key,
+						   &value)) {
+				hash_table_remove(hash, odd);
+				i_free(orig_key);
+			}
+		}
+		if (n == 10) {
+			for (i = 1000; i < 2000; i++) {
+				key = i_strdup_printf("%u", i);
+				hash_table_insert(hash, key, key);
+			}
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	for (i = 0; i < N_ELEMENTS(seen); i += 2)
+		test_assert_idx(seen[i], i);
+	test_assert(hash_table_count(hash) == 1000 + N_ELEMENTS(seen) / 2);
+
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		hash_table_remove(hash, key);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(hash_table_count(hash) == 0);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_open_iterate_remove_resized(void)
+{
+	HASH_TABLE(char *, char *) hash;
+	struct hash_iterate_context *iter;
+	ARRAY(char *) removed;
+	bool seen[100];
+	char *key, *value, *orig_key;
+	unsigned int i, n;
+	bool first = TRUE;
+
+	test_begin("hash table open addressing (remove after resize while iterating)");
+	hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < N_ELEMENTS(seen); i++) {
+		key = i_malloc(MAX_INT_STRLEN);
+		i_snprintf(key, MAX_INT_STRLEN, "%u", i);
+		hash_table_insert(hash, key, key);
+	}
+
+	/* resize the table and then remove and "free" the odd keys */
+	i_array_init(&removed, N_ELEMENTS(seen));
+	memset(seen, 0, sizeof(seen));
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		if (str_to_uint(key, &n) < 0 || n >= N_ELEMENTS(seen))
+			continue;
+		test_assert_idx(!seen[n], n);
+		seen[n] = TRUE;
+		if (!first)
+			continue;
+		first = FALSE;
+
+		for (i = 1000; i < 2000; i++) {
+			key = i_malloc(MAX_INT_STRLEN);
+			i_snprintf(key, MAX_INT_STRLEN, "%u", i);
+			hash_table_insert(hash, key, key);
+		}
+		for (i = 1; i < N_ELEMENTS(seen); i += 2) {
+			const char *odd = t_strdup_printf("%u", i);
+			if (i == n)
+				continue;
+			test_assert(hash_table_lookup_full(hash, odd,
+							   &orig_key, &value));
+			hash_table_remove(hash, odd);
+			/* the iterator must not access the key anymore -
+			   make it look like an already returned key */
+			i_snprintf(orig_key, MAX_INT_STRLEN, "%u", n);
+			array_push_back(&removed, &orig_key);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	for (i = 0; i < N_ELEMENTS(seen); i += 2)
+		test_assert_idx(seen[i], i);
+	test_assert(array_count(&removed) + hash_table_count(hash) ==
+		    1000 + N_ELEMENTS(seen));
+
+	array_foreach_elem(&removed, key)
+		i_free(key);
+	array_free(&removed);
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		hash_table_remove(hash, key);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_fast(void)
+{
+	unsigned char buf[64];
+	unsigned int i, hash, collisions = 0;
+	unsigned int buckets[64];
+
+	test_begin("hash fast");
+	/* the string and memory versions are the same */
+	test_assert(str_hash_fast("") == mem_hash_fast("", 0));
+	test_assert(str_hash_fast("hello world, this is a test") ==
+		    mem_hash_fast("hello world, this is a test", 27));
+
+	/* trailing NULs and the length affect the hash */
+	memset(buf, 0, sizeof(buf));
+	for (i = 1; i < sizeof(buf); i++) {
+		if (mem_hash_fast(buf, i) == mem_hash_fast(buf, i - 1))
+			collisions++;
+	}
+	test_assert(collisions == 0);
+
+	/* the result doesn't depend on the buffer's alignment */
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i_rand_uchar();
+	hash = mem_hash_fast(buf + 1, 40);
+	memmove(buf, buf + 1, 40);
+	test_assert(mem_hash_fast(buf, 40) == hash);
+
+	/* sequential keys are spread evenly to buckets */
+	memset(buckets, 0, sizeof(buckets));
+	for (i = 0; i < 64*100; i++) {
+		const char *key = t_strdup_printf("key%u", i);
+		buckets[str_hash_fast(key) % N_ELEMENTS(buckets)]++;
+	}
+	for (i = 0; i < N_ELEMENTS(buckets); i++)
+		test_assert_idx(buckets[i] > 50 && buckets[i] < 150, i);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
@@ -46,4 +266,9 @@ void test_hash(void)
 	test_hash_random_pool(pool);
 	pool_unref(&pool);
 	test_end();
+
+	test_hash_open_random();
+	test_hash_open_iterate_modify();
+	test_hash_open_iterate_remove_resized();
+	test_hash_fast();
 }
@@ -376,6 +376,181 @@ static void test_ioloop_context_events_run(struct event *root_event)
 	event_unref(&ctx2_event1);
 }
 
+struct test_file_op_ctx {
+	ssize_t ret;
+	int error;
+	unsigned int count;
+};
+
+static void
+test_ioloop_file_op_callback(ssize_t ret, const void *data ATTR_UNUSED,
+			     void *context)
+{
+	struct test_file_op_ctx *ctx = context;
+
+	ctx->ret = ret;
+	ctx->error = ret < 0 ? errno : 0;
+	ctx->count++;
+}
+
+static void test_ioloop_file_op_recreate(void)
+{
+	struct test_file_op_ctx ctx;
+	struct io_file_op *op;
+	struct ioloop *ioloop;
+	int fd;
+
+	test_begin("ioloop file op wait after recreate");
+	ioloop = io_loop_create();
+	if (!io_loop_have_file_ops(ioloop)) {
+		io_loop_destroy(&ioloop);
+		test_end();
+		return;
+	}
+	fd = test_create_temp_fd();
+	if (write(fd, "hello", 5) != 5)
+		i_fatal("write() failed: %m");
+
+	/* the pending operation is failed, and waiting for it must not
+	   block on the new ring */
+	i_zero(&ctx);
+	op = io_loop_file_pread(ioloop, fd, 5, 0,
+				test_ioloop_file_op_callback, &ctx);
+	io_loop_recreate(ioloop);
+	io_file_op_wait(op);
+	test_assert(ctx.count == 1);
+	test_assert(ctx.ret == -1 && ctx.error == ECANCELED);
+
+	/* the new ring works */
+	i_zero(&ctx);
+	op = io_loop_file_pread(ioloop, fd, 5, 0,
+				test_ioloop_file_op_callback, &ctx);
+	io_file_op_wait(op);
+	test_assert(ctx.count == 1 && ctx.ret == 5);
+
+	/* destroying the ioloop doesn't hang either */
+	i_zero(&ctx);
+	(void)io_loop_file_pread(ioloop, fd, 5, 0,
+				 test_ioloop_file_op_callback, &ctx);
+	io_loop_recreate(ioloop);
+	io_loop_destroy(&ioloop);
+	test_assert(ctx.count == 0);
+
+	i_close_fd(&fd);
+	test_end();
+}
+
+struct test_file_op_wait_ctx {
+	struct test_file_op_wait_ctx *other;
+	struct io_file_op *op;
+	unsigned int *count;
+	bool finished;
+};
+
+static void
+test_ioloop_file_op_wait_callback(ssize_t ret, const void *data ATTR_UNUSED,
+				  void *context)
+{
+	struct test_file_op_wait_ctx *ctx = context;
+
+	test_assert(ret == -1 && errno == ECANCELED);
+	test_assert(!ctx->finished);
+	ctx->finished = TRUE;
+	(*ctx->count)++;
+	if (!ctx->other->finished) {
+		/* the other operation's completion is still waiting to be
+		   handled */
+		io_file_op_wait(ctx->other->op);
+		test_assert(ctx->other->finished);
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_ioloop_file_op_wait_in_callback(void)
+{
+	struct test_file_op_wait_ctx ctx1, ctx2;
+	struct ioloop *ioloop;
+	unsigned int count = 0;
+	int fd;
+
+	test_begin("ioloop file op wait in file op callback");
+	ioloop = io_loop_create();
+	if (!io_loop_have_file_ops(ioloop)) {
+		io_loop_destroy(&ioloop);
+		test_end();
+		return;
+	}
+	fd = test_create_temp_fd();
+	if (write(fd, "hello", 5) != 5)
+		i_fatal("write() failed: %m");
+
+	/* The recreate fails both operations in the next ioloop run. The
+	   first callback waits for the other operation, which must be
+	   finished only once, without touching the first one again. */
+	i_zero(&ctx1);
+	i_zero(&ctx2);
+	ctx1.other = &ctx2;
+	ctx2.other = &ctx1;
+	ctx1.count = ctx2.count = &count;
+	ctx1.op = io_loop_file_pread(ioloop, fd, 5, 0,
+				     test_ioloop_file_op_wait_callback, &ctx1);
+	ctx2.op = io_loop_file_pread(ioloop, fd, 5, 0,
+				     test_ioloop_file_op_wait_callback, &ctx2);
+	io_loop_recreate(ioloop);
+	io_loop_run(ioloop);
+	test_assert(count == 2);
+
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fd);
+	test_end();
+}
+
+#define TEST_FILE_OP_MANY_COUNT 4096
+
+static void
+test_ioloop_file_op_many_callback(ssize_t ret, const void *data,
+				  void *context)
+{
+	unsigned int *count = context;
+
+	test_assert(ret == 5 && memcmp(data, "hello", 5) == 0);
+	if (++(*count) == TEST_FILE_OP_MANY_COUNT)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_file_op_many(void)
+{
+	struct ioloop *ioloop;
+	unsigned int i, count = 0;
+	int fd;
+
+	test_begin("ioloop file ops overflowing the rings");
+	ioloop = io_loop_create();
+	if (!io_loop_have_file_ops(ioloop)) {
+		io_loop_destroy(&ioloop);
+		test_end();
+		return;
+	}
+	fd = test_create_temp_fd();
+	if (write(fd, "hello", 5) != 5)
+		i_fatal("write() failed: %m");
+
+	/* Many more operations than fit into the submission and completion
+	   rings are queued without running the ioloop. Submitting them may
+	   fail with EBUSY until the completions are reaped. */
+	for (i = 0; i < TEST_FILE_OP_MANY_COUNT; i++) {
+		(void)io_loop_file_pread(ioloop, fd, 5, 0,
+					 test_ioloop_file_op_many_callback,
+					 &count);
+	}
+	io_loop_run(ioloop);
+	test_assert(count == TEST_FILE_OP_MANY_COUNT);
+
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fd);
+	test_end();
+}
+
 static void test_ioloop_context_events(void)
 {
 	test_begin("ioloop context - no root event");
@@ -401,4 +576,7 @@ void test_ioloop(void)
 	test_ioloop_fd();
 	test_ioloop_context();
 	test_ioloop_context_events();
+	test_ioloop_file_op_recreate();
+	test_ioloop_file_op_wait_in_callback();
+	test_ioloop_file_op_many();
 }
@@ -1,9 +1,14 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "randgen.h"
 #include "istream.h"
 #include "istream-crlf.h"
 
+#include <unistd.h>
+
 static void test_istream_children(void)
 {
 	struct istream *parent, *child1, *child2;
@@ -373,9 +378,125 @@ static void test_istream_read_next_line(void)
 	test_end();
 }
 
+struct test_istream_async_ctx {
+	struct istream *input;
+	string_t *str;
+	bool eof;
+};
+
+static void test_istream_fd_async_input(struct test_istream_async_ctx *ctx)
+{
+	const unsigned char *data;
+	size_t size;
+	ssize_t ret;
+
+	while ((ret = i_stream_read_more(ctx->input, &data, &size)) > 0) {
+		str_append_data(ctx->str, data, size);
+		i_stream_skip(ctx->input, size);
+	}
+	if (ret < 0) {
+		test_assert(ctx->input->stream_errno == 0);
+		ctx->eof = TRUE;
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_istream_fd_async(void)
+{
+	struct test_istream_async_ctx ctx;
+	struct ioloop *ioloop;
+	struct io *io;
+	unsigned char buf[IO_BLOCK_SIZE * 3 + 123];
+	int fd;
+
+	test_begin("istream fd async");
+	random_fill(buf, sizeof(buf));
+	fd = test_create_temp_fd();
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+		i_fatal("write() failed: %m");
+
+	ioloop = io_loop_create();
+	i_zero(&ctx);
+	ctx.str = str_new(default_pool, sizeof(buf));
+	ctx.input = i_stream_create_fd_async_autoclose(&fd, 1024);
+	test_assert(ctx.input->blocking ==
+		    !io_loop_have_file_ops(ioloop));
+
+	/* reading after a seek gets the data from the new offset */
+	i_stream_seek(ctx.input, 100);
+	/* without async reads the regular file can't be polled */
+	io = ctx.input->blocking ? NULL :
+		io_add_istream(ctx.input, test_istream_fd_async_input, &ctx);
+	test_istream_fd_async_input(&ctx);
+	if (!ctx.eof)
+		io_loop_run(ioloop);
+	test_assert(ctx.eof);
+	test_assert(str_len(ctx.str) == sizeof(buf) - 100 &&
+		    memcmp(str_data(ctx.str), buf + 100,
+			   sizeof(buf) - 100) == 0);
+
+	io_remove(&io);
+	i_stream_unref(&ctx.input);
+	str_free(&ctx.str);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_istream_fd_async_blocking(void)
+{
+	struct ioloop *ioloop;
+	struct istream *input;
+	const unsigned char *data;
+	unsigned char buf[IO_BLOCK_SIZE * 3 + 123];
+	string_t *str;
+	size_t size;
+	ssize_t ret;
+	int fd;
+
+	test_begin("istream fd async blocking");
+	random_fill(buf, sizeof(buf));
+	fd = test_create_temp_fd();
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+		i_fatal("write() failed: %m");
+
+	ioloop = io_loop_create();
+	str = str_new(default_pool, sizeof(buf));
+	input = i_stream_create_fd_async_autoclose(&fd, 1024);
+	input->blocking = TRUE;
+
+	/* the reads wait for the data without running the ioloop */
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		str_append_data(str, data, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(ret == -1);
+	test_assert(input->stream_errno == 0);
+	test_assert(str_len(str) == sizeof(buf) &&
+		    memcmp(str_data(str), buf, sizeof(buf)) == 0);
+
+	/* seeking back discards the data that was read ahead */
+	str_truncate(str, 0);
+	i_stream_seek(input, 1000);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		str_append_data(str, data, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(ret == -1);
+	test_assert(str_len(str) == sizeof(buf) - 1000 &&
+		    memcmp(str_data(str), buf + 1000,
+			   sizeof(buf) - 1000) == 0);
+
+	i_stream_unref(&input);
+	str_free(&str);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_istream(void)
 {
 	test_istream_children();
 	test_istream_next_line();
 	test_istream_read_next_line();
+	test_istream_fd_async();
+	test_istream_fd_async_blocking();
 }
@@ -1,10 +1,13 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "ioloop.h"
 #include "net.h"
 #include "str.h"
 #include "randgen.h"
+#include "fdpass.h"
 #include "istream.h"
+#include "istream-unix.h"
 #include "ostream.h"
 
 #include <fcntl.h>
@@ -176,6 +179,161 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_socket(void)
+{
+	struct istream *input;
+	struct ostream *output;
+	unsigned char buf[1024];
+	const size_t total_size = 1024*1024;
+	size_t written = 0, verified = 0, i;
+	ssize_t ret;
+	int in_fd[2], out_fd[2];
+
+	test_begin("ostream file send istream socket");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	net_set_nonblock(in_fd[0], TRUE);
+	net_set_nonblock(in_fd[1], TRUE);
+	net_set_nonblock(out_fd[0], TRUE);
+	net_set_nonblock(out_fd[1], TRUE);
+	input = i_stream_create_fd(in_fd[0], 1024);
+	output = o_stream_create_fd(out_fd[0], 4096);
+
+	/* some of the data is already in the istream's buffer */
+	test_assert(write(in_fd[1], "hello", 5) == 5);
+	test_assert(i_stream_read(input) == 5);
+	test_assert(o_stream_send_istream(output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(input->v_offset == 5 && output->offset == 5);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 5 &&
+		    memcmp(buf, "hello", 5) == 0);
+
+	/* send a lot of data, so the output gets full in between */
+	while (verified < total_size && !test_has_failed()) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = (written + i) % 251;
+		ret = write(in_fd[1], buf,
+			    I_MIN(sizeof(buf), total_size - written));
+		if (ret > 0)
+			written += ret;
+		if (written == total_size && in_fd[1] != -1)
+			i_close_fd(&in_fd[1]);
+
+		switch (o_stream_send_istream(output, input)) {
+		case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+			test_assert(written == total_size);
+			break;
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+			break;
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+			test_assert(FALSE);
+			break;
+		}
+		test_assert(o_stream_flush(output) >= 0);
+
+		while ((ret = read(out_fd[1], buf, sizeof(buf))) > 0) {
+			for (i = 0; i < (size_t)ret; i++) {
+				if (buf[i] != (verified + i) % 251)
+					break;
+			}
+			test_assert(i == (size_t)ret);
+			verified += ret;
+		}
+	}
+	test_assert(verified == total_size);
+	test_assert(input->v_offset == 5 + total_size);
+	test_assert(output->offset == 5 + total_size);
+	test_assert(input->eof);
+
+	i_stream_destroy(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	test_end();
+}
+
+static void test_ostream_file_send_istream_socket_corked(void)
+{
+	struct istream *input;
+	struct ostream *output;
+	char buf[64];
+	int in_fd[2], out_fd[2];
+
+	test_begin("ostream file send istream socket corked");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	net_set_nonblock(in_fd[0], TRUE);
+	net_set_nonblock(out_fd[0], TRUE);
+	net_set_nonblock(out_fd[1], TRUE);
+	input = i_stream_create_fd(in_fd[0], 1024);
+	output = o_stream_create_fd(out_fd[0], 4096);
+
+	/* the data sent while corked stays in the buffer until uncorking */
+	o_stream_cork(output);
+	test_assert(o_stream_send_str(output, "header ") == 7);
+	test_assert(write(in_fd[1], "body", 4) == 4);
+	test_assert(o_stream_send_istream(output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(input->v_offset == 4 && output->offset == 11);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) < 0 && errno == EAGAIN);
+
+	test_assert(o_stream_uncork_flush(output) > 0);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 11 &&
+		    memcmp(buf, "header body", 11) == 0);
+
+	i_stream_destroy(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&in_fd[1]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	test_end();
+}
+
+static void test_ostream_file_send_istream_unix(void)
+{
+	struct istream *input;
+	struct ostream *output;
+	char buf[64];
+	int in_fd[2], out_fd[2], read_fd;
+
+	test_begin("ostream file send istream unix");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	net_set_nonblock(in_fd[0], TRUE);
+	net_set_nonblock(out_fd[0], TRUE);
+	net_set_nonblock(out_fd[1], TRUE);
+	input = i_stream_create_unix(in_fd[0], 1024);
+	output = o_stream_create_fd(out_fd[0], 4096);
+
+	/* the data must be read via the istream, so the passed fd isn't
+	   lost */
+	i_stream_unix_set_read_fd(input);
+	test_assert(fd_send(in_fd[1], out_fd[1], "data", 4) == 4);
+	test_assert(o_stream_send_istream(output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(input->v_offset == 4 && output->offset == 4);
+	read_fd = i_stream_unix_get_read_fd(input);
+	test_assert(read_fd != -1);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 4 &&
+		    memcmp(buf, "data", 4) == 0);
+
+	i_close_fd(&read_fd);
+	i_stream_destroy(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&in_fd[1]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	test_end();
+}
+
 static void test_ostream_file_send_over_iov_max(void)
 {
 	test_begin("ostream file send over IOV_MAX");
@@ -208,12 +366,75 @@ static void test_ostream_file_send_over_iov_max(void)
 	test_end();
 }
 
+static int test_ostream_file_async_flush(struct ostream *output)
+{
+	int ret;
+
+	if ((ret = o_stream_flush(output)) != 0)
+		io_loop_stop(current_ioloop);
+	return ret;
+}
+
+static void test_ostream_file_async(void)
+{
+	struct ioloop *ioloop;
+	struct ostream *output;
+	unsigned char buf[IO_BLOCK_SIZE * 3 + 123], buf2[sizeof(buf)];
+	unsigned int i;
+	int fd;
+
+	test_begin("ostream file async");
+	random_fill(buf, sizeof(buf));
+	fd = test_create_temp_fd();
+
+	ioloop = io_loop_create();
+	output = o_stream_create_fd_file_async(fd, 0, SIZE_MAX, FALSE);
+	test_assert(output->blocking == !io_loop_have_file_ops(ioloop));
+	o_stream_set_flush_callback(output, test_ostream_file_async_flush,
+				    output);
+	for (i = 0; i < sizeof(buf); i += 1000) {
+		size_t size = I_MIN(1000, sizeof(buf) - i);
+		test_assert(o_stream_send(output, buf + i, size) ==
+			    (ssize_t)size);
+	}
+	/* this waits for the pending writes to finish */
+	memset(buf + 10, 'x', 10);
+	test_assert(o_stream_pwrite(output, buf + 10, 10, 10) == 0);
+
+	if (o_stream_flush(output) == 0) {
+		o_stream_set_flush_pending(output, TRUE);
+		io_loop_run(ioloop);
+	}
+	test_assert(o_stream_flush(output) == 1);
+	test_assert(output->offset == sizeof(buf));
+	o_stream_destroy(&output);
+
+	test_assert(pread(fd, buf2, sizeof(buf2), 0) == sizeof(buf2));
+	test_assert(memcmp(buf, buf2, sizeof(buf)) == 0);
+
+	/* unreferencing the stream finishes the pending writes */
+	output = o_stream_create_fd_file_async(fd, sizeof(buf), SIZE_MAX,
+					       FALSE);
+	test_assert(o_stream_send(output, buf, sizeof(buf)) == sizeof(buf));
+	test_assert(o_stream_flush(output) >= 0);
+	o_stream_unref(&output);
+	test_assert(pread(fd, buf2, sizeof(buf2), sizeof(buf)) == sizeof(buf2));
+	test_assert(memcmp(buf, buf2, sizeof(buf)) == 0);
+	i_close_fd(&fd);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_socket();
+	test_ostream_file_send_istream_socket_corked();
+	test_ostream_file_send_istream_unix();
 	test_ostream_file_send_over_iov_max();
+	test_ostream_file_async();
 }
 
 enum fatal_test_state fatal_ostream_file(unsigned int stage)
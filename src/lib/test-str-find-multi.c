@@ -0,0 +1,185 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "str.h"
+#include "str-find-multi.h"
+
+static void test_str_find_multi_keys(void)
+{
+	const char *const keys[] = {
+		"he", "she", "his", "hers", "she", "x", NULL
+	};
+	static const struct {
+		const char *text;
+		const char *found;
+	} tests[] = {
+		{ "", "......" },
+		{ "ushers", "yy.yy." },
+		{ "ahishe", "yyy.y." },
+		{ "hx", ".....y" },
+		{ "hhhhhe", "y....." },
+		{ "shshe", "yy..y." },
+	};
+	struct str_find_multi_context *ctx;
+	unsigned int i, j, len;
+	bool all;
+
+	test_begin("str_find_multi() keys");
+	ctx = str_find_multi_init(pool_datastack_create(), keys);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		len = strlen(tests[i].text);
+		str_find_multi_reset_found(ctx);
+		all = str_find_multi_more(ctx,
+			(const unsigned char *)tests[i].text, len);
+		test_assert_idx(all == (strchr(tests[i].found, '.') == NULL),
+				i);
+		for (j = 0; keys[j] != NULL; j++) {
+			test_assert_idx(str_find_multi_key_found(ctx, j) ==
+					(tests[i].found[j] == 'y'), i*10 + j);
+		}
+	}
+	test_assert(str_find_multi_more(ctx,
+					(const unsigned char *)"hersxhis", 8));
+	test_assert(str_find_multi_get_found_count(ctx) == 6);
+	str_find_multi_deinit(&ctx);
+	test_end();
+}
+
+static void test_str_find_multi_blocks(void)
+{
+	const char *const keys[] = { "abcab", "bca", "ca", NULL };
+	const unsigned char *text = (const unsigned char *)"xabcabx";
+	const unsigned int text_len = 7;
+	struct str_find_multi_context *ctx;
+	unsigned int i, j, pos;
+
+	test_begin("str_find_multi() blocks");
+	ctx = str_find_multi_init(pool_datastack_create(), keys);
+	/* divide text into every possible block combination and test that
+	   all the keys still match */
+	for (i = 0; i < (1U << (text_len-1)); i++) {
+		str_find_multi_reset_found(ctx);
+		for (j = pos = 0; j < text_len; j++) {
+			if ((i & (1U << j)) != 0 || j == text_len-1) {
+				(void)str_find_multi_more(ctx, text + pos,
+							  j - pos + 1);
+				pos = j + 1;
+			}
+		}
+		test_assert_idx(str_find_multi_get_found_count(ctx) == 3, i);
+	}
+
+	/* resetting input doesn't continue matching earlier data */
+	str_find_multi_reset_found(ctx);
+	test_assert(!str_find_multi_more(ctx, text, 3));
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, text + 3, 4));
+	test_assert(str_find_multi_get_found_count(ctx) == 1);
+	test_assert(str_find_multi_key_found(ctx, 2));
+	str_find_multi_deinit(&ctx);
+	test_end();
+}
+
+static void test_str_find_multi_random(void)
+{
+	ARRAY_TYPE(const_string) keys;
+	struct str_find_multi_context *ctx;
+	string_t *text;
+	const char *key;
+	unsigned int i, j, n, len, key_count;
+
+	test_begin("str_find_multi() random");
+	for (i = 0; i < 1000; i++) T_BEGIN {
+		text = t_str_new(256);
+		len = i_rand_limit(256);
+		for (j = 0; j < len; j++)
+			str_append_c(text, 'a' + i_rand_limit(3));
+
+		key_count = i_rand_minmax(1, 10);
+		t_array_init(&keys, key_count + 1);
+		for (j = 0; j < key_count; j++) {
+			char *new_key = t_malloc0(7);
+
+			len = i_rand_minmax(1, 6);
+			for (n = 0; n < len; n++)
+				new_key[n] = 'a' + i_rand_limit(3);
+			key = new_key;
+			array_push_back(&keys, &key);
+		}
+		array_append_zero(&keys);
+
+		ctx = str_find_multi_init(pool_datastack_create(),
+					  array_front(&keys));
+		(void)str_find_multi_more(ctx, str_data(text), str_len(text));
+		for (j = 0; j < key_count; j++) {
+			key = array_idx_elem(&keys, j);
+			test_assert_idx(str_find_multi_key_found(ctx, j) ==
+					(strstr(str_c(text), key) != NULL), i);
+		}
+		str_find_multi_deinit(&ctx);
+	} T_END;
+	test_end();
+}
+
+static void test_str_find_multi_large(void)
+{
+	/* 256 byte classes and >1024 states don't fit into the DFA size
+	   limit, so the keys are searched separately. */
+#define LARGE_KEY_COUNT 5
+#define LARGE_KEY_LEN 250
+	const unsigned int key_count = LARGE_KEY_COUNT, key_len = LARGE_KEY_LEN;
+	const char *keys[LARGE_KEY_COUNT + 1];
+	struct str_find_multi_context *ctx;
+	string_t *text;
+	unsigned int i, j;
+
+	test_begin("str_find_multi() large keys");
+	for (i = 0; i < key_count; i++) {
+		char *key = t_malloc0(key_len + 1);
+
+		for (j = 0; j < key_len; j++)
+			key[j] = 1 + (i * 50 + j) % UCHAR_MAX;
+		keys[i] = key;
+	}
+	keys[i] = NULL;
+	ctx = str_find_multi_init(pool_datastack_create(), keys);
+
+	text = t_str_new(1024);
+	str_append(text, "x");
+	str_append(text, keys[1]);
+	str_append(text, keys[3]);
+	/* a key split between blocks is found */
+	test_assert(!str_find_multi_more(ctx, str_data(text), 100));
+	test_assert(!str_find_multi_more(ctx, str_data(text) + 100,
+					 str_len(text) - 100));
+	test_assert(str_find_multi_get_found_count(ctx) == 2);
+	for (i = 0; i < key_count; i++)
+		test_assert_idx(str_find_multi_key_found(ctx, i) ==
+				(i == 1 || i == 3), i);
+
+	/* resetting input doesn't continue matching earlier data */
+	str_find_multi_reset_found(ctx);
+	test_assert(!str_find_multi_more(ctx, str_data(text), 100));
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, str_data(text) + 100,
+					 str_len(text) - 100));
+	test_assert(str_find_multi_get_found_count(ctx) == 1);
+	test_assert(str_find_multi_key_found(ctx, 3));
+
+	str_truncate(text, 0);
+	for (i = 0; i < key_count; i++)
+		str_append(text, keys[i]);
+	str_find_multi_reset_found(ctx);
+	test_assert(str_find_multi_more(ctx, str_data(text), str_len(text)));
+	str_find_multi_deinit(&ctx);
+	test_end();
+}
+
+void test_str_find_multi(void)
+{
+	test_str_find_multi_keys();
+	test_str_find_multi_blocks();
+	test_str_find_multi_random();
+	test_str_find_multi_large();
+}
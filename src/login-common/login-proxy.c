@@ -1364,8 +1364,8 @@ struct client *login_proxies_get_first_detached_client(void)
 void login_proxy_init(const char *proxy_notify_pipe_path)
 {
 	proxy_state = login_proxy_state_init(proxy_notify_pipe_path);
-	hash_table_create(&login_proxies_hash, default_pool, 0,
-			  str_hash, strcmp);
+	hash_table_create_open(&login_proxies_hash, default_pool, 0,
+			       str_hash, strcmp);
 }
 
 void login_proxy_deinit(void)
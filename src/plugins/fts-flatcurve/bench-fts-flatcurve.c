@@ -0,0 +1,278 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "module-dir.h"
+#include "istream.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-storage-private.h"
+#include "mail-search-build.h"
+#include "lang-settings.h"
+#include "fts-settings.h"
+#include "fts-plugin.h"
+#include "fts-flatcurve-plugin.h"
+#include "test-mail-storage-common.h"
+
+#include <stdio.h>
+
+/**
+ * Fills an mdbox INBOX with synthetic mails (1M by default) and indexes it
+ * with fts-flatcurve the same way as "doveadm index" does, by precaching
+ * each mail. The time taken by both steps is printed. The mails are the
+ * same for each run. Additional settings, for example
+ * fts_flatcurve_commit_limit=1000, can be given as parameters.
+ */
+
+#define DEFAULT_MAIL_COUNT 1000000
+#define SAVE_TRANSACTION_MAX_MAILS 10000
+#define SUBJECT_WORD_COUNT 6
+#define BODY_WORD_COUNT 120
+
+static const char *const bench_syllables[] = {
+	"ba", "ce", "di", "fo", "gu", "ha", "je", "ki", "lo", "mu", "na",
+	"pe", "qui", "ro", "sa", "te", "vi", "wo", "xu", "ya", "zo", "bri",
+	"cla", "dre", "fli", "gro", "ple", "stu", "tra", "vo", "shi", "ther"
+};
+
+static char bench_fts_module_path[] = "lib20_fts_plugin.so";
+static char bench_fts_module_name[] = "fts_plugin";
+static char bench_flatcurve_module_path[] = "lib21_fts_flatcurve_plugin.so";
+static char bench_flatcurve_module_name[] = "fts_flatcurve_plugin";
+
+static struct module bench_fts_module = {
+	.path = bench_fts_module_path,
+	.name = bench_fts_module_name,
+};
+static struct module bench_flatcurve_module = {
+	.path = bench_flatcurve_module_path,
+	.name = bench_flatcurve_module_name,
+};
+
+static uint32_t bench_rand_state = 1;
+
+static uint32_t bench_rand(void)
+{
+	/* xorshift32 - predictable, so each run indexes the same mails */
+	uint32_t x = bench_rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return bench_rand_state = x;
+}
+
+static void bench_append_words(string_t *str, unsigned int count)
+{
+	unsigned int i, j, syllables;
+
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append_c(str, i % 12 == 0 ? '\n' : ' ');
+		/* 2..4 syllables give about a million different words */
+		syllables = 2 + bench_rand() % 3;
+		for (j = 0; j < syllables; j++) {
+			str_append(str, bench_syllables[bench_rand() %
+					N_ELEMENTS(bench_syllables)]);
+		}
+	}
+}
+
+static void bench_build_mail(string_t *str, unsigned int idx)
+{
+	str_truncate(str, 0);
+	str_printfa(str, "From: user%u@example.com\n"
+		    "To: bench@example.com\n"
+		    "Subject: ", bench_rand() % 1000);
+	bench_append_words(str, SUBJECT_WORD_COUNT);
+	str_printfa(str, "\nMessage-ID: <%u@bench.example.com>\n"
+		    "Date: Thu, 01 Jan 2026 00:00:00 +0000\n\n", idx);
+	bench_append_words(str, BODY_WORD_COUNT);
+	str_append_c(str, '\n');
+}
+
+static int
+bench_save_mail(struct mailbox_transaction_context *trans,
+		const string_t *mail)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	ssize_t ret;
+
+	input = i_stream_create_from_data(str_data(mail), str_len(mail));
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0) {
+		i_stream_unref(&input);
+		return -1;
+	}
+	do {
+		if (mailbox_save_continue(save_ctx) < 0) {
+			mailbox_save_cancel(&save_ctx);
+			i_stream_unref(&input);
+			return -1;
+		}
+	} while ((ret = i_stream_read(input)) > 0);
+	i_assert(ret == -1);
+	i_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	return mailbox_save_finish(&save_ctx);
+}
+
+static void bench_fill_mailbox(struct mailbox *box, unsigned int count)
+{
+	struct mailbox_transaction_context *trans = NULL;
+	string_t *mail = str_new(default_pool, 2048);
+	unsigned int i;
+
+	for (i = 1; i <= count; i++) T_BEGIN {
+		if (trans == NULL) {
+			trans = mailbox_transaction_begin(box,
+				MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+		}
+		bench_build_mail(mail, i);
+		if (bench_save_mail(trans, mail) < 0) {
+			i_fatal("Saving mail failed: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		if ((i % SAVE_TRANSACTION_MAX_MAILS == 0 || i == count) &&
+		    mailbox_transaction_commit(&trans) < 0) {
+			i_fatal("Committing saved mails failed: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		}
+	} T_END;
+	str_free(&mail);
+}
+
+static void bench_index_mailbox(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *search_args;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC, __func__);
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+	ctx = mailbox_search_init(trans, search_args, NULL, 0, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(ctx, &mail)) {
+		if (mail_precache(mail) < 0) {
+			i_fatal("Indexing UID=%u failed: %s", mail->uid,
+				mail_get_last_internal_error(mail, NULL));
+		}
+	}
+	if (mailbox_search_deinit(&ctx) < 0) {
+		i_fatal("Mail search failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Committing the index failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+bench_print_result(const char *name, unsigned int count, uint64_t nsecs)
+{
+	printf("%-6s %8.2f secs %10.1f mails/s\n", name,
+	       (double)nsecs / 1000000000.0,
+	       nsecs == 0 ? 0 : (double)count * 1000000000.0 / (double)nsecs);
+}
+
+static void
+bench_fts_flatcurve(unsigned int count, const char *const *extra_settings)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	ARRAY_TYPE(const_string) input;
+	uint64_t ts_0, ts_1, ts_2;
+
+	const char *const bench_settings[] = {
+		"mail_plugins=fts fts_flatcurve",
+		"language+=en",
+		"language/en/language_default=yes",
+		"fts+=flatcurve",
+	};
+
+	t_array_init(&input, N_ELEMENTS(bench_settings) +
+		     str_array_length(extra_settings) + 1);
+	array_append(&input, bench_settings, N_ELEMENTS(bench_settings));
+	array_append(&input, extra_settings, str_array_length(extra_settings));
+	array_append_zero(&input);
+
+	struct test_mail_storage_settings set = {
+		.driver = "mdbox",
+		.extra_input = array_front(&input),
+	};
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0) {
+		i_fatal("Opening INBOX failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+
+	printf("Indexing %u mails\n\n", count);
+
+	ts_0 = i_nanoseconds();
+	bench_fill_mailbox(box, count);
+	ts_1 = i_nanoseconds();
+	bench_index_mailbox(box);
+	ts_2 = i_nanoseconds();
+
+	bench_print_result("save", count, ts_1 - ts_0);
+	bench_print_result("index", count, ts_2 - ts_1);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n mails] [<setting>=<value> ...]\n", prog);
+	lib_exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = DEFAULT_MAIL_COUNT;
+	int c;
+
+	master_service = master_service_init("bench-fts-flatcurve",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "n:");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'n':
+			if (str_to_uint(optarg, &count) < 0 || count == 0)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	settings_info_register(&langs_setting_parser_info);
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&fts_flatcurve_setting_parser_info);
+	fts_plugin_init(&bench_fts_module);
+	fts_flatcurve_plugin_init(&bench_flatcurve_module);
+
+	bench_fts_flatcurve(count, (const char *const *)argv + optind);
+
+	fts_flatcurve_plugin_deinit();
+	fts_plugin_deinit();
+	master_service_deinit(&master_service);
+	return 0;
+}
@@ -108,6 +108,9 @@ extern "C" {
  * manipulating current directory. */
 #define FLATCURVE_XAPIAN_LOCK_FNAME "flatcurve-lock"
 #define FLATCURVE_XAPIAN_LOCK_TIMEOUT_SECS 5
+/* Optimize lock: only one process at a time may optimize a mailbox. The
+ * name must begin with FLATCURVE_XAPIAN_LOCK_FNAME. */
+#define FLATCURVE_XAPIAN_OPTIMIZE_LOCK_FNAME FLATCURVE_XAPIAN_LOCK_FNAME "-optimize"
 
 #define ENUM_EMPTY(x) ((enum x) 0)
 
@@ -131,8 +134,11 @@ struct flatcurve_xapian_db {
 	struct flatcurve_xapian_db_path *dbpath;
 	unsigned int changes;
 	enum flatcurve_xapian_db_type type;
+	/* Revision of the shard when its optimize snapshot was taken. */
+	Xapian::rev optimize_revision;
 };
 HASH_TABLE_DEFINE_TYPE(xapian_db, char *, struct flatcurve_xapian_db *);
+ARRAY_DEFINE_TYPE(flatcurve_xapian_db_p, struct flatcurve_xapian_db *);
 
 struct flatcurve_xapian {
 	/* Current database objects. */
@@ -203,10 +209,19 @@ enum flatcurve_xapian_db_close {
 	FLATCURVE_XAPIAN_DB_CLOSE_MBOX       = BIT(4)
 };
 
+/* Externally accessible struct. */
+struct fts_flatcurve_xapian_multi_db {
+	/* Shards of all the mailboxes, queried as one DB. */
+	Xapian::Database *db;
+	/* Mailbox index of each shard, in the order they were added. */
+	ARRAY_TYPE(uint) shard_boxes;
+};
+
 /* Externally accessible struct. */
 struct fts_flatcurve_xapian_query_iter {
 	struct flatcurve_fts_backend *backend;
 	struct flatcurve_fts_query *query;
+	struct fts_flatcurve_xapian_multi_db *multi_db;
 	struct fts_flatcurve_xapian_query_result *result;
 	char *error;
 	Xapian::Database *db;
@@ -589,38 +604,61 @@ fts_flatcurve_xapian_db_add(struct flatcurve_fts_backend *backend,
 	return failed ? -1 : 0;
 }
 
+static bool
+fts_flatcurve_xapian_have_volatile_dir(struct flatcurve_fts_backend *backend)
+{
+	return backend->volatile_dir != NULL &&
+		str_len(backend->volatile_dir) > 0;
+}
+
+static const char *
+fts_flatcurve_xapian_lock_path(struct flatcurve_fts_backend *backend,
+			       const char *fname)
+{
+	if (!fts_flatcurve_xapian_have_volatile_dir(backend))
+		return t_strconcat(str_c(backend->db_path), fname, NULL);
+
+	unsigned char db_path_hash[MD5_RESULTLEN];
+	md5_get_digest(str_c(backend->db_path), str_len(backend->db_path),
+		       db_path_hash);
+	return t_strdup_printf("%s/%s.%s", str_c(backend->volatile_dir), fname,
+			       binary_to_hex(db_path_hash, sizeof(db_path_hash)));
+}
+
 /* Returns: lock fd >=0 on success, -1 on error */
-static int fts_flatcurve_xapian_lock(struct flatcurve_fts_backend *backend,
-				     const char **error_r)
+static int
+fts_flatcurve_xapian_lock_file(struct flatcurve_fts_backend *backend,
+			       const char *path, unsigned int timeout_secs,
+			       struct file_lock **lock_r, const char **error_r)
 {
 	struct file_create_settings set;
-	struct flatcurve_xapian *x = backend->xapian;
 
 	i_zero(&set);
-	set.lock_timeout_secs = FLATCURVE_XAPIAN_LOCK_TIMEOUT_SECS;
+	set.lock_timeout_secs = timeout_secs;
 	set.lock_settings.close_on_free = TRUE;
 	set.lock_settings.unlink_on_free = TRUE;
 	set.lock_settings.lock_method = backend->parsed_lock_method;
+	if (fts_flatcurve_xapian_have_volatile_dir(backend))
+		set.mkdir_mode = 0700;
+
+	bool created;
+	return file_create_locked(path, &set, lock_r, &created, error_r);
+}
+
+/* Returns: lock fd >=0 on success, -1 on error */
+static int fts_flatcurve_xapian_lock(struct flatcurve_fts_backend *backend,
+				     const char **error_r)
+{
+	struct flatcurve_xapian *x = backend->xapian;
 
 	if (x->lock_path == NULL) {
-		if (backend->volatile_dir != NULL && str_len(backend->volatile_dir) > 0) {
-			unsigned char db_path_hash[MD5_RESULTLEN];
-			md5_get_digest(str_c(backend->db_path), str_len(backend->db_path),
-				db_path_hash);
-			x->lock_path = p_strdup_printf(
-				x->pool, "%s/" FLATCURVE_XAPIAN_LOCK_FNAME ".%s",
-				str_c(backend->volatile_dir),
-				binary_to_hex(db_path_hash, sizeof(db_path_hash)));
-			set.mkdir_mode = 0700;
-		} else {
-			x->lock_path = p_strdup_printf(
-				x->pool, "%s" FLATCURVE_XAPIAN_LOCK_FNAME,
-				str_c(backend->db_path));
-		}
+		x->lock_path = p_strdup(x->pool,
+			fts_flatcurve_xapian_lock_path(
+				backend, FLATCURVE_XAPIAN_LOCK_FNAME));
 	}
-
-	bool created;
-	return file_create_locked(x->lock_path, &set, &x->lock, &created, error_r);
+	return fts_flatcurve_xapian_lock_file(
+		backend, x->lock_path, FLATCURVE_XAPIAN_LOCK_TIMEOUT_SECS,
+		&x->lock, error_r);
 }
 
 static void fts_flatcurve_xapian_unlock(struct flatcurve_fts_backend *backend)
@@ -1652,20 +1690,26 @@ fts_flatcurve_xapian_init_msg(struct flatcurve_fts_backend_update_context *ctx,
 		/* error or x->dbw_current == NULL */
 		return ret;
 	try {
-		(void)xdb->dbw->get_document(ctx->uid);
-		/* document already existed */
-		return 0;
+		/* Mails are indexed in ascending UID order, so a new mail's
+		 * UID is normally above the last document in the shard. Skip
+		 * the document lookup (and the exception it throws) then. */
+		if (ctx->uid <= xdb->dbw->get_lastdocid()) {
+			(void)xdb->dbw->get_document(ctx->uid);
+			/* document already existed */
+			return 0;
+		}
 	} catch (Xapian::DocNotFoundError &e) {
-		x->doc = new Xapian::Document();
-		x->doc_created = TRUE;
-		x->doc_uid = ctx->uid;
-		/* document did not exist */
-		return 1;
 	} catch (Xapian::Error &e) {
 		ctx->ctx.failed = TRUE;
 		*error_r = t_strdup(e.get_description().c_str());
 		return -1;
 	}
+
+	x->doc = new Xapian::Document();
+	x->doc_created = TRUE;
+	x->doc_uid = ctx->uid;
+	/* document did not exist */
+	return 1;
 }
 
 int
@@ -1833,30 +1877,95 @@ fts_flatcurve_xapian_optimize_rebuild(struct flatcurve_fts_backend *backend,
 			backend, xdb, FLATCURVE_XAPIAN_DB_CLOSE_WDB, error_r);
 }
 
-/* Returns: 0 on success, -1 on error */
+/* Returns: 0 if the shards were replaced by the optimized shard, 1 if they
+ * were modified after the optimize snapshot was taken, -1 on error */
 static int
-fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
-				     Xapian::Database *db, const char **error_r)
+fts_flatcurve_xapian_optimize_replace(struct flatcurve_fts_backend *backend,
+				      const ARRAY_TYPE(flatcurve_xapian_db_p) *shards,
+				      struct flatcurve_xapian_db_path *dbpath,
+				      const char **error_r)
 {
-	static const enum flatcurve_xapian_db_opts opts =
-		ENUM_EMPTY(flatcurve_xapian_db_opts);
 	static const enum flatcurve_xapian_wdb wopts =
 		ENUM_EMPTY(flatcurve_xapian_wdb);
 
+	struct flatcurve_xapian_db *xdb;
+	array_foreach_elem(shards, xdb) {
+		struct stat st;
+		if (stat(xdb->dbpath->path, &st) < 0) {
+			if (errno == ENOENT)
+				return 1;
+			*error_r = t_strdup_printf("stat(%s) failed: %m",
+						   xdb->dbpath->path);
+			return -1;
+		}
+		/* Opening the write DB waits for pending expunges to finish
+		 * and keeps new ones from starting. */
+		if (fts_flatcurve_xapian_write_db_get(
+			backend, xdb, wopts, error_r) < 0)
+			return -1;
+		if (xdb->dbw->get_revision() != xdb->optimize_revision)
+			return 1;
+	}
+
+	/* Delete old indexes. */
+	array_foreach_elem(shards, xdb) {
+		if (fts_flatcurve_xapian_delete(
+			backend, xdb->dbpath, error_r) < 0)
+			return -1;
+	}
+
+	/* Rename optimize index to an active index. */
+	if (fts_flatcurve_xapian_rename_db(backend, dbpath, NULL, error_r) < 0 ||
+	    fts_flatcurve_xapian_delete(backend, dbpath, error_r) < 0)
+		return -1;
+	return 0;
+}
+
+/* Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
+				     const char **error_r)
+{
 	struct flatcurve_xapian *x = backend->xapian;
 
-	/* We need to lock all of the mailboxes so nothing changes while we
-	 * are optimizing. */
+	/* Compact a snapshot of the index shards without holding any locks,
+	 * so that other processes can keep indexing new mails into the
+	 * current shard meanwhile. The current shard isn't optimized. Index
+	 * shards are modified only by expunges, so they are normally still
+	 * unchanged when the compacted shard replaces them. If not, the
+	 * optimization is left for later. */
+	ARRAY_TYPE(flatcurve_xapian_db_p) shards;
+	Xapian::Database db;
+	bool failed = FALSE;
 
+	t_array_init(&shards, hash_table_count(x->dbs));
 	void *key, *val;
 	struct hash_iterate_context *hiter = hash_table_iterate_init(x->dbs);
 	while (hash_table_iterate(hiter, x->dbs, &key, &val)) {
-		struct flatcurve_xapian_db *db = (struct flatcurve_xapian_db *)val;
-		if (fts_flatcurve_xapian_write_db_get(
-			backend, db, wopts, error_r) < 0)
-			return -1;
+		struct flatcurve_xapian_db *xdb = (struct flatcurve_xapian_db *)val;
+		if (xdb->type != FLATCURVE_XAPIAN_DB_TYPE_INDEX ||
+		    xdb->db == NULL)
+			continue;
+		try {
+			(void)xdb->db->reopen();
+			xdb->optimize_revision = xdb->db->get_revision();
+		} catch (Xapian::Error &e) {
+			*error_r = t_strdup_printf("Cannot open DB (RO; %s); %s",
+				xdb->dbpath->fname, e.get_description().c_str());
+			failed = TRUE;
+			break;
+		}
+		db.add_database(*xdb->db);
+		array_push_back(&shards, &xdb);
 	}
 	hash_table_iterate_deinit(&hiter);
+	if (failed)
+		return -1;
+
+	if (array_is_empty(&shards)) {
+		e_debug(backend->event, "No index shards to optimize");
+		return 0;
+	}
 
 	/* Create the optimize target. */
 	struct flatcurve_xapian_db_path *dbpath =
@@ -1868,12 +1977,15 @@ fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
 	struct timeval start;
 	i_gettimeofday(&start);
 
-	bool failed = FALSE;
+	bool changed = FALSE;
 	try {
-		(void)db->reopen();
-		db->compact(dbpath->path, Xapian::DBCOMPACT_NO_RENUMBER |
-					  Xapian::DBCOMPACT_MULTIPASS |
-					  Xapian::Compactor::FULLER);
+		db.compact(dbpath->path, Xapian::DBCOMPACT_NO_RENUMBER |
+					 Xapian::DBCOMPACT_MULTIPASS |
+					 Xapian::Compactor::FULLER);
+	} catch (Xapian::DatabaseModifiedError &e) {
+		/* A shard was modified so many times while it was being
+		 * read that the snapshot is no longer available. */
+		changed = TRUE;
 	} catch (Xapian::InvalidOperationError &e) {
 		/* This exception is not as specific as it could be...
 		 * but the likely reason it happens is due to
@@ -1889,7 +2001,7 @@ fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
 		 *      documents.
 		 * Let's try to be awesome and do the latter. */
 		failed = fts_flatcurve_xapian_optimize_rebuild(
-				backend, db, dbpath, error_r) < 0;
+				backend, &db, dbpath, error_r) < 0;
 		if (!failed)
 			e_debug(backend->event, "Native optimize failed, "
 				"falling back to manual optimization; %s",
@@ -1903,42 +2015,29 @@ fts_flatcurve_xapian_optimize_box_do(struct flatcurve_fts_backend *backend,
 		return 0;
 	}
 
-	/* Delete old indexes. */
-	struct flatcurve_xapian_db_iter *iter =
-		fts_flatcurve_xapian_db_iter_init(backend, opts);
-
-	int ret = 0;
-	while (fts_flatcurve_xapian_db_iter_next(iter)) {
-		if (iter->type == FLATCURVE_XAPIAN_DB_TYPE_INDEX ||
-		    iter->type == FLATCURVE_XAPIAN_DB_TYPE_CURRENT) {
-			if (fts_flatcurve_xapian_delete(
-				backend, iter->path, error_r) < 0) {
-				ret = -1;
-				break;
-			}
-		}
-	}
-	const char *error;
-	if (fts_flatcurve_xapian_db_iter_deinit(&iter, &error) < 0) {
+	if (!changed) {
+		/* Only the swap is done while locked. */
+		if (fts_flatcurve_xapian_lock(backend, error_r) < 0)
+			return -1;
+		int ret = fts_flatcurve_xapian_optimize_replace(
+				backend, &shards, dbpath, error_r);
+		fts_flatcurve_xapian_unlock(backend);
 		if (ret < 0)
-			e_error(backend->event, "%s", error);
-		else
-			*error_r = error;
-		ret = -1;
+			return -1;
+		changed = ret > 0;
+	}
+	if (changed) {
+		e_debug(backend->event, "Index shards were modified while "
+			"optimizing, leaving optimization for later");
+		return fts_flatcurve_xapian_delete(backend, dbpath, error_r) < 0 ?
+			-1 : 0;
 	}
-	if (ret < 0)
-		return -1;
-
-	/* Rename optimize index to an active index. */
-	if (fts_flatcurve_xapian_rename_db(backend, dbpath, NULL, error_r) < 0 ||
-	    fts_flatcurve_xapian_delete(backend, dbpath, error_r) < 0)
-		return -1;
 
 	struct timeval now;
 	i_gettimeofday(&now);
 	long long elapsed = timeval_diff_msecs(&now, &start);
-	e_debug(backend->event, "Optimized DB in %lld.%03lld secs",
-				elapsed / 1000, elapsed % 1000);
+	e_debug(backend->event, "Optimized %u DB shards in %lld.%03lld secs",
+		array_count(&shards), elapsed / 1000, elapsed % 1000);
 
 	return 0;
 }
@@ -1952,10 +2051,9 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
 			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
 
-	Xapian::Database *db;
 	int ret;
 	if ((ret = fts_flatcurve_xapian_read_db(
-		backend, opts, &db, error_r)) <= 0)
+		backend, opts, NULL, error_r)) <= 0)
 		return ret;
 
 	if (backend->xapian->deinit &&
@@ -1963,15 +2061,28 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 		return fts_flatcurve_xapian_close(backend, error_r);
 	}
 
-	e_debug(event_create_passthrough(backend->event)->
-		set_name("fts_flatcurve_optimize")->
-		add_str("mailbox", str_c(backend->boxname))->event(),
-		"Optimizing");
+	/* Don't wait if another process is already optimizing the mailbox;
+	 * it's taking care of the same shards. */
+	struct file_lock *lock = NULL;
+	const char *lock_path = fts_flatcurve_xapian_lock_path(
+		backend, FLATCURVE_XAPIAN_OPTIMIZE_LOCK_FNAME);
+	if (fts_flatcurve_xapian_lock_file(backend, lock_path, 0,
+					   &lock, error_r) < 0) {
+		if (errno != EAGAIN)
+			ret = -1;
+		else {
+			e_debug(backend->event, "Mailbox is already being "
+				"optimized by another process");
+			ret = 0;
+		}
+	} else {
+		e_debug(event_create_passthrough(backend->event)->
+			set_name("fts_flatcurve_optimize")->
+			add_str("mailbox", str_c(backend->boxname))->event(),
+			"Optimizing");
 
-	ret = 0;
-	if (fts_flatcurve_xapian_lock(backend, error_r) < 0 ||
-	    fts_flatcurve_xapian_optimize_box_do(backend, db, error_r) < 0)
-		ret = -1;
+		ret = fts_flatcurve_xapian_optimize_box_do(backend, error_r);
+	}
 
 	const char *error;
 	if (fts_flatcurve_xapian_close(backend, &error) < 0) {
@@ -1981,7 +2092,7 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 			*error_r = error;
 		ret = -1;
 	}
-	fts_flatcurve_xapian_unlock(backend);
+	file_lock_free(&lock);
 	return ret;
 }
 
@@ -2184,6 +2295,37 @@ fts_flatcurve_xapian_query_iter_init(struct flatcurve_fts_query *query)
 	return iter;
 }
 
+/* Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_query_iter_get_mset(struct fts_flatcurve_xapian_query_iter *iter)
+{
+	bool retried = FALSE;
+
+	for (;;) {
+		try {
+			iter->m = iter->enquire->get_mset(
+				0, iter->db->get_doccount());
+			return 0;
+		} catch (Xapian::DatabaseModifiedError &e) {
+			/* Xapian can read a single earlier revision of a
+			 * modified DB, so this is thrown if more than one
+			 * change has been made after the DB was opened. This
+			 * happens easily with a multi-mailbox DB, which keeps
+			 * the shards of all the mailboxes open while other
+			 * processes are indexing them. Reopen the shards to
+			 * their latest revision and try once more. */
+			if (retried) {
+				iter->error = i_strdup_printf(
+					"Cannot query DB (RO); %s",
+					e.get_description().c_str());
+				return -1;
+			}
+			(void)iter->db->reopen();
+			retried = TRUE;
+		}
+	}
+}
+
 bool
 fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *iter,
 				     struct fts_flatcurve_xapian_query_result **result_r)
@@ -2223,6 +2365,8 @@ fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *ite
 		if (q == NULL)
 			return FALSE;
 
+		if (iter->db == NULL && iter->multi_db != NULL)
+			iter->db = iter->multi_db->db;
 		if (iter->db == NULL) {
 			const char *error;
 			int ret = fts_flatcurve_xapian_read_db(
@@ -2239,21 +2383,8 @@ fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *ite
 		}
 		iter->enquire->set_query(*q);
 
-		try {
-			iter->m = iter->enquire->get_mset(0, iter->db->get_doccount());
-		} catch (Xapian::DatabaseModifiedError &e) {
-			/* Per documentation, this is only thrown if more than
-			 * one change has been made to the database. To
-			 * resolve you need to reopen the DB (Xapian can
-			 * handle a single snapshot of a modified DB natively,
-			 * so this only occurs if there have been multiple
-			 * writes). However, we ALWAYS want to use the
-			 * most up-to-date version, so we have already
-			 * explicitly called reopen() above. Thus, we should
-			 * never see this exception. */
-			i_unreached();
-		}
-
+		if (fts_flatcurve_xapian_query_iter_get_mset(iter) < 0)
+			return FALSE;
 		iter->mset_iter = iter->m.begin();
 	}
 
@@ -2270,7 +2401,24 @@ fts_flatcurve_xapian_query_iter_next(struct fts_flatcurve_xapian_query_iter *ite
 	 * Xapian::Database when handling multiple DBs at once. Instead, we
 	 * want the "unique docid", which is obtained by looking at the
 	 * doc id from the Document object itself. */
-	iter->result->uid = iter->mset_iter.get_document().get_docid();
+	try {
+		iter->result->uid = iter->mset_iter.get_document().get_docid();
+	} catch (Xapian::DatabaseModifiedError &e) {
+		/* The shards were modified again while the results were
+		 * being read. Retrying would return the earlier results
+		 * twice, so fail the lookup instead. */
+		iter->error = i_strdup_printf("Cannot query DB (RO); %s",
+					      e.get_description().c_str());
+		return FALSE;
+	}
+	if (iter->multi_db != NULL) {
+		/* The interleaved docid tells which shard the document is
+		 * from. */
+		unsigned int shard = (*iter->mset_iter - 1) %
+			array_count(&iter->multi_db->shard_boxes);
+		iter->result->box_idx =
+			array_idx_elem(&iter->multi_db->shard_boxes, shard);
+	}
 	++iter->mset_iter;
 
 	*result_r = iter->result;
@@ -2299,6 +2447,27 @@ fts_flatcurve_xapian_query_iter_deinit(struct fts_flatcurve_xapian_query_iter **
 	return ret;
 }
 
+static void
+fts_flatcurve_xapian_add_result(struct flatcurve_fts_query *query,
+				struct flatcurve_fts_result *r,
+				const struct fts_flatcurve_xapian_query_result *result)
+{
+	struct fts_score_map *score;
+
+	bool add_score = TRUE;
+	if (result->maybe || query->xapian->maybe) {
+		add_score = !seq_range_exists(&r->uids, result->uid) &&
+			    !seq_range_exists(&r->maybe_uids, result->uid);
+		seq_range_array_add(&r->maybe_uids, result->uid);
+	} else
+		seq_range_array_add(&r->uids, result->uid);
+	if (add_score) {
+		score = array_append_space(&r->scores);
+		score->score = (float)result->score;
+		score->uid = result->uid;
+	}
+}
+
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 				   struct flatcurve_fts_result *r,
@@ -2306,22 +2475,98 @@ int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 {
 	struct fts_flatcurve_xapian_query_iter *iter;
 	struct fts_flatcurve_xapian_query_result *result;
-	struct fts_score_map *score;
 
 	iter = fts_flatcurve_xapian_query_iter_init(query);
+	while (fts_flatcurve_xapian_query_iter_next(iter, &result))
+		fts_flatcurve_xapian_add_result(query, r, result);
+	return fts_flatcurve_xapian_query_iter_deinit(&iter, error_r);
+}
+
+struct fts_flatcurve_xapian_multi_db *fts_flatcurve_xapian_multi_db_init(void)
+{
+	struct fts_flatcurve_xapian_multi_db *mdb;
+
+	mdb = i_new(struct fts_flatcurve_xapian_multi_db, 1);
+	mdb->db = new Xapian::Database();
+	i_array_init(&mdb->shard_boxes, 16);
+	return mdb;
+}
+
+void fts_flatcurve_xapian_multi_db_reset(struct fts_flatcurve_xapian_multi_db *mdb)
+{
+	delete(mdb->db);
+	mdb->db = new Xapian::Database();
+	array_clear(&mdb->shard_boxes);
+}
+
+void fts_flatcurve_xapian_multi_db_deinit(struct fts_flatcurve_xapian_multi_db **_mdb)
+{
+	struct fts_flatcurve_xapian_multi_db *mdb = *_mdb;
+
+	*_mdb = NULL;
+	delete(mdb->db);
+	array_free(&mdb->shard_boxes);
+	i_free(mdb);
+}
+
+unsigned int
+fts_flatcurve_xapian_multi_db_shard_count(struct fts_flatcurve_xapian_multi_db *mdb)
+{
+	return array_count(&mdb->shard_boxes);
+}
+
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_multi_db_add(struct flatcurve_fts_backend *backend,
+				      struct fts_flatcurve_xapian_multi_db *mdb,
+				      unsigned int box_idx,
+				      const char **error_r)
+{
+	static const enum flatcurve_xapian_db_opts opts =
+		(enum flatcurve_xapian_db_opts)
+			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
+			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
+	Xapian::Database *db;
+	unsigned int i;
+
+	/* Open the mailbox's DB the same way as for a single mailbox query,
+	 * so the shards are listed while locked and their versions are
+	 * checked. Shards that can't be opened are logged and skipped. */
+	int ret = fts_flatcurve_xapian_read_db(backend, opts, &db, error_r);
+	if (ret <= 0)
+		return ret;
+
+	/* The combined DB keeps references to the shards, so they stay
+	 * open after the mailbox is closed. */
+	try {
+		mdb->db->add_database(*db);
+	} catch (Xapian::Error &e) {
+		*error_r = t_strdup_printf("Cannot add DB (RO; %s); %s",
+			str_c(backend->db_path), e.get_description().c_str());
+		return -1;
+	}
+	for (i = 0; i < backend->xapian->shards; i++)
+		array_push_back(&mdb->shard_boxes, &box_idx);
+	return 0;
+}
+
+/* Returns: 0 on success, -1 on error */
+int
+fts_flatcurve_xapian_run_query_multi(struct flatcurve_fts_query *query,
+				     struct fts_flatcurve_xapian_multi_db *mdb,
+				     struct flatcurve_fts_result *const results[],
+				     const char **error_r)
+{
+	struct fts_flatcurve_xapian_query_iter *iter;
+	struct fts_flatcurve_xapian_query_result *result;
+
+	if (array_is_empty(&mdb->shard_boxes))
+		return 0;
+
+	iter = fts_flatcurve_xapian_query_iter_init(query);
+	iter->multi_db = mdb;
 	while (fts_flatcurve_xapian_query_iter_next(iter, &result)) {
-		bool add_score = TRUE;
-		if (result->maybe || query->xapian->maybe) {
-			add_score = !seq_range_exists(&r->uids, result->uid) &&
-				    !seq_range_exists(&r->maybe_uids, result->uid);
-			seq_range_array_add(&r->maybe_uids, result->uid);
-		} else
-			seq_range_array_add(&r->uids, result->uid);
-		if (add_score) {
-			score = array_append_space(&r->scores);
-			score->score = (float)result->score;
-			score->uid = result->uid;
-		}
+		fts_flatcurve_xapian_add_result(query,
+			results[result->box_idx], result);
 	}
 	return fts_flatcurve_xapian_query_iter_deinit(&iter, error_r);
 }
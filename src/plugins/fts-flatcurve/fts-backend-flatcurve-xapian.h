@@ -7,6 +7,8 @@
 struct fts_flatcurve_xapian_query_result {
 	double score;
 	uint32_t uid;
+	/* Index of the mailbox with multi-DB queries */
+	unsigned int box_idx;
 
 	bool maybe:1;
 };
@@ -25,6 +27,7 @@ struct fts_flatcurve_xapian_db_stats {
 HASH_TABLE_DEFINE_TYPE(term_counter, char *, void *);
 
 struct fts_flatcurve_xapian_query_iter;
+struct fts_flatcurve_xapian_multi_db;
 
 void fts_flatcurve_xapian_init(struct flatcurve_fts_backend *backend);
 int fts_flatcurve_xapian_refresh(struct flatcurve_fts_backend *backend,
@@ -60,6 +63,28 @@ int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 				   struct flatcurve_fts_result *r,
 				   const char **error_r);
 void fts_flatcurve_xapian_destroy_query(struct flatcurve_fts_query *query);
+
+/* Multi-DB: the shards of several mailboxes are combined into a single
+   read-only Xapian DB, so that they can be searched with one query instead
+   of one query per mailbox. */
+struct fts_flatcurve_xapian_multi_db *fts_flatcurve_xapian_multi_db_init(void);
+/* Remove all the added shards. */
+void fts_flatcurve_xapian_multi_db_reset(struct fts_flatcurve_xapian_multi_db *mdb);
+void fts_flatcurve_xapian_multi_db_deinit(struct fts_flatcurve_xapian_multi_db **mdb);
+unsigned int
+fts_flatcurve_xapian_multi_db_shard_count(struct fts_flatcurve_xapian_multi_db *mdb);
+/* Add the shards of the backend's current mailbox. Their results are
+   returned for the mailbox box_idx. */
+int fts_flatcurve_xapian_multi_db_add(struct flatcurve_fts_backend *backend,
+				      struct fts_flatcurve_xapian_multi_db *mdb,
+				      unsigned int box_idx,
+				      const char **error_r);
+/* Run the query over the multi-DB, adding the matches to results[box_idx]. */
+int
+fts_flatcurve_xapian_run_query_multi(struct flatcurve_fts_query *query,
+				     struct fts_flatcurve_xapian_multi_db *mdb,
+				     struct flatcurve_fts_result *const results[],
+				     const char **error_r);
 int fts_flatcurve_xapian_delete_index(struct flatcurve_fts_backend *backend,
 				      const char **error_r);
 
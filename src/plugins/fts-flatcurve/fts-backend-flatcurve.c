@@ -569,6 +569,48 @@ static int fts_backend_flatcurve_rescan(struct fts_backend *backend)
 			FTS_BACKEND_FLATCURVE_ACTION_RESCAN);
 }
 
+static int
+fts_backend_flatcurve_lookup_multi_db(struct flatcurve_fts_backend *backend,
+				      struct flatcurve_fts_query *query,
+				      struct mailbox *const boxes[],
+				      struct flatcurve_fts_result *const fresults[],
+				      const char **error_r)
+{
+	struct fts_flatcurve_xapian_multi_db *mdb;
+	unsigned int i;
+	int ret = 0;
+
+	/* Search the shards of all the mailboxes with a single query, instead
+	   of querying each mailbox's DB separately. Each mailbox's DB is
+	   opened the same way as for a single mailbox lookup. The currently
+	   open mailbox is closed first, so its pending changes are committed
+	   and visible to the query. */
+	if (fts_backend_flatcurve_close_mailbox(backend, error_r) < 0)
+		return -1;
+
+	mdb = fts_flatcurve_xapian_multi_db_init();
+	for (i = 0; boxes[i] != NULL && ret == 0; i++) T_BEGIN {
+		if (fts_backend_flatcurve_set_mailbox(backend, boxes[i],
+						      error_r) < 0 ||
+		    fts_flatcurve_xapian_multi_db_add(backend, mdb, i,
+						      error_r) < 0)
+			ret = -1;
+		else if (fts_flatcurve_xapian_multi_db_shard_count(mdb) >=
+			 FTS_FLATCURVE_MULTI_MAX_SHARDS) {
+			ret = fts_flatcurve_xapian_run_query_multi(query, mdb,
+								   fresults,
+								   error_r);
+			fts_flatcurve_xapian_multi_db_reset(mdb);
+		}
+	} T_END_PASS_STR_IF(ret < 0, error_r);
+	if (ret == 0) {
+		ret = fts_flatcurve_xapian_run_query_multi(query, mdb, fresults,
+							   error_r);
+	}
+	fts_flatcurve_xapian_multi_db_deinit(&mdb);
+	return ret;
+}
+
 static int
 fts_backend_flatcurve_lookup_multi(struct fts_backend *_backend,
 				   struct mailbox *const boxes[],
@@ -580,8 +622,8 @@ fts_backend_flatcurve_lookup_multi(struct fts_backend *_backend,
 	struct flatcurve_fts_backend *backend =
 		(struct flatcurve_fts_backend *)_backend;
 	ARRAY(struct fts_result) box_results;
-	struct flatcurve_fts_result *fresult;
-	unsigned int i;
+	struct flatcurve_fts_result *fresult, **fresults;
+	unsigned int i, count;
 	struct flatcurve_fts_query *query;
 	struct fts_result *r;
 	int ret = 0;
@@ -592,25 +634,30 @@ fts_backend_flatcurve_lookup_multi(struct fts_backend *_backend,
 	query->flags = flags;
 	fts_flatcurve_xapian_build_query(query);
 
-	p_array_init(&box_results, result->pool, 8);
-	for (i = 0; boxes[i] != NULL; i++) {
-		r = array_append_space(&box_results);
-		r->box = boxes[i];
-
+	for (count = 0; boxes[count] != NULL; count++) ;
+	fresults = p_new(result->pool, struct flatcurve_fts_result *, count + 1);
+	for (i = 0; i < count; i++) {
 		fresult = p_new(result->pool, struct flatcurve_fts_result, 1);
 		p_array_init(&fresult->maybe_uids, result->pool, 32);
 		p_array_init(&fresult->scores, result->pool, 32);
 		p_array_init(&fresult->uids, result->pool, 32);
+		fresults[i] = fresult;
+	}
 
-		if (fts_backend_flatcurve_set_mailbox(backend, r->box, &error) < 0) {
+	if (count == 1) {
+		if (fts_backend_flatcurve_set_mailbox(backend, boxes[0], &error) < 0 ||
+		    fts_flatcurve_xapian_run_query(query, fresults[0], &error) < 0)
 			ret = -1;
-			break;
-		}
+	} else {
+		ret = fts_backend_flatcurve_lookup_multi_db(backend, query, boxes,
+							   fresults, &error);
+	}
 
-		if (fts_flatcurve_xapian_run_query(query, fresult, &error) < 0) {
-			ret = -1;
-			break;
-		}
+	p_array_init(&box_results, result->pool, count + 1);
+	for (i = 0; i < count && ret == 0; i++) {
+		r = array_append_space(&box_results);
+		r->box = boxes[i];
+		fresult = fresults[i];
 
 		r->definite_uids = fresult->uids;
 		r->maybe_uids = fresult->maybe_uids;
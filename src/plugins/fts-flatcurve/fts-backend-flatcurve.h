@@ -10,6 +10,10 @@
 #define FTS_FLATCURVE_LABEL "fts-flatcurve"
 #define FTS_FLATCURVE_DEBUG_PREFIX FTS_FLATCURVE_LABEL ": "
 
+/* Maximum number of shards searched at once by multi-mailbox lookups. Each
+   open shard uses file descriptors. */
+#define FTS_FLATCURVE_MULTI_MAX_SHARDS 64
+
 struct flatcurve_fts_backend {
 	struct fts_backend backend;
 	string_t *boxname, *db_path, *volatile_dir;
@@ -0,0 +1,325 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "module-dir.h"
+#include "istream.h"
+#include "str.h"
+#include "seq-range-array.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-storage-private.h"
+#include "mail-search-build.h"
+#include "lang-settings.h"
+#include "fts-api.h"
+#include "fts-settings.h"
+#include "fts-storage.h"
+#include "fts-plugin.h"
+#include "fts-flatcurve-plugin.h"
+#include "fts-backend-flatcurve.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+static char test_fts_module_path[] = "lib20_fts_plugin.so";
+static char test_fts_module_name[] = "fts_plugin";
+static char test_flatcurve_module_path[] = "lib21_fts_flatcurve_plugin.so";
+static char test_flatcurve_module_name[] = "fts_flatcurve_plugin";
+
+static struct module test_fts_module = {
+	.path = test_fts_module_path,
+	.name = test_fts_module_name,
+};
+static struct module test_flatcurve_module = {
+	.path = test_flatcurve_module_path,
+	.name = test_flatcurve_module_name,
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+
+static void test_flatcurve_init(void)
+{
+	const char *const test_settings[] = {
+		"mail_plugins=fts fts_flatcurve",
+		"language+=en",
+		"language/en/language_default=yes",
+		"fts+=flatcurve",
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "mdbox",
+		.extra_input = test_settings,
+	};
+
+	test_ctx = test_mail_storage_init();
+	test_mail_storage_init_user(test_ctx, &set);
+}
+
+static void test_flatcurve_deinit(void)
+{
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+}
+
+static void test_save_mail(struct mailbox_transaction_context *trans,
+			   const char *body)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	ssize_t ret;
+
+	input = i_stream_create_from_data(body, strlen(body));
+	save_ctx = mailbox_save_alloc(trans);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	do {
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	} while ((ret = i_stream_read(input)) > 0);
+	test_assert(ret == -1);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	i_stream_unref(&input);
+}
+
+static void test_index_mailbox(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *search_args;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC, __func__);
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+	ctx = mailbox_search_init(trans, search_args, NULL, 0, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(ctx, &mail))
+		test_assert(mail_precache(mail) == 0);
+	test_assert(mailbox_search_deinit(&ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+/* Create a mailbox with one mail for each of the bodies and index it. */
+static struct mailbox *
+test_create_mailbox(const char *name, const char *const *bodies)
+{
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+
+	box = mailbox_alloc(test_ctx->user->namespaces->list, name, 0);
+	test_assert(mailbox_create(box, NULL, FALSE) == 0);
+	test_assert(mailbox_open(box) == 0);
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (; *bodies != NULL; bodies++) T_BEGIN {
+		test_save_mail(trans, t_strdup_printf(
+			"From: user@example.com\n"
+			"Subject: test\n\n%s\n", *bodies));
+	} T_END;
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_index_mailbox(box);
+	return box;
+}
+
+static void
+test_lookup_multi(struct mailbox *const boxes[], const char *word,
+		  pool_t pool, struct fts_multi_result *result_r)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_BODY);
+	arg->value.str = p_strdup(args->pool, word);
+
+	i_zero(result_r);
+	result_r->pool = pool;
+	test_assert(fts_backend_lookup_multi(
+		fts_list_backend(test_ctx->user->namespaces->list),
+		boxes, args->args, 0, result_r) == 0);
+	mail_search_args_unref(&args);
+}
+
+/* Check the mailbox's matches. uid=0 means no matches. */
+static void
+test_assert_result(const struct fts_result *r, struct mailbox *box,
+		   uint32_t uid, unsigned int idx)
+{
+	unsigned int count;
+
+	test_assert_idx(r->box == box, idx);
+	count = seq_range_count(&r->definite_uids) +
+		seq_range_count(&r->maybe_uids);
+	if (uid == 0)
+		test_assert_idx(count == 0, idx);
+	else {
+		test_assert_idx(count == 1, idx);
+		test_assert_idx(seq_range_exists(&r->definite_uids, uid) ||
+				seq_range_exists(&r->maybe_uids, uid), idx);
+	}
+}
+
+static void test_flatcurve_lookup_multi(void)
+{
+	static const char *const box0_bodies[] = {
+		"apple banana", "cherry", NULL
+	};
+	static const char *const box1_bodies[] = {
+		"banana", "apple", NULL
+	};
+	static const char *const box2_bodies[] = {
+		"cherry", NULL
+	};
+	struct mailbox *boxes[4];
+	struct fts_multi_result result;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("fts flatcurve lookup multi");
+	test_flatcurve_init();
+	pool = pool_alloconly_create("test fts result", 1024);
+
+	boxes[0] = test_create_mailbox("box0", box0_bodies);
+	boxes[1] = test_create_mailbox("box1", box1_bodies);
+	boxes[2] = test_create_mailbox("box2", box2_bodies);
+	boxes[3] = NULL;
+
+	/* each match is mapped back to the mailbox it came from */
+	test_lookup_multi(boxes, "apple", pool, &result);
+	test_assert_result(&result.box_results[0], boxes[0], 1, 0);
+	test_assert_result(&result.box_results[1], boxes[1], 2, 1);
+	test_assert_result(&result.box_results[2], boxes[2], 0, 2);
+	test_assert(result.box_results[3].box == NULL);
+
+	test_lookup_multi(boxes, "cherry", pool, &result);
+	test_assert_result(&result.box_results[0], boxes[0], 2, 0);
+	test_assert_result(&result.box_results[1], boxes[1], 0, 1);
+	test_assert_result(&result.box_results[2], boxes[2], 1, 2);
+
+	pool_unref(&pool);
+	for (i = 0; boxes[i] != NULL; i++)
+		mailbox_free(&boxes[i]);
+	test_flatcurve_deinit();
+	test_end();
+}
+
+static void test_flatcurve_lookup_multi_batches(void)
+{
+	const unsigned int box_count = FTS_FLATCURVE_MULTI_MAX_SHARDS + 2;
+	struct mailbox *boxes[FTS_FLATCURVE_MULTI_MAX_SHARDS + 3];
+	struct fts_multi_result result;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("fts flatcurve lookup multi batches");
+	test_flatcurve_init();
+	pool = pool_alloconly_create("test fts result", 1024);
+
+	/* each mailbox has one shard, so they're searched in two batches */
+	for (i = 0; i < box_count; i++) T_BEGIN {
+		const char *bodies[] = {
+			t_strdup_printf("common unique%u", i), NULL
+		};
+		boxes[i] = test_create_mailbox(t_strdup_printf("box%u", i),
+					       bodies);
+	} T_END;
+	boxes[box_count] = NULL;
+
+	test_lookup_multi(boxes, "common", pool, &result);
+	for (i = 0; i < box_count; i++)
+		test_assert_result(&result.box_results[i], boxes[i], 1, i);
+	test_assert(result.box_results[box_count].box == NULL);
+
+	/* the last batch is mapped to the right mailboxes */
+	test_lookup_multi(boxes, t_strdup_printf("unique%u", box_count - 1),
+			  pool, &result);
+	for (i = 0; i < box_count; i++) {
+		test_assert_result(&result.box_results[i], boxes[i],
+				   i == box_count - 1 ? 1 : 0, i);
+	}
+
+	pool_unref(&pool);
+	for (i = 0; i < box_count; i++)
+		mailbox_free(&boxes[i]);
+	test_flatcurve_deinit();
+	test_end();
+}
+
+static void test_flatcurve_lookup_multi_broken_shard(void)
+{
+	static const char *const bodies[] = { "apple", NULL };
+	struct mailbox *boxes[4];
+	struct fts_multi_result result;
+	const char *path;
+	pool_t pool;
+	unsigned int i;
+	int fd;
+
+	test_begin("fts flatcurve lookup multi broken shard");
+	test_flatcurve_init();
+	pool = pool_alloconly_create("test fts result", 1024);
+
+	boxes[0] = test_create_mailbox("box0", bodies);
+	boxes[1] = test_create_mailbox("box1", bodies);
+	boxes[2] = test_create_mailbox("box2", bodies);
+	boxes[3] = NULL;
+
+	/* add a shard that can't be opened to the middle mailbox */
+	test_assert(mailbox_get_path_to(boxes[1], MAILBOX_LIST_PATH_TYPE_INDEX,
+					&path) > 0);
+	path = t_strdup_printf("%s/"FTS_FLATCURVE_LABEL"/index.broken", path);
+	test_assert(mkdir(path, 0700) == 0);
+	fd = open(t_strconcat(path, "/iamglass", NULL),
+		  O_WRONLY | O_CREAT, 0600);
+	test_assert(fd != -1);
+	test_assert(write(fd, "broken", 6) == 6);
+	i_close_fd(&fd);
+
+	/* the broken shard is logged and skipped, the rest of the mailbox's
+	   shards and the other mailboxes are still searched */
+	test_expect_error_string("Cannot open DB (RO; index.broken)");
+	test_lookup_multi(boxes, "apple", pool, &result);
+	test_expect_no_more_errors();
+	for (i = 0; i < 3; i++)
+		test_assert_result(&result.box_results[i], boxes[i], 1, i);
+
+	pool_unref(&pool);
+	for (i = 0; boxes[i] != NULL; i++)
+		mailbox_free(&boxes[i]);
+	test_flatcurve_deinit();
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_flatcurve_lookup_multi,
+		test_flatcurve_lookup_multi_batches,
+		test_flatcurve_lookup_multi_broken_shard,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-flatcurve",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+
+	settings_info_register(&langs_setting_parser_info);
+	settings_info_register(&fts_setting_parser_info);
+	settings_info_register(&fts_flatcurve_setting_parser_info);
+	fts_plugin_init(&test_fts_module);
+	fts_flatcurve_plugin_init(&test_flatcurve_module);
+
+	ret = test_run(test_functions);
+
+	fts_flatcurve_plugin_deinit();
+	fts_plugin_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -16,6 +16,7 @@ static const struct setting_define fts_setting_defines[] = {
 	  .filter_array_field_name = "fts_driver", },
 	DEF(BOOL,    autoindex),
 	DEF(UINT,    autoindex_max_recent_msgs),
+	DEF(BOOL,    autoindex_inline),
 	DEF(ENUM,    decoder_driver),
 	DEF(STR,     decoder_script_socket_path),
 	{ .type = SET_FILTER_NAME, .key = FTS_FILTER_DECODER_TIKA },
@@ -47,6 +48,7 @@ static const struct fts_settings fts_default_settings = {
 	.fts = ARRAY_INIT,
 	.autoindex = FALSE,
 	.autoindex_max_recent_msgs = 0,
+	.autoindex_inline = FALSE,
 	.decoder_driver = FTS_DECODER_KEYWORD_NONE
 		       ":"FTS_DECODER_KEYWORD_TIKA
 		       ":"FTS_DECODER_KEYWORD_SCRIPT,
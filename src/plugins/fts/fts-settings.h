@@ -29,6 +29,7 @@ struct fts_settings {
 	unsigned int search_timeout;
 	uoff_t message_max_size;
 	bool autoindex;
+	bool autoindex_inline;
 
 	enum fts_decoder parsed_decoder_driver;
 	bool parsed_search_add_missing_body_only;
@@ -4,6 +4,7 @@
 #include "net.h"
 #include "str.h"
 #include "strescape.h"
+#include "seq-range-array.h"
 #include "write-full.h"
 #include "settings.h"
 #include "mail-search-build.h"
@@ -48,6 +49,8 @@ struct fts_mailbox {
 	union mailbox_module_context module_ctx;
 	const struct fts_settings *set;
 	struct fts_backend_update_context *sync_update_ctx;
+	/* UIDs of the saved mails waiting for fts_autoindex_inline */
+	ARRAY_TYPE(seq_range) autoindex_uids;
 };
 
 struct fts_transaction_context {
@@ -652,12 +655,120 @@ static void fts_queue_index(struct mailbox *box)
 	str_printfa(str, "\t%u", fbox->set->autoindex_max_recent_msgs);
 	str_append_c(str, '\t');
 	str_append_tabescaped(str, box->storage->user->session_id);
-	str_append_c(str, '\n');
+	str_append(str, "\tdelivery\n");
 	if (write_full(fd, str_data(str), str_len(str)) < 0)
 		e_error(box->event, "write(%s) failed: %m", path);
 	i_close_fd(&fd);
 }
 
+static int
+fts_autoindex_inline_mails(struct mailbox *box,
+			   const ARRAY_TYPE(seq_range) *uids)
+{
+	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT_REQUIRE(box->list);
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *t;
+	struct seq_range_iter iter;
+	struct mail *mail;
+	unsigned int n = 0;
+	uint32_t uid;
+	int ret = 0;
+
+	update_ctx = fts_backend_update_init(flist->backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+
+	t = mailbox_transaction_begin(box, 0, "fts autoindex");
+	mail = mail_alloc(t, MAIL_FETCH_STREAM_HEADER |
+			  MAIL_FETCH_STREAM_BODY, NULL);
+	seq_range_array_iter_init(&iter, uids);
+	while (seq_range_array_iter_nth(&iter, n++, &uid)) {
+		if (!mail_set_uid(mail, uid))
+			continue;
+		if (fts_build_mail(update_ctx, mail) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&t) < 0) {
+		e_error(box->event, "fts: Transaction commit failed: %s",
+			mailbox_get_last_internal_error(box, NULL));
+		ret = -1;
+	}
+	if (fts_backend_update_deinit(&update_ctx) < 0)
+		ret = -1;
+	return ret;
+}
+
+/* Index the saved mails in this process, while the mails and their parsed
+   MIME structure are still cached. The mailbox view must already be synced
+   to see them. Returns 1 if the mails were indexed, 0 if they need to be
+   indexed by the indexer instead, -1 on error. */
+static int
+fts_autoindex_inline(struct mailbox *box, const ARRAY_TYPE(seq_range) *uids)
+{
+	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT_REQUIRE(box->list);
+	const struct seq_range *range, *first, *last;
+	uint32_t last_uid, seq1, seq2;
+	unsigned int pending_count = 0;
+	int ret;
+
+	if (fts_backend_is_updating(flist->backend)) {
+		/* already indexing with precaching */
+		return 0;
+	}
+	if (fts_backend_get_last_uid(flist->backend, box, &last_uid) < 0)
+		return -1;
+
+	/* If there are any other mails that aren't indexed yet, leave all of
+	   them to the indexer. The backends expect the mails to be indexed
+	   in UID order without gaps. */
+	first = array_front(uids);
+	last = array_back(uids);
+	if (first->seq1 <= last_uid)
+		return 0;
+	array_foreach(uids, range) {
+		mailbox_get_seq_range(box, range->seq1, range->seq2,
+				      &seq1, &seq2);
+		if (seq1 != 0)
+			pending_count += seq2 - seq1 + 1;
+	}
+	mailbox_get_seq_range(box, last_uid + 1, last->seq2, &seq1, &seq2);
+	if (seq1 == 0 || seq2 - seq1 + 1 != pending_count)
+		return 0;
+
+	struct event_reason *reason = event_reason_begin("fts:index");
+	ret = fts_autoindex_inline_mails(box, uids);
+	event_reason_end(&reason);
+	return ret < 0 ? -1 : 1;
+}
+
+static void fts_autoindex_inline_pending(struct mailbox *box)
+{
+	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(box);
+	ARRAY_TYPE(seq_range) uids;
+	int ret;
+
+	if (!array_is_created(&fbox->autoindex_uids) ||
+	    array_is_empty(&fbox->autoindex_uids))
+		return;
+
+	T_BEGIN {
+		/* indexing may sync the mailbox again */
+		t_array_init(&uids, array_count(&fbox->autoindex_uids));
+		array_append_array(&uids, &fbox->autoindex_uids);
+		array_clear(&fbox->autoindex_uids);
+
+		ret = fts_autoindex_inline(box, &uids);
+	} T_END;
+	if (ret < 0) {
+		e_error(box->event, "fts: Failed to index saved mails - "
+			"leaving them to the indexer");
+	}
+	if (ret <= 0)
+		fts_queue_index(box);
+}
+
 static int
 fts_transaction_commit(struct mailbox_transaction_context *t,
 		       struct mail_transaction_commit_changes *changes_r)
@@ -683,8 +794,23 @@ fts_transaction_commit(struct mailbox_transaction_context *t,
 	if (ret < 0)
 		return -1;
 
-	if (autoindex)
-		fts_queue_index(box);
+	if (!autoindex)
+		return 0;
+
+	if (fbox->set->autoindex_inline &&
+	    !array_is_empty(&changes_r->saved_uids) &&
+	    box->virtual_vfuncs == NULL) {
+		/* The mails aren't visible in the mailbox view until it's
+		   synced. Don't sync it here, because the caller may still
+		   rely on the view. Index them after the caller's next sync
+		   or when the mailbox is closed. */
+		if (!array_is_created(&fbox->autoindex_uids))
+			i_array_init(&fbox->autoindex_uids, 8);
+		seq_range_array_merge(&fbox->autoindex_uids,
+				      &changes_r->saved_uids);
+		return 0;
+	}
+	fts_queue_index(box);
 	return 0;
 }
 
@@ -733,6 +859,8 @@ static int fts_sync_deinit(struct mailbox_sync_context *ctx,
 		return -1;
 	ctx = NULL;
 
+	fts_autoindex_inline_pending(box);
+
 	if (optimize) {
 		i_assert(flist != NULL);
 		if (fts_backend_optimize(flist->backend) < 0) {
@@ -804,9 +932,29 @@ static int fts_mailbox_search_next_match_mail(struct mail_search_context *ctx,
 	return fbox->module_ctx.super.search_next_match_mail(ctx, mail);
 }
 
+static void fts_mailbox_close(struct mailbox *box)
+{
+	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(box);
+
+	if (array_is_created(&fbox->autoindex_uids) &&
+	    array_not_empty(&fbox->autoindex_uids)) {
+		/* Nothing uses the mailbox view anymore, so it can be synced
+		   to see the saved mails. fts_sync_deinit() indexes them. */
+		if (mailbox_sync(box, MAILBOX_SYNC_FLAG_FAST) < 0) {
+			array_clear(&fbox->autoindex_uids);
+			fts_queue_index(box);
+		}
+		i_assert(array_is_empty(&fbox->autoindex_uids));
+	}
+	fbox->module_ctx.super.close(box);
+}
+
 static void fts_mailbox_free(struct mailbox *box)
 {
 	struct fts_mailbox *fbox = FTS_CONTEXT_REQUIRE(box);
+
+	if (array_is_created(&fbox->autoindex_uids))
+		array_free(&fbox->autoindex_uids);
 	settings_free(fbox->set);
 	fbox->module_ctx.super.free(box);
 }
@@ -829,6 +977,7 @@ void fts_mailbox_allocated(struct mailbox *box)
 
 	fbox = p_new(box->pool, struct fts_mailbox, 1);
 	fbox->module_ctx.super = *v;
+	v->close = fts_mailbox_close;
 	v->free = fts_mailbox_free;
 	fbox->set = set;
 	box->vlast = &fbox->module_ctx.super;
@@ -0,0 +1,286 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "module-dir.h"
+#include "istream.h"
+#include "seq-range-array.h"
+#include "settings.h"
+#include "master-service.h"
+#include "mail-storage-private.h"
+#include "lang-settings.h"
+#include "fts-api-private.h"
+#include "fts-settings.h"
+#include "fts-plugin.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+static char test_fts_module_path[] = "lib20_fts_plugin.so";
+static char test_fts_module_name[] = "fts_plugin";
+
+static struct module test_fts_module = {
+	.path = test_fts_module_path,
+	.name = test_fts_module_name,
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+/* UIDs indexed by the test backend. There's only a single mailbox. */
+static ARRAY_TYPE(seq_range) test_indexed_uids;
+
+static const struct fts_backend fts_backend_test;
+
+static struct fts_backend *fts_backend_test_alloc(void)
+{
+	struct fts_backend *backend;
+
+	backend = i_new(struct fts_backend, 1);
+	*backend = fts_backend_test;
+	return backend;
+}
+
+static int
+fts_backend_test_init(struct fts_backend *backend ATTR_UNUSED,
+		      const char **error_r ATTR_UNUSED)
+{
+	return 0;
+}
+
+static void fts_backend_test_deinit(struct fts_backend *backend)
+{
+	i_free(backend);
+}
+
+static int
+fts_backend_test_get_last_uid(struct fts_backend *backend ATTR_UNUSED,
+			      struct mailbox *box ATTR_UNUSED,
+			      uint32_t *last_uid_r)
+{
+	const struct seq_range *range;
+
+	if (array_is_empty(&test_indexed_uids))
+		*last_uid_r = 0;
+	else {
+		range = array_back(&test_indexed_uids);
+		*last_uid_r = range->seq2;
+	}
+	return 0;
+}
+
+static struct fts_backend_update_context *
+fts_backend_test_update_init(struct fts_backend *backend)
+{
+	struct fts_backend_update_context *ctx;
+
+	ctx = i_new(struct fts_backend_update_context, 1);
+	ctx->backend = backend;
+	return ctx;
+}
+
+static int
+fts_backend_test_update_deinit(struct fts_backend_update_context *ctx)
+{
+	i_free(ctx);
+	return 0;
+}
+
+static void
+fts_backend_test_update_set_mailbox(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				    struct mailbox *box ATTR_UNUSED)
+{
+}
+
+static void
+fts_backend_test_update_expunge(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				uint32_t uid)
+{
+	seq_range_array_remove(&test_indexed_uids, uid);
+}
+
+static bool
+fts_backend_test_update_set_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				      const struct fts_backend_build_key *key)
+{
+	seq_range_array_add(&test_indexed_uids, key->uid);
+	return TRUE;
+}
+
+static void
+fts_backend_test_update_unset_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED)
+{
+}
+
+static int
+fts_backend_test_update_build_more(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				   const unsigned char *data ATTR_UNUSED,
+				   size_t size ATTR_UNUSED)
+{
+	return 0;
+}
+
+static int fts_backend_test_refresh(struct fts_backend *backend ATTR_UNUSED)
+{
+	return 0;
+}
+
+static int
+fts_backend_test_lookup(struct fts_backend *backend ATTR_UNUSED,
+			struct mailbox *box ATTR_UNUSED,
+			struct mail_search_arg *args ATTR_UNUSED,
+			enum fts_lookup_flags flags ATTR_UNUSED,
+			struct fts_result *result ATTR_UNUSED)
+{
+	return 0;
+}
+
+static const struct fts_backend fts_backend_test = {
+	.name = "test",
+	.v = {
+		.alloc = fts_backend_test_alloc,
+		.init = fts_backend_test_init,
+		.deinit = fts_backend_test_deinit,
+		.get_last_uid = fts_backend_test_get_last_uid,
+		.update_init = fts_backend_test_update_init,
+		.update_deinit = fts_backend_test_update_deinit,
+		.update_set_mailbox = fts_backend_test_update_set_mailbox,
+		.update_expunge = fts_backend_test_update_expunge,
+		.update_set_build_key = fts_backend_test_update_set_build_key,
+		.update_unset_build_key = fts_backend_test_update_unset_build_key,
+		.update_build_more = fts_backend_test_update_build_more,
+		.refresh = fts_backend_test_refresh,
+		.can_lookup = fts_backend_default_can_lookup,
+		.lookup = fts_backend_test_lookup,
+	}
+};
+
+static void test_save_mails(struct mailbox *box, unsigned int count)
+{
+	static const char mail[] =
+		"From: user@example.com\n"
+		"Subject: test\n\nbody\n";
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	unsigned int i;
+	ssize_t ret;
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL |
+		MAILBOX_TRANSACTION_FLAG_ASSIGN_UIDS, __func__);
+	for (i = 0; i < count; i++) {
+		input = i_stream_create_from_data(mail, sizeof(mail) - 1);
+		save_ctx = mailbox_save_alloc(trans);
+		test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+		do {
+			test_assert(mailbox_save_continue(save_ctx) == 0);
+		} while ((ret = i_stream_read(input)) > 0);
+		test_assert(ret == -1);
+		test_assert(mailbox_save_finish(&save_ctx) == 0);
+		i_stream_unref(&input);
+	}
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static struct mailbox *test_mailbox_open(void)
+{
+	struct mailbox *box;
+
+	box = mailbox_alloc(test_ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	return box;
+}
+
+static bool test_indexed_uids_equal(uint32_t uid1, uint32_t uid2)
+{
+	const struct seq_range *range;
+
+	if (uid1 == 0)
+		return array_is_empty(&test_indexed_uids);
+	if (array_count(&test_indexed_uids) != 1)
+		return FALSE;
+	range = array_front(&test_indexed_uids);
+	return range->seq1 == uid1 && range->seq2 == uid2;
+}
+
+static void test_fts_autoindex_inline(void)
+{
+	const char *const test_settings[] = {
+		"mail_plugins=fts",
+		"language+=en",
+		"language/en/language_default=yes",
+		"fts+=test",
+		"fts_autoindex=yes",
+		"fts_autoindex_inline=yes",
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = test_settings,
+	};
+	struct mailbox *box;
+
+	test_begin("fts autoindex inline");
+	test_ctx = test_mail_storage_init();
+	test_mail_storage_init_user(test_ctx, &set);
+	box = test_mailbox_open();
+
+	/* the commit doesn't sync the mailbox, so the mails are indexed
+	   only after the next sync */
+	test_save_mails(box, 2);
+	test_assert(test_indexed_uids_equal(0, 0));
+	test_save_mails(box, 1);
+	test_assert(test_indexed_uids_equal(0, 0));
+	test_assert(mailbox_sync(box, 0) == 0);
+	test_assert(test_indexed_uids_equal(1, 3));
+
+	/* mails that were saved, but not synced, are indexed when the
+	   mailbox is closed */
+	test_save_mails(box, 2);
+	test_assert(test_indexed_uids_equal(1, 3));
+	mailbox_free(&box);
+	test_assert(test_indexed_uids_equal(1, 5));
+
+	/* older unindexed mails are left to the indexer, together with the
+	   saved ones */
+	box = test_mailbox_open();
+	array_clear(&test_indexed_uids);
+	test_save_mails(box, 1);
+	test_expect_error_string("net_connect_unix(");
+	test_assert(mailbox_sync(box, 0) == 0);
+	test_expect_no_more_errors();
+	test_assert(test_indexed_uids_equal(0, 0));
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_fts_autoindex_inline,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-autoindex",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+
+	settings_info_register(&langs_setting_parser_info);
+	settings_info_register(&fts_setting_parser_info);
+	fts_plugin_init(&test_fts_module);
+	fts_backend_register(&fts_backend_test);
+	i_array_init(&test_indexed_uids, 8);
+
+	ret = test_run(test_functions);
+
+	array_free(&test_indexed_uids);
+	fts_backend_unregister(fts_backend_test.name);
+	fts_plugin_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,302 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "module-dir.h"
+#include "istream.h"
+#include "str.h"
+#include "seq-range-array.h"
+#include "mkdir-parents.h"
+#include "write-full.h"
+#include "master-service.h"
+#include "mail-storage-private.h"
+#include "mail-search-build.h"
+#include "virtual-storage.h"
+#include "virtual-plugin.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <fcntl.h>
+
+#define TEST_INTERLEAVED_MAILBOXES 2
+
+static char test_virtual_module_path[] = "lib20_virtual_plugin.so";
+static char test_virtual_module_name[] = "virtual_plugin";
+
+static struct module test_virtual_module = {
+	.path = test_virtual_module_path,
+	.name = test_virtual_module_name,
+};
+
+static struct test_mail_storage_ctx *test_ctx;
+
+struct test_mail {
+	const char *subject;
+	const char *body;
+};
+
+/* more backends than TEST_INTERLEAVED_MAILBOXES */
+static const struct test_mail test_box1_mails[] = {
+	{ "a1", "apple" },
+	{ "a2", "banana" },
+	{ "a3", "apple banana" },
+	{ NULL, NULL }
+};
+static const struct test_mail test_box2_mails[] = {
+	{ "b1", "banana" },
+	{ "b2", "apple" },
+	{ NULL, NULL }
+};
+static const struct test_mail test_box3_mails[] = {
+	{ "c1", "apple" },
+	{ "c2", "cherry" },
+	{ "c3", "apple cherry" },
+	{ NULL, NULL }
+};
+
+static void test_save_mail(struct mailbox_transaction_context *trans,
+			   const struct test_mail *test_mail)
+{
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *mail;
+	ssize_t ret;
+
+	mail = t_strdup_printf("From: user@example.com\n"
+			       "Subject: %s\n\n%s\n",
+			       test_mail->subject, test_mail->body);
+	input = i_stream_create_from_data(mail, strlen(mail));
+	save_ctx = mailbox_save_alloc(trans);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	do {
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	} while ((ret = i_stream_read(input)) > 0);
+	test_assert(ret == -1);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	i_stream_unref(&input);
+}
+
+static void
+test_create_mailbox(const char *name, const struct test_mail *mails)
+{
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+
+	box = mailbox_alloc(test_ctx->user->namespaces->list, name, 0);
+	test_assert(mailbox_create(box, NULL, FALSE) == 0);
+	test_assert(mailbox_open(box) == 0);
+
+	trans = mailbox_transaction_begin(box,
+		MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (; mails->subject != NULL; mails++) T_BEGIN {
+		test_save_mail(trans, mails);
+	} T_END;
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mailbox_free(&box);
+}
+
+static struct mailbox *test_virtual_init(void)
+{
+	const char *home = t_strconcat(test_ctx->home_root, "testuser", NULL);
+	const char *virtual_path = t_strconcat(home, "/virtual", NULL);
+	const char *const test_settings[] = {
+		"mail_plugins=virtual",
+		"namespace+=virtual",
+		"namespace/virtual/prefix=Virtual/",
+		"namespace/virtual/separator=/",
+		"namespace/virtual/mail_driver=virtual",
+		t_strdup_printf("namespace/virtual/mail_path=%s", virtual_path),
+		NULL
+	};
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.hierarchy_sep = "/",
+		.extra_input = test_settings,
+	};
+	static const char virtual_config[] =
+		"box1\nbox2\nbox3\n  all\n";
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	const char *path;
+	int fd;
+
+	test_mail_storage_init_user(test_ctx, &set);
+	test_create_mailbox("box1", test_box1_mails);
+	test_create_mailbox("box2", test_box2_mails);
+	test_create_mailbox("box3", test_box3_mails);
+
+	path = t_strconcat(virtual_path, "/All", NULL);
+	test_assert(mkdir_parents(path, 0700) == 0);
+	path = t_strconcat(path, "/"VIRTUAL_CONFIG_FNAME, NULL);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	test_assert(fd != -1);
+	test_assert(write_full(fd, virtual_config,
+			       strlen(virtual_config)) == 0);
+	i_close_fd(&fd);
+
+	ns = mail_namespace_find(test_ctx->user->namespaces, "Virtual/");
+	box = mailbox_alloc(ns->list, "Virtual/All", 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	return box;
+}
+
+static void
+test_virtual_set_interleaved(struct mailbox *box, unsigned int count)
+{
+	struct virtual_storage *storage =
+		container_of(box->storage, struct virtual_storage, storage);
+
+	storage->search_max_interleaved_mailboxes = count;
+}
+
+/* Search the virtual mailbox and return the subjects of the matching mails
+   in the returned order. */
+static const char *
+test_virtual_search(struct mailbox *box, struct mail_search_args *args,
+		    const enum mail_sort_type *sort_program)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+	const char *subject;
+	string_t *str = t_str_new(64);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail_search_args_init(args, box, FALSE, NULL);
+	ctx = mailbox_search_init(trans, args, sort_program, 0, NULL);
+	while (mailbox_search_next(ctx, &mail)) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		test_assert(mail_get_first_header(mail, "Subject",
+						  &subject) > 0);
+		str_append(str, subject);
+	}
+	test_assert(mailbox_search_deinit(&ctx) == 0);
+	mail_search_args_deinit(args);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	return str_c(str);
+}
+
+static struct mail_search_args *test_search_args_body(const char *word)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_BODY);
+	arg->value.str = p_strdup(args->pool, word);
+	return args;
+}
+
+static void
+test_virtual_search_both(struct mailbox *box, struct mail_search_args *args,
+			 const enum mail_sort_type *sort_program,
+			 const char *expected)
+{
+	const char *serial, *interleaved;
+
+	test_virtual_set_interleaved(box, 0);
+	serial = test_virtual_search(box, args, sort_program);
+	test_virtual_set_interleaved(box, TEST_INTERLEAVED_MAILBOXES);
+	interleaved = test_virtual_search(box, args, sort_program);
+
+	test_assert_strcmp(interleaved, serial);
+	if (expected != NULL)
+		test_assert_strcmp(interleaved, expected);
+}
+
+static void test_virtual_search_interleaved(void)
+{
+	static const enum mail_sort_type sort_subject_reverse[] = {
+		MAIL_SORT_FLAG_REVERSE | MAIL_SORT_SUBJECT,
+		MAIL_SORT_END
+	};
+	struct mail_search_args *args;
+	struct mailbox *box;
+
+	test_begin("virtual search interleaved");
+	test_ctx = test_mail_storage_init();
+	box = test_virtual_init();
+
+	/* the matches of all the backends are merged in the virtual
+	   mailbox's order */
+	args = test_search_args_body("apple");
+	test_virtual_search_both(box, args, NULL, "a1,a3,b2,c1,c3");
+	test_virtual_search_both(box, args, sort_subject_reverse,
+				 "c3,c1,b2,a3,a1");
+	mail_search_args_unref(&args);
+
+	/* mixed with a static search key */
+	args = test_search_args_body("cherry");
+	mail_search_build_add(args, SEARCH_ALL);
+	test_virtual_search_both(box, args, NULL, "c2,c3");
+	mail_search_args_unref(&args);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+	test_end();
+}
+
+static void test_virtual_search_interleaved_fallback(void)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mailbox *box;
+
+	test_begin("virtual search interleaved fallback");
+	test_ctx = test_mail_storage_init();
+	box = test_virtual_init();
+
+	/* The virtual UIDs differ from the backend UIDs, so the search can't
+	   be done in the backends. Searching UIDs 1..3 in each backend would
+	   also match b2 and c1. */
+	args = test_search_args_body("apple");
+	arg = mail_search_build_add(args, SEARCH_UIDSET);
+	p_array_init(&arg->value.seqset, args->pool, 1);
+	seq_range_array_add_range(&arg->value.seqset, 1, 3);
+	test_virtual_search_both(box, args, NULL, "a1,a3");
+	mail_search_args_unref(&args);
+
+	/* same with the key inside OR */
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_OR);
+	arg->value.subargs = p_new(args->pool, struct mail_search_arg, 1);
+	arg->value.subargs->type = SEARCH_SEQSET;
+	p_array_init(&arg->value.subargs->value.seqset, args->pool, 1);
+	seq_range_array_add(&arg->value.subargs->value.seqset, 4);
+	arg->value.subargs->next = p_new(args->pool, struct mail_search_arg, 1);
+	arg->value.subargs->next->type = SEARCH_BODY;
+	arg->value.subargs->next->value.str = "cherry";
+	test_virtual_search_both(box, args, NULL, "b1,c2,c3");
+	mail_search_args_unref(&args);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(test_ctx);
+	test_mail_storage_deinit(&test_ctx);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_virtual_search_interleaved,
+		test_virtual_search_interleaved_fallback,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-virtual-search",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	virtual_plugin_init(&test_virtual_module);
+
+	ret = test_run(test_functions);
+
+	virtual_plugin_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -3,11 +3,14 @@
 #include "lib.h"
 #include "array.h"
 #include "mail-search.h"
+#include "mail-search-build.h"
 #include "index-search-private.h"
 #include "virtual-storage.h"
+#include "virtual-transaction.h"
 
 
 enum virtual_search_state {
+	VIRTUAL_SEARCH_STATE_BACKENDS,
 	VIRTUAL_SEARCH_STATE_BUILD,
 	VIRTUAL_SEARCH_STATE_RETURN,
 	VIRTUAL_SEARCH_STATE_SORT,
@@ -20,13 +23,30 @@ struct virtual_search_record {
 	uint32_t virtual_seq;
 };
 
+struct virtual_search_backend {
+	struct virtual_backend_box *bbox;
+	struct mail_search_args *search_args;
+	struct mail_search_context *search_ctx;
+	/* this backend's range in virtual_search_context.records */
+	unsigned int first_record_idx, record_count;
+	/* virtual sequences of the matching mails */
+	ARRAY_TYPE(seq_range) matches;
+};
+
 struct virtual_search_context {
 	union mail_search_module_context module_ctx;
 
 	ARRAY_TYPE(seq_range) result;
 	struct seq_range_iter result_iter;
+	/* possible matches, sorted by mailbox_id and real_uid. virtual_seq
+	   is set to 0 for records already checked by a backend search. */
 	ARRAY(struct virtual_search_record) records;
 
+	/* backend searches currently interleaved with each other */
+	ARRAY(struct virtual_search_backend) backends;
+	unsigned int max_backends;
+	unsigned int next_backend_record_idx;
+
 	enum virtual_search_state search_state;
 	unsigned int next_result_n;
 	unsigned int next_record_idx;
@@ -97,6 +117,206 @@ static void virtual_search_get_records(struct mail_search_context *ctx,
 	ctx->progress_max = array_count(&vctx->records);
 }
 
+static bool
+virtual_search_args_can_interleave(const struct mail_search_arg *args)
+{
+	for (; args != NULL; args = args->next) {
+		switch (args->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			if (!virtual_search_args_can_interleave(args->value.subargs))
+				return FALSE;
+			break;
+		case SEARCH_FLAGS:
+			/* \Recent is tracked separately by virtual mailboxes */
+			if ((args->value.flags & MAIL_RECENT) != 0)
+				return FALSE;
+			break;
+		case SEARCH_ALL:
+		case SEARCH_KEYWORDS:
+		case SEARCH_BEFORE:
+		case SEARCH_ON:
+		case SEARCH_SINCE:
+		case SEARCH_SMALLER:
+		case SEARCH_LARGER:
+		case SEARCH_HEADER:
+		case SEARCH_HEADER_ADDRESS:
+		case SEARCH_HEADER_COMPRESS_LWSP:
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+		case SEARCH_GUID:
+		case SEARCH_MIMEPART:
+			break;
+		default:
+			/* sequences, UIDs, modseqs, etc. are different in the
+			   virtual and the backend mailboxes */
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void
+virtual_search_backend_start(struct mail_search_context *ctx,
+			     struct virtual_search_context *vctx)
+{
+	struct virtual_mailbox *mbox =
+		container_of(ctx->transaction->box, struct virtual_mailbox, box);
+	struct mailbox_transaction_context *backend_trans;
+	const struct virtual_search_record *recs;
+	struct virtual_search_backend backend;
+	struct mail_search_arg *arg;
+	unsigned int i, count, first_idx;
+
+	recs = array_get(&vctx->records, &count);
+	first_idx = vctx->next_backend_record_idx;
+	for (i = first_idx; i < count; i++) {
+		if (recs[i].mailbox_id != recs[first_idx].mailbox_id)
+			break;
+	}
+	vctx->next_backend_record_idx = i;
+
+	i_zero(&backend);
+	backend.first_record_idx = first_idx;
+	backend.record_count = i - first_idx;
+	if (!virtual_backend_box_lookup(mbox, recs[first_idx].mailbox_id,
+					&backend.bbox))
+		i_unreached();
+	if (!backend.bbox->box->opened &&
+	    virtual_backend_box_open(mbox, backend.bbox) < 0) {
+		/* leave the records to be checked via the virtual mailbox.
+		   it handles the error. */
+		return;
+	}
+	virtual_backend_box_accessed(mbox, backend.bbox);
+
+	/* search the possibly matching UIDs with the original query */
+	backend.search_args = mail_search_build_init();
+	arg = mail_search_build_add(backend.search_args, SEARCH_UIDSET);
+	p_array_init(&arg->value.seqset, backend.search_args->pool,
+		     backend.record_count);
+	for (i = 0; i < backend.record_count; i++) {
+		seq_range_array_add(&arg->value.seqset,
+				    recs[first_idx + i].real_uid);
+	}
+	arg = mail_search_build_add(backend.search_args, SEARCH_SUB);
+	arg->value.subargs =
+		mail_search_arg_dup(backend.search_args->pool, ctx->args->args);
+	mail_search_args_reset(arg->value.subargs, TRUE);
+
+	i_array_init(&backend.matches, 32);
+	backend_trans = virtual_transaction_get(ctx->transaction,
+						backend.bbox->box);
+	mail_search_args_init(backend.search_args, backend.bbox->box,
+			      FALSE, NULL);
+	backend.search_ctx = mailbox_search_init(backend_trans,
+						 backend.search_args,
+						 NULL, 0, NULL);
+	array_push_back(&vctx->backends, &backend);
+}
+
+static void
+virtual_search_backend_add_match(struct virtual_search_context *vctx,
+				 struct virtual_search_backend *backend,
+				 uint32_t real_uid)
+{
+	const struct virtual_search_record *rec;
+	struct virtual_search_record key;
+
+	i_zero(&key);
+	key.mailbox_id = backend->bbox->mailbox_id;
+	key.real_uid = real_uid;
+	rec = array_bsearch(&vctx->records, &key, virtual_search_record_cmp);
+	i_assert(rec != NULL);
+	seq_range_array_add(&backend->matches, rec->virtual_seq);
+}
+
+static void
+virtual_search_backend_finish(struct mail_search_context *ctx,
+			      struct virtual_search_context *vctx,
+			      struct virtual_search_backend *backend)
+{
+	struct virtual_search_record *recs;
+	unsigned int i;
+	int ret;
+
+	ret = mailbox_search_deinit(&backend->search_ctx);
+	mail_search_args_deinit(backend->search_args);
+	mail_search_args_unref(&backend->search_args);
+
+	if (ret < 0) {
+		/* leave the records to be checked via the virtual mailbox */
+		e_debug(ctx->transaction->box->event,
+			"Search failed for backend mailbox %s: %s",
+			mailbox_get_vname(backend->bbox->box),
+			mailbox_get_last_internal_error(backend->bbox->box,
+							NULL));
+	} else {
+		seq_range_array_merge(&vctx->result, &backend->matches);
+		recs = array_idx_modifiable(&vctx->records,
+					    backend->first_record_idx);
+		for (i = 0; i < backend->record_count; i++)
+			recs[i].virtual_seq = 0;
+	}
+	array_free(&backend->matches);
+}
+
+static int
+virtual_search_backends_more(struct mail_search_context *ctx,
+			     struct virtual_search_context *vctx)
+{
+	struct virtual_search_backend *backend;
+	struct mail *mail;
+	unsigned int i;
+	bool tryagain, any_tryagain = FALSE;
+
+	do {
+		while (array_count(&vctx->backends) < vctx->max_backends &&
+		       vctx->next_backend_record_idx <
+		       array_count(&vctx->records))
+			virtual_search_backend_start(ctx, vctx);
+
+		/* Get one mail from each search at a time. The searches run
+		   in this same process, so this only interleaves them: a
+		   backend waiting for I/O still blocks the others. Any
+		   overlap comes from the backends' own asynchronous mail
+		   prefetching. */
+		for (i = 0; i < array_count(&vctx->backends); ) {
+			backend = array_idx_modifiable(&vctx->backends, i);
+			if (mailbox_search_next_nonblock(backend->search_ctx,
+							 &mail, &tryagain)) {
+				virtual_search_backend_add_match(vctx, backend,
+								 mail->uid);
+				i++;
+			} else if (tryagain) {
+				any_tryagain = TRUE;
+				i++;
+			} else {
+				virtual_search_backend_finish(ctx, vctx,
+							      backend);
+				array_delete(&vctx->backends, i, 1);
+			}
+		}
+		if (array_count(&vctx->backends) == 0)
+			return 1;
+	} while (!any_tryagain);
+	return 0;
+}
+
+static void
+virtual_search_backends_deinit(struct mail_search_context *ctx,
+			       struct virtual_search_context *vctx)
+{
+	struct virtual_search_backend *backend;
+
+	if (!array_is_created(&vctx->backends))
+		return;
+
+	array_foreach_modifiable(&vctx->backends, backend)
+		virtual_search_backend_finish(ctx, vctx, backend);
+	array_free(&vctx->backends);
+}
+
 struct mail_search_context *
 virtual_search_init(struct mailbox_transaction_context *t,
 		    struct mail_search_args *args,
@@ -104,6 +324,8 @@ virtual_search_init(struct mailbox_transaction_context *t,
 		    enum mail_fetch_field wanted_fields,
 		    struct mailbox_header_lookup_ctx *wanted_headers)
 {
+	struct virtual_mailbox *mbox =
+		container_of(t->box, struct virtual_mailbox, box);
 	struct mail_search_context *ctx;
 	struct virtual_search_context *vctx;
 
@@ -118,6 +340,18 @@ virtual_search_init(struct mailbox_transaction_context *t,
 
 	virtual_search_get_records(ctx, vctx);
 	seq_range_array_iter_init(&vctx->result_iter, &vctx->result);
+
+	if (mbox->storage->search_max_interleaved_mailboxes > 0 &&
+	    array_count(&vctx->records) > 0 &&
+	    virtual_search_args_can_interleave(args->args)) {
+		/* search the possible matches directly from the backend
+		   mailboxes, several of them at a time */
+		vctx->max_backends =
+			I_MIN(mbox->storage->search_max_interleaved_mailboxes,
+			      mbox->storage->max_open_mailboxes);
+		i_array_init(&vctx->backends, vctx->max_backends);
+		vctx->search_state = VIRTUAL_SEARCH_STATE_BACKENDS;
+	}
 	return ctx;
 }
 
@@ -125,6 +359,7 @@ int virtual_search_deinit(struct mail_search_context *ctx)
 {
 	struct virtual_search_context *vctx = VIRTUAL_CONTEXT_REQUIRE(ctx);
 
+	virtual_search_backends_deinit(ctx, vctx);
 	array_free(&vctx->result);
 	array_free(&vctx->records);
 	i_free(vctx);
@@ -140,6 +375,13 @@ bool virtual_search_next_nonblock(struct mail_search_context *ctx,
 	uint32_t seq;
 
 	switch (vctx->search_state) {
+	case VIRTUAL_SEARCH_STATE_BACKENDS:
+		if (virtual_search_backends_more(ctx, vctx) == 0) {
+			*tryagain_r = TRUE;
+			return FALSE;
+		}
+		vctx->search_state = VIRTUAL_SEARCH_STATE_BUILD;
+		/* fall through */
 	case VIRTUAL_SEARCH_STATE_BUILD:
 		if (ctx->sort_program == NULL)
 			vctx->search_state = VIRTUAL_SEARCH_STATE_SORT;
@@ -184,14 +426,20 @@ bool virtual_search_next_update_seq(struct mail_search_context *ctx)
 	struct virtual_search_context *vctx = VIRTUAL_CONTEXT_REQUIRE(ctx);
 	const struct virtual_search_record *recs;
 	unsigned int count;
+	uint32_t seq;
 
 	recs = array_get(&vctx->records, &count);
-	if (vctx->next_record_idx < count) {
+	while (vctx->next_record_idx < count) {
 		/* go through potential results first */
-		ctx->seq = recs[vctx->next_record_idx++].virtual_seq - 1;
+		seq = recs[vctx->next_record_idx++].virtual_seq;
+		ctx->progress_cur = vctx->next_record_idx;
+		if (seq == 0) {
+			/* already checked by a backend search */
+			continue;
+		}
+		ctx->seq = seq - 1;
 		if (!index_storage_search_next_update_seq(ctx))
 			i_unreached();
-		ctx->progress_cur = vctx->next_record_idx;
 		return TRUE;
 	}
 
@@ -11,12 +11,14 @@
 static const struct setting_define virtual_setting_defines[] = {
 	{ .type = SET_FILTER_NAME, .key = "virtual" },
 	DEF(UINT, virtual_max_open_mailboxes),
+	DEF(UINT, virtual_search_max_interleaved_mailboxes),
 
 	SETTING_DEFINE_LIST_END
 };
 
 static const struct virtual_settings virtual_default_settings = {
 	.virtual_max_open_mailboxes = 64,
+	.virtual_search_max_interleaved_mailboxes = 0,
 };
 
 static const struct setting_keyvalue virtual_default_settings_keyvalue[] = {
@@ -5,6 +5,7 @@ struct virtual_settings {
 	pool_t pool;
 
 	unsigned int virtual_max_open_mailboxes;
+	unsigned int virtual_search_max_interleaved_mailboxes;
 };
 
 extern const struct setting_parser_info virtual_setting_parser_info;
@@ -99,6 +99,8 @@ virtual_storage_create(struct mail_storage *_storage,
 		return -1;
 
 	storage->max_open_mailboxes = set->virtual_max_open_mailboxes;
+	storage->search_max_interleaved_mailboxes =
+		set->virtual_search_max_interleaved_mailboxes;
 	settings_free(set);
 	return 0;
 }
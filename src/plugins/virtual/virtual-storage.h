@@ -76,6 +76,9 @@ struct virtual_storage {
 	ARRAY_TYPE(const_string) open_stack;
 
 	unsigned int max_open_mailboxes;
+	/* Maximum number of backend mailboxes whose searches are interleaved,
+	   0 = search via the virtual mailbox one mail at a time. */
+	unsigned int search_max_interleaved_mailboxes;
 };
 
 struct virtual_backend_uidmap {